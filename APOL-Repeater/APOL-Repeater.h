@@ -6,10 +6,16 @@
 #define DEBUG //define to enable serial print statements
 #define BUTTONS_CONNECTED //define to enable GPIO interrupts
 #define RF_ENABLED
+// #define LOW_POWER_LISTEN //define to relay frames to the HHD and VDD with preambles long enough to wake them (must match on every device)
+// #define MESH //define to find routes through the repeaters and have only the repeaters on a route forward its frames (must match on every device)
 // #define UART //if defined, serial communications are through UART pins rather than USB emulation
 // #define TASK_LOGGING
 // #define TEST_PLAN_5
 
+//Addressing (see APOL_ADDRESS): the pit box this repeater serves. It relays frames for every box in range
+#define PIT_BOX 0 //0-7
+#define REPEATER_MEMBER 0 //0-3, different on each repeater in the box
+
 #include <APOL_Comms_Lib.h>
 #include <Seeed_Arduino_FreeRTOS.h>
 #include "ArduinoLowPower.h"
@@ -45,7 +51,6 @@ typedef struct {
 
 typedef struct {
   request_type current_request;
-  request_type ack_context;
   uint32_t current_payload;
   bool ack_flag;
 } request_handler_t; 
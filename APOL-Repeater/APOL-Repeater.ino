@@ -6,9 +6,6 @@ TaskHandle_t terminal_task_handle;
 TaskHandle_t soc_monitoring_task_handle;
 TaskHandle_t power_management_task_handle;
 
-QueueHandle_t request_queue;
-QueueHandle_t payload_queue;
-
 //Mutexes
 SemaphoreHandle_t uart_mutex;
 
@@ -26,7 +23,7 @@ power_management_parameters_t power_management_parameters;
 uint8_t battery_soc;
 double battery_voltage;
 
-APOL_Comms_Lib comms(HHD, &rx_task_handle);
+APOL_Comms_Lib comms(APOL_ADDRESS(REPEATER, PIT_BOX, REPEATER_MEMBER), &rx_task_handle);
 
 #ifdef UART
   Uart & serial = Serial1;
@@ -58,6 +55,13 @@ void setup() {
     comms.begin();
     comms.rf95 -> setModeRx(); //Start in Rx Mode
     comms.rf95 -> setTxPower(20);
+    comms.rf95 -> setPromiscuous(true); //Compact frames are addressed in the RH header, the repeater needs to hear all of them
+    #ifdef LOW_POWER_LISTEN
+      comms.enable_low_power_listen(true, 20); //The repeater is mains powered and always listens
+    #endif
+    #ifdef MESH
+      comms.enable_mesh(true);
+    #endif
 
     xTaskCreate(rx_task, // Task function
               "RX HANDLER", // Task name
@@ -104,20 +108,28 @@ void loop() {
 void rx_task(void *pvParameters) {
   while(1){
 
-    vTaskSuspend(rx_task_handle);
+    ulTaskNotifyTake(pdTRUE, comms.forward_wait()); //Woken by the radio driver when a frame is queued, or when a held frame is due to go on
 
     #ifdef DEBUG
       xSemaphoreTake(uart_mutex, portMAX_DELAY);
     #endif
     
-    if(comms.check_for_any_packet()){
+    //Hand every frame the driver has queued to the library, not just the one that woke this task, straight from the
+    //driver's buffer. Each is held until the target has had time to answer, and dropped if it does, if another repeater
+    //forwards it first, or if it is a copy of a frame already forwarded or at the hop limit (see comms.relay_counts(),
+    //shown by configure status)
+    while (comms.rf95 -> rxPending() > 0){
+      comms.relay_packet();
+    }
+
+    //Then forward what is due, as it came but for the hop count, so the ACK still matches. The driver goes back to RX
+    //as soon as each has gone
+    packet_fields forwarded;
+    while (comms.forward_held(&forwarded)){
       format_terminal_for_new_entry();
-      serial.printf("Forwarding New Packet (Sender: %s Target: %s Request: %s Payload: %d)\n", comms.subsystem_strings[comms.packet_contents.sender_device], comms.subsystem_strings[comms.packet_contents.target_device], comms.request_strings[comms.packet_contents.request], comms.packet_contents.payload);
+      serial.printf("Forwarded Packet (Sender: %s 0x%02X Target: 0x%02X Request: %s Payload: %d Hops: %d)\n", comms.subsystem_strings[APOL_ROLE(forwarded.sender_device)], forwarded.sender_device, forwarded.target_device, comms.request_strings[forwarded.request], forwarded.payload, forwarded.hops + 1);
       format_new_terminal_entry();
-
-      comms._device_type = comms.packet_contents.sender_device; //Mock sender
-      comms.send_packet(comms.packet_contents.request, comms.packet_contents.target_device, comms.packet_contents.payload); //repeat
-    } 
+    }
 
     //After responding, put back into RX mode
     comms.rf95 -> setModeRx();
@@ -18,7 +18,7 @@ extern TaskHandle_t power_management_task_handle;
 char input_buffer [MAX_BUFFER_SIZE] = {0};
 int buffer_pos;
 
-subsystem term_destination_device = POL; //default is POL
+uint8_t term_destination_device = APOL_ADDRESS(POL, PIT_BOX, 0); //default is POL
 request_type term_request_type = NONE;
 uint8_t term_request_payload = 0; 
 uint8_t current_tx_power = 20; //default
@@ -82,7 +82,7 @@ void argument_mapping(char * arguments[MAX_ARGS], uint8_t num_args){
       }
       else if (0 == strcmp(arguments[1], "help")){
         format_terminal_for_new_entry();
-        serial.print("Valid options are: destination, status, and terminal\n");
+        serial.print("Valid options are: destination, neighbours, routes, status, and terminal\n");
         format_new_terminal_entry();
       }
 
@@ -98,21 +98,21 @@ void argument_mapping(char * arguments[MAX_ARGS], uint8_t num_args){
           format_terminal_for_new_entry();
           serial.print("Destination set to Handheld Device.\n");
           format_new_terminal_entry();
-          term_destination_device = HHD;
+          term_destination_device = APOL_ADDRESS(HHD, PIT_BOX, 0);
         } 
         
         else if (0 == strcmp(arguments[2], "POL")){ 
           format_terminal_for_new_entry();
           serial.print("Destination set to Pit Out Light.\n");
           format_new_terminal_entry();
-          term_destination_device = POL;
+          term_destination_device = APOL_ADDRESS(POL, PIT_BOX, 0);
         } 
         
         else if (0 == strcmp(arguments[2], "VDD")){
           format_terminal_for_new_entry();
           serial.print("Destination set to Vehicle Deteciton Device.\n");
           format_new_terminal_entry();
-          term_destination_device = VDD;
+          term_destination_device = APOL_ADDRESS(VDD, PIT_BOX, 0);
         }
         
         else{
@@ -176,7 +176,7 @@ void argument_mapping(char * arguments[MAX_ARGS], uint8_t num_args){
           
           bool arg_found = 0;
 
-          for(int request = 0; lessThan(request , NUM_REQUEST_TYPES) ; request++){ // Code to execute if request is less than NUM_REQUEST_TYPES (compiler is doing stupid shit again)
+          for(int request = 0; lessThan(request , APOL_NUM_APP_REQUESTS) ; request++){ // Code to execute if request is less than APOL_NUM_APP_REQUESTS (compiler is doing stupid shit again)
 
             if (0 == strcmp(arguments[2], comms.request_strings[request])){
               term_request_type = (request_type) request;
@@ -201,14 +201,61 @@ void argument_mapping(char * arguments[MAX_ARGS], uint8_t num_args){
       
       else if (0 == strcmp(arguments[1], "status")){
         format_terminal_for_new_entry();
-        serial.printf("Destination = %s\n\r", comms.subsystem_strings[term_destination_device]);
+        serial.printf("Destination = %s\n\r", comms.subsystem_strings[APOL_ROLE(term_destination_device)]);
         serial.printf("\033[2KRequest Type = %s\n\r", comms.request_strings[term_request_type]);
         serial.printf("\033[2KPayload = %u\n\r", term_request_payload);
         serial.printf("\033[2KPayload = %u\n\r", term_request_payload);
         serial.printf("\033[2KTransmit power = %u dBm\n\r", current_tx_power);
+        serial.printf("\033[2KRadio ISR max = %lu us, service max = %lu us\n\r", comms.rf95 -> isrMaxMicros(), comms.rf95 -> serviceMaxMicros());
+        serial.printf("\033[2KSPI transactions = %lu (last interrupt %u), writes skipped = %lu\n\r", comms.rf95 -> spiTransactions(), comms.rf95 -> lastServiceSpiTransactions(), comms.rf95 -> spiWritesSkipped());
+        unsigned long tx_airtime = comms.rf95 -> txAirtime(), rx_airtime = comms.rf95 -> rxAirtime();
+        unsigned long channel_use = (tx_airtime + rx_airtime) / max(millis() / 1000, 1UL); //ms per s, ie per mille
+        serial.printf("\033[2KAirtime: tx = %lu ms, rx = %lu ms, channel use since start up = %lu.%lu%%\n\r", tx_airtime, rx_airtime, channel_use / 10, channel_use % 10);
+        serial.printf("\033[2KChannel busy before send (CAD) = %lu\n\r", (unsigned long)comms.rf95 -> cadBusy());
+        serial.printf("\033[2KRadio charge since start up = %lu uAh (energy model)\n\r", (unsigned long)comms.radio_charge());
+        const relay_stats * relay = comms.relay_counts();
+        serial.printf("\033[2KForwarded = %lu, suppressed = %lu (answered directly %lu, copies %lu, hop limit %lu, off route %lu), resends answered with the ACK = %lu\n\r", relay -> forwarded, relay -> direct + relay -> duplicates + relay -> hop_limit + relay -> off_route, relay -> direct, relay -> duplicates, relay -> hop_limit, relay -> off_route, relay -> answered);
         format_new_terminal_entry();
       } 
 
+      else if (0 == strcmp(arguments[1], "neighbours")){
+        uint8_t count;
+        const neighbour * table = comms.neighbours(&count);
+        format_terminal_for_new_entry();
+        serial.printf("%d neighbours\n\r", count);
+        for (uint8_t idx = 0; idx < count; idx++){
+          serial.printf("\033[2K%s 0x%02X: RSSI = %d dBm, SNR = %d dB, heard %lu s ago, answers", comms.subsystem_strings[APOL_ROLE(table[idx].address)], table[idx].address, table[idx].rssi, table[idx].snr, (millis() - table[idx].heard) / 1000);
+          for (uint8_t sender = 0; sender < count; sender++){
+            if ((table[idx].direct >> sender) & 1) serial.printf(" 0x%02X", table[sender].address);
+          }
+          serial.print(" directly, needs a repeater for");
+          for (uint8_t sender = 0; sender < count; sender++){
+            if ((table[idx].relayed >> sender) & 1) serial.printf(" 0x%02X", table[sender].address);
+          }
+          serial.print("\n\r");
+        }
+        format_new_terminal_entry();
+      }
+
+      else if (0 == strcmp(arguments[1], "routes")){
+        uint8_t count;
+        const mesh_route * table = comms.routes(&count);
+        format_terminal_for_new_entry();
+        serial.printf("%d routes\n\r", count);
+        for (uint8_t idx = 0; idx < count; idx++){
+          serial.printf("\033[2K0x%02X to 0x%02X: ", table[idx].source, table[idx].target);
+          if (table[idx].count == APOL_NO_ROUTE){
+            serial.print("no route\n\r");
+            continue;
+          }
+          serial.print("through");
+          for (uint8_t relay = 0; relay < table[idx].count; relay++) serial.printf(" 0x%02X", table[idx].relays[relay]);
+          if (table[idx].count == 0) serial.print(" no repeater");
+          serial.printf(", weakest link %d dB above the floor, found %lu s ago\n\r", table[idx].quality, (millis() - table[idx].found) / 1000);
+        }
+        format_new_terminal_entry();
+      }
+
       else if (0 == strcmp(arguments[1], "terminal")){
         serial.print("\033[?25l"); //hide cursor
         serial.printf("\33[2J");
@@ -303,7 +350,7 @@ void argument_mapping(char * arguments[MAX_ARGS], uint8_t num_args){
           serial.printf("Packet #%d sent.\n\r", packet_idx, NUM_PERSISTENT_LINES + 1);
           format_new_terminal_entry();
 
-          delay(50);
+          delay(comms.retransmit_timeout(term_destination_device)); //Time for the ACK to come back
 
           int attempts = 0;
           do {
@@ -322,7 +369,7 @@ void argument_mapping(char * arguments[MAX_ARGS], uint8_t num_args){
             comms.send_packet(NONE, term_destination_device, packet_idx);
             comms.rf95 -> setModeRx();
 
-            delay(50);
+            delay(comms.retransmit_timeout(term_destination_device)); //Time for the ACK to come back
 
             attempts++;
 
@@ -6,12 +6,29 @@
 #define DEBUG //define to enable serial print statements
 #define BUTTONS_CONNECTED //define to enable GPIO interrupts
 #define RF_ENABLED
+// #define ADAPTIVE_RATE //define to adapt the data rate and TX power of each link to its SNR (must match on every device, the repeater only relays frames sent at the base rate)
+// #define SLOTTED_MAC //define to send in the time slots set by the POL's beacon, which also stands in for the ping (must match on every device)
+// #define LOW_POWER_LISTEN //define to keep the radio asleep, waking it every listen interval (APOL_LPL_INTERVAL_HHD ms) to check for a preamble (must match on every device)
+// #define MESH //define to find routes through the repeaters and have only the repeaters on a route forward its frames (must match on every device)
 #define IDLE_ENABLED
 // #define UART //if defined, serial communications are through UART pins rather than USB emulation
 // #define TASK_LOGGING
 // #define TEST_PLAN_5
 
+//Addressing (see APOL_ADDRESS): the pit box this handheld works with, and which of the box's handhelds it is
+#define PIT_BOX 0 //0-7, as on the box's POL and VDD
+#define HHD_MEMBER 0 //0-3, different on each handheld working with the box
+#define POL_ADDRESS APOL_ADDRESS(POL, PIT_BOX, 0)
+
+#if defined(SLOTTED_MAC) && defined(ADAPTIVE_RATE)
+  #error "SLOTTED_MAC slots are sized for the base rate, and beacons are only heard at it: define one of SLOTTED_MAC and ADAPTIVE_RATE"
+#endif
+#if defined(SLOTTED_MAC) && defined(LOW_POWER_LISTEN)
+  #error "Wake-up preambles do not fit in a SLOTTED_MAC slot: define one of SLOTTED_MAC and LOW_POWER_LISTEN"
+#endif
+
 #include <APOL_Comms_Lib.h>
+#include <APOL_Request_Queue.h>
 #include <Seeed_Arduino_FreeRTOS.h>
 #include "ArduinoLowPower.h"
 #include "display.h"
@@ -25,6 +42,9 @@
 #define REFRESH_DELAY 100
 #define BAUD_RATE 115200 //For serial
 #define MAX_TRANSMIT_ATTEMPTS 5
+#define PING_INTERVAL 1000 //How often the link is checked (ms). A ping is only sent if no ACK has come from the POL in the last half interval
+#define PING_LOSS_LIMIT 3 //Ping intervals without hearing from the POL before it counts as disconnected
+#define RATE_INTERVAL 1000 //How often the data rate is adapted (ms), see ADAPTIVE_RATE
 #define SOC_MONITORING_DELAY 1000
 #define IDLE_START_MILLISECONDS 30000 //30 Seconds
 
@@ -45,7 +65,6 @@ typedef struct {
 
 typedef struct {
   request_type current_request;
-  request_type ack_context;
   uint32_t current_payload;
   bool ack_flag;
 } request_handler_t; 
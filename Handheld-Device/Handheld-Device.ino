@@ -10,9 +10,9 @@ TaskHandle_t request_task_handle;
 TaskHandle_t terminal_task_handle;
 TaskHandle_t soc_monitoring_task_handle;
 TaskHandle_t power_management_task_handle;
+TaskHandle_t listen_task_handle;
 
-QueueHandle_t request_queue;
-QueueHandle_t payload_queue;
+APOL_Request_Queue request_queue(MAX_QUEUED_REQUESTS); //Requests waiting for the send window, overrides and RED first
 
 //Mutexes
 SemaphoreHandle_t uart_mutex;
@@ -30,14 +30,14 @@ typedef struct{
 } power_management_parameters_t;
 
 typedef struct{
-  bool successful_ping;
+  uint32_t last_contact; //millis() when an ACK (or beacon) last came from the POL. Every ACK carries its state, so any of them will do in place of a ping
   bool is_connected;
-  uint8_t unsusccesful_attempts;
 } ping_parameters_t;
 
 override_t override_paramaters;
 request_handler_t request_handler_parameters;
 light_state_t light_parameters;
+pol_state pol_replica; //The POL's light state as of its last ACK (version 0 until one arrives)
 power_management_parameters_t power_management_parameters;
 ping_parameters_t ping_parameters;
 request_type request;
@@ -49,7 +49,8 @@ int testVar;
 double battery_voltage;
 char display_string[10];
 uint32_t start_time;
-APOL_Comms_Lib comms(HHD, &rx_task_handle);
+uint32_t last_rate_adapt; //millis() when the data rate was last adapted (see ADAPTIVE_RATE)
+APOL_Comms_Lib comms(APOL_ADDRESS(HHD, PIT_BOX, HHD_MEMBER), &rx_task_handle);
 
 #ifdef UART
   Uart & serial = Serial1;
@@ -109,15 +110,38 @@ void setup() {
 
   #ifdef RF_ENABLED
     comms.begin();
+    comms.on_request_done(request_done);
     comms.rf95 -> setModeRx(); //Start in Rx Mode
     comms.rf95 -> setTxPower(13);
+    #ifdef ADAPTIVE_RATE
+      comms.enable_rate_adaptation(APOL_PEER(POL), 13); //Only the POL sends to the HHD
+    #endif
+    #ifdef MESH
+      comms.enable_mesh(true);
+    #endif
     
-    xTaskCreate(ping_task, // Task function
-              "PING", // Task name
-              64, // Stack size 
-              &ping_parameters, 
-              4, // Priority
-              &ping_task_handle); // Task handler
+    #ifdef LOW_POWER_LISTEN
+      comms.enable_low_power_listen(true, 13);
+      xTaskCreate(listen_task, // Task function
+                "LISTEN", // Task name
+                128, // Stack size 
+                NULL, 
+                3, // Priority
+                &listen_task_handle); // Task handler
+    #endif
+
+    #ifdef SLOTTED_MAC
+      comms.enable_slotted_mac(true);
+      ping_parameters.last_contact = millis() - PING_LOSS_LIMIT * APOL_SUPERFRAME; //start not connected, rx_task follows the beacons
+      ping_parameters.is_connected = 0;
+    #else
+      xTaskCreate(ping_task, // Task function
+                "PING", // Task name
+                256, // Stack size, send_packet() may find a route and listen before talk
+                &ping_parameters, 
+                4, // Priority
+                &ping_task_handle); // Task handler
+    #endif
 
     xTaskCreate(rx_task, // Task function
               "RX HANDLER", // Task name
@@ -140,8 +164,6 @@ void setup() {
               4, // Priority
               &request_task_handle); // Task handler
 
-    request_queue = xQueueCreate(MAX_QUEUED_REQUESTS, sizeof(request_type));
-    payload_queue = xQueueCreate(MAX_QUEUED_REQUESTS, sizeof(uint32_t));
 
   #endif
 
@@ -182,13 +204,12 @@ void loop() {
 void ping_task(void *pvParameters) {
   
   ping_parameters_t * ping_parameters = (ping_parameters_t *) pvParameters;
-  ping_parameters -> unsusccesful_attempts = 3; //start not connected
-  ping_parameters -> successful_ping = false;
+  ping_parameters -> last_contact = millis() - PING_LOSS_LIMIT * PING_INTERVAL; //start not connected
   ping_parameters -> is_connected = 0;
 
   while(1){
     
-    vTaskDelay(1000);
+    vTaskDelay(PING_INTERVAL);
     
     #ifdef DEBUG
       xSemaphoreTake(uart_mutex, portMAX_DELAY);
@@ -200,20 +221,15 @@ void ping_task(void *pvParameters) {
       format_new_terminal_entry();
     #endif
 
-    if (ping_parameters -> successful_ping == true) {
-      ping_parameters -> unsusccesful_attempts = 0;
-    }
-    else{
-      ping_parameters -> unsusccesful_attempts++;
-    }
-    
-    //We are not connected if there are more than 3 unsuccessful attempts
-    ping_parameters -> is_connected = ping_parameters -> unsusccesful_attempts < 3;
+    //We are not connected if nothing has been heard from the POL for PING_LOSS_LIMIT intervals
+    uint32_t quiet = millis() - ping_parameters -> last_contact;
+    ping_parameters -> is_connected = quiet < PING_LOSS_LIMIT * PING_INTERVAL;
 
-    //
-    ping_parameters -> successful_ping = false;
-    comms.send_packet(PING, POL, NO_PAYLOAD);
-    comms.rf95 -> setModeRx();
+    //Requests going out bring the POL's state back in their ACKs, so only ping when the link has been quiet
+    if (quiet >= PING_INTERVAL / 2 && comms.requests_outstanding(POL_ADDRESS) == 0){
+      comms.send_packet(PING, POL_ADDRESS, NO_PAYLOAD);
+      comms.rf95 -> setModeRx();
+    }
     
     #if defined(DEBUG) && defined(TASK_LOGGING)
       format_terminal_for_new_entry();
@@ -235,7 +251,13 @@ void rx_task(void *pvParameters) {
   light_state_t * params = (light_state_t *) pvParameters;
   while(1){
 
-    vTaskSuspend(rx_task_handle);
+    #ifdef ADAPTIVE_RATE
+      ulTaskNotifyTake(pdTRUE, RATE_INTERVAL); //Woken by the radio driver when a frame is queued, or in time to adapt the rate
+    #elif defined(SLOTTED_MAC)
+      ulTaskNotifyTake(pdTRUE, APOL_SUPERFRAME); //Woken by the radio driver when a frame is queued, or in time to notice a missed beacon
+    #else
+      ulTaskNotifyTake(pdTRUE, portMAX_DELAY); //Woken by the radio driver when a frame is queued
+    #endif
 
     #ifdef DEBUG
       xSemaphoreTake(uart_mutex, portMAX_DELAY);
@@ -247,56 +269,71 @@ void rx_task(void *pvParameters) {
       format_new_terminal_entry();
     #endif
     
-    if(comms.check_for_packet() && comms.packet_contents.target_device == HHD){
-      switch(comms.packet_contents.request){
-        case OVERRIDE_START:{
-        #if defined(DEBUG) 
-        format_terminal_for_new_entry();
-        serial.print("Override Start Received\n");
-        format_new_terminal_entry();
-        #endif
-          override_delay = comms.packet_contents.payload;
-          is_override = true;  
-          new_override = 1;
-          vTaskResume(override_task_handle);
-        } break;
-        case OVERRIDE_STOP:{
-          #if defined(DEBUG) && defined(TASK_LOGGING)
-          serial.println("Override stop received\n");
+    //Handle every frame the driver has queued, not just the one that woke this task
+    while (comms.rf95 -> rxPending() > 0){
+      if(comms.check_for_packet()){ //Only frames to this handheld, or to every handheld of the box
+        switch(comms.packet_contents.request){
+          case OVERRIDE_START:{
+          #if defined(DEBUG) 
+          format_terminal_for_new_entry();
+          serial.print("Override Start Received\n");
+          format_new_terminal_entry();
           #endif
-          override_delay = 0;
-          is_override = false;
-          vTaskResume(override_task_handle);
-        } break;
-        case PING:{
-          comms.send_packet(ACK, comms.packet_contents.sender_device, NO_PAYLOAD);
-        } break;
-        case GREEN_PULSE:{
-          status_string_select = none;
-        } break;
-        case ACK:{
-          #ifdef DEBUG
-            format_terminal_for_new_entry();
-            serial.printf("Ack received = %d & Ack context = %d. (for reference GREEN is %d).\n", comms.packet_contents.payload, request_handler_parameters.ack_context, GREEN); //green is 1, red is 3
-            format_new_terminal_entry();
-          #endif
-          switch (comms.packet_contents.payload){
-            case GREEN:{
-              params-> green_state ? status_string_select = green : status_string_select = none;
-            } break;
-            case RED: {
-              params-> red_state ? status_string_select = red : status_string_select = none;
-            }break;
-            case GREEN_PULSE: {
-              status_string_select = green_pulse;
-            }break;
-          }
-          if (comms.packet_contents.payload == PING) ping_parameters.is_connected = (comms.packet_contents.sender_device == POL);
-          else if (comms.packet_contents.payload == request_handler_parameters.ack_context) request_handler_parameters.ack_flag = 0;
-
-        } break;
+            override_delay = comms.packet_contents.payload;
+            is_override = true;  
+            new_override = 1;
+            vTaskResume(override_task_handle);
+          } break;
+          case OVERRIDE_STOP:{
+            #if defined(DEBUG) && defined(TASK_LOGGING)
+            serial.println("Override stop received\n");
+            #endif
+            override_delay = 0;
+            is_override = false;
+            vTaskResume(override_task_handle);
+          } break;
+          case PING:{
+            comms.send_ack(&comms.packet_contents);
+          } break;
+          case GREEN_PULSE:{
+            status_string_select = none;
+          } break;
+          case ACK:{
+            #ifdef DEBUG
+              format_terminal_for_new_entry();
+              serial.printf("Ack received = %d. (for reference GREEN is %d).\n", comms.packet_contents.payload & APOL_ACK_REQUEST_MASK, GREEN); //green is 1, red is 3
+              format_new_terminal_entry();
+            #endif
+            if ((comms.packet_contents.payload & APOL_ACK_REQUEST_MASK) != PING && comms.handle_ack(&comms.packet_contents)) request_handler_parameters.ack_flag = comms.requests_outstanding(POL_ADDRESS) > 0; //Cumulative ACK for the send window
+            if (comms.packet_contents.sender_device == POL_ADDRESS){
+              ping_parameters.last_contact = millis();
+              ping_parameters.is_connected = 1;
+              reconcile_state(comms.packet_contents.payload); //After handle_ack(), so requests it completed no longer count as pending
+            }
+
+          } break;
+          case BEACON:{
+            //Sent by the POL every superframe with its state, so it tells us we are connected in place of a ping
+            ping_parameters.last_contact = millis();
+            ping_parameters.is_connected = 1;
+            reconcile_state(comms.packet_contents.payload);
+          } break;
+        }
       }
-    } 
+    }
+
+    //Without the ping task, we are not connected once PING_LOSS_LIMIT beacons in a row have been missed
+    #ifdef SLOTTED_MAC
+      ping_parameters.is_connected = millis() - ping_parameters.last_contact < PING_LOSS_LIMIT * APOL_SUPERFRAME;
+    #endif
+
+    //Frames are handled here, so RATE requests and their ACKs are too
+    #ifdef ADAPTIVE_RATE
+      if (millis() - last_rate_adapt >= RATE_INTERVAL){
+        last_rate_adapt = millis();
+        comms.adapt_rate();
+      }
+    #endif
 
     //After responding, put back into RX mode
     comms.rf95 -> setModeRx();
@@ -332,42 +369,43 @@ void request_handler_task(void *pvParameters) {
       format_new_terminal_entry();
     #endif
 
-    while (uxQueueMessagesWaiting(request_queue) > 0){
-      xQueueReceive(request_queue, &(params -> current_request), 0);
-      xQueueReceive(payload_queue, &(params -> current_payload), 0);
+    int attempts = 0;
 
-      //Set the context to match the current request
-      //Set the ack flag and keep sending the request until an acknowledgement is received that matches the current context 
-      params -> ack_context = params -> current_request;
-      params -> ack_flag = 1;
-      #ifdef DEBUG
-            format_terminal_for_new_entry();
-            serial.printf("Ack context was set to %d.\n\r", params -> current_request);
-            serial.printf("Ack context is actually %d.\n", params -> ack_context);
-            format_new_terminal_entry();
-      #endif
-      
-      int attempts = 0;
-      
-      do {
-          #ifdef DEBUG
-            format_terminal_for_new_entry();
-            serial.print("Trying to send a new packet.\n");
-            format_new_terminal_entry();
-            xSemaphoreGive(uart_mutex);
-          #endif
-          comms.send_packet(params -> current_request, POL, params -> current_payload);
-          comms.rf95 -> setModeRx();
-          vTaskDelay(50);
-          attempts++;
-          xSemaphoreTake(uart_mutex, portMAX_DELAY);
-      } while (params -> ack_flag && attempts < MAX_TRANSMIT_ATTEMPTS);
+    while (request_queue.count() > 0 || comms.requests_outstanding(POL_ADDRESS) > 0){
+
+      //Move as many queued requests into the send window as it has room for
+      request_record record;
+      while (comms.window_space(POL_ADDRESS) > 0 && request_queue.receive(&record)){
+        params -> current_request = record.request;
+        params -> current_payload = record.payload;
+        comms.queue_request(record.request, POL_ADDRESS, record.payload, record.tag);
 
-      if (attempts == MAX_TRANSMIT_ATTEMPTS) center_string_select = transmit_failed;
+        //The ack flag stays set until the window is empty
+        params -> ack_flag = 1;
+      }
 
+      #ifdef DEBUG
+        format_terminal_for_new_entry();
+        serial.printf("Trying to send %d packets.\n", comms.requests_outstanding(POL_ADDRESS));
+        format_new_terminal_entry();
+        xSemaphoreGive(uart_mutex);
+      #endif
+      //Everything not sent yet goes out as one burst that the POL acknowledges once. After a timeout or a partial ACK
+      //that is everything from the oldest unacknowledged request on
+      comms.flush_requests(POL_ADDRESS);
+      comms.rf95 -> setModeRx();
+      //Sleep until an ACK moves the window, or for the timeout worked out from measured round trips (doubled on each resend)
+      if (comms.wait_for_ack(POL_ADDRESS)) attempts = 0;
+      else if (++attempts >= MAX_TRANSMIT_ATTEMPTS){
+        comms.abandon_requests(POL_ADDRESS);
+        center_string_select = transmit_failed;
+        attempts = 0;
+      }
+      xSemaphoreTake(uart_mutex, portMAX_DELAY);
     }
+
+    params -> ack_flag = 0;
     
-    params -> ack_context = NONE;
     comms.rf95 -> setModeRx();
     #if defined(DEBUG) && defined(TASK_LOGGING)
       format_terminal_for_new_entry();
@@ -380,6 +418,53 @@ void request_handler_task(void *pvParameters) {
   }
 }
 
+//Name: request_done
+//Purpose: Hands requests the POL acknowledged, or that were given up on, back to the queue so their callbacks run.
+//Inputs: tag, request, payload (as sent), delivered
+//Outputs: None
+void request_done(uint16_t tag, request_type request, uint32_t payload, bool delivered) {
+  request_queue.complete(tag, request, payload, delivered);
+}
+
+//Name: light_request_done
+//Purpose: Completion callback for light button presses. A press that was given up on never reached the POL, so the
+//         light state the next press toggles from goes back to what the POL last reported.
+//Inputs: request, payload (as sent), delivered, arg (unused)
+//Outputs: None
+void light_request_done(request_type request, uint32_t payload, bool delivered, void * arg) {
+  if (delivered || pol_replica.version == 0) return;
+  light_parameters.green_state = pol_replica.green;
+  light_parameters.red_state = pol_replica.red;
+}
+
+//Name: reconcile_state
+//Purpose: Updates the replica of the POL's light state from the snapshot in one of its ACKs. Once nothing is left to
+//         send, the light state presses toggle from, the status string and the override display are matched to it,
+//         so a lost ACK or a pulse the POL ended is put right by the same exchange rather than by polling.
+//Inputs: payload (of an ACK from the POL)
+//Outputs: None
+void reconcile_state(uint32_t payload) {
+  if (!APOL_Comms_Lib::decode_state(payload, &pol_replica)) return; //No snapshot
+  if (request_queue.count() > 0 || comms.requests_outstanding(POL_ADDRESS) > 0) return; //The POL has not seen every press yet
+
+  light_parameters.green_state = pol_replica.green;
+  light_parameters.red_state = pol_replica.red;
+
+  if (pol_replica.override && !is_override){
+    override_delay = (pol_replica.end_time - millis() + 999) / 1000;
+    is_override = true;
+    new_override = 1;
+    vTaskResume(override_task_handle);
+  }
+  else if (!pol_replica.override && is_override){
+    override_delay = 0;
+    is_override = false;
+    vTaskResume(override_task_handle);
+  }
+
+  if (!is_override) status_string_select = pol_replica.pulse ? green_pulse : (pol_replica.green ? green : (pol_replica.red ? red : none));
+}
+
 //Name: button_task
 //Purpose: FreeRTOS task that handles button inputs (unsuspended by GPIO ISRs).
 //Inputs: None
@@ -509,8 +594,14 @@ void button_task(void *pvParameters) {
     }
 
     #ifdef RF_ENABLED
-      xQueueSend(request_queue, &new_request, 0);
-      xQueueSend(payload_queue, &new_request_payload, 0);
+      //Filled in place in the queue. A full priority class drops the press (counted by the queue). Light presses still
+      //waiting to be sent are coalesced, so mashing a button sends only the state it ends up in
+      request_record * record = (new_request != NONE) ? request_queue.reserve(new_request, light_request_done) : NULL;
+      if (record != NULL){
+        record -> target_device = POL_ADDRESS;
+        record -> payload = new_request_payload;
+        request_queue.commit(record);
+      }
       vTaskResume(request_task_handle);
     #endif
 
@@ -679,6 +770,18 @@ void soc_monitoring_task(void *pvParameters) {
   }
 }
 
+//Name: listen_task
+//Purpose: FreeRTOS task for low power listening while the device is awake: every listen interval, checks for a preamble
+//         and puts the radio to sleep if there is none and nothing is expected (see LOW_POWER_LISTEN).
+//Inputs: None
+//Outputs: None
+void listen_task(void *pvParameters) {
+  while(1){
+    vTaskDelay(comms.listen_interval(HHD));
+    comms.sniff();
+  }
+}
+
 //Name: power_management_task
 //Purpose: Monitors when device is being used and when it isn't. When device not in use, turn off display and put system into deepsleep.
 //Inputs: None
@@ -722,7 +825,15 @@ void power_management_task(void *pvParameters) {
 
       power_management_parameters -> idle = true;
 
-      LowPower.deepSleep();
+      #ifdef LOW_POWER_LISTEN
+        //Wake every listen interval to sniff for a preamble, until the radio is left listening or a button is pressed
+        while (!(green_flag || green_pulse_flag || red_flag || override_flag) && !comms.sniff()){
+          LowPower.deepSleep(comms.listen_interval(HHD));
+        }
+        if (!(green_flag || green_pulse_flag || red_flag || override_flag)) power_management_parameters -> idle = false; //Woken by the radio: handle the frame, then sleep again
+      #else
+        LowPower.deepSleep();
+      #endif
 
       //Now that the risk of the mutex being stuck is gone, give it back.
       xSemaphoreGive(uart_mutex); 
@@ -781,9 +892,8 @@ void terminal_task(void *pvParameters) {
     serial.printf("\033[%dF", NUM_PERSISTENT_LINES ); //Escape sequence to put cursor up N lines and at the start of the line
     serial.printf("****************************\33[0K\033[E");
     serial.printf("*  Last Packet Paylod = %d  *\33[0K\033[E", comms.packet_contents.payload);
-    serial.printf("* Current Ack Context = %d  *\33[0K\033[E", request_handler_parameters.ack_context);
     serial.printf("*   Connection Status = %d  *\33[0K\033[E", ping_parameters.is_connected);
-    serial.printf("*   Messages in Queue = %d  *\33[0K\033[E", uxQueueMessagesWaiting(request_queue));
+    serial.printf("*   Messages in Queue = %d  *\33[0K\033[E", request_queue.count());
     serial.printf("*  Battery Voltage = %.2lfV *\33[0K\033[E", battery_voltage);
     serial.printf("*    Battery SoC = %3d%%    *\33[0K\033[E", battery_soc);
     // serial.printf("* Free RAM = %d bytes *\n", freeMemory());
@@ -3,11 +3,26 @@
 #define DEBUG //define to enable serial print statements
 #define BUTTONS_CONNECTED //define to enable GPIO interrupts
 #define RF_ENABLED
+// #define AUTO_ACK //define to ACK requests from the radio service task before rx_task acts on them (those ACKs carry no light state, PING replies still do)
+// #define ADAPTIVE_RATE //define to adapt the data rate and TX power of each link to its SNR (must match on every device, the repeater only relays frames sent at the base rate)
+// #define SLOTTED_MAC //define to broadcast the beacon that gives every device its time slot to send in (must match on every device)
+// #define LOW_POWER_LISTEN //define to send frames to the HHD and VDD with preambles long enough to wake them (must match on every device)
+// #define MESH //define to find routes through the repeaters and have only the repeaters on a route forward its frames (must match on every device)
 // #define IDLE_ENABLED
 // #define UART //if defined, serial communications are through UART pins rather than USB emulation
 //#define TASK_LOGGING //define to enable task entry and exit logging
 #define LIGHTS_CONNECTED
 
+//Addressing (see APOL_ADDRESS): the pit box this POL lights
+#define PIT_BOX 0 //0-7, as on the box's VDD and handhelds
+
+#if defined(SLOTTED_MAC) && defined(ADAPTIVE_RATE)
+  #error "SLOTTED_MAC slots are sized for the base rate, and beacons are only heard at it: define one of SLOTTED_MAC and ADAPTIVE_RATE"
+#endif
+#if defined(SLOTTED_MAC) && defined(LOW_POWER_LISTEN)
+  #error "Wake-up preambles do not fit in a SLOTTED_MAC slot: define one of SLOTTED_MAC and LOW_POWER_LISTEN"
+#endif
+
 #define NO_PAYLOAD 0
 
 //Macros for system parameters
@@ -16,6 +31,7 @@
 #define DURATION_INC 5
 #define BAUD_RATE 115200
 #define PULSE_DELAY 1000
+#define RATE_INTERVAL 1000 //How often the data rate is adapted (ms), see ADAPTIVE_RATE
 #define IDLE_START_MILLISECONDS 5000 //30 Seconds
 
 #include <APOL_Comms_Lib.h>
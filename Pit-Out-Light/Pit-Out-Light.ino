@@ -7,6 +7,7 @@ TaskHandle_t display_task_handle;
 TaskHandle_t light_control_task_handle;
 TaskHandle_t terminal_task_handle;
 TaskHandle_t power_management_task_handle;
+TaskHandle_t beacon_task_handle;
 
 //Mutexes
 SemaphoreHandle_t uart_mutex;
@@ -17,9 +18,11 @@ bool override_flag;
 bool new_override;
 bool display_update_flag = true; //Here because its safer to do this than suspend/resume tasks
 int time_multiplier;
+uint32_t last_rate_adapt; //millis() when the data rate was last adapted (see ADAPTIVE_RATE)
 
 //Task parameters
 light_control_t light_parameters;
+pol_state light_state; //What the lights are doing, reported in every ACK. The HHD keeps a replica of it
 
 typedef struct{
   uint32_t last_activity;
@@ -29,7 +32,7 @@ typedef struct{
 power_management_parameters_t power_management_parameters;
 
 //Comms stack
-APOL_Comms_Lib comms(POL, &rx_task_handle);
+APOL_Comms_Lib comms(APOL_ADDRESS(POL, PIT_BOX, 0), &rx_task_handle);
 
 #ifdef UART
   Uart & serial = Serial1;
@@ -97,8 +100,22 @@ void setup() {
 
   #ifdef RF_ENABLED
     comms.begin();
+    light_state.version = 1; //All off
+    comms.set_ack_state(&light_state);
+    #ifdef AUTO_ACK
+      comms.enable_auto_ack(true);
+    #endif
     comms.rf95 -> setModeRx(); //Start in Rx Mode
     comms.rf95 -> setTxPower(20);
+    #ifdef ADAPTIVE_RATE
+      comms.enable_rate_adaptation(APOL_PEER(HHD) | APOL_PEER(VDD), 20); //Both send requests to the POL
+    #endif
+    #ifdef LOW_POWER_LISTEN
+      comms.enable_low_power_listen(true, 20); //The POL always listens (APOL_LPL_INTERVAL_POL)
+    #endif
+    #ifdef MESH
+      comms.enable_mesh(true);
+    #endif
 
     xTaskCreate(rx_task, // Task function
               "RX HANDLER", // Task name
@@ -107,6 +124,16 @@ void setup() {
               5, // Priority
               &rx_task_handle); // Task handler
 
+    #ifdef SLOTTED_MAC
+      comms.enable_slotted_mac(true);
+      xTaskCreate(beacon_task, // Task function
+                "BEACON", // Task name
+                256, // Stack size, send_beacon() may send a ROUTE request too
+                NULL, 
+                6, // Priority, above rx_task so the superframe starts on time
+                &beacon_task_handle); // Task handler
+    #endif
+
   #endif
 
   interrupts();
@@ -140,7 +167,11 @@ void loop() {
 void rx_task(void *pvParameters) {
   while(1){
     
-    vTaskSuspend(rx_task_handle);
+    #ifdef ADAPTIVE_RATE
+      uint32_t woken = ulTaskNotifyTake(pdTRUE, RATE_INTERVAL); //Woken by the radio driver when a frame is queued, or in time to adapt the rate
+    #else
+      uint32_t woken = ulTaskNotifyTake(pdTRUE, portMAX_DELAY); //Woken by the radio driver when a frame is queued
+    #endif
     
     #ifdef DEBUG
       xSemaphoreTake(uart_mutex, portMAX_DELAY);
@@ -153,99 +184,123 @@ void rx_task(void *pvParameters) {
     #endif
     
     
-    if(comms.check_for_packet() || (trigger_flag == 1)){
+    //Handle every frame the driver has queued, not just the one that woke this task
+    while ((comms.rf95 -> rxPending() > 0) || (trigger_flag == 1)){
+      if(comms.check_for_packet() || (trigger_flag == 1)){
+
+        //A resent or out of order request from a send window is not acted on again, only acknowledged so the sender knows where to resume
+        if ((trigger_flag == 0) && !comms.accept_request(&comms.packet_contents)){
+          comms.send_ack(&comms.packet_contents);
+          continue;
+        }
       
-      #ifdef DEBUG
-        if (trigger_flag == 1) trigger_flag = 0;
-      #endif
+        #ifdef DEBUG
+          if (trigger_flag == 1) trigger_flag = 0;
+        #endif
 
-      switch(comms.packet_contents.request){
-        case GREEN:{
+        switch(comms.packet_contents.request){
+          case GREEN:{
           
-          #ifdef DEBUG
-            format_terminal_for_new_entry();
-            serial.print("Green Request Received\n");
-            format_new_terminal_entry();
-          #endif
-          if (light_parameters.pulse_active == 1){
-            light_parameters.pulse_active = 0;
-          }
-          light_parameters.requested_light = GREEN_LIGHT_PIN;
-          light_parameters.requested_state = comms.packet_contents.payload;
-          light_parameters.requested_mode = GREEN; //continuous
-          vTaskResume(light_control_task_handle);
-        } break;
-        case GREEN_PULSE: {
-          #ifdef DEBUG
-            format_terminal_for_new_entry();
-            serial.print("Green Pulse Request Received\n");
-            format_new_terminal_entry();
-          #endif
-          if (light_parameters.pulse_active == 1){
-            light_parameters.pulse_active = 0;
-          }
-          light_parameters.requested_light = GREEN_LIGHT_PIN;
-          light_parameters.requested_mode = GREEN_PULSE; //pulsed
-          vTaskResume(light_control_task_handle);
-        } break;
-        case OVERRIDE_START: {
-          #ifdef DEBUG
-            format_terminal_for_new_entry();
-            serial.print("Override Start Request received\n");
-            format_new_terminal_entry();
-          #endif
-          comms.send_packet(ACK, VDD, OVERRIDE_START); 
-          comms.send_packet(OVERRIDE_START, HHD, time_multiplier * DURATION_INC);
-          if (light_parameters.pulse_active == 1){
-            light_parameters.pulse_active = 0;
-          }
-          light_parameters.requested_mode = OVERRIDE_START; //override
-          new_override = 1;
-          override_flag = 1;
-          comms.rf95 -> setModeRx();
-          vTaskResume(light_control_task_handle);
-        } break;
-        case OVERRIDE_STOP: {
-          #ifdef DEBUG
-            format_terminal_for_new_entry();
-            serial.print("Override Stop Request received\n");
-            format_new_terminal_entry();
-          #endif
-          //comms.send_packet(OVERRIDE_STOP, HHD, NO_PAYLOAD);
-          light_parameters.requested_light = light_parameters.active_light;
-          light_parameters.requested_mode = GREEN; //pulsed
-          override_flag = 0;
-          vTaskResume(light_control_task_handle);
-        } break;
-        case PING: {
-          #ifdef DEBUG
-            format_terminal_for_new_entry();
-            serial.print("Ping received\n");
-            format_new_terminal_entry();
-          #endif
-        } break;
-        case RED: {
-          #ifdef DEBUG
-            format_terminal_for_new_entry();
-            serial.print("Red request received\n");
-            format_new_terminal_entry();
-          #endif
-          if (light_parameters.pulse_active == 1){
-            light_parameters.pulse_active = 0;
-          }
-          light_parameters.requested_light = RED_LIGHT_PIN;
-          light_parameters.requested_state = comms.packet_contents.payload;
-          light_parameters.requested_mode = RED; 
-          vTaskResume(light_control_task_handle);
-        } break;
+            #ifdef DEBUG
+              format_terminal_for_new_entry();
+              serial.print("Green Request Received\n");
+              format_new_terminal_entry();
+            #endif
+            if (!update_light_state(comms.packet_contents.payload, 0, 0, light_state.override, light_state.end_time)) break; //Already in that state
+            if (light_parameters.pulse_active == 1){
+              light_parameters.pulse_active = 0;
+            }
+            light_parameters.requested_light = GREEN_LIGHT_PIN;
+            light_parameters.requested_state = comms.packet_contents.payload;
+            light_parameters.requested_mode = GREEN; //continuous
+            vTaskResume(light_control_task_handle);
+          } break;
+          case GREEN_PULSE: {
+            #ifdef DEBUG
+              format_terminal_for_new_entry();
+              serial.print("Green Pulse Request Received\n");
+              format_new_terminal_entry();
+            #endif
+            if (!update_light_state(0, 0, 1, light_state.override, millis() + PULSE_DELAY)) break; //Already pulsing, let it finish
+            if (light_parameters.pulse_active == 1){
+              light_parameters.pulse_active = 0;
+            }
+            light_parameters.requested_light = GREEN_LIGHT_PIN;
+            light_parameters.requested_mode = GREEN_PULSE; //pulsed
+            vTaskResume(light_control_task_handle);
+          } break;
+          case OVERRIDE_START: {
+            #ifdef DEBUG
+              format_terminal_for_new_entry();
+              serial.print("Override Start Request received\n");
+              format_new_terminal_entry();
+            #endif
+            //Queue both and let the light state update while they go out, each send waits for the one before it
+            update_light_state(0, 0, 0, 1, millis() + (time_multiplier * DURATION_INC) * 1000);
+            comms.send_ack_async(&comms.packet_contents);
+            comms.send_packet_async(OVERRIDE_START, APOL_MULTICAST(HHD, PIT_BOX), time_multiplier * DURATION_INC); //Every handheld working with this box
+            if (light_parameters.pulse_active == 1){
+              light_parameters.pulse_active = 0;
+            }
+            light_parameters.requested_mode = OVERRIDE_START; //override
+            new_override = 1;
+            override_flag = 1;
+            comms.rf95 -> waitPacketSent();
+            comms.rf95 -> setModeRx();
+            vTaskResume(light_control_task_handle);
+          } break;
+          case OVERRIDE_STOP: {
+            #ifdef DEBUG
+              format_terminal_for_new_entry();
+              serial.print("Override Stop Request received\n");
+              format_new_terminal_entry();
+            #endif
+            //comms.send_packet(OVERRIDE_STOP, HHD, NO_PAYLOAD);
+            if (!update_light_state(0, 0, 0, 0, 0)) break; //No override running
+            light_parameters.requested_light = light_parameters.active_light;
+            light_parameters.requested_mode = GREEN; //pulsed
+            override_flag = 0;
+            vTaskResume(light_control_task_handle);
+          } break;
+          case PING: {
+            #ifdef DEBUG
+              format_terminal_for_new_entry();
+              serial.print("Ping received\n");
+              format_new_terminal_entry();
+            #endif
+          } break;
+          case RED: {
+            #ifdef DEBUG
+              format_terminal_for_new_entry();
+              serial.print("Red request received\n");
+              format_new_terminal_entry();
+            #endif
+            if (!update_light_state(0, comms.packet_contents.payload, 0, light_state.override, light_state.end_time)) break; //Already in that state
+            if (light_parameters.pulse_active == 1){
+              light_parameters.pulse_active = 0;
+            }
+            light_parameters.requested_light = RED_LIGHT_PIN;
+            light_parameters.requested_state = comms.packet_contents.payload;
+            light_parameters.requested_mode = RED; 
+            vTaskResume(light_control_task_handle);
+          } break;
+        }
+        comms.send_ack(&comms.packet_contents); //send ACK back (held until the last frame of a burst)
       }
-      comms.send_packet(ACK, comms.packet_contents.sender_device, comms.packet_contents.request); //send ACK back
-    } 
+    }
+
+    //Frames are handled here, so RATE requests and their ACKs are too
+    #ifdef ADAPTIVE_RATE
+      if (millis() - last_rate_adapt >= RATE_INTERVAL){
+        last_rate_adapt = millis();
+        comms.adapt_rate();
+      }
+    #endif
 
     comms.rf95 -> setModeRx(); //Put back into Rx mode after responding
     
     #ifdef IDLE_ENABLED
-      power_management_parameters.last_activity = millis();
+      if (woken) power_management_parameters.last_activity = millis(); //Not for a timed wake-up with nothing received
     #endif
 
     #if defined(DEBUG) && defined(TASK_LOGGING)
@@ -262,6 +317,19 @@ void rx_task(void *pvParameters) {
 
 }
 
+//Name: beacon_task
+//Purpose: FreeRTOS task that broadcasts a beacon every superframe, giving the other devices the time their slots start
+//         from and the light state (see SLOTTED_MAC).
+//Inputs: None
+//Outputs: None
+void beacon_task(void *pvParameters) {
+  TickType_t last_wake = xTaskGetTickCount();
+  while(1){
+    vTaskDelayUntil(&last_wake, pdMS_TO_TICKS(APOL_SUPERFRAME));
+    comms.send_beacon();
+  }
+}
+
 //Name: button_task
 //Purpose: FreeRTOS task that handles button inputs (unsuspended by GPIO ISRs).
 //Inputs: None
@@ -408,6 +476,7 @@ void light_control_task(void *pvParameters) {
         } while ((override_flag == 1) && (millis() < override_end_time)); 
         digitalWrite(RED_LIGHT_PIN, LOW);
         override_flag = 0;
+        if (light_state.override) update_light_state(0, 0, 0, 0, 0); //Timed out (an OVERRIDE_STOP has already cleared it)
         #ifdef IDLE_ENABLED
         power_management_parameters.last_activity = millis();
         vTaskResume(power_management_task_handle);
@@ -426,10 +495,7 @@ void light_control_task(void *pvParameters) {
         } while ( (millis() < pulse_end_time) && (light_parameters.pulse_active == 1));
         if (light_parameters.pulse_active == 1 || light_parameters.requested_mode == RED)
         digitalWrite(GREEN_LIGHT_PIN,  LOW);
-        if (light_parameters.pulse_active == 1){ 
-          comms.send_packet(GREEN_PULSE, HHD, NO_PAYLOAD);
-          comms.rf95 -> setModeRx();
-        }
+        if (light_parameters.pulse_active == 1) update_light_state(0, 0, 0, light_state.override, light_state.end_time); //The HHD sees the pulse end in its next ACK
         //If the pulse was externally interrupted, do not suspend the task and handle the new request.
         if (light_parameters.pulse_active == 1){
           light_parameters.pulse_active = 0;
@@ -453,6 +519,24 @@ void light_control_task(void *pvParameters) {
 }
 
 
+//Name: update_light_state
+//Purpose: Sets the light state vector that every ACK reports, moving its version on if anything changed.
+//Inputs: green, red, pulse, override, end_time (millis() when the pulse or override ends)
+//Outputs: true if the state changed
+bool update_light_state(bool green, bool red, bool pulse, bool override, unsigned long end_time) {
+  bool changed;
+  taskENTER_CRITICAL();
+  changed = (light_state.green != green) || (light_state.red != red) || (light_state.pulse != pulse) || (light_state.override != override);
+  light_state.green = green;
+  light_state.red = red;
+  light_state.pulse = pulse;
+  light_state.override = override;
+  light_state.end_time = end_time;
+  if (changed && ++light_state.version == 0) light_state.version = 1;
+  taskEXIT_CRITICAL();
+  return changed;
+}
+
 //Name: power_management_task
 //Purpose: Monitors when device is being used and when it isn't. When device not in use, turn off display and put system into deepsleep.
 //Inputs: None
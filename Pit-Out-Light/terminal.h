@@ -25,7 +25,7 @@ bool trigger_flag = 0;
 char input_buffer [MAX_BUFFER_SIZE] = {0};
 int buffer_pos;
 
-subsystem term_destination_device = HHD; //default is POL
+uint8_t term_destination_device = APOL_ADDRESS(HHD, PIT_BOX, 0); //default is POL
 request_type term_request_type = NONE;
 uint8_t term_request_payload = 0; 
 uint8_t current_tx_power = 20; //default
@@ -135,21 +135,21 @@ void argument_mapping(char * arguments[MAX_ARGS], uint8_t num_args){
           format_terminal_for_new_entry();
           serial.print("Destination set to Handheld Device.\n");
           format_new_terminal_entry();
-          term_destination_device = HHD;
+          term_destination_device = APOL_ADDRESS(HHD, PIT_BOX, 0);
         } 
         
         else if (0 == strcmp(arguments[2], "POL")){ 
           format_terminal_for_new_entry();
           serial.print("Destination set to Pit Out Light.\n");
           format_new_terminal_entry();
-          term_destination_device = POL;
+          term_destination_device = APOL_ADDRESS(POL, PIT_BOX, 0);
         } 
         
         else if (0 == strcmp(arguments[2], "VDD")){
           format_terminal_for_new_entry();
           serial.print("Destination set to Vehicle Deteciton Device.\n");
           format_new_terminal_entry();
-          term_destination_device = VDD;
+          term_destination_device = APOL_ADDRESS(VDD, PIT_BOX, 0);
         }
         
         else{
@@ -213,7 +213,7 @@ void argument_mapping(char * arguments[MAX_ARGS], uint8_t num_args){
           
           bool arg_found = 0;
 
-          for(int request = 0; lessThan(request , NUM_REQUEST_TYPES) ; request++){ // Code to execute if request is less than NUM_REQUEST_TYPES (compiler is doing stupid shit again)
+          for(int request = 0; lessThan(request , APOL_NUM_APP_REQUESTS) ; request++){ // Code to execute if request is less than APOL_NUM_APP_REQUESTS (compiler is doing stupid shit again)
 
             if (0 == strcmp(arguments[2], comms.request_strings[request])){
               term_request_type = (request_type) request;
@@ -238,11 +238,18 @@ void argument_mapping(char * arguments[MAX_ARGS], uint8_t num_args){
       
       else if (0 == strcmp(arguments[1], "status")){
         format_terminal_for_new_entry();
-        serial.printf("Destination = %s\n\r", comms.subsystem_strings[term_destination_device]);
+        serial.printf("Destination = %s\n\r", comms.subsystem_strings[APOL_ROLE(term_destination_device)]);
         serial.printf("\033[2KRequest Type = %s\n\r", comms.request_strings[term_request_type]);
         serial.printf("\033[2KPayload = %u\n\r", term_request_payload);
         serial.printf("\033[2KPayload = %u\n\r", term_request_payload);
         serial.printf("\033[2KTransmit power = %u dBm\n\r", current_tx_power);
+        serial.printf("\033[2KRadio ISR max = %lu us, service max = %lu us\n\r", comms.rf95 -> isrMaxMicros(), comms.rf95 -> serviceMaxMicros());
+        serial.printf("\033[2KSPI transactions = %lu (last interrupt %u), writes skipped = %lu\n\r", comms.rf95 -> spiTransactions(), comms.rf95 -> lastServiceSpiTransactions(), comms.rf95 -> spiWritesSkipped());
+        unsigned long tx_airtime = comms.rf95 -> txAirtime(), rx_airtime = comms.rf95 -> rxAirtime();
+        unsigned long channel_use = (tx_airtime + rx_airtime) / max(millis() / 1000, 1UL); //ms per s, ie per mille
+        serial.printf("\033[2KAirtime: tx = %lu ms, rx = %lu ms, channel use since start up = %lu.%lu%%\n\r", tx_airtime, rx_airtime, channel_use / 10, channel_use % 10);
+        serial.printf("\033[2KChannel busy before send (CAD) = %lu\n\r", (unsigned long)comms.rf95 -> cadBusy());
+        serial.printf("\033[2KRadio charge since start up = %lu uAh (energy model)\n\r", (unsigned long)comms.radio_charge());
         format_new_terminal_entry();
       } 
 
@@ -337,7 +344,7 @@ void argument_mapping(char * arguments[MAX_ARGS], uint8_t num_args){
           serial.printf("Packet #%d sent.\n\r", packet_idx, NUM_PERSISTENT_LINES + 1);
           format_new_terminal_entry();
 
-          delay(50);
+          delay(comms.retransmit_timeout(term_destination_device)); //Time for the ACK to come back
 
           int attempts = 0;
           do {
@@ -356,7 +363,7 @@ void argument_mapping(char * arguments[MAX_ARGS], uint8_t num_args){
             comms.send_packet(NONE, term_destination_device, packet_idx);
             comms.rf95 -> setModeRx();
 
-            delay(50);
+            delay(comms.retransmit_timeout(term_destination_device)); //Time for the ACK to come back
 
             attempts++;
 
@@ -433,7 +440,7 @@ void argument_mapping(char * arguments[MAX_ARGS], uint8_t num_args){
 
         trigger_flag = 1;
         comms.packet_contents.request = OVERRIDE_START;
-        vTaskResume(rx_task_handle);
+        xTaskNotifyGive(rx_task_handle);
         
 
       }
@@ -447,7 +454,7 @@ void argument_mapping(char * arguments[MAX_ARGS], uint8_t num_args){
         trigger_flag = 1;
         comms.packet_contents.request = RED;
         comms.packet_contents.payload = digitalRead(RED_LIGHT_PIN) ^ 1;
-        vTaskResume(rx_task_handle);
+        xTaskNotifyGive(rx_task_handle);
       }
 
       else if (0 == strcmp(arguments[1], "green")){
@@ -459,7 +466,7 @@ void argument_mapping(char * arguments[MAX_ARGS], uint8_t num_args){
         trigger_flag = 1;
         comms.packet_contents.request = GREEN;
         comms.packet_contents.payload = digitalRead(GREEN_LIGHT_PIN) ^ 1;
-        vTaskResume(rx_task_handle);
+        xTaskNotifyGive(rx_task_handle);
 
       }
       
@@ -1,4 +1,9 @@
+//Addressing (see APOL_ADDRESS): the pit box this VDD watches
+#define PIT_BOX 0 //0-7, as on the box's POL and handhelds
+#define POL_ADDRESS APOL_ADDRESS(POL, PIT_BOX, 0)
+
 #include <APOL_Comms_Lib.h>
+#include <APOL_Request_Queue.h>
 #include <Seeed_Arduino_FreeRTOS.h>
 #include "GPIO.h"
 #include "terminal.h"
@@ -6,13 +11,25 @@
 
 #define DEBUG //define to enable serial print statements
 #define RF_ENABLED
+// #define ADAPTIVE_RATE //define to adapt the data rate and TX power of each link to its SNR (must match on every device, the repeater only relays frames sent at the base rate)
+// #define SLOTTED_MAC //define to send in the time slot set by the POL's beacon, overrides may also use the contention slot (must match on every device)
+// #define LOW_POWER_LISTEN //define to keep the radio asleep, waking it every listen interval (APOL_LPL_INTERVAL_VDD ms) to check for a preamble (must match on every device)
+// #define MESH //define to find routes through the repeaters and have only the repeaters on a route forward its frames (must match on every device)
 // #define TASK_LOGGING //define to enable task entry and exit logging
 
+#if defined(SLOTTED_MAC) && defined(ADAPTIVE_RATE)
+  #error "SLOTTED_MAC slots are sized for the base rate, and beacons are only heard at it: define one of SLOTTED_MAC and ADAPTIVE_RATE"
+#endif
+#if defined(SLOTTED_MAC) && defined(LOW_POWER_LISTEN)
+  #error "Wake-up preambles do not fit in a SLOTTED_MAC slot: define one of SLOTTED_MAC and LOW_POWER_LISTEN"
+#endif
+
 #define DURATION_MAX 10
 #define DURATION_MIN 0
 #define BAUD_RATE 115200
 #define MAX_QUEUED_REQUESTS 5 //halved to try to try and fix loss of comms issue due to too many items in queue
 #define MAX_TRANSMIT_ATTEMPTS 5
+#define RATE_INTERVAL 1000 //How often the data rate is adapted (ms), see ADAPTIVE_RATE
 #define IDLE_START_MILLISECONDS 10000 //Stay active for 10 seconds
 
 extern RH_RF95 rf95;
@@ -21,7 +38,6 @@ extern volatile _Bool down_button_flag;
 
 typedef struct {
   request_type current_request;
-  request_type ack_context;
   uint32_t current_payload;
   bool ack_flag;
 } request_handler_t; 
\ No newline at end of file
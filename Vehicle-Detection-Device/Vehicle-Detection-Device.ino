@@ -6,13 +6,13 @@ TaskHandle_t rx_task_handle;
 TaskHandle_t terminal_task_handle;
 TaskHandle_t request_task_handle;
 TaskHandle_t power_management_task_handle;
+TaskHandle_t listen_task_handle;
 
 //Comms stack
-APOL_Comms_Lib comms(VDD, &rx_task_handle);
+APOL_Comms_Lib comms(APOL_ADDRESS(VDD, PIT_BOX, 0), &rx_task_handle);
 
 //Queues
-QueueHandle_t request_queue;
-QueueHandle_t payload_queue;
+APOL_Request_Queue request_queue(MAX_QUEUED_REQUESTS); //Requests waiting for the send window, overrides and RED first
 
 request_handler_t request_handler_params;
 
@@ -28,6 +28,7 @@ power_management_parameters_t power_management_parameters;
 
 //Global vars
 uint32_t vehicle_detections = 0;
+uint32_t last_rate_adapt; //millis() when the data rate was last adapted (see ADAPTIVE_RATE)
 
 #ifdef UART
   Uart & serial = Serial1;
@@ -67,6 +68,24 @@ void setup() {
     comms.begin();
     comms.rf95 -> setModeRx(); //Start in Rx Mode
     comms.rf95 -> setTxPower(20); //Set to max power (VDD far away from everything else)
+    #ifdef ADAPTIVE_RATE
+      comms.enable_rate_adaptation(0, 20); //Nothing sends requests to the VDD, so it listens at the base rate and follows the POL's
+    #endif
+    #ifdef MESH
+      comms.enable_mesh(true);
+    #endif
+    #ifdef SLOTTED_MAC
+      comms.enable_slotted_mac(true);
+    #endif
+    #ifdef LOW_POWER_LISTEN
+      comms.enable_low_power_listen(true, 20);
+      xTaskCreate(listen_task, // Task function
+                "LISTEN", // Task name
+                128, // Stack size 
+                NULL, 
+                3, // Priority
+                &listen_task_handle); // Task handler
+    #endif
 
     xTaskCreate(rx_task, // Task function
               "RX HANDLER", // Task name
@@ -92,8 +111,6 @@ void setup() {
   //           3, // Priority
   //           &power_management_task_handle); // Task handler
 
-  request_queue = xQueueCreate(MAX_QUEUED_REQUESTS, sizeof(request_type));
-  payload_queue = xQueueCreate(MAX_QUEUED_REQUESTS, sizeof(uint32_t));
 
   //Start tasks
   vTaskStartScheduler();
@@ -108,7 +125,11 @@ void loop() {
 void rx_task(void *pvParameters) {
   while(1){
     
-    vTaskSuspend(rx_task_handle);
+    #ifdef ADAPTIVE_RATE
+      ulTaskNotifyTake(pdTRUE, RATE_INTERVAL); //Woken by the radio driver when a frame is queued, or in time to adapt the rate
+    #else
+      ulTaskNotifyTake(pdTRUE, portMAX_DELAY); //Woken by the radio driver when a frame is queued
+    #endif
 
     #ifdef DEBUG
       xSemaphoreTake(uart_mutex, portMAX_DELAY);
@@ -120,21 +141,32 @@ void rx_task(void *pvParameters) {
       format_new_terminal_entry();
     #endif
 
-    if(comms.check_for_packet() && comms.packet_contents.target_device == VDD){
-      switch(comms.packet_contents.request){
-        case ACK:
-          #ifdef DEBUG
-            format_terminal_for_new_entry();
-            serial.printf("Ack received = %d & Ack context = %d. (for reference GREEN is %d).\n", comms.packet_contents.payload, request_handler_params.ack_context, GREEN);
-            format_new_terminal_entry();
-          #endif
-          if (comms.packet_contents.payload == request_handler_params.ack_context) request_handler_params.ack_flag = 0;
-          break;
+    //Handle every frame the driver has queued, not just the one that woke this task
+    while (comms.rf95 -> rxPending() > 0){
+      if(comms.check_for_packet()){
+        switch(comms.packet_contents.request){
+          case ACK:
+            #ifdef DEBUG
+              format_terminal_for_new_entry();
+              serial.printf("Ack received = %d. (for reference GREEN is %d).\n", comms.packet_contents.payload, GREEN);
+              format_new_terminal_entry();
+            #endif
+            if (comms.handle_ack(&comms.packet_contents)) request_handler_params.ack_flag = comms.requests_outstanding(POL_ADDRESS) > 0; //Cumulative ACK for the send window
+            break;
         
-        default:
-          break;
+          default:
+            break;
+        }
       }
-    } 
+    }
+
+    //Frames are handled here, so RATE requests and their ACKs are too
+    #ifdef ADAPTIVE_RATE
+      if (millis() - last_rate_adapt >= RATE_INTERVAL){
+        last_rate_adapt = millis();
+        comms.adapt_rate();
+      }
+    #endif
 
     comms.rf95 -> setModeRx(); //Put back into Rx mode after responding
     
@@ -177,8 +209,7 @@ void override_task(void *pvParameters) {
 
       vehicle_detections++;
       
-      xQueueSend(request_queue, &override, 0);
-      xQueueSend(payload_queue, &no_payload, 0);
+      request_queue.send(override, POL_ADDRESS, no_payload); //Overrides jump ahead of anything else queued
 
       vTaskResume(request_task_handle);
     }
@@ -218,42 +249,38 @@ void request_handler_task(void *pvParameters) {
       format_new_terminal_entry();
     #endif
 
-    while (uxQueueMessagesWaiting(request_queue) > 0){
-      xQueueReceive(request_queue, &(params -> current_request), 0);
-      xQueueReceive(payload_queue, &(params -> current_payload), 0);
+    while (request_queue.count() > 0 || comms.requests_outstanding(POL_ADDRESS) > 0){
+
+      //Move as many queued requests into the send window as it has room for
+      request_record record;
+      while (comms.window_space(POL_ADDRESS) > 0 && request_queue.receive(&record)){
+        params -> current_request = record.request;
+        params -> current_payload = record.payload;
+        comms.queue_request(record.request, POL_ADDRESS, record.payload);
+
+        //The ack flag stays set until the window is empty
+        params -> ack_flag = true;
+      }
 
-      //Set the context to match the current request
-      //Set the ack flag and keep sending the request until an acknowledgement is received that matches the current context 
-      params -> ack_context = params -> current_request;
-      params -> ack_flag = true;
       #ifdef DEBUG
         format_terminal_for_new_entry();
-        serial.printf("Ack context was set to %d.\n\r", params -> current_request);
-        serial.printf("Ack context is actually %d.\n", params -> ack_context);
+        serial.printf("Trying to send %d packets.\n", comms.requests_outstanding(POL_ADDRESS));
         format_new_terminal_entry();
+        xSemaphoreGive(uart_mutex);
       #endif
-
-      int attempts = 0;
+      //Everything not sent yet goes out as one burst that the POL acknowledges once. After a timeout or a partial ACK
+      //that is everything from the oldest unacknowledged request on
+      comms.flush_requests(POL_ADDRESS);
+      comms.rf95 -> setModeRx();
       
-      do {
-          #ifdef DEBUG
-            format_terminal_for_new_entry();
-            serial.print("Trying to send a new packet.\n");
-            format_new_terminal_entry();
-            xSemaphoreGive(uart_mutex);
-          #endif
-          comms.send_packet(params -> current_request, POL, params -> current_payload);
-          comms.rf95 -> setModeRx();
-          
-          vTaskDelay(50);
-          
-          attempts++;
-          xSemaphoreTake(uart_mutex, portMAX_DELAY);
-      } while (params -> ack_flag); //continuously send
-
+      //Sleep until an ACK moves the window, or for the timeout worked out from measured round trips.
+      //Detections are never given up on, the timeout backs off up to APOL_RTO_MAX
+      comms.wait_for_ack(POL_ADDRESS);
+      
+      xSemaphoreTake(uart_mutex, portMAX_DELAY);
     }
-    
-    params -> ack_context = NONE;
+
+    params -> ack_flag = false;
     
     #if defined(DEBUG) && defined(TASK_LOGGING)
       format_terminal_for_new_entry();
@@ -266,6 +293,18 @@ void request_handler_task(void *pvParameters) {
   }
 }
 
+//Name: listen_task
+//Purpose: FreeRTOS task for low power listening: every listen interval, checks for a preamble and puts the radio to sleep
+//         if there is none and nothing is expected (see LOW_POWER_LISTEN).
+//Inputs: None
+//Outputs: None
+void listen_task(void *pvParameters) {
+  while(1){
+    vTaskDelay(comms.listen_interval(VDD));
+    comms.sniff();
+  }
+}
+
 //Name: power_management_task
 //Purpose: Monitors when device is being used and when it isn't. When device not in use, turn off display and put system into deepsleep.
 //Inputs: None
@@ -1,4 +1,5 @@
 #include <APOL_Comms_Lib.h>
+#include <APOL_Request_Queue.h>
 #include "GPIO.h"
 
 #define MAX_BUFFER_SIZE (100)
@@ -7,6 +8,7 @@
 
 //global vars
 extern APOL_Comms_Lib comms;
+extern APOL_Request_Queue request_queue;
 extern TaskHandle_t ping_task_handle;
 extern TaskHandle_t rx_task_handle;
 extern TaskHandle_t button_task_handle;
@@ -25,7 +27,7 @@ bool trigger_flag = 0;
 char input_buffer [MAX_BUFFER_SIZE] = {0};
 int buffer_pos;
 
-subsystem term_destination_device = POL; //default is POL
+uint8_t term_destination_device = APOL_ADDRESS(POL, PIT_BOX, 0); //default is POL
 request_type term_request_type = NONE;
 uint8_t term_request_payload = 0; 
 uint8_t current_tx_power = 20; //default
@@ -135,21 +137,21 @@ void argument_mapping(char * arguments[MAX_ARGS], uint8_t num_args){
           format_terminal_for_new_entry();
           serial.print("Destination set to Handheld Device.\n");
           format_new_terminal_entry();
-          term_destination_device = HHD;
+          term_destination_device = APOL_ADDRESS(HHD, PIT_BOX, 0);
         } 
         
         else if (0 == strcmp(arguments[2], "POL")){ 
           format_terminal_for_new_entry();
           serial.print("Destination set to Pit Out Light.\n");
           format_new_terminal_entry();
-          term_destination_device = POL;
+          term_destination_device = APOL_ADDRESS(POL, PIT_BOX, 0);
         } 
         
         else if (0 == strcmp(arguments[2], "VDD")){
           format_terminal_for_new_entry();
           serial.print("Destination set to Vehicle Deteciton Device.\n");
           format_new_terminal_entry();
-          term_destination_device = VDD;
+          term_destination_device = APOL_ADDRESS(VDD, PIT_BOX, 0);
         }
         
         else{
@@ -213,7 +215,7 @@ void argument_mapping(char * arguments[MAX_ARGS], uint8_t num_args){
           
           bool arg_found = 0;
 
-          for(int request = 0; lessThan(request , NUM_REQUEST_TYPES) ; request++){ // Code to execute if request is less than NUM_REQUEST_TYPES (compiler is doing stupid shit again)
+          for(int request = 0; lessThan(request , APOL_NUM_APP_REQUESTS) ; request++){ // Code to execute if request is less than APOL_NUM_APP_REQUESTS (compiler is doing stupid shit again)
 
             if (0 == strcmp(arguments[2], comms.request_strings[request])){
               term_request_type = (request_type) request;
@@ -238,11 +240,21 @@ void argument_mapping(char * arguments[MAX_ARGS], uint8_t num_args){
       
       else if (0 == strcmp(arguments[1], "status")){
         format_terminal_for_new_entry();
-        serial.printf("Destination = %s\n\r", comms.subsystem_strings[term_destination_device]);
+        serial.printf("Destination = %s\n\r", comms.subsystem_strings[APOL_ROLE(term_destination_device)]);
         serial.printf("\033[2KRequest Type = %s\n\r", comms.request_strings[term_request_type]);
         serial.printf("\033[2KPayload = %u\n\r", term_request_payload);
         serial.printf("\033[2KPayload = %u\n\r", term_request_payload);
         serial.printf("\033[2KTransmit power = %u dBm\n\r", current_tx_power);
+        serial.printf("\033[2KRadio ISR max = %lu us, service max = %lu us\n\r", comms.rf95 -> isrMaxMicros(), comms.rf95 -> serviceMaxMicros());
+        serial.printf("\033[2KSPI transactions = %lu (last interrupt %u), writes skipped = %lu\n\r", comms.rf95 -> spiTransactions(), comms.rf95 -> lastServiceSpiTransactions(), comms.rf95 -> spiWritesSkipped());
+        unsigned long tx_airtime = comms.rf95 -> txAirtime(), rx_airtime = comms.rf95 -> rxAirtime();
+        unsigned long channel_use = (tx_airtime + rx_airtime) / max(millis() / 1000, 1UL); //ms per s, ie per mille
+        serial.printf("\033[2KAirtime: tx = %lu ms, rx = %lu ms, channel use since start up = %lu.%lu%%\n\r", tx_airtime, rx_airtime, channel_use / 10, channel_use % 10);
+        serial.printf("\033[2KChannel busy before send (CAD) = %lu\n\r", (unsigned long)comms.rf95 -> cadBusy());
+        serial.printf("\033[2KRadio charge since start up = %lu uAh (energy model)\n\r", (unsigned long)comms.radio_charge());
+        serial.printf("\033[2KAirtime resent to POL = %lu ms (%lu%% of tx)\n\r", (unsigned long)(comms.link(POL_ADDRESS) -> resent_airtime / 1000), tx_airtime ? (unsigned long)(comms.link(POL_ADDRESS) -> resent_airtime / 10 / tx_airtime) : 0UL);
+        serial.printf("\033[2KLink to POL: srtt = %lu ms, rttvar = %lu ms, rto = %lu ms, retransmissions = %u\n\r", (unsigned long)(comms.link(POL_ADDRESS) -> srtt >> 3), (unsigned long)(comms.link(POL_ADDRESS) -> rttvar >> 2), (unsigned long)comms.link(POL_ADDRESS) -> rto, comms.link(POL_ADDRESS) -> retransmissions);
+        serial.printf("\033[2KRequest queue: waiting = %u, high water = %u, dropped = %u override %u safety %u normal, superseded = %u, coalesced = %u\n\r", request_queue.count(), request_queue.high_water(), request_queue.drops(PRIORITY_OVERRIDE), request_queue.drops(PRIORITY_SAFETY), request_queue.drops(PRIORITY_NORMAL), request_queue.superseded(), request_queue.coalesced());
         format_new_terminal_entry();
       } 
 
@@ -3,10 +3,72 @@
 constexpr const char* const APOL_Comms_Lib::request_strings[];
 constexpr const char* const APOL_Comms_Lib::subsystem_strings[];
 
-APOL_Comms_Lib::APOL_Comms_Lib(subsystem device_type, TaskHandle_t * rx_task_handle_ptr)
+static_assert(APOL_RTO_INITIAL <= APOL_RTO_MAX, "The first exchange at the base rate does not fit in APOL_RTO_MAX");
+static_assert(APOL_MAX_PEERS <= 8, "_rate_acked has a bit per peer");
+
+//SF7 with CR 4/5, CRC and AGC on, at 125 kHz (the RH_RF95::init() default), 250 kHz and 500 kHz. Floors are the SF7
+//demodulation limit (-7.5 dB) plus 3 dB for each doubling of the bandwidth, since the SNR is referred to 125 kHz.
+const rate_profile APOL_Comms_Lib::rate_profiles[APOL_NUM_RATES] = {
+	{{RH_RF95_BW_125KHZ | RH_RF95_CODING_RATE_4_5, RH_RF95_SPREADING_FACTOR_128CPS | RH_RF95_PAYLOAD_CRC_ON, RH_RF95_AGC_AUTO_ON}, -30},
+	{{RH_RF95_BW_250KHZ | RH_RF95_CODING_RATE_4_5, RH_RF95_SPREADING_FACTOR_128CPS | RH_RF95_PAYLOAD_CRC_ON, RH_RF95_AGC_AUTO_ON}, -18},
+	{{RH_RF95_BW_500KHZ | RH_RF95_CODING_RATE_4_5, RH_RF95_SPREADING_FACTOR_128CPS | RH_RF95_PAYLOAD_CRC_ON, RH_RF95_AGC_AUTO_ON}, -6}
+};
+
+//address is this device's unicast address (see APOL_ADDRESS), a role on its own for member 0 in pit box 0.
+//cs_pin and int_pin default to the Feather M0 RFM95 wiring
+APOL_Comms_Lib::APOL_Comms_Lib(uint8_t address, TaskHandle_t * rx_task_handle_ptr, uint8_t cs_pin, uint8_t int_pin)
 {
-	_device_type = device_type;
-	rf95 = new RH_RF95(RFM95_CS, RFM95_INT, rx_task_handle_ptr);
+	_address = address;
+	_device_type = APOL_ROLE(address);
+	memset(_peer_index, 0, sizeof(_peer_index));
+	_num_peers = 0;
+	_datagram_sequence = 0;
+	memset(_tx_sequence, 0, sizeof(_tx_sequence));
+	memset(_links, 0, sizeof(_links));
+	memset(_rx_expected, 0, sizeof(_rx_expected));
+	memset(_rx_last_request, 0, sizeof(_rx_last_request));
+	memset(_rx_synced, 0, sizeof(_rx_synced));
+	memset(_rx_group_heard, 0, sizeof(_rx_group_heard));
+	_group_count = 0;
+	_group_acked = 0;
+	_group_sequence = 0;
+	_group_task = NULL;
+	memset(_relay_cache, 0, sizeof(_relay_cache));
+	memset(&_relay_stats, 0, sizeof(_relay_stats));
+	memset(_relay_held, 0, sizeof(_relay_held));
+	memset(_neighbours, 0, sizeof(_neighbours));
+	_num_neighbours = 0;
+	memset(_routes, 0, sizeof(_routes));
+	_num_routes = 0;
+	_mesh_enabled = false;
+	_route_sequence = 0;
+	_route_task = NULL;
+	_request_done = NULL;
+	_ack_state = NULL;
+	memset(_rates, 0, sizeof(_rates));
+	memset(_rate_power, 0, sizeof(_rate_power));
+	_rate_enabled = false;
+	_rate_peers = 0;
+	_rate_max_power = 0;
+	_rx_rate = APOL_RATE_BASE;
+	_rate_acked = 0;
+	_rate_asking = APOL_NO_PEER;
+	_slotted = false;
+	_beacon_heard = false;
+	_superframe_start = 0;
+	_beacon_sequence = 0;
+	_lpl_enabled = false;
+	_lpl_power = 20;
+	_lpl_interval[HHD] = APOL_LPL_INTERVAL_HHD;
+	_lpl_interval[POL] = APOL_LPL_INTERVAL_POL;
+	_lpl_interval[VDD] = APOL_LPL_INTERVAL_VDD;
+	memset(_lpl_heard, 0, sizeof(_lpl_heard));
+	_lpl_active = 0;
+	#if defined(APOL_SPI_DMA) && defined(RH_HAVE_SAMD21_DMA)
+		rf95 = new RH_RF95(cs_pin, int_pin, rx_task_handle_ptr, hardware_spi_dma);
+	#else
+		rf95 = new RH_RF95(cs_pin, int_pin, rx_task_handle_ptr);
+	#endif
 }
 
 void APOL_Comms_Lib::begin()
@@ -44,56 +106,2105 @@ void APOL_Comms_Lib::begin()
 		#endif
 	while (1);
 	}
+
+	//Compact frames are addressed through the TO header, so let the driver filter on our own address and the multicasts
+	//for our role and pit box. Legacy frames are sent to the broadcast address and are still accepted.
+	rf95 -> setThisAddress(_address);
+	rf95 -> clearAddressFilter();
+	join_multicast(APOL_MULTICAST(_device_type, APOL_GROUP(_address)), true);
+	join_multicast(APOL_MULTICAST(_device_type, APOL_ANY_GROUP), true);
+	join_multicast(APOL_MULTICAST(APOL_ANY_ROLE, APOL_GROUP(_address)), true);
+
+	//Listen before talk: every send waits for CAD to find the channel clear, backing off in slots while it is busy
+	rf95 -> setCADTimeout(APOL_CAD_TIMEOUT);
+
+	//Forget every peer, so each starts again from find_peer()
+	memset(_peer_index, 0, sizeof(_peer_index));
+	_num_peers = 0;
+	_rate_asking = APOL_NO_PEER;
 	
 }
 
-void APOL_Comms_Lib::send_packet(request_type request, subsystem target_device, uint32_t payload)
+//Name: address
+//Purpose: Gives this device's own unicast address. Addresses let several pit boxes, each with its own POL and VDD, and
+//         several handhelds share the channel. A unicast address is 0GGGMMRR: the role (subsystem) in bits 0-1, a member
+//         number telling devices of the same role in a pit box apart in bits 2-3 and the group (pit box) in bits 4-6, so
+//         member 0 of a role in pit box 0 has the role itself as its address.
+//Inputs: None
+//Outputs: Address (see APOL_ADDRESS)
+uint8_t APOL_Comms_Lib::address()
+{
+	return _address;
+}
+
+//Name: join_multicast
+//Purpose: Starts or stops taking in frames sent to a multicast address, besides those begin() joins (every device of
+//         this role in its pit box, of this role anywhere, and of any role in its pit box). Call after begin().
+//         A multicast address is 1RRRGGGG and takes in every device of a role (APOL_ANY_ROLE for all) in a group
+//         (APOL_ANY_GROUP for all), eg APOL_MULTICAST(POL, 2) is every POL in pit box 2 and APOL_MULTICAST(APOL_ANY_ROLE,
+//         APOL_ANY_GROUP) is the RadioHead broadcast address. The driver drops frames to any other address as soon as it
+//         has read the TO header. Multicast frames are datagrams and are not acknowledged.
+//Inputs: address (see APOL_MULTICAST), join
+//Outputs: None
+void APOL_Comms_Lib::join_multicast(uint8_t address, bool join)
+{
+	if (APOL_IS_MULTICAST(address)) rf95 -> setAddressFilter(address, join);
+}
+
+//Name: find_peer
+//Purpose: Looks up the slot in the peer table (the per-peer arrays) for a device, giving it one if it has none. A new
+//         peer starts with no round trip measured (on the initial timeout, or the airtime floor if that is longer), an
+//         unsynchronised send window, so its receive sequence is reset by the first request, and the base rate at full
+//         power. Once the table is full, the least recently heard peer with nothing in its send window is forgotten to
+//         make room. Safe from any task (including the auto-ACK).
+//Inputs: address (a unicast address)
+//Outputs: Slot, or APOL_NO_PEER for a multicast address or if every peer has requests outstanding
+uint8_t APOL_Comms_Lib::find_peer(uint8_t address)
+{
+	if (APOL_IS_MULTICAST(address)) return APOL_NO_PEER;
+	uint8_t index = _peer_index[address];
+	if (index) return index - 1;
+
+	bool added = false;
+	taskENTER_CRITICAL();
+	uint8_t peer = _peer_index[address] - 1; //Another task may have got in first
+	if (peer == APOL_NO_PEER){
+		if (_num_peers < APOL_MAX_PEERS) peer = _num_peers++;
+		else {
+			for (uint8_t idx = 0; idx < APOL_MAX_PEERS; idx++){
+				if (_links[idx].next != _links[idx].base || idx == _rate_asking) continue;
+				if (peer == APOL_NO_PEER || (long)(_peer_used[idx] - _peer_used[peer]) < 0) peer = idx;
+			}
+			if (peer != APOL_NO_PEER) _peer_index[_peer_address[peer]] = 0;
+		}
+		if (peer != APOL_NO_PEER){
+			unsigned long now = millis();
+			_peer_address[peer] = address;
+			_peer_used[peer] = now;
+			_tx_sequence[peer] = 0;
+			memset(&_links[peer], 0, sizeof(peer_link));
+			_rx_expected[peer] = 0;
+			_rx_last_request[peer] = PING;
+			_rx_synced[peer] = false;
+			_rx_group_heard[peer] = false;
+			memset(&_rates[peer], 0, sizeof(rate_link));
+			_rates[peer].tx_rate = APOL_RATE_BASE;
+			_rates[peer].tx_power = _rate_max_power;
+			_rates[peer].rx_power = _rate_max_power;
+			_rates[peer].heard_time = now;
+			_rate_power[peer] = _rate_max_power;
+			_rate_acked &= ~(1 << peer);
+			_lpl_heard[peer] = 0;
+			_links[peer].rto = APOL_RTO_INITIAL;
+			_peer_index[address] = peer + 1;
+			added = true;
+		}
+	}
+	taskEXIT_CRITICAL();
+	if (added) _links[peer].rto = max(_links[peer].rto, min_rto(peer)); //Reads the radio's settings, so outside the critical section
+	return peer;
+}
+
+//Name: send_packet
+//Purpose: Sends a packet and blocks (without spinning) until the radio reports TX_DONE.
+//Inputs: request, target_device, payload (bits 0-27, see APOL_PAYLOAD_MASK)
+//Outputs: None
+void APOL_Comms_Lib::send_packet(request_type request, uint8_t target_device, uint32_t payload)
+{
+	if (send_packet_async(request, target_device, payload)) rf95 -> waitPacketSent();
+}
+
+//Name: send_packet_async
+//Purpose: Loads a packet into the radio FIFO and starts the transmitter, then returns straight away (after finding a
+//         route to the target, with mesh routing on, and waiting for this device's slot, with the slotted MAC on). The next send waits for this one to finish; call
+//         rf95 -> waitPacketSent() before changing radio mode.
+//Inputs: request, target_device (node or multicast address), payload (bits 0-27, see APOL_PAYLOAD_MASK)
+//Outputs: true if the packet was queued for transmit
+bool APOL_Comms_Lib::send_packet_async(request_type request, uint8_t target_device, uint32_t payload)
+{
+  find_route(target_device);
+  wait_for_slot(1, is_emergency(request));
+  uint8_t peer = find_peer(target_device);
+  uint8_t sequence = peer == APOL_NO_PEER ? _datagram_sequence++ : _tx_sequence[peer]++;
+  return send_frame(request, _address, target_device, payload, sequence);
+}
+
+//Name: send_frame
+//Purpose: Builds a compact frame and starts the transmitter. Does not wait for it to finish. Sender, target, sequence
+//         number and request type ride in the RadioHead header (FROM, TO, ID and FLAGS), and the body only carries the
+//         significant bytes of the payload (0-4 bytes), with the hop count in its top 4 bits.
+//         Requests listen before talk (CAD) first. ACKs go straight out, as the auto-ACKs do, since the peer is waiting for them.
+//Inputs: request, sender_device (FROM header), target_device (TO header), payload (bits 0-27), sequence (ID header), window (APOL_WINDOW_* marker),
+//        settings (modem configuration and power to send with, NULL for the ones the link to the target uses),
+//        prefix and prefix_len (what goes ahead of the payload: the member list of a group command, or the repeaters
+//        listed in a ROUTE frame, see encode_route()), hops (times the frame has been forwarded, with this send)
+//Outputs: true if the packet was queued for transmit
+bool APOL_Comms_Lib::send_frame(request_type request, uint8_t sender_device, uint8_t target_device, uint32_t payload, uint8_t sequence, uint8_t window, const RH_RF95::TxSettings * settings, const uint8_t * prefix, uint8_t prefix_len, uint8_t hops)
+{
+  //Addressing, sequence number, request type and window marker go into the RadioHead header
+  rf95 -> setHeaderTo(target_device);
+  rf95 -> setHeaderFrom(sender_device);
+  rf95 -> setHeaderId(sequence);
+  rf95 -> setHeaderFlags(frame_flags(request, window), 0xFF);
+
+  uint8_t radiopacket[APOL_MAX_BODY_LEN];
+  memcpy(radiopacket, prefix, prefix_len);
+  uint8_t len = prefix_len + encode_payload((payload & APOL_PAYLOAD_MASK) | ((uint32_t)hops << APOL_HOPS_SHIFT), radiopacket + prefix_len);
+  RH_RF95::TxSettings link_settings, wake_settings;
+  if (!settings) settings = tx_settings(target_device, &link_settings);
+  settings = lpl_settings(target_device, settings, &wake_settings);
+  _lpl_active = millis();
+  if (request == ACK){
+    rf95 -> waitPacketSent();
+    return rf95 -> sendWithHeaders(target_device, sender_device, sequence, frame_flags(request, window), radiopacket, len, settings);
+  }
+  return rf95 -> send(radiopacket, len, settings);
+}
+
+//Name: tx_settings
+//Purpose: Works out the modem configuration and power for frames to a peer, with rate adaptation on. Frames to a multicast
+//         address go at full power with the slowest listen rate among the peers it takes in (the base rate if none are known).
+//Inputs: target_device, settings (where to put them)
+//Outputs: settings, or NULL if the radio's own settings (the listen rate at full power) are the right ones
+const RH_RF95::TxSettings * APOL_Comms_Lib::tx_settings(uint8_t target_device, RH_RF95::TxSettings * settings)
 {
-  //Send ping and wait for response
-  uint8_t radiopacket[NUM_FIELDS] = {_device_type, request, target_device, uint8_t(payload), uint8_t(payload >> 8), uint8_t(payload >> 16), uint8_t(payload >> 24)}; //sender device, request type, target device
-  rf95 -> send(radiopacket, NUM_FIELDS);
-  rf95 -> waitPacketSent();
+  if (!_rate_enabled) return NULL;
+  uint8_t rate = APOL_RATE_BASE;
+  int8_t power = _rate_max_power;
+  if (APOL_IS_MULTICAST(target_device)){
+    bool known = false;
+    for (uint8_t peer = 0; peer < _num_peers; peer++){
+      if (!APOL_IN_MULTICAST(target_device, _peer_address[peer])) continue;
+      rate = known ? min(rate, _rates[peer].tx_rate) : _rates[peer].tx_rate;
+      known = true;
+    }
+  }
+  else {
+    uint8_t peer = find_peer(target_device);
+    if (peer == APOL_NO_PEER) return NULL;
+    rate = _rates[peer].tx_rate;
+    power = _rates[peer].tx_power;
+  }
+  if (rate == _rx_rate && power == _rate_max_power) return NULL;
+  settings -> modem = rate_profiles[rate].modem;
+  settings -> power = power;
+  settings -> preamble = 0;
+  return settings;
+}
+
+//Name: frame_flags
+//Purpose: Builds the FLAGS header of a compact frame. APOL does not use RHReliableDatagram, which would otherwise own
+//         the window bits.
+//Inputs: request, window (APOL_WINDOW_* marker)
+//Outputs: FLAGS header
+uint8_t APOL_Comms_Lib::frame_flags(request_type request, uint8_t window)
+{
+  return (window & APOL_FLAGS_WINDOW_MASK) | (APOL_FRAME_VERSION << APOL_FLAGS_VERSION_SHIFT) | (request & APOL_FLAGS_REQUEST_MASK);
+}
+
+//Name: encode_payload
+//Purpose: Writes the significant bytes of a payload into a compact frame body (little endian, 0 to 4 bytes).
+//Inputs: payload, body (room for APOL_MAX_PAYLOAD_LEN bytes)
+//Outputs: Number of bytes written
+uint8_t APOL_Comms_Lib::encode_payload(uint32_t payload, uint8_t * body)
+{
+  uint8_t len = 0;
+  while (payload != 0 && len < APOL_MAX_PAYLOAD_LEN){
+    body[len++] = uint8_t(payload);
+    payload >>= 8;
+  }
+  return len;
+}
+
+//Name: decode_frame
+//Purpose: Fills in a packet from a received frame body (and the RadioHead headers for compact frames). For a group
+//         command, finds this device's reply slot in the member list. For a ROUTE frame, takes in the repeaters it lists.
+//Inputs: headers (TO, FROM, ID and FLAGS, as they come off the air), body (frame body after the RadioHead header),
+//        len (number of bytes in the body), packet (where to put the decoded fields)
+//Outputs: true if the frame was a valid APOL frame
+bool APOL_Comms_Lib::decode_frame(const uint8_t * headers, const uint8_t * body, uint8_t len, packet_fields * packet)
+{
+	uint8_t version = (headers[3] & APOL_FLAGS_VERSION_MASK) >> APOL_FLAGS_VERSION_SHIFT;
+	packet -> auto_ack = APOL_AUTO_ACK_NONE;
+	packet -> reply_slot = APOL_NO_REPLY_SLOT;
+	packet -> route_count = 0;
+
+	if (version == 0){
+		//Legacy frame, everything is in the body
+		if (len < NUM_FIELDS) return 0;
+		packet -> sender_device = body[0];
+		packet -> request = (request_type) (body[1]);
+		packet -> target_device = body[2];
+		packet -> payload = body[3] | (body[4] << 8) | (body[5] << 16) | (body[6] << 24);
+		packet -> sequence = 0;
+		packet -> window = APOL_WINDOW_NONE;
+		packet -> hops = 0;
+		return 1;
+	}
+
+	if (version != APOL_FRAME_VERSION) return 0;
+	if ((headers[3] & APOL_FLAGS_WINDOW_MASK) == APOL_GROUP_COMMAND && APOL_IS_MULTICAST(headers[0])){
+		//Group command: the member list comes ahead of the payload
+		uint8_t count = len ? body[0] : 0;
+		if (count == 0 || count > APOL_GROUP_MAX_MEMBERS || len < 1 + count) return 0;
+		for (uint8_t idx = 0; idx < count; idx++){
+			if (body[1 + idx] == _address) packet -> reply_slot = idx;
+		}
+		body += 1 + count;
+		len -= 1 + count;
+	}
+	else if ((headers[3] & APOL_FLAGS_REQUEST_MASK) == ROUTE){
+		//ROUTE frame: the repeaters it has come through (a request) or goes back through (a reply) come ahead of the payload
+		uint8_t entry_len = (headers[3] & APOL_FLAGS_WINDOW_MASK) == APOL_ROUTE_REPLY ? 1 : 2;
+		uint8_t count = len ? body[0] : 0;
+		if (len == 0 || count > APOL_MAX_HOPS || len < 1 + count * entry_len) return 0;
+		for (uint8_t idx = 0; idx < count; idx++){
+			packet -> route_relays[idx] = body[1 + idx * entry_len];
+			packet -> route_snr[idx] = entry_len == 2 ? (int8_t)body[2 + idx * entry_len] : 0;
+		}
+		packet -> route_count = count;
+		body += 1 + count * entry_len;
+		len -= 1 + count * entry_len;
+	}
+	if (len > APOL_MAX_PAYLOAD_LEN) return 0;
+
+	packet -> sender_device = headers[1];
+	packet -> request = (request_type) (headers[3] & APOL_FLAGS_REQUEST_MASK);
+	packet -> target_device = headers[0];
+	packet -> sequence = headers[2];
+	packet -> window = headers[3] & APOL_FLAGS_WINDOW_MASK;
+	packet -> payload = 0;
+	for (uint8_t idx = len; idx > 0; idx--){
+		packet -> payload = (packet -> payload << 8) | body[idx - 1];
+	}
+	packet -> hops = packet -> payload >> APOL_HOPS_SHIFT;
+	packet -> payload &= APOL_PAYLOAD_MASK;
+	return 1;
+}
+
+//Name: receive_packet
+//Purpose: Decodes the next received frame straight out of the driver's receive buffer (no intermediate copy or stack buffer).
+//Inputs: packet (where to put the decoded fields), any_target (if false, frames addressed to neither this device nor a
+//        multicast it has joined are dropped)
+//Outputs: true if a packet was decoded into packet, and is to be handled (see heard_packet())
+bool APOL_Comms_Lib::receive_packet(packet_fields * packet, bool any_target)
+{
+	const uint8_t * frame;
+	uint8_t len;
 
+	if (!rf95 -> recvViewFrame(&frame, &len)) return 0;
+	bool valid = read_frame(frame, len, packet);
+	rf95 -> recvRelease();
+	return valid && heard_packet(packet, len - RH_RF95_HEADER_LEN, any_target);
+}
+
+//Name: read_frame
+//Purpose: Decodes a frame borrowed from the driver's receive buffer, with what the driver knows about it: what the
+//         auto-ACK did with it, if anything, when it arrived and its signal. Called before the frame is released.
+//Inputs: frame (the frame as recvViewFrame() gives it, starting with the headers), len (including the headers),
+//        packet (where to put the decoded fields)
+//Outputs: true if the frame was decoded into packet
+bool APOL_Comms_Lib::read_frame(const uint8_t * frame, uint8_t len, packet_fields * packet)
+{
+	bool valid = decode_frame(frame, frame + RH_RF95_HEADER_LEN, len - RH_RF95_HEADER_LEN, packet);
+	if (valid) packet -> auto_ack = rf95 -> rxHookResult();
+	packet -> rx_time = rf95 -> lastRxTime();
+	packet -> rssi = rf95 -> lastRssi();
+	packet -> snr = rf95 -> lastSNR();
+	return valid;
+}
+
+//Name: heard_packet
+//Purpose: Does the bookkeeping for a decoded frame and tells whether it is for the application. With rate adaptation on,
+//         the SNR of frames addressed to this device is measured, and RATE requests and their ACKs are handled here and
+//         not given back. A beacon from the POL of this pit box sets the slotted MAC's schedule (and may refresh a route),
+//         and is given back as addressed to this device. ROUTE frames are handled here and only given back to a repeater. A group command is only given back to the members it lists.
+//Inputs: packet (the decoded frame), len (of its body), any_target (as for receive_packet())
+//Outputs: true if the packet is to be handled
+bool APOL_Comms_Lib::heard_packet(packet_fields * packet, uint8_t len, bool any_target)
+{
+	//Whoever sent it is listening for a while, and so are we
+	uint8_t peer = find_peer(packet -> sender_device);
+	if (peer != APOL_NO_PEER){
+		_lpl_heard[peer] = millis();
+		_peer_used[peer] = millis();
+	}
+	_lpl_active = millis();
+
+	//A beacon is for every device in the POL's pit box. A promiscuous receiver (the repeater) is not given it, since relayed it would be late
+	if (packet -> request == BEACON){
+		if (APOL_ROLE(packet -> sender_device) != POL || APOL_GROUP(packet -> sender_device) != APOL_GROUP(_address) || _device_type == POL) return 0;
+		_superframe_start = packet -> rx_time - rf95 -> timeOnAir(len);
+		_beacon_heard = true;
+		packet -> target_device = _address;
+		refresh_routes();
+		return !any_target;
+	}
+
+	//Route discovery is handled here (see enable_mesh()), and only a repeater passes it on
+	if (packet -> request == ROUTE){
+		if (packet -> target_device == _address) route_frame(packet);
+		return any_target;
+	}
+
+	if (_rate_enabled && packet -> target_device == _address && peer != APOL_NO_PEER){
+		if (rate_frame(peer, packet)) return 0;
+		rate_heard(peer, packet -> snr);
+	}
+
+	if (packet -> window == APOL_GROUP_COMMAND && APOL_IS_MULTICAST(packet -> target_device) && packet -> reply_slot == APOL_NO_REPLY_SLOT) return any_target; //Not listed, so answered already or not asked
+	return any_target || for_this_device(packet -> target_device);
+}
+
+//Name: for_this_device
+//Purpose: Tells whether frames to an address are for this device: its own address, or a multicast it has joined.
+//Inputs: target_device (TO address)
+//Outputs: true if it is taken in
+bool APOL_Comms_Lib::for_this_device(uint8_t target_device)
+{
+	return target_device == _address || (APOL_IS_MULTICAST(target_device) && rf95 -> isAddressAccepted(target_device));
 }
 
 _Bool APOL_Comms_Lib::check_for_packet()
 {
-	if (rf95 -> available()){
-		uint8_t buf[RH_RF95_MAX_MESSAGE_LEN];
-		uint8_t len = sizeof(buf);
-		if (rf95 -> recv(buf, &len)) {
-		  
-			//Separate out data
-			packet_contents.sender_device = (subsystem) (buf[0]);
-			packet_contents.request = (request_type) (buf[1]);
-			packet_contents.target_device = (subsystem) (buf[2]);
-			packet_contents.payload = buf[3] | (buf[4] << 8) | (buf[5] << 16) | (buf[6] << 24); 
-		
-		if (packet_contents.target_device == _device_type){ 
+	return receive_packet(&packet_contents);
+}
+
+_Bool APOL_Comms_Lib::check_for_any_packet()
+{
+	return receive_packet(&packet_contents, true);
+}
+
+//Name: queue_request
+//Purpose: Puts a request that the target must acknowledge into the send window for that target, with the next
+//         sequence number. Nothing is sent until flush_requests().
+//Inputs: request, target_device, payload (bits 0-27, see APOL_PAYLOAD_MASK), tag (handed back to the request done handler, eg request_record::tag)
+//Outputs: false if the window is full (wait_for_ack() until it has room), or the target is a multicast address or has no
+//         room in the peer table
+bool APOL_Comms_Lib::queue_request(request_type request, uint8_t target_device, uint32_t payload, uint16_t tag)
+{
+	uint8_t index = find_peer(target_device);
+	if (index == APOL_NO_PEER || window_space(target_device) == 0) return 0;
+	peer_link * peer = &_links[index];
+
+	window_slot * slot = &peer -> window[peer -> next % APOL_WINDOW_SIZE];
+	slot -> request = request;
+	slot -> payload = payload;
+	slot -> tag = tag;
+	slot -> transmissions = 0;
+	peer -> next++;
+	return 1;
+}
+
+//Name: on_request_done
+//Purpose: Sets the function told about each request in a send window once it is acknowledged (from handle_ack(), so
+//         usually the rx task) or abandoned (from abandon_requests()). It should not block.
+//Inputs: handler (NULL for none)
+//Outputs: None
+void APOL_Comms_Lib::on_request_done(request_done_handler handler)
+{
+	_request_done = handler;
+}
+
+//Name: flush_requests
+//Purpose: Sends every request in the window to a target that has not gone out yet (or has been wound back to resend)
+//         as one burst. All but the last frame tell the target to hold its ACK, so the burst is acknowledged once.
+//         Until the target has acknowledged a SYNC request only the oldest request is sent, on its own. With mesh routing
+//         on, first finds a route to the target if it has none. With the slotted MAC on, first waits for a slot with room
+//         for the burst and its ACK. Starts the retransmission timer and blocks until the radio reports TX_DONE for the last frame.
+//Inputs: target_device
+//Outputs: Number of frames sent
+uint8_t APOL_Comms_Lib::flush_requests(uint8_t target_device)
+{
+	uint8_t index = find_peer(target_device);
+	if (index == APOL_NO_PEER) return 0;
+	peer_link * peer = &_links[index];
+	uint8_t end = peer -> next;
+	if (!peer -> synced && peer -> next != peer -> base) end = peer -> base + 1;
+
+	peer -> waiting_task = xTaskGetCurrentTaskHandle();
+	peer -> acked = false;
+
+	bool emergency = false;
+	for (uint8_t sequence = peer -> unsent; sequence != end; sequence++){
+		emergency |= is_emergency(peer -> window[sequence % APOL_WINDOW_SIZE].request);
+	}
+	if (peer -> unsent != end){
+		find_route(target_device);
+		wait_for_slot(end - peer -> unsent, emergency);
+	}
+
+	uint8_t sent = 0;
+	while (peer -> unsent != end){
+		uint8_t sequence = peer -> unsent++;
+		window_slot * slot = &peer -> window[sequence % APOL_WINDOW_SIZE];
+		uint8_t window = !peer -> synced ? APOL_WINDOW_SYNC : (peer -> unsent == end ? APOL_WINDOW_LAST : APOL_WINDOW_MORE);
+
+		bool resend = slot -> transmissions++ > 0;
+		if (resend) peer -> retransmissions++;
+		slot -> sent_time = millis();
+		if (send_frame(slot -> request, _address, target_device, slot -> payload, sequence, window)){
+			if (resend) peer -> resent_airtime += rf95 -> lastTxAirtime();
+			rf95 -> waitPacketSent();
+		}
+		sent++;
+	}
+
+	if (sent) peer -> sent_time = millis();
+	return sent;
+}
+
+//Name: wait_for_ack
+//Purpose: Sleeps until an ACK moves the send window to a target (handle_ack() wakes this task) or the retransmission
+//         timeout runs out. On a timeout everything unacknowledged is wound back to be resent by the next
+//         flush_requests(), and the timeout doubles (up to APOL_RTO_MAX), and it counts against the route to the target.
+//         Without a task to wake (scheduler not running) the radio is polled for the ACK instead.
+//Inputs: target_device
+//Outputs: true if the window moved (or nothing was waiting), false on a timeout
+bool APOL_Comms_Lib::wait_for_ack(uint8_t target_device)
+{
+	uint8_t index = find_peer(target_device);
+	if (index == APOL_NO_PEER) return 1;
+	peer_link * peer = &_links[index];
+	while (!peer -> acked && peer -> unsent != peer -> base){
+		unsigned long elapsed = millis() - peer -> sent_time;
+		if (elapsed >= peer -> rto){
+			peer -> rto = min(peer -> rto * 2, (uint32_t)APOL_RTO_MAX);
+			peer -> unsent = peer -> base;
+			rate_loss(index);
+			route_loss(target_device, true);
+			return 0;
+		}
+		if (peer -> waiting_task) ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(peer -> rto - elapsed));
+		else if (rf95 -> available() && check_for_packet()) handle_ack(&packet_contents);
+	}
+	return 1;
+}
+
+//Name: abandon_requests
+//Purpose: Gives up on every request in the send window to a target. The next request is sent as a SYNC on its own,
+//         so the target does not wait for the abandoned sequence numbers.
+//Inputs: target_device
+//Outputs: None
+void APOL_Comms_Lib::abandon_requests(uint8_t target_device)
+{
+	uint8_t index = find_peer(target_device);
+	if (index == APOL_NO_PEER) return;
+	peer_link * peer = &_links[index];
+	requests_done(peer, peer -> next, false);
+	peer -> unsent = peer -> next;
+	peer -> synced = false;
+}
+
+//Name: window_space
+//Purpose: Gives how many more requests to a target can be queued before the oldest is acknowledged.
+//Inputs: target_device
+//Outputs: Free slots in the send window
+uint8_t APOL_Comms_Lib::window_space(uint8_t target_device)
+{
+	return APOL_WINDOW_SIZE - requests_outstanding(target_device);
+}
+
+//Name: requests_outstanding
+//Purpose: Gives how many requests to a target are queued or sent and not yet acknowledged.
+//Inputs: target_device
+//Outputs: Requests in the send window
+uint8_t APOL_Comms_Lib::requests_outstanding(uint8_t target_device)
+{
+	uint8_t index = find_peer(target_device);
+	if (index == APOL_NO_PEER) return 0;
+	return _links[index].next - _links[index].base;
+}
+
+//Name: handle_ack
+//Purpose: Applies a cumulative ACK to the send window to its sender: every request up to and including the ACK's
+//         sequence number is done. Updates the round trip estimate from the newest of them (unless it was resent) and
+//         wakes the task in wait_for_ack(). If sent requests remain unacknowledged the target dropped or missed them,
+//         so they are wound back to be resent straight away. Stale and duplicate ACKs, and ACKs for datagrams, are ignored.
+//         An ACK to the group command in flight from send_group() marks its sender as having answered.
+//Inputs: ack (a received packet)
+//Outputs: true if it moved the window (or marked a member)
+bool APOL_Comms_Lib::handle_ack(const packet_fields * ack)
+{
+	if (ack -> request != ACK || ack -> window == APOL_WINDOW_NONE) return 0;
+	if (ack -> window == APOL_GROUP_ACK) return handle_group_ack(ack);
+	uint8_t index = find_peer(ack -> sender_device);
+	if (index == APOL_NO_PEER) return 0;
+	peer_link * peer = &_links[index];
+
+	uint8_t count = ack -> sequence + 1 - peer -> base; //Requests this ACK covers
+	if (count == 0 || count > (uint8_t)(peer -> next - peer -> base)) return 0;
+	window_slot * newest = &peer -> window[ack -> sequence % APOL_WINDOW_SIZE];
+	if (newest -> transmissions == 0) return 0; //Not sent yet, so the ACK is from an older window
+
+	if (newest -> transmissions == 1){
+		//Only a request sent once gives an unambiguous round trip
+		int32_t sample = millis() - newest -> sent_time;
+		if (!peer -> measured){
+			peer -> srtt = sample << 3;
+			peer -> rttvar = sample << 1;
+			peer -> measured = true;
+		}
+		else{
+			int32_t error = sample - (int32_t)(peer -> srtt >> 3);
+			peer -> srtt += error;
+			if (error < 0) error = -error;
+			peer -> rttvar += error - (peer -> rttvar >> 2);
+		}
+		peer -> rto = min(max((peer -> srtt >> 3) + peer -> rttvar, min_rto(index)), (uint32_t)APOL_RTO_MAX);
+	}
+	_rates[index].losses = 0;
+	route_loss(ack -> sender_device, false);
+
+	requests_done(peer, peer -> base + count, true);
+	peer -> unsent = peer -> base; //Go-back-N: anything sent after the ACK's sequence number did not arrive in order
+	peer -> synced = true;
+	peer -> acked = true;
+	if (peer -> waiting_task) xTaskNotifyGive(peer -> waiting_task);
+	return 1;
+}
+
+//Name: accept_request
+//Purpose: Decides whether a received request should be acted on. Windowed requests are accepted once each, in the
+//         order they were sent: duplicates (resends after a lost ACK) and requests after a missing one are refused,
+//         and the ACK from send_ack() tells the sender where to resume. A SYNC request (or the first windowed request
+//         from a peer) restarts the expected sequence, so a resent SYNC may be acted on twice. A group command is accepted
+//         unless it has the sequence number of the last one from its sender, within APOL_GROUP_MEMORY (a resend after our ACK
+//         was lost). Datagrams are always accepted. If the auto-ACK already decided, its verdict is given back. A duplicate means our ACK was lost, which counts
+//         against the link for rate adaptation.
+//Inputs: request (a received packet)
+//Outputs: true if the request is new and in order
+bool APOL_Comms_Lib::accept_request(const packet_fields * request)
+{
+	if (request -> auto_ack != APOL_AUTO_ACK_NONE) return request -> auto_ack & APOL_AUTO_ACK_ACCEPTED;
+	if (request -> window == APOL_WINDOW_NONE || request -> request == ACK) return 1;
+	uint8_t peer = find_peer(request -> sender_device);
+	if (peer == APOL_NO_PEER) return 1;
+
+	if (APOL_IS_MULTICAST(request -> target_device)){
+		if (request -> window != APOL_GROUP_COMMAND) return 1;
+		if (_rx_group_heard[peer] && request -> sequence == _rx_group_sequence[peer] && millis() - _rx_group_time[peer] < APOL_GROUP_MEMORY) return 0;
+		_rx_group_sequence[peer] = request -> sequence;
+		_rx_group_time[peer] = millis();
+		_rx_group_heard[peer] = true;
+		return 1;
+	}
+
+	//A request we have already had (even a SYNC, which is acted on again) is being resent because our ACK was lost
+	uint8_t behind = _rx_expected[peer] - request -> sequence;
+	if (_rx_synced[peer] && behind > 0 && behind < 0x80) rate_loss(peer);
+	else if (behind == 0) _rates[peer].losses = 0;
+
+	if (request -> window != APOL_WINDOW_SYNC && _rx_synced[peer] && request -> sequence != _rx_expected[peer]) return 0;
+
+	_rx_expected[peer] = request -> sequence + 1;
+	_rx_last_request[peer] = request -> request;
+	_rx_synced[peer] = true;
+	return 1;
+}
+
+//Name: send_ack
+//Purpose: Acknowledges a received request. A datagram gets an ACK echoing its sequence number. A windowed request gets
+//         a cumulative ACK carrying the newest sequence number accepted in order, but only at the end of a burst: nothing
+//         is sent for a frame that says more follow. The payload is the request type (the last one accepted, if windowed)
+//         and, if set_ack_state() was given one, a snapshot of the light state as it is when the ACK goes out.
+//         A group command gets an ACK echoing its sequence number in this device's reply slot, so this sleeps until the
+//         slot starts, and sends nothing if it has already gone by. Nothing is sent if the auto-ACK already sent it, or for
+//         any other request sent to a multicast address. Blocks until the radio reports TX_DONE.
+//Inputs: request (the received packet being acknowledged)
+//Outputs: None
+void APOL_Comms_Lib::send_ack(const packet_fields * request)
+{
+	if (send_ack_async(request)) rf95 -> waitPacketSent();
+}
+
+//Name: send_ack_async
+//Purpose: As send_ack(), but returns as soon as the transmitter has started.
+//Inputs: request (the received packet being acknowledged)
+//Outputs: true if an ACK was queued for transmit
+bool APOL_Comms_Lib::send_ack_async(const packet_fields * request)
+{
+	uint32_t payload;
+	uint8_t sequence, window;
+	if (request -> auto_ack & APOL_AUTO_ACK_SENT || request -> request == RATE || !ack_fields(request, &payload, &sequence, &window)) return 0;
+	if (window == APOL_GROUP_ACK && !wait_for_reply_slot(request)) return 0;
+	if (_ack_state) payload |= encode_state(_ack_state);
+	return send_frame(ACK, _address, request -> sender_device, payload, sequence, window);
+}
+
+//Name: ack_fields
+//Purpose: Works out the ACK due for a received request (see send_ack()), without the light state snapshot.
+//Inputs: request (the received packet being acknowledged), payload, sequence and window (where to put the ACK's fields)
+//Outputs: false if no ACK is due
+bool APOL_Comms_Lib::ack_fields(const packet_fields * request, uint32_t * payload, uint8_t * sequence, uint8_t * window)
+{
+	if (APOL_IS_MULTICAST(request -> target_device)){
+		if (request -> window != APOL_GROUP_COMMAND || request -> reply_slot == APOL_NO_REPLY_SLOT) return 0;
+		*payload = request -> request;
+		*sequence = request -> sequence;
+		*window = APOL_GROUP_ACK;
+		return 1;
+	}
+	uint8_t peer = find_peer(request -> sender_device);
+	if (request -> window == APOL_WINDOW_NONE || peer == APOL_NO_PEER){
+		*payload = request -> request;
+		*sequence = request -> sequence;
+		*window = APOL_WINDOW_NONE;
+		return 1;
+	}
+	if (request -> window == APOL_WINDOW_MORE || !_rx_synced[peer]) return 0;
+
+	*payload = _rx_last_request[peer];
+	*sequence = _rx_expected[peer] - 1;
+	*window = APOL_WINDOW_LAST;
+	return 1;
+}
+
+//Name: wait_for_reply_slot
+//Purpose: Sleeps until this device's reply slot for a group command starts: APOL_ACK_TURNAROUND after the end of the
+//         frame, then one APOL_GROUP_REPLY_SLOT for each member listed ahead of it.
+//Inputs: request (the received group command)
+//Outputs: false if the slot has already gone by (the sender asks again)
+bool APOL_Comms_Lib::wait_for_reply_slot(const packet_fields * request)
+{
+	unsigned long start = request -> rx_time + (APOL_ACK_TURNAROUND + request -> reply_slot * APOL_GROUP_REPLY_SLOT) * 1000UL;
+	long wait = (long)(start - micros());
+	if (wait < -(long)(APOL_GROUP_REPLY_GUARD * 1000L)) return 0;
+	if (wait > 0){
+		uint32_t ms = (wait + 999) / 1000;
+		if (xTaskGetSchedulerState() == taskSCHEDULER_RUNNING) vTaskDelay(pdMS_TO_TICKS(ms));
+		else delay(ms);
+	}
+	return 1;
+}
+
+//Name: relay_packet
+//Purpose: Cut-through forwarding, eg on a repeater: decodes the next received frame into packet_contents straight out
+//         of the driver's receive buffer, and hands forward_frame() the frame as it came while it is still borrowed.
+//Inputs: None
+//Outputs: true if the frame is held to go on, or was sent on, or an ACK for it was sent
+bool APOL_Comms_Lib::relay_packet()
+{
+	const uint8_t * frame;
+	uint8_t len;
+
+	if (!rf95 -> recvViewFrame(&frame, &len)) return 0;
+	bool relayed = read_frame(frame, len, &packet_contents) && heard_packet(&packet_contents, len - RH_RF95_HEADER_LEN, true) &&
+		forward_frame(&packet_contents, frame, len);
+	rf95 -> recvRelease();
+	return relayed;
+}
+
+//Name: forward_frame
+//Purpose: Takes a received frame to retransmit unchanged (same sender, sequence number, window marker and body), so the
+//         ACK still matches at the original sender, counting the hop. The sender goes into the neighbour table if it was
+//         heard directly. Frames forwarded APOL_MAX_HOPS times already, and copies of a frame forwarded in the last
+//         APOL_RELAY_MEMORY ms or being held, are dropped. A sender's resend of a request whose ACK from the target has
+//         been heard is answered with a copy of that ACK at once. A frame between a pair with a route (see enable_mesh())
+//         goes on at once if this repeater is next on the route, and is dropped if not. Anything else is held (see
+//         APOL_RELAY_HOLD) and goes on from forward_held(), unless the target's ACK shows it is not needed. Beacons and
+//         group commands are not forwarded, as they would arrive late, nor are legacy frames, which have no hop count.
+//         ROUTE frames go to relay_route(). Forwarded frames are remembered by sender, target, sequence number and request
+//         type (see relay_key()) long enough for the copies of the repeaters either side to come back after their waits,
+//         but short of the soonest resend over a repeater, so a resend goes on again unless its ACK has been heard. The
+//         hold covers the frame's airtime and the turnaround of the target and of this repeater: a frame is dropped if
+//         the target's ACK to the sender (the target has it, and the sender hears the ACK too) or another repeater's copy
+//         (it has gone on already) is heard meanwhile. ACKs go on unless the pair is known to be in range of each other.
+//Inputs: packet (the decoded frame), frame and len (the frame as it came, starting with the headers)
+//Outputs: true if the frame is held to go on, or was sent on, or an ACK for it was sent
+bool APOL_Comms_Lib::forward_frame(const packet_fields * packet, const uint8_t * frame, uint8_t len)
+{
+	if (packet -> request == BEACON || (packet -> window == APOL_GROUP_COMMAND && APOL_IS_MULTICAST(packet -> target_device))) return 0;
+	if ((frame[3] & APOL_FLAGS_VERSION_MASK) >> APOL_FLAGS_VERSION_SHIFT != APOL_FRAME_VERSION) return 0;
+	unsigned long now = millis();
+
+	//Heard straight from the sender, so its signal is the sender's own
+	if (packet -> hops == 0){
+		uint8_t slot = find_neighbour(packet -> sender_device, true);
+		_neighbours[slot].rssi = packet -> rssi;
+		_neighbours[slot].snr = packet -> snr;
+		_neighbours[slot].heard = now;
+	}
+	if (packet -> hops >= APOL_MAX_HOPS){
+		_relay_stats.hop_limit++;
+		return 0;
+	}
+	if (packet -> request == ROUTE) return relay_route(packet, frame, len);
+	bool turn;
+	bool routed = route_turn(packet, &turn);
+
+	if (packet -> request == ACK && !APOL_IS_MULTICAST(packet -> target_device)){
+		//The target has the request this ACKs, so a resend of it only needs the ACK
+		if ((packet -> payload & APOL_ACK_REQUEST_MASK) != RATE){
+			uint32_t request_key = relay_key(packet -> target_device, packet -> sender_device, packet -> sequence, packet -> payload & APOL_ACK_REQUEST_MASK);
+			relay_entry * request = relay_lookup(request_key);
+			if (request -> key == request_key){
+				request -> time = now;
+				request -> ack_payload = packet -> payload;
+				request -> ack_window = packet -> window;
+				request -> acked = true;
+			}
+		}
+
+		//The target has the frames still held here, so they are not needed, and the sender is in range of the ACK. Only an
+		//ACK to a frame heard straight from the sender shows the target heard the sender itself. A route says otherwise
+		if (packet -> hops == 0 && !routed){
+			bool direct = false;
+			uint8_t dropped = relay_drop_held(packet -> target_device, packet -> sender_device, packet -> sequence, &direct);
+			if (direct) relay_learn(packet -> target_device, packet -> sender_device, true);
+			if (dropped){
+				_relay_stats.direct += dropped;
+				return 0;
+			}
+		}
+		if (!routed && relay_known(packet -> target_device, packet -> sender_device, true)){
+			_relay_stats.direct++;
+			return 0;
+		}
+	}
+
+	uint32_t key = relay_key(packet -> sender_device, packet -> target_device, packet -> sequence, packet -> request);
+	relay_entry * entry = relay_lookup(key);
+	if (entry -> key == key){
+		unsigned long age = now - entry -> time;
+		if (entry -> acked && packet -> hops == 0 && age < APOL_RELAY_ACK_MEMORY){
+			if (!send_frame(ACK, packet -> target_device, packet -> sender_device, entry -> ack_payload, packet -> sequence, entry -> ack_window, NULL, NULL, 0, 1)) return 0;
+			_relay_stats.answered++;
 			return 1;
-		 }
+		}
+		if (age < APOL_RELAY_MEMORY){
+			_relay_stats.duplicates++;
+			return 0;
+		}
+	}
 
+	//Only the repeaters on a route forward the pair's frames, each in turn, so there is nothing to wait for
+	if (routed){
+		if (turn) return relay_send(packet, frame, len);
+		_relay_stats.off_route++;
+		return 0;
+	}
+
+	//Another repeater's copy of a frame held here has gone on already
+	relay_hold * free_slot = NULL;
+	for (uint8_t idx = 0; idx < APOL_RELAY_HOLD_SLOTS; idx++){
+		relay_hold * held = &_relay_held[idx];
+		if (!held -> used){
+			if (!free_slot) free_slot = held;
+			continue;
 		}
+		if (relay_key(held -> packet.sender_device, held -> packet.target_device, held -> packet.sequence, held -> packet.request) != key) continue;
+		if (packet -> hops > held -> packet.hops) held -> used = false;
+		_relay_stats.duplicates++;
+		return 0;
+	}
+
+	//Requests wait for the target's ACK unless the pair is known to need a repeater. A frame forwarded already may have
+	//been forwarded to where the target hears it, so it always waits
+	bool checking = packet -> request != ACK && !APOL_IS_MULTICAST(packet -> target_device) &&
+		(packet -> hops > 0 || !relay_known(packet -> sender_device, packet -> target_device, false));
+	unsigned long due = now + random(0, APOL_RELAY_JITTER + 1) + (checking ? APOL_RELAY_HOLD : 0);
+
+	//No room to hold it, so it goes on now, from the driver's buffer
+	if (!free_slot || len > sizeof(free_slot -> frame)) return relay_send(packet, frame, len);
+
+	//The frames of a burst all wait for the ACK to the last one
+	for (uint8_t idx = 0; idx < APOL_RELAY_HOLD_SLOTS; idx++){
+		relay_hold * held = &_relay_held[idx];
+		if (held -> used && held -> checking && held -> packet.sender_device == packet -> sender_device && held -> packet.target_device == packet -> target_device &&
+			(long)(due - held -> due) > 0) held -> due = due;
+	}
+	free_slot -> packet = *packet;
+	memcpy(free_slot -> frame, frame, len);
+	free_slot -> len = len;
+	free_slot -> due = due;
+	free_slot -> checking = checking;
+	free_slot -> used = true;
+	return 1;
+}
+
+//Name: forward_held
+//Purpose: Forwards the held frame (see forward_frame()) that has waited longest past its time, if any. Does not wait for
+//         it to go out (see relay_send()). If a frame is arriving it is put back for APOL_RELAY_JITTER, in case that is
+//         another repeater forwarding it. A request that waited for its target's ACK and did not get it shows the pair
+//         needs a repeater: their frames then go on after a random wait of up to APOL_RELAY_JITTER, so that two repeaters
+//         do not both send them, until APOL_NEIGHBOUR_RECHECK has gone by and the next frame is held again to check.
+//Inputs: packet (where to put the frame that was forwarded)
+//Outputs: true if a frame was forwarded
+bool APOL_Comms_Lib::forward_held(packet_fields * packet)
+{
+	unsigned long now = millis();
+	relay_hold * next = NULL;
+	for (uint8_t idx = 0; idx < APOL_RELAY_HOLD_SLOTS; idx++){
+		relay_hold * held = &_relay_held[idx];
+		if (held -> used && (long)(now - held -> due) >= 0 && (!next || (long)(held -> due - next -> due) < 0)) next = held;
+	}
+	if (!next) return 0;
+
+	//Another repeater may be sending it already, so hear that frame out first
+	if (rf95 -> isReceiving()){
+		next -> due = now + APOL_RELAY_JITTER;
+		return 0;
+	}
+	next -> used = false;
+	*packet = next -> packet;
+	if (next -> checking && packet -> hops == 0) relay_learn(packet -> sender_device, packet -> target_device, false);
+	return relay_send(packet, next -> frame, next -> len);
+}
+
+//Name: relay_send
+//Purpose: Sends a frame on as it came, with the hop count at the top of its payload moved on by one, at the settings the
+//         link to its target uses, and remembers it as forwarded.
+//         Does not wait for it to go out: the driver turns the receiver back on from the TX_DONE interrupt.
+//Inputs: packet (the decoded frame), frame and len (the frame as it came, starting with the headers)
+//Outputs: true if the frame was queued for transmit
+bool APOL_Comms_Lib::relay_send(const packet_fields * packet, const uint8_t * frame, uint8_t len)
+{
+	uint32_t key = relay_key(packet -> sender_device, packet -> target_device, packet -> sequence, packet -> request);
+	relay_entry * entry = relay_lookup(key);
+	entry -> key = key;
+	entry -> time = millis();
+	entry -> acked = false;
+
+	//The payload ends the body, so everything ahead of it (headers, member or repeater list) goes on as it is
+	uint8_t sent[RH_RF95_HEADER_LEN + APOL_MAX_BODY_LEN];
+	uint8_t payload_len = encode_payload(packet -> payload | ((uint32_t)packet -> hops << APOL_HOPS_SHIFT), sent);
+	if (len > sizeof(sent) || len < RH_RF95_HEADER_LEN + payload_len) return 0;
+	uint8_t sent_len = len - payload_len;
+	memcpy(sent, frame, sent_len);
+	sent_len += encode_payload(packet -> payload | ((uint32_t)(packet -> hops + 1) << APOL_HOPS_SHIFT), sent + sent_len);
+	RH_RF95::TxSettings link_settings, wake_settings;
+	const RH_RF95::TxSettings * settings = lpl_settings(packet -> target_device, tx_settings(packet -> target_device, &link_settings), &wake_settings);
+	_lpl_active = millis();
+	if (!rf95 -> resend(sent, sent_len, frame[3], settings)) return 0;
+	_relay_stats.forwarded++;
+	return 1;
+}
+
+//Name: forward_wait
+//Purpose: Gives the time until the next held frame is due to go on, for the rx task to wait for frames with.
+//Inputs: None
+//Outputs: Ticks, portMAX_DELAY if nothing is held
+TickType_t APOL_Comms_Lib::forward_wait()
+{
+	unsigned long now = millis();
+	long wait = -1;
+	for (uint8_t idx = 0; idx < APOL_RELAY_HOLD_SLOTS; idx++){
+		if (!_relay_held[idx].used) continue;
+		long left = max((long)(_relay_held[idx].due - now), 0L);
+		if (wait < 0 || left < wait) wait = left;
+	}
+	return wait < 0 ? portMAX_DELAY : pdMS_TO_TICKS(wait);
+}
+
+//Name: relay_drop_held
+//Purpose: Drops the held frames from a sender to a target, once the target has been heard answering it (the ACK is
+//         cumulative, so it covers the frames of a burst ahead of the one it answers).
+//Inputs: sender_device, target_device, sequence (ID header of the ACK), direct (set true if the frame the ACK answers
+//        was among them, as heard straight from the sender)
+//Outputs: Frames dropped
+uint8_t APOL_Comms_Lib::relay_drop_held(uint8_t sender_device, uint8_t target_device, uint8_t sequence, bool * direct)
+{
+	uint8_t dropped = 0;
+	for (uint8_t idx = 0; idx < APOL_RELAY_HOLD_SLOTS; idx++){
+		relay_hold * held = &_relay_held[idx];
+		if (!held -> used || held -> packet.request == ACK || held -> packet.request == ROUTE || held -> packet.sender_device != sender_device || held -> packet.target_device != target_device) continue;
+		if (held -> packet.sequence == sequence && held -> packet.hops == 0) *direct = true;
+		held -> used = false;
+		dropped++;
+	}
+	return dropped;
+}
+
+//Name: find_neighbour
+//Purpose: Looks up the slot in the neighbour table for a device, optionally giving it one if it has none. Once the table
+//         is full the least recently heard device is forgotten, along with what is known about its frames to the others.
+//Inputs: address (a unicast address), add (give it a slot if it has none)
+//Outputs: Slot, or APOL_NO_NEIGHBOUR if it has none
+uint8_t APOL_Comms_Lib::find_neighbour(uint8_t address, bool add)
+{
+	uint8_t slot = APOL_NO_NEIGHBOUR;
+	for (uint8_t idx = 0; idx < _num_neighbours; idx++){
+		if (_neighbours[idx].address == address) return idx;
+		if (slot == APOL_NO_NEIGHBOUR || (long)(_neighbours[idx].heard - _neighbours[slot].heard) < 0) slot = idx;
+	}
+	if (!add) return APOL_NO_NEIGHBOUR;
+
+	if (_num_neighbours < APOL_MAX_NEIGHBOURS) slot = _num_neighbours++;
+	for (uint8_t idx = 0; idx < _num_neighbours; idx++){
+		_neighbours[idx].direct &= ~(1 << slot);
+		_neighbours[idx].relayed &= ~(1 << slot);
+	}
+	memset(&_neighbours[slot], 0, sizeof(neighbour));
+	_neighbours[slot].address = address;
+	_neighbours[slot].heard = millis();
+	return slot;
+}
+
+//Name: relay_learn
+//Purpose: Notes whether a target answers a sender without a repeater, in the target's neighbour table entry, as learnt
+//         from the ACKs a repeater overhears. Nothing is noted unless both are in the table.
+//Inputs: sender_device, target_device, direct (true if the target answered the sender itself, false if a repeater had
+//        to forward the sender's frame)
+//Outputs: None
+void APOL_Comms_Lib::relay_learn(uint8_t sender_device, uint8_t target_device, bool direct)
+{
+	uint8_t sender = find_neighbour(sender_device, false);
+	uint8_t target = find_neighbour(target_device, false);
+	if (sender == APOL_NO_NEIGHBOUR || target == APOL_NO_NEIGHBOUR) return;
+	if (direct){
+		_neighbours[target].direct |= 1 << sender;
+		_neighbours[target].relayed &= ~(1 << sender);
+	}
+	else {
+		_neighbours[target].relayed |= 1 << sender;
+		_neighbours[target].direct &= ~(1 << sender);
+		_neighbours[target].relayed_time = millis();
+	}
+}
+
+//Name: relay_known
+//Purpose: Tells whether a target is known to answer a sender without a repeater, or known to need one (until
+//         APOL_NEIGHBOUR_RECHECK has gone by).
+//Inputs: sender_device, target_device, direct (which to ask)
+//Outputs: true if it is known
+bool APOL_Comms_Lib::relay_known(uint8_t sender_device, uint8_t target_device, bool direct)
+{
+	uint8_t sender = find_neighbour(sender_device, false);
+	uint8_t target = find_neighbour(target_device, false);
+	if (sender == APOL_NO_NEIGHBOUR || target == APOL_NO_NEIGHBOUR) return 0;
+	if (direct) return (_neighbours[target].direct >> sender) & 1;
+	return ((_neighbours[target].relayed >> sender) & 1) && millis() - _neighbours[target].relayed_time < APOL_NEIGHBOUR_RECHECK;
+}
+
+//Name: relay_key
+//Purpose: Builds the key a frame is remembered by in the recently forwarded table. Sequence numbers are counted per peer
+//         (and separately for datagrams and send windows), so the target and request type are part of it.
+//Inputs: sender_device, target_device, sequence, request
+//Outputs: Key, never 0
+uint32_t APOL_Comms_Lib::relay_key(uint8_t sender_device, uint8_t target_device, uint8_t sequence, uint8_t request)
+{
+	return 0x80000000UL | ((uint32_t)sender_device << 20) | ((uint32_t)target_device << 12) | ((uint32_t)sequence << 4) | (request & APOL_FLAGS_REQUEST_MASK);
+}
+
+//Name: relay_lookup
+//Purpose: Finds the entry in the recently forwarded table a key hashes to. The table is direct mapped, so a newer frame
+//         with the same hash takes the entry over.
+//Inputs: key (from relay_key())
+//Outputs: Entry, which holds the key's frame only if its key matches
+relay_entry * APOL_Comms_Lib::relay_lookup(uint32_t key)
+{
+	return &_relay_cache[((key * 2654435761UL) >> 16) & (APOL_RELAY_CACHE_SIZE - 1)];
+}
+
+//Name: relay_counts
+//Purpose: Gives read access to what relay_packet() has done with the frames it was given since start up.
+//Inputs: None
+//Outputs: Counts
+const relay_stats * APOL_Comms_Lib::relay_counts()
+{
+	return &_relay_stats;
+}
+
+//Name: neighbours
+//Purpose: Gives read access to the neighbour table (see forward_frame()).
+//Inputs: count (where to put the number of devices in it)
+//Outputs: Table
+const neighbour * APOL_Comms_Lib::neighbours(uint8_t * count)
+{
+	*count = _num_neighbours;
+	return _neighbours;
+}
+
+//Name: enable_mesh
+//Purpose: Turns mesh routing on or off. Must be the same on every device, repeaters included. With it on, a send to a
+//         target with no route first finds one (see find_route()), and a repeater only forwards the frames of a pair with
+//         a route if it is on it, in turn and straight away. Pairs with no route are relayed as before. Route discovery
+//         follows RHMesh's, but on compact frames: RHMesh runs on RHReliableDatagram, whose hop by hop ACKs and headers
+//         would replace APOL's own. Each repeater passes a ROUTE request on once, listing itself and the SNR it heard it
+//         with (see relay_route()), and the target answers along the best path it has heard rather than the first (see
+//         route_newer()). Routes are not aged, as millis() stops in deep sleep so a device that slept could not tell their
+//         age: one goes after APOL_MESH_ROUTE_LOSSES consecutive ACK timeouts over it (see route_loss()), to make room
+//         (see find_route_slot()), or for a newer discovery. With the slotted MAC on, beacons refresh them (see
+//         refresh_routes()).
+//Inputs: enable
+//Outputs: None
+void APOL_Comms_Lib::enable_mesh(bool enable)
+{
+	_mesh_enabled = enable;
+}
+
+//Name: find_route
+//Purpose: With mesh routing on, makes sure there is a route to a target: if there is none, sends it a ROUTE request and
+//         sleeps until the first reply comes (the rx task hands it over) or APOL_MESH_DISCOVERY_TIMEOUT (the request and
+//         reply over every hop, the repeaters' waits and the target's) runs out, plus the target's listen interval with
+//         low power listening on. Better routes answered later take its place as they come.
+//         Does not ask again within APOL_MESH_RETRY of the last request, so frames go without a route meanwhile. Without a
+//         task to wake (scheduler not running) the radio is polled for the reply instead.
+//Inputs: target_device
+//Outputs: true if there is a route
+bool APOL_Comms_Lib::find_route(uint8_t target_device)
+{
+	if (!_mesh_enabled || APOL_IS_MULTICAST(target_device) || target_device == _address) return 0;
+	uint8_t slot = find_route_slot(_address, target_device, true);
+	if (_routes[slot].count != APOL_NO_ROUTE) return 1;
+	if (millis() - _routes[slot].asked < APOL_MESH_RETRY) return 0;
+
+	_route_task = xTaskGetCurrentTaskHandle();
+	bool found = false;
+	if (send_route_request(slot, target_device, APOL_ROUTE_REQUEST)){
+		uint32_t timeout = APOL_MESH_DISCOVERY_TIMEOUT + (_lpl_enabled ? listen_interval(APOL_ROLE(target_device)) : 0);
+		unsigned long start = millis();
+		while (!found){
+			unsigned long elapsed = millis() - start;
+			if (elapsed >= timeout) break;
+			if (_route_task) ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(timeout - elapsed));
+			else if (rf95 -> available() && check_for_packet()) handle_ack(&packet_contents);
+			slot = find_route_slot(_address, target_device, false);
+			found = slot != APOL_NO_ROUTE && _routes[slot].count != APOL_NO_ROUTE;
+		}
+	}
+	_route_task = NULL;
+	return found;
+}
+
+//Name: send_route_request
+//Purpose: Starts a discovery of the route from this device to a target: sends it a ROUTE request and blocks until the
+//         radio reports TX_DONE, leaving the receiver on for the reply. A new discovery (APOL_ROUTE_REQUEST) drops the route
+//         meanwhile, a refresh (APOL_ROUTE_REFRESH) keeps it in use until the reply.
+//Inputs: slot (in the route table, for this device and the target), target_device, window (APOL_ROUTE_REQUEST or APOL_ROUTE_REFRESH)
+//Outputs: true if the request was sent
+bool APOL_Comms_Lib::send_route_request(uint8_t slot, uint8_t target_device, uint8_t window)
+{
+	mesh_route * route = &_routes[slot];
+	route_orient(route, _address);
+	route -> sequence = _route_sequence++;
+	route -> asked = millis();
+	if (window == APOL_ROUTE_REQUEST) route -> count = APOL_NO_ROUTE;
+	uint8_t prefix[1];
+	uint8_t prefix_len = encode_route(NULL, NULL, 0, prefix); //No repeaters on it yet
+	if (!send_frame(ROUTE, _address, target_device, 0, route -> sequence, window, NULL, prefix, prefix_len)) return 0;
+	rf95 -> waitPacketSent();
+	rf95 -> setModeRx();
+	return 1;
+}
+
+//Name: route_frame
+//Purpose: Handles a ROUTE frame addressed to this device, with mesh routing on. A reply to the discovery this device has
+//         in progress sets the route, if it is the first reply or better than the one set, and wakes the task in
+//         find_route(). A request is answered with a reply back along the path it came, if that is the best path heard
+//         for the discovery so far, which sets the route here too. Sleeps for APOL_MESH_REPLY_WAIT from the request, so
+//         the reply does not collide with the repeaters' copies of the request still going on, then blocks until the radio
+//         reports TX_DONE for the reply.
+//Inputs: packet (the ROUTE frame)
+//Outputs: None
+void APOL_Comms_Lib::route_frame(const packet_fields * packet)
+{
+	if (!_mesh_enabled) return;
+	mesh_route * route;
+
+	if (packet -> window == APOL_ROUTE_REPLY){
+		uint8_t slot = find_route_slot(_address, packet -> sender_device, false);
+		int8_t quality = (int8_t)(packet -> payload & APOL_ROUTE_QUALITY_MASK);
+		if (slot == APOL_NO_ROUTE) return;
+		route = &_routes[slot];
+		if (route -> source != _address || packet -> sequence != route -> sequence || !route_newer(route, _address, packet -> sequence, quality, packet -> route_count)) return;
+		memcpy(route -> relays, packet -> route_relays, packet -> route_count);
+		route -> count = packet -> route_count;
+		route -> quality = quality;
+		route -> found = millis();
+		route -> losses = 0;
+		if (_route_task) xTaskNotifyGive(_route_task);
+		return;
+	}
+
+	//The path the request took, and the link it came to this device over
+	int8_t quality = min(path_quality(packet), link_quality(packet -> snr));
+	route = &_routes[find_route_slot(packet -> sender_device, _address, true)];
+	if (!route_newer(route, packet -> sender_device, packet -> sequence, quality, packet -> route_count)) return;
+	route -> source = packet -> sender_device;
+	route -> target = _address;
+	memcpy(route -> relays, packet -> route_relays, packet -> route_count);
+	route -> count = packet -> route_count;
+	route -> quality = quality;
+	route -> sequence = packet -> sequence;
+	route -> found = millis();
+	route -> losses = 0;
+	long wait = (long)(packet -> rx_time + APOL_MESH_REPLY_WAIT * 1000UL - micros());
+	if (wait > 0){
+		uint32_t ms = (wait + 999) / 1000;
+		if (xTaskGetSchedulerState() == taskSCHEDULER_RUNNING) vTaskDelay(pdMS_TO_TICKS(ms));
+		else delay(ms);
+	}
+	uint8_t prefix[1 + APOL_MAX_HOPS];
+	uint8_t prefix_len = encode_route(route -> relays, NULL, route -> count, prefix);
+	if (send_frame(ROUTE, _address, packet -> sender_device, (uint8_t)quality, packet -> sequence, APOL_ROUTE_REPLY, NULL, prefix, prefix_len)) rf95 -> waitPacketSent();
+	rf95 -> setModeRx();
+}
+
+//Name: relay_route
+//Purpose: Passes ROUTE frames on, on a repeater with mesh routing on. A request goes on with this repeater's address and
+//         the SNR it was heard with added, after the random wait and APOL_MESH_LINK_DELAY for each dB its path is short of
+//         APOL_RATE_MARGIN, unless it lists this repeater already or has gone on from here lately. A better copy heard
+//         while it waits takes its place. A new discovery (not a refresh) has the pair relayed as if it had no route until
+//         the reply. A reply sets the pair's route here, if it is newer or better than the one set, and goes on at once if
+//         this repeater is next on it.
+//Inputs: packet (the decoded frame), frame and len (the frame as it came, starting with the headers)
+//Outputs: true if the frame is held to go on, or was sent on
+bool APOL_Comms_Lib::relay_route(const packet_fields * packet, const uint8_t * frame, uint8_t len)
+{
+	if (!_mesh_enabled) return 0;
+	unsigned long now = millis();
+
+	if (packet -> window == APOL_ROUTE_REPLY){
+		//The reply goes from the target of the discovery back to its source
+		int8_t quality = (int8_t)(packet -> payload & APOL_ROUTE_QUALITY_MASK);
+		mesh_route * route = &_routes[find_route_slot(packet -> target_device, packet -> sender_device, true)];
+		if (!route_newer(route, packet -> target_device, packet -> sequence, quality, packet -> route_count)) return 0;
+		route -> source = packet -> target_device;
+		route -> target = packet -> sender_device;
+		memcpy(route -> relays, packet -> route_relays, packet -> route_count);
+		route -> count = packet -> route_count;
+		route -> quality = quality;
+		route -> sequence = packet -> sequence;
+		route -> found = now;
+		bool turn;
+		if (!route_turn(packet, &turn) || !turn) return 0;
+		return relay_send(packet, frame, len);
+	}
+
+	if (packet -> route_count >= APOL_MAX_HOPS) return 0;
+	for (uint8_t idx = 0; idx < packet -> route_count; idx++){
+		if (packet -> route_relays[idx] == _address) return 0;
+	}
+	uint32_t key = relay_key(packet -> sender_device, packet -> target_device, packet -> sequence, ROUTE);
+	relay_entry * entry = relay_lookup(key);
+	if (entry -> key == key && now - entry -> time < APOL_RELAY_MEMORY){
+		_relay_stats.duplicates++;
+		return 0;
+	}
+
+	//A newer discovery puts the pair's route in doubt until its reply, unless it is a refresh
+	uint8_t slot = find_route_slot(packet -> sender_device, packet -> target_device, false);
+	if (slot != APOL_NO_ROUTE){
+		mesh_route * route = &_routes[slot];
+		if (route -> source != packet -> sender_device || (uint8_t)(packet -> sequence - route -> sequence - 1) < 0x7F){
+			route_orient(route, packet -> sender_device);
+			route -> sequence = packet -> sequence;
+			route -> asked = now;
+			if (packet -> window == APOL_ROUTE_REQUEST) route -> count = APOL_NO_ROUTE;
+		}
+	}
+
+	//The request as it goes on from here
+	packet_fields request = *packet;
+	request.route_relays[request.route_count] = _address;
+	request.route_snr[request.route_count++] = packet -> snr;
+	int8_t quality = path_quality(&request);
+	uint8_t request_frame[RH_RF95_HEADER_LEN + APOL_ROUTE_MAX_BODY_LEN];
+	memcpy(request_frame, frame, RH_RF95_HEADER_LEN);
+	uint8_t request_len = RH_RF95_HEADER_LEN + encode_route(request.route_relays, request.route_snr, request.route_count, request_frame + RH_RF95_HEADER_LEN);
+	request_len += encode_payload(request.payload | ((uint32_t)request.hops << APOL_HOPS_SHIFT), request_frame + request_len);
+
+	relay_hold * free_slot = NULL;
+	for (uint8_t idx = 0; idx < APOL_RELAY_HOLD_SLOTS; idx++){
+		relay_hold * held = &_relay_held[idx];
+		if (!held -> used){
+			if (!free_slot) free_slot = held;
+			continue;
+		}
+		if (relay_key(held -> packet.sender_device, held -> packet.target_device, held -> packet.sequence, held -> packet.request) != key) continue;
+		//A copy that came a better way takes the place of the one held
+		int8_t held_quality = path_quality(&held -> packet);
+		if (quality < held_quality || (quality == held_quality && packet -> hops >= held -> packet.hops)){
+			_relay_stats.duplicates++;
+			return 0;
+		}
+		held -> packet = request;
+		memcpy(held -> frame, request_frame, request_len);
+		held -> len = request_len;
+		return 1;
+	}
+
+	if (!free_slot) return relay_send(&request, request_frame, request_len);
+	free_slot -> packet = request;
+	memcpy(free_slot -> frame, request_frame, request_len);
+	free_slot -> len = request_len;
+	free_slot -> due = now + random(0, APOL_RELAY_JITTER + 1) + (APOL_RATE_MARGIN - max(quality, (int8_t)0)) * APOL_MESH_LINK_DELAY;
+	free_slot -> checking = false;
+	free_slot -> used = true;
+	return 1;
+}
+
+//Name: route_turn
+//Purpose: Looks up the route between a frame's sender and target, on a repeater with mesh routing on, and whether this
+//         repeater is next on it for the frame: the nth repeater from either end forwards the frames that have been
+//         forwarded n - 1 times.
+//Inputs: packet (the decoded frame), turn (set true if it is this repeater's turn)
+//Outputs: true if the pair has a route
+bool APOL_Comms_Lib::route_turn(const packet_fields * packet, bool * turn)
+{
+	*turn = false;
+	if (!_mesh_enabled || APOL_IS_MULTICAST(packet -> target_device)) return 0;
+	uint8_t slot = find_route_slot(packet -> sender_device, packet -> target_device, false);
+	if (slot == APOL_NO_ROUTE || _routes[slot].count == APOL_NO_ROUTE) return 0;
+	const mesh_route * route = &_routes[slot];
+	for (uint8_t idx = 0; idx < route -> count; idx++){
+		if (route -> relays[idx] == _address) *turn = packet -> hops == (packet -> sender_device == route -> source ? idx : route -> count - 1 - idx);
+	}
+	return 1;
+}
+
+//Name: route_loss
+//Purpose: Counts an ACK timeout against the route to a target, dropping it after APOL_MESH_ROUTE_LOSSES in a row so the
+//         next send finds it again. An ACK clears the count.
+//Inputs: target_device, lost (true for a timeout, false for an ACK)
+//Outputs: None
+void APOL_Comms_Lib::route_loss(uint8_t target_device, bool lost)
+{
+	if (!_mesh_enabled) return;
+	uint8_t slot = find_route_slot(_address, target_device, false);
+	if (slot == APOL_NO_ROUTE || _routes[slot].count == APOL_NO_ROUTE) return;
+	mesh_route * route = &_routes[slot];
+	if (!lost) route -> losses = 0;
+	else if (++route -> losses >= APOL_MESH_ROUTE_LOSSES){
+		route -> count = APOL_NO_ROUTE;
+		route -> asked = millis() - APOL_MESH_RETRY; //Ask again straight away
+	}
+}
+
+//Name: refresh_routes
+//Purpose: Called on each beacon sent or heard, with mesh routing on: refreshes the route of this device's that was found
+//         longest ago, once that is APOL_MESH_REFRESH ago and no request for it has gone out within APOL_MESH_RETRY. Blocks
+//         until the radio reports TX_DONE for the request.
+//Inputs: None
+//Outputs: None
+void APOL_Comms_Lib::refresh_routes()
+{
+	if (!_mesh_enabled) return;
+	unsigned long now = millis();
+	uint8_t oldest = APOL_NO_ROUTE;
+	for (uint8_t idx = 0; idx < _num_routes; idx++){
+		const mesh_route * route = &_routes[idx];
+		if ((route -> source != _address && route -> target != _address) || route -> count == APOL_NO_ROUTE) continue;
+		if (now - route -> found < APOL_MESH_REFRESH || now - route -> asked < APOL_MESH_RETRY) continue;
+		if (oldest == APOL_NO_ROUTE || (long)(route -> found - _routes[oldest].found) < 0) oldest = idx;
+	}
+	if (oldest == APOL_NO_ROUTE) return;
+	send_route_request(oldest, _routes[oldest].source == _address ? _routes[oldest].target : _routes[oldest].source, APOL_ROUTE_REFRESH);
+}
+
+//Name: find_route_slot
+//Purpose: Looks up the slot in the route table for the route between two devices (found by either), optionally giving
+//         it one if it has none. Once the table is full, the route found longest ago is forgotten. A new slot has no route
+//         yet, and may be asked for straight away. Safe from any task.
+//Inputs: device, other_device, add (give them a slot if they have none)
+//Outputs: Slot, or APOL_NO_ROUTE if they have none
+uint8_t APOL_Comms_Lib::find_route_slot(uint8_t device, uint8_t other_device, bool add)
+{
+	uint8_t slot = APOL_NO_ROUTE;
+	taskENTER_CRITICAL();
+	for (uint8_t idx = 0; idx < _num_routes; idx++){
+		const mesh_route * route = &_routes[idx];
+		if ((route -> source == device && route -> target == other_device) || (route -> source == other_device && route -> target == device)){
+			taskEXIT_CRITICAL();
+			return idx;
+		}
+		if (slot == APOL_NO_ROUTE || (long)(route -> found - _routes[slot].found) < 0) slot = idx;
+	}
+	if (!add) slot = APOL_NO_ROUTE;
+	else {
+		unsigned long now = millis();
+		if (_num_routes < APOL_MAX_ROUTES) slot = _num_routes++;
+		memset(&_routes[slot], 0, sizeof(mesh_route));
+		_routes[slot].source = device;
+		_routes[slot].target = other_device;
+		_routes[slot].count = APOL_NO_ROUTE;
+		_routes[slot].found = now;
+		_routes[slot].asked = now - APOL_MESH_RETRY;
+	}
+	taskEXIT_CRITICAL();
+	return slot;
+}
+
+//Name: route_orient
+//Purpose: Turns a route round, if need be, so that it runs from the given end.
+//Inputs: route, source (one of its ends)
+//Outputs: None
+void APOL_Comms_Lib::route_orient(mesh_route * route, uint8_t source)
+{
+	if (route -> source == source) return;
+	route -> target = route -> source;
+	route -> source = source;
+	if (route -> count == APOL_NO_ROUTE) return;
+	for (uint8_t idx = 0; idx < route -> count / 2; idx++){
+		uint8_t relay = route -> relays[idx];
+		route -> relays[idx] = route -> relays[route -> count - 1 - idx];
+		route -> relays[route -> count - 1 - idx] = relay;
+	}
+}
+
+//Name: route_newer
+//Purpose: Decides whether a route found by a discovery should take the place of the one in a slot: it should if the slot
+//         has none, or one found by the other end or an older discovery, or if it is the first answer to a refresh.
+//         Otherwise, for the same discovery, only a better route does: more SNR on its weakest link, then fewer repeaters.
+//Inputs: route (the slot), source (of the discovery), sequence (its ID header), quality and count (of the route it found)
+//Outputs: true if the route found should be taken
+bool APOL_Comms_Lib::route_newer(const mesh_route * route, uint8_t source, uint8_t sequence, int8_t quality, uint8_t count)
+{
+	if (route -> count == APOL_NO_ROUTE || route -> source != source) return 1;
+	uint8_t ahead = sequence - route -> sequence;
+	if (ahead != 0) return ahead < 0x80;
+	if ((long)(route -> found - route -> asked) < 0) return 1;
+	return quality > route -> quality || (quality == route -> quality && count < route -> count);
+}
+
+//Name: link_quality
+//Purpose: Rates a link for mesh routing by the SNR of a frame heard over it: dB above the base rate's demodulation floor,
+//         up to APOL_RATE_MARGIN.
+//Inputs: snr (dB)
+//Outputs: Quality (dB)
+int8_t APOL_Comms_Lib::link_quality(int8_t snr)
+{
+	int16_t margin = (snr * 4 - rate_profiles[APOL_RATE_BASE].floor) / 4;
+	return (int8_t)min(margin, (int16_t)APOL_RATE_MARGIN);
+}
+
+//Name: path_quality
+//Purpose: Rates the path a ROUTE request has taken by its weakest link (see link_quality()). The ROUTE reply carries
+//         it back as its payload.
+//Inputs: packet (the request)
+//Outputs: Quality (dB), APOL_RATE_MARGIN with no repeaters listed
+int8_t APOL_Comms_Lib::path_quality(const packet_fields * packet)
+{
+	int8_t quality = APOL_RATE_MARGIN;
+	for (uint8_t idx = 0; idx < packet -> route_count; idx++){
+		quality = min(quality, link_quality(packet -> route_snr[idx]));
+	}
+	return quality;
+}
+
+//Name: encode_route
+//Purpose: Writes the list of repeaters that goes ahead of the payload in a ROUTE frame body: their number, then for
+//         each its address and, in a request, the SNR (dB) it heard the request with.
+//Inputs: relays (their addresses, nearest the requester first), snr (for a request, the SNR each heard it with, NULL for a
+//        reply), count (up to APOL_MAX_HOPS), body (room for 1 + 2 * count bytes)
+//Outputs: Number of bytes written
+uint8_t APOL_Comms_Lib::encode_route(const uint8_t * relays, const int8_t * snr, uint8_t count, uint8_t * body)
+{
+	uint8_t len = 0;
+	body[len++] = count;
+	for (uint8_t idx = 0; idx < count; idx++){
+		body[len++] = relays[idx];
+		if (snr) body[len++] = (uint8_t)snr[idx];
+	}
+	return len;
+}
+
+//Name: routes
+//Purpose: Gives read access to the route table (see enable_mesh()).
+//Inputs: count (where to put the number of routes in it)
+//Outputs: Table
+const mesh_route * APOL_Comms_Lib::routes(uint8_t * count)
+{
+	*count = _num_routes;
+	return _routes;
+}
+
+//Name: retransmit_timeout
+//Purpose: Gives the current retransmission timeout for requests to a target, including any backoff.
+//Inputs: target_device
+//Outputs: Timeout in milliseconds
+uint32_t APOL_Comms_Lib::retransmit_timeout(uint8_t target_device)
+{
+	uint8_t index = find_peer(target_device);
+	return index == APOL_NO_PEER ? APOL_RTO_INITIAL : _links[index].rto;
+}
+
+//Name: link
+//Purpose: Gives read access to the acknowledgement state for a target (round trip estimate, resend count).
+//Inputs: target_device
+//Outputs: The peer's link state, or NULL for a multicast address (or no room in the peer table)
+const peer_link * APOL_Comms_Lib::link(uint8_t target_device)
+{
+	uint8_t index = find_peer(target_device);
+	return index == APOL_NO_PEER ? NULL : &_links[index];
+}
+
+//Name: requests_done
+//Purpose: Takes the requests from the oldest unacknowledged one up to (not including) end out of a send window, and
+//         tells the request done handler about each.
+//Inputs: peer, end (sequence number), delivered
+//Outputs: None
+void APOL_Comms_Lib::requests_done(peer_link * peer, uint8_t end, bool delivered)
+{
+	while (peer -> base != end){
+		window_slot * slot = &peer -> window[peer -> base++ % APOL_WINDOW_SIZE];
+		if (_request_done) _request_done(slot -> tag, slot -> request, slot -> payload, delivered);
+	}
+}
+
+//Name: send_group
+//Purpose: Sends a request to several devices at once, eg every POL in the pit lane, with one frame to a multicast address
+//         that takes them all in (see APOL_GROUP_COMMAND). Members listed ACK in their reply slots, and once every slot has
+//         gone by the members that have not answered are sent the request again, in a frame listing only them, up to
+//         attempts times. Members act on each command once. Waits for the slotted MAC as a burst would (the reply slots
+//         may run past the end of this device's slot). Blocks until every member has answered or the last reply slot is
+//         over; ACKs are handed over by handle_ack() from the rx task, or polled for without a scheduler. One group
+//         command at a time, from one task.
+//Inputs: request, target_device (a multicast address taking in every member), members (their unicast addresses),
+//        count (up to APOL_GROUP_MAX_MEMBERS), payload, attempts
+//Outputs: Bit mask of the members that acknowledged (bit n for members[n])
+uint8_t APOL_Comms_Lib::send_group(request_type request, uint8_t target_device, const uint8_t * members, uint8_t count, uint32_t payload, uint8_t attempts)
+{
+	if (!APOL_IS_MULTICAST(target_device) || count == 0 || count > APOL_GROUP_MAX_MEMBERS) return 0;
+	uint8_t all = (uint8_t)((1U << count) - 1);
+
+	taskENTER_CRITICAL();
+	memcpy(_group_members, members, count);
+	_group_acked = 0;
+	_group_sequence = _datagram_sequence++;
+	_group_task = xTaskGetCurrentTaskHandle();
+	_group_count = count;
+	taskEXIT_CRITICAL();
+
+	for (uint8_t attempt = 0; attempt < attempts && _group_acked != all; attempt++){
+		//List only the members that have not answered, which closes up their reply slots
+		uint8_t listed[1 + APOL_GROUP_MAX_MEMBERS];
+		uint8_t num_listed = 0;
+		for (uint8_t idx = 0; idx < count; idx++){
+			if (!(_group_acked & (1 << idx))) listed[1 + num_listed++] = members[idx];
+		}
+		listed[0] = num_listed;
+
+		wait_for_slot(min(num_listed, (uint8_t)(APOL_SLOT_FRAMES - 1)), is_emergency(request));
+		if (send_frame(request, _address, target_device, payload, _group_sequence, APOL_GROUP_COMMAND, NULL, listed, 1 + num_listed)) rf95 -> waitPacketSent();
+		rf95 -> setModeRx();
+
+		unsigned long deadline = millis() + APOL_ACK_TURNAROUND + num_listed * APOL_GROUP_REPLY_SLOT + APOL_GROUP_REPLY_GUARD;
+		while (_group_acked != all && (long)(deadline - millis()) > 0){
+			if (_group_task) ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(deadline - millis()));
+			else if (rf95 -> available() && check_for_packet()) handle_ack(&packet_contents);
+		}
+	}
+
+	_group_count = 0;
+	return _group_acked;
+}
+
+//Name: handle_group_ack
+//Purpose: Marks the sender of an ACK to the group command in flight as having answered, and wakes the task in
+//         send_group() once every member has. ACKs to earlier commands are ignored.
+//Inputs: ack (a received ACK with the APOL_GROUP_ACK marker)
+//Outputs: true if it marked a member
+bool APOL_Comms_Lib::handle_group_ack(const packet_fields * ack)
+{
+	if (_group_count == 0 || ack -> sequence != _group_sequence) return 0;
+	for (uint8_t idx = 0; idx < _group_count; idx++){
+		if (_group_members[idx] != ack -> sender_device || (_group_acked & (1 << idx))) continue;
+		_group_acked |= 1 << idx;
+		if (_group_acked == (uint8_t)((1U << _group_count) - 1) && _group_task) xTaskNotifyGive(_group_task);
+		return 1;
 	}
 	return 0;
 }
 
-_Bool APOL_Comms_Lib::check_for_any_packet()
+//Name: set_ack_state
+//Purpose: Attaches a snapshot of a light state vector to every ACK this device sends. For the device that owns the
+//         state (the POL). The snapshot is taken as each ACK goes out, so keep the vector up to date rather than calling
+//         this again.
+//Inputs: state (NULL to stop attaching snapshots)
+//Outputs: None
+void APOL_Comms_Lib::set_ack_state(const pol_state * state)
 {
-	if (rf95 -> available()){
-		uint8_t buf[RH_RF95_MAX_MESSAGE_LEN];
-		uint8_t len = sizeof(buf);
-		if (rf95 -> recv(buf, &len)) {
-		  
-			//Separate out data
-			packet_contents.sender_device = (subsystem) (buf[0]);
-			packet_contents.request = (request_type) (buf[1]);
-			packet_contents.target_device = (subsystem) (buf[2]);
-			packet_contents.payload = buf[3] | (buf[4] << 8) | (buf[5] << 16) | (buf[6] << 24); 
-		
-			return 1;
+	_ack_state = state;
+}
+
+//Name: enable_auto_ack
+//Purpose: Turns the auto-ACK on or off. With it on, the radio service task runs accept_request() on each windowed request
+//         addressed to this device as soon as it is received, and sends the ACK at the end of a burst straight away,
+//         before the rx task is woken. The sender's round trip then no longer includes however long the rx task takes to
+//         act on the request. The rx task still calls accept_request() and send_ack() as usual: they give back the
+//         verdict and skip the ACK. Auto-ACKs carry no light state snapshot, as the request has not been acted on yet.
+//         Datagrams and ACKs are left to the rx task.
+//Inputs: enable
+//Outputs: None
+void APOL_Comms_Lib::enable_auto_ack(bool enable)
+{
+	rf95 -> setRxHook(enable ? auto_ack_hook : NULL, this);
+}
+
+//Name: auto_ack_hook
+//Purpose: Receive hook handed to the driver by enable_auto_ack(). Runs in the radio service task.
+//Inputs: context (the APOL_Comms_Lib), frame (headers then body), len (including the headers)
+//Outputs: APOL_AUTO_ACK_* flags, kept with the frame for receive_packet()
+uint8_t APOL_Comms_Lib::auto_ack_hook(void * context, const uint8_t * frame, uint8_t len)
+{
+	return ((APOL_Comms_Lib *) context) -> auto_ack(frame, len);
+}
+
+//Name: auto_ack
+//Purpose: Accepts or refuses a windowed request addressed to this device and sends its ACK if one is due. Must not block:
+//         if the radio is still transmitting, the ACK is left to send_ack().
+//Inputs: frame (headers then body), len (including the headers)
+//Outputs: APOL_AUTO_ACK_* flags
+uint8_t APOL_Comms_Lib::auto_ack(const uint8_t * frame, uint8_t len)
+{
+	packet_fields request;
+	if (len < RH_RF95_HEADER_LEN || !decode_frame(frame, frame + RH_RF95_HEADER_LEN, len - RH_RF95_HEADER_LEN, &request)) return APOL_AUTO_ACK_NONE;
+	if (request.target_device != _address || request.request == ACK || request.request == ROUTE || request.window == APOL_WINDOW_NONE) return APOL_AUTO_ACK_NONE;
+
+	uint8_t verdict = accept_request(&request) ? APOL_AUTO_ACK_ACCEPTED : APOL_AUTO_ACK_REFUSED;
 
+	uint32_t payload;
+	uint8_t sequence, window;
+	if (!ack_fields(&request, &payload, &sequence, &window)) return verdict | APOL_AUTO_ACK_SENT; //Nothing due, so nothing for send_ack() to do
+
+	uint8_t body[APOL_MAX_PAYLOAD_LEN];
+	uint8_t body_len = encode_payload(payload, body);
+	RH_RF95::TxSettings settings;
+	if (rf95 -> sendWithHeaders(request.sender_device, _address, sequence, frame_flags(ACK, window), body, body_len, tx_settings(request.sender_device, &settings))) verdict |= APOL_AUTO_ACK_SENT;
+	return verdict;
+}
+
+//Name: encode_state
+//Purpose: Packs a light state vector into bits 4-27 of an ACK payload.
+//Inputs: state
+//Outputs: Snapshot, to be ORed with the request type acknowledged
+uint32_t APOL_Comms_Lib::encode_state(const pol_state * state)
+{
+	pol_state now;
+	taskENTER_CRITICAL();
+	now = *state;
+	taskEXIT_CRITICAL();
+
+	uint32_t snapshot = (uint32_t)now.version << APOL_STATE_VERSION_SHIFT;
+	if (now.green) snapshot |= APOL_STATE_GREEN;
+	if (now.red) snapshot |= APOL_STATE_RED;
+	if (now.pulse) snapshot |= APOL_STATE_PULSE;
+	if (now.override) snapshot |= APOL_STATE_OVERRIDE;
+	long left = (long)(now.end_time - millis());
+	if ((now.pulse || now.override) && left > 0) snapshot |= min((uint32_t)(left + 999) / 1000, (uint32_t)(APOL_PAYLOAD_MASK >> APOL_STATE_TIME_SHIFT)) << APOL_STATE_TIME_SHIFT;
+	return snapshot;
+}
+
+//Name: decode_state
+//Purpose: Unpacks the light state snapshot from an ACK payload. end_time is worked out from the time left, against this
+//         device's millis().
+//Inputs: payload (of a received ACK), state (where to put it)
+//Outputs: false if the ACK carried no snapshot (state is left alone)
+bool APOL_Comms_Lib::decode_state(uint32_t payload, pol_state * state)
+{
+	uint8_t version = payload >> APOL_STATE_VERSION_SHIFT;
+	if (version == 0) return 0;
+	state -> version = version;
+	state -> green = payload & APOL_STATE_GREEN;
+	state -> red = payload & APOL_STATE_RED;
+	state -> pulse = payload & APOL_STATE_PULSE;
+	state -> override = payload & APOL_STATE_OVERRIDE;
+	state -> end_time = millis() + (payload >> APOL_STATE_TIME_SHIFT) * 1000;
+	return 1;
+}
+
+//Name: min_rto
+//Purpose: Works out the shortest sensible retransmission timeout for requests to a peer: the airtime of a full size
+//         request (at the peer's listen rate) and its ACK (at ours), plus the peer's turnaround time.
+//Inputs: peer (slot in the peer table)
+//Outputs: Timeout in milliseconds
+uint32_t APOL_Comms_Lib::min_rto(uint8_t peer)
+{
+	const RH_RF95::ModemConfig * tx_config = NULL;
+	const RH_RF95::ModemConfig * rx_config = NULL;
+	if (_rate_enabled){
+		tx_config = &rate_profiles[_rates[peer].tx_rate].modem;
+		rx_config = &rate_profiles[_rx_rate].modem;
+	}
+	uint32_t airtime = rf95 -> timeOnAir(APOL_MAX_PAYLOAD_LEN, tx_config) + rf95 -> timeOnAir(APOL_MAX_PAYLOAD_LEN, rx_config);
+	return (airtime + 999) / 1000 + APOL_ACK_TURNAROUND;
+}
+
+//Name: enable_rate_adaptation
+//Purpose: Turns on the adaptive data rate, starting every link on the base rate at full power. Call once, after begin(),
+//         on every device or on none (frames from a device without it are still heard, but it never follows a RATE
+//         request). Then call adapt_rate() every second or so. With peers left 0 the listen rate stays on the base rate,
+//         but frames to other devices still follow their listen rates.
+//Inputs: peers (APOL_PEER() mask of every role that sends to this device, through a repeater or not),
+//        max_power (full TX power in dBm, as for RH_RF95::setTxPower())
+//Outputs: None
+void APOL_Comms_Lib::enable_rate_adaptation(uint8_t peers, int8_t max_power)
+{
+	unsigned long now = millis();
+	_rate_max_power = max_power;
+	for (uint8_t peer = 0; peer < APOL_MAX_PEERS; peer++){
+		memset(&_rates[peer], 0, sizeof(rate_link));
+		_rates[peer].tx_rate = APOL_RATE_BASE;
+		_rates[peer].tx_power = max_power;
+		_rates[peer].rx_power = max_power;
+		_rates[peer].heard_time = now;
+	}
+	_rate_asking = APOL_NO_PEER;
+	_rate_holdoff = now;
+	_rate_peers = peers;
+	_rx_rate = APOL_RATE_BASE;
+	rf95 -> setTxPower(max_power);
+	rf95 -> setRxModemRegisters(&rate_profiles[APOL_RATE_BASE].modem);
+	_rate_enabled = true;
+}
+
+//Name: adapt_rate
+//Purpose: Moves the listen rate and the TX power peers use towards what their SNR allows, one step per call. Resends a
+//         RATE request that has not been acknowledged in time, and drops back to the base rate if a peer never
+//         acknowledges. A peer that has not been heard lately (see APOL_RATE_SILENCE) holds the listen rate at the base
+//         rate. Blocks while a RATE request goes out. Call from the task that handles received frames (or one that does
+//         not run alongside it), every second or so.
+//Inputs: None
+//Outputs: true if a RATE request was sent or the listen rate moved
+bool APOL_Comms_Lib::adapt_rate()
+{
+	if (!_rate_enabled) return 0;
+	unsigned long now = millis();
+
+	//Fastest rate every peer reaches with the margin to spare. Speeding up also needs the hysteresis on top
+	uint8_t target = APOL_NUM_RATES - 1;
+	for (uint8_t peer = 0; peer < _num_peers; peer++){
+		if (!(_rate_peers & APOL_PEER(APOL_ROLE(_peer_address[peer])))) continue;
+		rate_link * link = &_rates[peer];
+		uint8_t best = APOL_RATE_BASE;
+		if (now - link -> heard_time >= APOL_RATE_SILENCE){
+			//It may have fallen back, or gone. Either way it sends at full power once its frames stop getting through, so assume
+			//it does, send to it robustly and start again from fresh frames when it is back
+			link -> samples = 0;
+			link -> rx_power = _rate_max_power;
+			if (link -> tx_rate != APOL_RATE_BASE || link -> tx_power != _rate_max_power) rate_fallback(peer);
 		}
+		if (link -> samples >= APOL_RATE_MIN_SAMPLES){
+			for (uint8_t rate = APOL_NUM_RATES - 1; rate > APOL_RATE_BASE; rate--){
+				int16_t margin = APOL_RATE_MARGIN + (rate > _rx_rate ? APOL_RATE_HYSTERESIS : 0);
+				if (link -> snr - rate_profiles[rate].floor >= margin * 4){
+					best = rate;
+					break;
+				}
+			}
+		}
+		target = min(target, best);
+	}
+	if (_rate_peers == 0 || (target > _rx_rate && (long)(now - _rate_holdoff) < 0)) target = min(target, _rx_rate);
+
+	//A change in progress carries on unless we now have to slow down, which takes over from it
+	if (_rate_asking != APOL_NO_PEER && target >= _rx_rate){
+		uint8_t peer = _rate_asking;
+		if (now - _rate_sent_time < max(min_rto(peer), (uint32_t)APOL_RTO_INITIAL)) return 0;
+		if (_rate_attempts < APOL_RATE_ATTEMPTS) return send_rate(peer);
+		//The peer does not reach us with the new settings, or never heard them. Go back to the base rate, which it falls
+		//back to as well once its frames stop getting through
+		_rate_asking = APOL_NO_PEER;
+		rate_fallback(peer);
+		set_listen_rate(APOL_RATE_BASE);
+		return 1;
+	}
+	_rate_asking = APOL_NO_PEER;
+
+	//Ask for more power as soon as a link drops under the margin, but for less only once it has the hysteresis twice
+	//over, and then leave it the hysteresis in hand
+	_rate_acked = 0;
+	uint8_t asked = 0; //Bit per slot, as _rate_acked
+	for (uint8_t peer = 0; peer < _num_peers; peer++){
+		if (!(_rate_peers & APOL_PEER(APOL_ROLE(_peer_address[peer])))) continue;
+		asked |= 1 << peer;
+		int8_t needed = rate_power(peer, target);
+		int8_t current = _rates[peer].rx_power;
+		if (target == _rx_rate && needed <= current && needed + 2 * APOL_RATE_HYSTERESIS > current){
+			_rate_power[peer] = current;
+			_rate_acked |= 1 << peer;
+		}
+		else _rate_power[peer] = min(needed + APOL_RATE_HYSTERESIS, (int)_rate_max_power);
+	}
+	if (_rate_acked == asked){
+		_rate_acked = 0;
+		return 0;
+	}
+
+	//Listen with the new rate straight away, so each peer's ACK comes back with it and shows the peer reaches us. Frames
+	//from peers not asked yet are lost until they are, and resent
+	if (target < _rx_rate) _rate_holdoff = now + APOL_RATE_HOLDOFF;
+	set_listen_rate(target);
+	return next_rate_request();
+}
+
+//Name: listen_rate
+//Purpose: Gives the rate this device receives with.
+//Inputs: None
+//Outputs: Index into rate_profiles[]
+uint8_t APOL_Comms_Lib::listen_rate()
+{
+	return _rx_rate;
+}
+
+//Name: rate
+//Purpose: Gives read access to the rate adaptation state for the link to a peer (SNR, rate and power in use).
+//Inputs: address (of the peer)
+//Outputs: The link's rate state, or NULL for a multicast address (or no room in the peer table)
+const rate_link * APOL_Comms_Lib::rate(uint8_t address)
+{
+	uint8_t index = find_peer(address);
+	return index == APOL_NO_PEER ? NULL : &_rates[index];
+}
+
+//Name: rate_frame
+//Purpose: Handles a RATE request from a peer (sends to it with the new rate and power from now on, starting with the ACK,
+//         which goes at full power) and ACKs for our own RATE requests (moving on to the next peer).
+//Inputs: peer (the sender's slot in the peer table), packet (a received packet addressed to this device)
+//Outputs: true if the packet was a RATE request or an ACK for one, and has been dealt with
+bool APOL_Comms_Lib::rate_frame(uint8_t peer, const packet_fields * packet)
+{
+	rate_link * link = &_rates[peer];
+
+	if (packet -> request == RATE){
+		uint8_t new_rate = packet -> payload & APOL_RATE_LISTEN_MASK;
+		int8_t power = (int8_t)(packet -> payload >> APOL_RATE_POWER_SHIFT);
+		if (new_rate >= APOL_NUM_RATES) return 1;
+
+		//Resends of the request (our ACK was lost) get the same answer
+		RH_RF95::TxSettings settings = {rate_profiles[new_rate].modem, _rate_max_power, 0};
+		if (send_frame(ACK, _address, packet -> sender_device, RATE, packet -> sequence, APOL_WINDOW_NONE, &settings)) rf95 -> waitPacketSent();
+		rf95 -> setModeRx();
+
+		link -> tx_rate = new_rate;
+		link -> tx_power = min(max(power, (int8_t)APOL_RATE_POWER_MIN), _rate_max_power);
+		link -> losses = 0;
+		_links[peer].rto = max(_links[peer].rto, min_rto(peer));
+		return 1;
 	}
+
+	if (packet -> request == ACK && packet -> window == APOL_WINDOW_NONE && (packet -> payload & APOL_ACK_REQUEST_MASK) == RATE){
+		if (peer == _rate_asking && packet -> sequence == _rate_sequence){
+			link -> rx_power = _rate_power[peer];
+			_rate_acked |= 1 << peer;
+			_rate_asking = APOL_NO_PEER;
+			next_rate_request();
+		}
+		return 1;
+	}
+
 	return 0;
-}
\ No newline at end of file
+}
+
+//Name: rate_heard
+//Purpose: Folds the SNR of a frame from a peer into the link's smoothed SNR, referred to 125 kHz (3 dB per doubling of
+//         the bandwidth we listen with) and to the peer sending at our full power.
+//Inputs: peer, snr (dB, of the frame just received)
+//Outputs: None
+void APOL_Comms_Lib::rate_heard(uint8_t peer, int8_t snr)
+{
+	rate_link * link = &_rates[peer];
+	int16_t sample = snr * 4 + 12 * ((rate_profiles[_rx_rate].modem.reg_1d >> 4) - (RH_RF95_BW_125KHZ >> 4)) + (_rate_max_power - link -> rx_power) * 4;
+	if (link -> samples == 0) link -> snr = sample;
+	else link -> snr += (sample - link -> snr) / 4;
+	if (link -> samples < APOL_RATE_MIN_SAMPLES) link -> samples++;
+	link -> heard_time = millis();
+}
+
+//Name: rate_loss
+//Purpose: Counts a lost frame to a peer, and falls the link back after APOL_RATE_LOSS_LIMIT in a row.
+//Inputs: peer
+//Outputs: None
+void APOL_Comms_Lib::rate_loss(uint8_t peer)
+{
+	if (!_rate_enabled) return;
+	rate_link * link = &_rates[peer];
+	if (link -> tx_rate == APOL_RATE_BASE && link -> tx_power == _rate_max_power) return; //Nothing more robust to go to
+	if (++link -> losses >= APOL_RATE_LOSS_LIMIT) rate_fallback(peer);
+}
+
+//Name: rate_fallback
+//Purpose: Sends to a peer with the base rate and full power from now on, and holds off speeding up our listen rate. The
+//         peer takes us to be at full power once it stops hearing us (see adapt_rate). Makes no radio calls, so is safe
+//         from any task (including the auto-ACK).
+//Inputs: peer
+//Outputs: None
+void APOL_Comms_Lib::rate_fallback(uint8_t peer)
+{
+	rate_link * link = &_rates[peer];
+	link -> tx_rate = APOL_RATE_BASE;
+	link -> tx_power = _rate_max_power;
+	link -> losses = 0;
+	link -> samples = 0; //Its SNR is out of date too
+	_rate_holdoff = millis() + APOL_RATE_HOLDOFF;
+	_links[peer].rto = max(_links[peer].rto, min_rto(peer));
+}
+
+//Name: rate_power
+//Purpose: Works out the lowest TX power that leaves a peer's frames the margin at a rate.
+//Inputs: peer, rate
+//Outputs: Power in dBm, full power if the peer's SNR is not known
+int8_t APOL_Comms_Lib::rate_power(uint8_t peer, uint8_t rate)
+{
+	const rate_link * link = &_rates[peer];
+	if (link -> samples < APOL_RATE_MIN_SAMPLES) return _rate_max_power;
+	int16_t spare = (link -> snr - rate_profiles[rate].floor) / 4 - APOL_RATE_MARGIN;
+	return min(max(_rate_max_power - spare, APOL_RATE_POWER_MIN), (int)_rate_max_power);
+}
+
+//Name: next_rate_request
+//Purpose: Sends the RATE request for the change in progress to the next peer that has not acknowledged it.
+//Inputs: None
+//Outputs: true if a request was sent, false once every peer has acknowledged
+bool APOL_Comms_Lib::next_rate_request()
+{
+	for (uint8_t peer = 0; peer < _num_peers; peer++){
+		if (!(_rate_peers & APOL_PEER(APOL_ROLE(_peer_address[peer]))) || (_rate_acked & (1 << peer))) continue;
+		_rate_attempts = 0;
+		return send_rate(peer);
+	}
+	_rate_acked = 0;
+	return 0;
+}
+
+//Name: send_rate
+//Purpose: Sends the RATE request for the change in progress (our listen rate, and the power the peer is to use) to a
+//         peer, with the rate it listens with at full power.
+//         Blocks until the radio reports TX_DONE.
+//Inputs: peer
+//Outputs: true if the request was sent
+bool APOL_Comms_Lib::send_rate(uint8_t peer)
+{
+	_rate_asking = peer;
+	_rate_sequence = _tx_sequence[peer]++;
+	_rate_attempts++;
+	uint32_t payload = _rx_rate | ((uint32_t)(uint8_t)_rate_power[peer] << APOL_RATE_POWER_SHIFT);
+	RH_RF95::TxSettings settings = {rate_profiles[_rates[peer].tx_rate].modem, _rate_max_power, 0};
+	bool sent = send_frame(RATE, _address, _peer_address[peer], payload, _rate_sequence, APOL_WINDOW_NONE, &settings);
+	if (sent) rf95 -> waitPacketSent();
+	rf95 -> setModeRx();
+	_rate_sent_time = millis();
+	return sent;
+}
+
+//Name: set_listen_rate
+//Purpose: Moves the radio's receive settings to a rate, and makes sure no retransmission timeout is shorter than the
+//         airtime now allows.
+//Inputs: rate
+//Outputs: None
+void APOL_Comms_Lib::set_listen_rate(uint8_t rate)
+{
+	if (rate == _rx_rate) return;
+	rf95 -> setRxModemRegisters(&rate_profiles[rate].modem);
+	_rx_rate = rate;
+	for (uint8_t peer = 0; peer < _num_peers; peer++){
+		_links[peer].rto = max(_links[peer].rto, min_rto(peer));
+	}
+}
+
+//Name: enable_slotted_mac
+//Purpose: Turns the slotted MAC on or off (see APOL_SLOT_LENGTH). Must be the same on every device. With it on, the POL
+//         should call send_beacon() every APOL_SUPERFRAME ms, and the other devices send in their slots once they hear it.
+//Inputs: enable
+//Outputs: None
+void APOL_Comms_Lib::enable_slotted_mac(bool enable)
+{
+	_slotted = enable;
+}
+
+//Name: send_beacon
+//Purpose: Sends the beacon that starts a superframe to every device in this pit box, at the base rate with no CAD, and
+//         starts this device's schedule from it. For the POL. The payload is a snapshot of the light state if set_ack_state() was given one.
+//         Blocks until the radio reports TX_DONE, then may refresh a route (see enable_mesh()).
+//Inputs: None
+//Outputs: true if the beacon was sent
+bool APOL_Comms_Lib::send_beacon()
+{
+	uint8_t body[APOL_MAX_PAYLOAD_LEN];
+	uint8_t len = encode_payload(_ack_state ? encode_state(_ack_state) : 0, body);
+
+	rf95 -> waitPacketSent();
+	unsigned long start_time = micros();
+	if (!rf95 -> sendWithHeaders(APOL_MULTICAST(APOL_ANY_ROLE, APOL_GROUP(_address)), _address, _beacon_sequence, frame_flags(BEACON, APOL_WINDOW_NONE), body, len, NULL)) return 0;
+	_superframe_start = start_time;
+	_beacon_heard = true;
+	_beacon_sequence++;
+	rf95 -> waitPacketSent();
+	refresh_routes();
+	return 1;
+}
+
+//Name: slot_synced
+//Purpose: Tells whether this device is keeping to the slotted MAC's schedule: it is on and a beacon has been heard (or
+//         sent) in the last APOL_BEACON_LOSS_LIMIT superframes.
+//Inputs: None
+//Outputs: true if sends wait for their slot
+bool APOL_Comms_Lib::slot_synced()
+{
+	return _slotted && _beacon_heard && micros() - _superframe_start < APOL_BEACON_LOSS_LIMIT * APOL_SUPERFRAME * 1000UL;
+}
+
+//Name: wait_for_slot
+//Purpose: With the slotted MAC keeping to the schedule, sleeps until this device's slot (or the contention slot, for an
+//         emergency) has room left for some frames and the ACK to them. Returns straight away otherwise.
+//Inputs: frames (full size frames to be sent back to back), emergency (true if the contention slot may be used)
+//Outputs: None
+void APOL_Comms_Lib::wait_for_slot(uint8_t frames, bool emergency)
+{
+	uint32_t needed = (frames + 1) * APOL_BASE_FRAME_AIRTIME + APOL_ACK_TURNAROUND * 1000UL;
+	while (slot_synced()){
+		uint32_t wait = slot_wait(needed, emergency);
+		if (wait == 0) return;
+		uint32_t ms = (wait + 999) / 1000;
+		if (xTaskGetSchedulerState() == taskSCHEDULER_RUNNING) vTaskDelay(pdMS_TO_TICKS(ms));
+		else delay(ms);
+	}
+}
+
+//Name: slot_wait
+//Purpose: Works out how long until a slot this device may send in has the time needed left before its guard.
+//Inputs: needed (us), emergency (true if the contention slot may be used)
+//Outputs: Time to wait (us), 0 to send now
+uint32_t APOL_Comms_Lib::slot_wait(uint32_t needed, bool emergency)
+{
+	const uint32_t slot_length = APOL_SLOT_LENGTH * 1000UL;
+	const uint32_t superframe = APOL_SUPERFRAME * 1000UL;
+	uint32_t now = (micros() - _superframe_start) % superframe;
+	uint8_t slots[2] = {(uint8_t)(_device_type < NUM_SUBSYSTEMS ? 1 + _device_type : APOL_CONTENTION_SLOT), APOL_CONTENTION_SLOT};
+
+	uint32_t wait = superframe;
+	for (uint8_t idx = 0; idx < (emergency ? 2 : 1); idx++){
+		uint32_t start = slots[idx] * slot_length;
+		if (now >= start && now + needed <= start + slot_length - APOL_SLOT_GUARD * 1000UL) return 0;
+		uint32_t until = (start + superframe - now) % superframe;
+		wait = min(wait, until ? until : superframe);
+	}
+	return wait;
+}
+
+//Name: is_emergency
+//Purpose: Tells whether a request may use the slotted MAC's contention slot.
+//Inputs: request
+//Outputs: true for OVERRIDE_START
+bool APOL_Comms_Lib::is_emergency(request_type request)
+{
+	return request == OVERRIDE_START;
+}
+
+//Name: enable_low_power_listen
+//Purpose: Turns low power listening on or off (see APOL_LPL_INTERVAL_HHD). Must be the same on every device. With it on,
+//         frames to a device with a listen interval go out with a preamble long enough to wake it, unless it was heard from
+//         lately, and if this device has one it should call sniff() every listen_interval(its type) ms.
+//Inputs: enable, power (TX power in dBm for frames with a wake-up preamble, as the link's own is used with rate adaptation on)
+//Outputs: None
+void APOL_Comms_Lib::enable_low_power_listen(bool enable, int8_t power)
+{
+	_lpl_enabled = enable;
+	_lpl_power = power;
+}
+
+//Name: set_listen_interval
+//Purpose: Sets how often devices of a role wake their radios with low power listening. Must be the same on every device.
+//Inputs: device (role), interval (ms, 0 if it always listens)
+//Outputs: None
+void APOL_Comms_Lib::set_listen_interval(subsystem device, uint16_t interval)
+{
+	if (device < NUM_SUBSYSTEMS) _lpl_interval[device] = interval;
+}
+
+//Name: listen_interval
+//Purpose: Gives how often devices of a role wake their radios with low power listening.
+//Inputs: device (role)
+//Outputs: Interval in ms, 0 if it always listens
+uint16_t APOL_Comms_Lib::listen_interval(subsystem device)
+{
+	return device < NUM_SUBSYSTEMS ? _lpl_interval[device] : 0;
+}
+
+//Name: sniff
+//Purpose: One wake-up of low power listening. Leaves the receiver on while anything is expected: a send window (or a group
+//         command) waiting for ACKs, frames not collected yet, or within APOL_LPL_LINGER of sending or receiving. Otherwise runs a CAD,
+//         and leaves the receiver on if it found a preamble or puts the radio to sleep if not. Blocks for the CAD.
+//Inputs: None
+//Outputs: true if the receiver was left on
+bool APOL_Comms_Lib::sniff()
+{
+	if (!_lpl_enabled || listen_interval(_device_type) == 0) return 1;
+
+	bool expecting = rf95 -> rxPending() > 0 || millis() - _lpl_active < APOL_LPL_LINGER || _group_count != 0;
+	for (uint8_t peer = 0; peer < _num_peers; peer++){
+		expecting |= _links[peer].next != _links[peer].base;
+	}
+	if (expecting){
+		rf95 -> setModeRx();
+		return 1;
+	}
+
+	if (!rf95 -> sniff()) return 0;
+	_lpl_active = millis(); //Give the frame behind the preamble time to arrive
+	return 1;
+}
+
+//Name: lpl_settings
+//Purpose: Gives the settings for a frame to a peer that may be asleep with low power listening: those given, but with a
+//         preamble that spans the peer's listen interval (the longest of the roles a multicast address takes in).
+//Inputs: target_device, settings (as worked out so far, NULL for the radio's own), wake (where to put new ones)
+//Outputs: settings to send with
+const RH_RF95::TxSettings * APOL_Comms_Lib::lpl_settings(uint8_t target_device, const RH_RF95::TxSettings * settings, RH_RF95::TxSettings * wake)
+{
+	if (!_lpl_enabled) return settings;
+	uint16_t interval = 0;
+	if (!APOL_IS_MULTICAST(target_device)) interval = listen_interval(APOL_ROLE(target_device));
+	else for (uint8_t role = 0; role < NUM_SUBSYSTEMS; role++){
+		uint8_t roles = APOL_MULTICAST_ROLE(target_device);
+		if (roles == APOL_ANY_ROLE || roles == role) interval = max(interval, _lpl_interval[role]);
+	}
+	if (interval == 0) return settings;
+	uint8_t peer = find_peer(target_device);
+	if (peer != APOL_NO_PEER && millis() - _lpl_heard[peer] < APOL_LPL_LINGER / 2) return settings; //Still listening
+
+	if (settings) *wake = *settings;
+	else {
+		//The radio's own settings: the listen rate at full power
+		wake -> modem = rate_profiles[_rate_enabled ? _rx_rate : APOL_RATE_BASE].modem;
+		wake -> power = _rate_enabled ? _rate_max_power : _lpl_power;
+	}
+	uint32_t preamble = interval * 1000UL / rf95 -> symbolMicros(&wake -> modem) + APOL_LPL_PREAMBLE_MARGIN;
+	wake -> preamble = preamble > 0xFFFF ? 0xFFFF : preamble;
+	return wake;
+}
+
+//Name: radio_charge
+//Purpose: Energy model: works out the charge the radio has drawn since start up, from the time it has spent in each mode
+//         and the APOL_CURRENT_* figures.
+//Inputs: None
+//Outputs: Charge in microamp hours
+uint32_t APOL_Comms_Lib::radio_charge()
+{
+	uint64_t charge = (uint64_t)rf95 -> modeTime(RHGenericDriver::RHModeSleep) * APOL_CURRENT_SLEEP
+		+ (uint64_t)(rf95 -> modeTime(RHGenericDriver::RHModeIdle) + rf95 -> modeTime(RHGenericDriver::RHModeInitialising)) * APOL_CURRENT_IDLE
+		+ (uint64_t)rf95 -> modeTime(RHGenericDriver::RHModeRx) * APOL_CURRENT_RX
+		+ (uint64_t)rf95 -> modeTime(RHGenericDriver::RHModeCad) * APOL_CURRENT_CAD
+		+ (uint64_t)rf95 -> modeTime(RHGenericDriver::RHModeTx) * APOL_CURRENT_TX;
+	return (uint32_t)(charge / 3600000); //ms uA to uAh
+}
+
+//Name: lpl_listen_current
+//Purpose: Energy model for low power listening: estimates the average radio current of a device that wakes every interval
+//         for a CAD (2 symbols at the base rate, and APOL_LPL_WAKE_TIME in standby) and sleeps otherwise. Each frame to it
+//         adds, on average, half the interval receiving the rest of its wake-up preamble, APOL_LPL_LINGER listening
+//         afterwards and a full size ACK. A longer interval saves on CADs but costs more per frame, and adds up to that
+//         much to the frame's latency.
+//Inputs: interval (ms between CADs, 0 for always listening), frame_interval (mean ms between frames to the device, 0 if none)
+//Outputs: Average current in microamps
+uint32_t APOL_Comms_Lib::lpl_listen_current(uint16_t interval, uint32_t frame_interval)
+{
+	uint64_t frame_charge = (uint64_t)APOL_BASE_FRAME_AIRTIME * APOL_CURRENT_TX; //us uA, for the ACK
+	if (interval == 0){
+		if (frame_interval == 0) return APOL_CURRENT_RX;
+		return APOL_CURRENT_RX + (uint32_t)(frame_charge / (frame_interval * 1000ULL));
+	}
+
+	uint32_t period = interval * 1000UL;
+	uint32_t cad = 2 * APOL_BASE_SYMBOL_TIME;
+	uint64_t charge = (uint64_t)cad * APOL_CURRENT_CAD + (uint64_t)APOL_LPL_WAKE_TIME * APOL_CURRENT_IDLE
+		+ (uint64_t)(period - cad - APOL_LPL_WAKE_TIME) * APOL_CURRENT_SLEEP; //us uA per interval
+	uint32_t current = (uint32_t)((charge + period / 2) / period);
+	if (frame_interval == 0) return current;
+
+	frame_charge += (uint64_t)(period / 2 + APOL_LPL_LINGER * 1000UL) * APOL_CURRENT_RX;
+	return current + (uint32_t)(frame_charge / (frame_interval * 1000ULL));
+}
@@ -9,6 +9,7 @@
 
 #include <SPI.h>
 #include <RH_RF95.h>
+#include <RHHardwareSPIDMA.h>
 #include <Seeed_Arduino_FreeRTOS.h>
 
 //M0 RF95 Pins
@@ -16,34 +17,476 @@
 #define RFM95_RST (4) //reset pin
 #define RFM95_INT (3) //interrupt pin
 #define RF95_FREQ (915.0) //MHz
+//#define APOL_SPI_DMA //Move RFM95 FIFO transfers by DMA instead of one byte at a time (SAMD21 only)
 #define PING_TIMEOUT (100) //How long the transmitter will wait to receive a response
-#define NUM_REQUEST_TYPES (9)
-#define NUM_SUBSYSTEMS (3)
-#define NUM_FIELDS (7) //source, destination, request type, and 4 payload fields. 
+#define NUM_SUBSYSTEMS (3) //Roles with a slot and a listen interval (the repeater has neither)
+#define NUM_FIELDS (7) //Legacy (version 0) frame body: source, destination, request type, and 4 payload fields.
 
-enum request_type {PING, GREEN, GREEN_PULSE, RED, OVERRIDE_START, OVERRIDE_STOP, DETECTION, ACK, NONE, RESERVED}; //Putting in an additional request type stopped the compiler from "optimizing" some control structures.
-enum subsystem {HHD, POL, VDD};
+//Node addresses, in the TO and FROM headers (see address() and join_multicast())
+#define APOL_ADDRESS(role, group, member) ((uint8_t)(((group) << 4) | ((member) << 2) | (role))) //Unicast, 0GGGMMRR
+#define APOL_MULTICAST(role, group) ((uint8_t)(0x80 | ((role) << 4) | (group))) //Multicast, 1RRRGGGG
+#define APOL_IS_MULTICAST(address) (((address) & 0x80) != 0)
+#define APOL_ROLE(address) ((subsystem)((address) & 0x03)) //Of a unicast address
+#define APOL_MEMBER(address) (((address) >> 2) & 0x03) //Of a unicast address
+#define APOL_GROUP(address) (((address) >> 4) & 0x07) //Of a unicast address
+#define APOL_MULTICAST_ROLE(address) (((address) >> 4) & 0x07) //Of a multicast address
+#define APOL_MULTICAST_GROUP(address) ((address) & 0x0F) //Of a multicast address
+#define APOL_IN_MULTICAST(multicast, address) ((APOL_MULTICAST_ROLE(multicast) == APOL_ANY_ROLE || APOL_MULTICAST_ROLE(multicast) == APOL_ROLE(address)) && \
+	(APOL_MULTICAST_GROUP(multicast) == APOL_ANY_GROUP || APOL_MULTICAST_GROUP(multicast) == APOL_GROUP(address))) //Whether a multicast takes in a unicast address
+#define APOL_ANY_ROLE (0x07)
+#define APOL_ANY_GROUP (0x0F)
+#define APOL_NUM_ADDRESSES (0x80) //Unicast addresses
+#define APOL_MAX_PEERS (8) //Devices with send window, sequence and rate state at once (up to 8, see find_peer())
+#define APOL_NO_PEER (0xFF) //From find_peer(): a multicast address, or no room in the peer table
+
+//Compact frame format (see send_frame() and decode_frame())
+#define APOL_FRAME_VERSION (1) //Version 0 is the legacy 7 byte body
+#define APOL_FLAGS_VERSION_SHIFT (4)
+#define APOL_FLAGS_VERSION_MASK (0x30) //Bits 4-5 of the FLAGS header
+#define APOL_FLAGS_REQUEST_MASK (0x0F) //Bits 0-3 of the FLAGS header: the request type
+#define APOL_FLAGS_WINDOW_MASK (0xC0) //Bits 6-7 of the FLAGS header: the APOL_WINDOW_* marker
+#define APOL_MAX_PAYLOAD_LEN (4)
+#define APOL_PAYLOAD_MASK (0x0FFFFFFF) //Bits 0-27 of a payload are the request's own
+#define APOL_HOPS_SHIFT (28) //Bits 28-31 of the payload as sent: the hop count
+
+//Forwarding (see relay_packet() and forward_frame())
+#define APOL_MAX_HOPS (4) //Times a frame can be forwarded, and repeaters a route can list (up to 15)
+#define APOL_RELAY_CACHE_SIZE (32) //Frames a repeater remembers (a power of 2)
+#define APOL_RELAY_MEMORY (2 * (APOL_RELAY_HOLD + APOL_RELAY_JITTER)) //Time (ms) a forwarded frame is remembered
+#define APOL_RELAY_ACK_MEMORY (APOL_RTO_MAX) //Time (ms) the ACK to a forwarded request is kept
+
+//Selective forwarding (see forward_frame() and forward_held())
+#define APOL_MAX_NEIGHBOURS (16) //Devices in a repeater's neighbour table (up to 16)
+#define APOL_NO_NEIGHBOUR (0xFF)
+#define APOL_RELAY_HOLD_SLOTS (8) //Frames a repeater can hold at once
+#define APOL_RELAY_HOLD ((APOL_BASE_FRAME_AIRTIME + 999) / 1000 + 2 * APOL_ACK_TURNAROUND) //Time (ms) a frame is held for the target's ACK
+#define APOL_RELAY_JITTER ((APOL_BASE_FRAME_AIRTIME + 999) / 1000) //Longest random wait (ms) before forwarding
+#define APOL_NEIGHBOUR_RECHECK (10000) //Time (ms) a pair is taken to need a repeater
+
+//Mesh routing (see enable_mesh())
+#define APOL_MAX_ROUTES (16) //Routes a device keeps, its own and those it relays
+#define APOL_NO_ROUTE (0xFF)
+#define APOL_ROUTE_REQUEST (APOL_WINDOW_NONE) //Window marker of a ROUTE request
+#define APOL_ROUTE_REFRESH (APOL_WINDOW_MORE) //Window marker of a ROUTE request for a route still in use
+#define APOL_ROUTE_REPLY (APOL_WINDOW_LAST) //Window marker of a ROUTE reply
+#define APOL_MESH_LINK_DELAY (2) //Time (ms) a repeater holds a ROUTE request per dB its path is short of APOL_RATE_MARGIN
+#define APOL_MESH_ROUTE_LOSSES (2) //Consecutive ACK timeouts over a route before it is found again
+#define APOL_MESH_REFRESH (30000) //Time (ms) after a route was found before a beacon refreshes it
+#define APOL_MESH_RETRY (5000) //Time (ms) after a discovery before another for the same target
+#define APOL_MESH_REPLY_WAIT (APOL_RELAY_JITTER + APOL_RATE_MARGIN * APOL_MESH_LINK_DELAY) //Time (ms) the target waits before a ROUTE reply
+#define APOL_MESH_DISCOVERY_TIMEOUT (2 * (APOL_MAX_HOPS + 1) * ((APOL_BASE_FRAME_AIRTIME + 999) / 1000 + APOL_ACK_TURNAROUND) + \
+	(APOL_MAX_HOPS + 1) * APOL_MESH_REPLY_WAIT) //Time (ms) to wait for a ROUTE reply
+#define APOL_ROUTE_QUALITY_MASK (0x000000FF) //ROUTE reply payload: the route's quality (see path_quality())
+#define APOL_ROUTE_MAX_BODY_LEN (1 + 2 * APOL_MAX_HOPS + APOL_MAX_PAYLOAD_LEN) //A ROUTE request listing APOL_MAX_HOPS repeaters (see encode_route())
+
+//Send window: up to APOL_WINDOW_SIZE sequence-numbered requests to one peer can be outstanding at once. They go out
+//back to back as a burst and only the last frame of a burst asks for an ACK, which is cumulative (it carries the
+//newest sequence number received in order). A lost frame is resent along with everything after it (go-back-N).
+#define APOL_WINDOW_SIZE (4) //Requests that can wait for an ACK at once, per peer. A power of 2 up to 64; 1 gives stop-and-wait
+#define APOL_WINDOW_NONE (0x00) //Datagram, not part of a send window (PING, terminal sends, ACKs for datagrams)
+#define APOL_WINDOW_MORE (0x40) //Windowed request, more of the burst follows so hold the ACK
+#define APOL_WINDOW_LAST (0x80) //Windowed request that ends a burst, ACK now. Also marks the cumulative ACK itself
+#define APOL_WINDOW_SYNC (0xC0) //Windowed request that restarts the receiver's sequence (after start up or an abandoned window), sent on its own
+
+//Retransmission timeout (RTO) for requests that expect an ACK, from a smoothed round trip time (SRTT) and
+//its variation (RTTVAR) as in TCP: RTO = SRTT + 4 * RTTVAR, doubled on each resend.
+#define APOL_BASE_FRAME_AIRTIME (RH_RF95::loraTimeOnAir(7, 125000, 1, 8, false, true, false, RH_RF95_HEADER_LEN + APOL_MAX_PAYLOAD_LEN)) //Airtime (us) of a full size frame with the RH_RF95::init() settings
+#define APOL_RTO_INITIAL (3 * ((2 * APOL_BASE_FRAME_AIRTIME + 999) / 1000 + APOL_ACK_TURNAROUND)) //RTO (ms) before any round trip has been measured: three of the shortest round trips with the init() settings
+#define APOL_RTO_MAX (2000) //Ceiling on the RTO (ms), including backoff
+#define APOL_ACK_TURNAROUND (10) //Time (ms) allowed for the peer to handle a request and start its ACK. Added to the airtime of both frames to give the smallest RTO
+#define APOL_CAD_TIMEOUT ((10 * APOL_BASE_FRAME_AIRTIME + 999) / 1000) //Longest time (ms) a send listens before talk while the channel is busy: ten full size frames at the base rate. A request not sent by then is resent as if it was lost
+
+//ACK payload: the request type acknowledged in bits 0-3, then a snapshot of the sender's light state (see pol_state).
+//Only the POL attaches a snapshot, the other devices leave bits 4-27 clear. Commands that set the state are absolute
+//(GREEN and RED carry the state to set, GREEN_PULSE starts a pulse unless one is running, OVERRIDE_STOP clears the
+//override), so applying one twice changes nothing and the version does not move.
+#define APOL_ACK_REQUEST_MASK (0x0000000F)
+#define APOL_STATE_GREEN (0x00000010) //Green light on (steady)
+#define APOL_STATE_RED (0x00000020) //Red light on (steady)
+#define APOL_STATE_PULSE (0x00000040) //Green pulse running
+#define APOL_STATE_OVERRIDE (0x00000080) //Override running
+#define APOL_STATE_VERSION_SHIFT (8) //Bits 8-15: state version, never 0 in a snapshot
+#define APOL_STATE_TIME_SHIFT (16) //Bits 16-27: seconds left of the override or pulse, rounded up
+
+//Adaptive data rate (see enable_rate_adaptation()). A radio only receives with one modem configuration at a time, so each
+//device has a listen rate: the fastest profile in rate_profiles[] that every peer sending to it reaches with APOL_RATE_MARGIN
+//dB of SNR to spare, judged from the SNR of their recent frames. Frames to a peer go out with the peer's listen rate, at a TX
+//power that leaves it that margin. A device moves its listen rate, then sends each of those peers a RATE request giving the
+//new rate and the power to use. The ACK comes back with the new rate, so shows the peer reaches us with it, and if one never
+//does the device drops back to the base rate (the one every device starts on). Frames to a peer fall back to the base rate
+//and full power after consecutive losses, or when the peer goes quiet, and the peer takes them to be at full power once it
+//stops hearing them. Otherwise only the receiving end changes the power, as it judges the link by it. The listen rate is only
+//raised again after APOL_RATE_HOLDOFF.
+#define APOL_PEER(role) (1 << (role)) //Builds the peer mask (of roles) for enable_rate_adaptation()
+#define APOL_RATE_BASE (0) //Index of the base profile, the Bw125Cr45Sf128 that RH_RF95::init() sets
+#define APOL_NUM_RATES (3)
+#define APOL_RATE_MARGIN (10) //dB of SNR above the demodulation floor to keep on every link
+#define APOL_RATE_HYSTERESIS (3) //dB of extra margin needed before speeding up or turning the power down
+#define APOL_RATE_MIN_SAMPLES (4) //Frames to hear from a peer before going by its SNR
+#define APOL_RATE_POWER_MIN (2) //Lowest TX power (dBm) on PA_BOOST
+#define APOL_RATE_LOSS_LIMIT (3) //Consecutive losses on a link (ACK timeouts, or resends showing our ACK was lost) before it falls back
+#define APOL_RATE_ATTEMPTS (4) //Times a RATE request is sent to a peer before the change is given up
+#define APOL_RATE_HOLDOFF (10000) //Time (ms) after a fallback or a failed change before speeding up again
+#define APOL_RATE_SILENCE (3000) //Time (ms) without hearing from a peer in the mask before its link falls back (three HHD pings)
+//RATE request payload
+#define APOL_RATE_LISTEN_MASK (0x0000000F) //Bits 0-3: the sender's listen rate, send to it (starting with the ACK) with this from now on
+#define APOL_RATE_POWER_SHIFT (8) //Bits 8-15: TX power (dBm) to send to it with
+
+//Auto-ACK (see enable_auto_ack()): what the radio service task did with a windowed request addressed to this device
+//before the rx task saw it, kept in packet_fields::auto_ack. APOL_AUTO_ACK_NONE means the request is handled as usual.
+#define APOL_AUTO_ACK_NONE (0x00)
+#define APOL_AUTO_ACK_ACCEPTED (0x01) //accept_request() took it, act on it
+#define APOL_AUTO_ACK_REFUSED (0x02) //accept_request() refused it (duplicate or out of order)
+#define APOL_AUTO_ACK_SENT (0x04) //Its ACK (if one was due) is already on the air, send_ack() does nothing
+
+//Slotted MAC (see enable_slotted_mac()): time is split into superframes of APOL_NUM_SLOTS slots, each started by a BEACON
+//the POL sends to its pit box at the base rate in slot 0. Slot 1 + role belongs to the device with that role, which sends its requests (bursts and
+//datagrams) only there, so they never collide and wait at most one superframe. The last slot is for contention: emergency
+//requests (OVERRIDE_START) may go there, listening before talk, when it comes before the device's own slot. ACKs, beacons and
+//forwarded frames go straight out. Each device keeps the schedule from the end of the last beacon it heard, and sends
+//whenever it likes (with CAD) until it has heard one, or once APOL_BEACON_LOSS_LIMIT superframes go by without one.
+//Beacons carry the superframe count in the ID header and, like the POL's ACKs, a snapshot of the light state.
+#define APOL_SLOT_FRAMES (APOL_WINDOW_SIZE + 1) //Full size frames a slot has room for: a full burst and its ACK
+#define APOL_SLOT_GUARD (5) //Time (ms) at the end of each slot left clear, for clocks drifting between beacons
+#define APOL_SLOT_LENGTH ((APOL_SLOT_FRAMES * APOL_BASE_FRAME_AIRTIME + 999) / 1000 + APOL_ACK_TURNAROUND + APOL_SLOT_GUARD) //ms
+#define APOL_NUM_SLOTS (NUM_SUBSYSTEMS + 2) //Beacon slot, one slot per device, contention slot
+#define APOL_CONTENTION_SLOT (APOL_NUM_SLOTS - 1)
+#define APOL_SUPERFRAME (APOL_NUM_SLOTS * APOL_SLOT_LENGTH) //Time (ms) from one beacon to the next
+#define APOL_BEACON_LOSS_LIMIT (3) //Superframes without a beacon before the schedule is dropped
+
+//Group commands (see send_group()): one frame to a multicast address carries a request for a list of members, eg every POL
+//in the pit lane. The body starts with the number of members and their unicast addresses, then the payload. Each member
+//listed ACKs in its own reply slot, its place in the list, counted from the end of the frame, so the ACKs never collide and
+//the whole exchange takes one frame plus one reply slot per member. Members that did not answer are sent the request again
+//in a frame listing only them. The window bits of the FLAGS header, unused on frames to multicast addresses, mark the command
+//and its ACKs. Reply slots are timed from the frame as heard, so repeaters do not forward group commands.
+#define APOL_GROUP_COMMAND (APOL_WINDOW_LAST) //Window marker of a group command (on a frame to a multicast address)
+#define APOL_GROUP_ACK (APOL_WINDOW_SYNC) //Window marker of the ACK to a group command
+#define APOL_GROUP_MAX_MEMBERS (8) //Members one group command can list
+#define APOL_GROUP_ATTEMPTS (4) //Times send_group() sends a request before giving up on the members that have not answered
+#define APOL_GROUP_REPLY_GUARD (3) //Time (ms) at the end of each reply slot left clear, for members handling the command late
+#define APOL_GROUP_REPLY_SLOT ((APOL_BASE_FRAME_AIRTIME + 999) / 1000 + APOL_GROUP_REPLY_GUARD) //ms, a full size ACK at the base rate
+#define APOL_GROUP_MEMORY (APOL_RTO_MAX) //Time (ms) a member takes a group command with the same sequence number to be a resend
+#define APOL_NO_REPLY_SLOT (0xFF) //packet_fields::reply_slot of anything but a group command listing this device
+#define APOL_GROUP_MAX_BODY_LEN (1 + APOL_GROUP_MAX_MEMBERS + APOL_MAX_PAYLOAD_LEN) //A group command to every member it can list
+#define APOL_MAX_BODY_LEN (APOL_GROUP_MAX_BODY_LEN > APOL_ROUTE_MAX_BODY_LEN ? APOL_GROUP_MAX_BODY_LEN : APOL_ROUTE_MAX_BODY_LEN) //Longest compact frame body
+
+//Low power listening (see enable_low_power_listen()): a role with a listen interval (defaults below, see set_listen_interval())
+//keeps its radio asleep, waking it every interval for a CAD and staying in RX only if it finds a preamble. Frames to it go out
+//with a preamble that spans its interval, unless it was heard from in the last APOL_LPL_LINGER / 2 ms: a device stays in RX for
+//APOL_LPL_LINGER ms after it sends or receives, and while it waits for an ACK, so replies (ACKs) need no long preamble. The
+//interval is the worst case added to the latency of frames to the device, and each of them costs the sender about that much
+//more time transmitting.
+#define APOL_LPL_INTERVAL_HHD (500) //Time (ms) between CADs on the HHD
+#define APOL_LPL_INTERVAL_POL (0) //The POL is mains powered and always listens
+#define APOL_LPL_INTERVAL_VDD (2000) //Only RATE requests (and ACKs) are sent to the VDD, so it can sleep longer
+#define APOL_LPL_LINGER (200) //Time (ms) a device keeps listening after it sends or receives
+#define APOL_LPL_PREAMBLE_MARGIN (16) //Symbols added to a wake-up preamble, for the CAD and for wake-ups running late
+#define APOL_BASE_SYMBOL_TIME ((1UL << 7) * 1000000 / 125000) //Symbol time (us) with the RH_RF95::init() settings (SF7, 125 kHz)
+
+//Energy model: supply current (uA) of the radio in each mode, typical figures from the SX1276 datasheet. Used by radio_charge()
+//to work out the charge drawn from the time spent in each mode, and by lpl_listen_current() to estimate the average current
+//for a listen interval and traffic
+#define APOL_CURRENT_SLEEP (1) //0.2 uA, rounded up
+#define APOL_CURRENT_IDLE (1600) //Standby
+#define APOL_CURRENT_RX (11500) //125 kHz with LnaBoost
+#define APOL_CURRENT_CAD (11500) //The receiver runs for the CAD
+#define APOL_CURRENT_TX (120000) //+20 dBm on PA_BOOST, so an upper bound at lower powers
+#define APOL_LPL_WAKE_TIME (500) //Time (us) in standby for each wake-up: the crystal starting (250 us) and the SPI traffic around the CAD
+
+enum request_type {PING, GREEN, GREEN_PULSE, RED, OVERRIDE_START, OVERRIDE_STOP, DETECTION, ACK, NONE, RATE, BEACON, ROUTE, RESERVED}; //RATE and ROUTE are handled inside the library and never given to the application //Putting in an additional request type stopped the compiler from "optimizing" some control structures.
+#define APOL_NUM_APP_REQUESTS (NONE + 1) //Request types the application can send, PING to NONE
+enum subsystem {HHD, POL, VDD, REPEATER}; //Roles
 
 typedef struct packet_fields{
-  subsystem sender_device;
+  uint8_t sender_device; //Node address (see APOL_ADDRESS)
   request_type request;
-  subsystem target_device;
+  uint8_t target_device; //Node or multicast address
   uint32_t payload;
+  uint8_t sequence; //sequence number from the ID header (always 0 for legacy frames)
+  uint8_t window; //APOL_WINDOW_* marker from the FLAGS header (APOL_WINDOW_NONE for datagrams and legacy frames)
+  uint8_t auto_ack; //APOL_AUTO_ACK_* flags, set by receive_packet()
+  uint8_t reply_slot; //Place of this device in a group command's member list, APOL_NO_REPLY_SLOT if it is not listed (or not a group command)
+  unsigned long rx_time; //micros() when the frame finished arriving, set by receive_packet()
+  uint8_t hops; //Times the frame has been forwarded, 0 if heard straight from its sender
+  uint8_t route_count; //Repeaters listed in a ROUTE frame's body, 0 for other frames
+  uint8_t route_relays[APOL_MAX_HOPS]; //Their addresses, nearest the requester first
+  int8_t route_snr[APOL_MAX_HOPS]; //SNR (dB) each heard a ROUTE request with (0 in a reply)
+  int16_t rssi; //dBm, set by receive_packet()
+  int8_t snr; //dB, set by receive_packet()
 } packet_fields;
 
+//Light state vector, owned by the POL and replicated to the other devices through the snapshot in every ACK it sends
+typedef struct pol_state{
+  unsigned long end_time; //millis() when the override or pulse ends
+  uint8_t version; //Moved on by the owner at every change (skipping 0), so a replica can tell whether it is behind
+  bool green;
+  bool red;
+  bool pulse;
+  bool override;
+} pol_state;
+
+//One modem profile for the adaptive data rate
+typedef struct rate_profile{
+  RH_RF95::ModemConfig modem;
+  int8_t floor; //Lowest SNR it demodulates, in quarter dB referred to 125 kHz (wider bandwidths let in more noise, so need more)
+} rate_profile;
+
+//Adaptive data rate state for the link to one peer
+typedef struct rate_link{
+  int16_t snr; //Smoothed SNR of frames heard from the peer, in quarter dB, referred to 125 kHz and the peer at full power
+  unsigned long heard_time; //millis() when a frame from the peer was last heard
+  uint8_t samples; //Frames heard since the link last fell back (stops counting at APOL_RATE_MIN_SAMPLES)
+  uint8_t tx_rate; //The peer's listen rate, frames to it are sent with this
+  int8_t tx_power; //TX power (dBm) for frames to the peer, as it last asked
+  int8_t rx_power; //TX power (dBm) the peer was last asked to send to us with, or full power once it goes quiet
+  uint8_t losses; //Consecutive losses, see APOL_RATE_LOSS_LIMIT
+} rate_link;
+
+//A frame a repeater has forwarded, in its recently forwarded table
+typedef struct relay_entry{
+  uint32_t key; //Sender, target, sequence number and request type (see relay_key()), 0 for an empty entry
+  unsigned long time; //millis() when it was last forwarded, or its ACK heard
+  uint32_t ack_payload; //The target's ACK to it, if acked
+  uint8_t ack_window;
+  bool acked;
+} relay_entry;
+
+//What relay_packet() did with the frames it was given
+typedef struct relay_stats{
+  uint32_t forwarded; //Sent on
+  uint32_t duplicates; //Dropped, forwarded lately
+  uint32_t hop_limit; //Dropped, forwarded APOL_MAX_HOPS times already
+  uint32_t answered; //Resends of requests the target had already acknowledged, answered with a copy of its ACK
+  uint32_t direct; //Held and dropped, the target answered the sender without a repeater
+  uint32_t off_route; //Dropped, the pair has a route through other repeaters (see enable_mesh())
+} relay_stats;
+
+//A frame a repeater is holding before it forwards it
+typedef struct relay_hold{
+  packet_fields packet;
+  uint8_t frame[RH_RF95_HEADER_LEN + APOL_MAX_BODY_LEN]; //As it came, starting with the headers, to send on as it is
+  uint8_t len;
+  unsigned long due; //millis() when it goes on, unless dropped first
+  bool checking; //Held for the target's ACK, not just the random wait
+  bool used;
+} relay_hold;
+
+//A device a repeater hears directly, in its neighbour table
+typedef struct neighbour{
+  uint8_t address;
+  int16_t rssi; //Of the last frame heard from it (dBm)
+  int8_t snr; //Of the last frame heard from it (dB)
+  unsigned long heard; //millis() when it was last heard
+  uint16_t direct; //Bit per neighbour table slot: senders it has answered without a repeater
+  uint16_t relayed; //Bit per neighbour table slot: senders whose frames to it a repeater had to forward
+  unsigned long relayed_time; //millis() when a bit was last set in relayed
+} neighbour;
+
+//A route between two devices (see enable_mesh()), kept by both and by the repeaters that heard it found
+typedef struct mesh_route{
+  uint8_t source; //Device that found it, or last asked for it again
+  uint8_t target; //Device it goes to
+  uint8_t relays[APOL_MAX_HOPS]; //Repeaters on it, nearest the source first
+  uint8_t count; //Repeaters on it, APOL_NO_ROUTE until one is found
+  int8_t quality; //SNR (dB) above the floor on its weakest link, up to APOL_RATE_MARGIN
+  uint8_t sequence; //ID header of the ROUTE request that found it
+  unsigned long found; //millis() when it was found
+  unsigned long asked; //millis() when this device last sent a ROUTE request for it (on a repeater, last heard one)
+  uint8_t losses; //Consecutive ACK timeouts over it
+} mesh_route;
+
+//Called for each request in a send window once it is acknowledged (delivered true) or abandoned (delivered false)
+typedef void (*request_done_handler)(uint16_t tag, request_type request, uint32_t payload, bool delivered);
+
+//One request in a send window
+typedef struct window_slot{
+  uint32_t payload;
+  request_type request;
+  uint16_t tag; //Caller's identifier from queue_request(), handed back to the request done handler
+  unsigned long sent_time; //millis() when it was last sent
+  uint8_t transmissions; //Times it has been sent. Round trips are only measured from requests sent once (Karn's algorithm)
+} window_slot;
+
+//Send window and acknowledgement tracking for requests sent to one peer
+typedef struct peer_link{
+  uint32_t srtt; //Smoothed round trip time (ms, scaled by 8)
+  uint32_t rttvar; //Round trip time variation (ms, scaled by 4)
+  uint32_t rto; //Current retransmission timeout (ms), including backoff
+  unsigned long sent_time; //millis() when the last burst finished going out, the retransmission timer runs from here
+  TaskHandle_t waiting_task; //Task to wake when an ACK moves the window
+  window_slot window[APOL_WINDOW_SIZE]; //Indexed by sequence number modulo APOL_WINDOW_SIZE
+  uint8_t base; //Oldest unacknowledged sequence number
+  uint8_t unsent; //First sequence number not sent yet. Wound back to base to resend
+  uint8_t next; //Sequence number the next queued request will get
+  bool synced; //false until the peer acknowledges a SYNC request (at start up and after abandon_requests())
+  bool acked; //Set when an ACK moves the window, cleared by each burst
+  bool measured; //true once srtt and rttvar hold a measurement
+  uint16_t retransmissions; //Resends to this peer since begin()
+  uint32_t resent_airtime; //Airtime (us) of those resends
+} peer_link;
+
 class APOL_Comms_Lib
 {
 	public:
-		APOL_Comms_Lib(subsystem device_type, TaskHandle_t * rx_task_handle_ptr);
+		APOL_Comms_Lib(uint8_t address, TaskHandle_t * rx_task_handle_ptr, uint8_t cs_pin = RFM95_CS, uint8_t int_pin = RFM95_INT);
 		void begin();
-		void send_packet(request_type request, subsystem target_device, uint32_t payload);
+		uint8_t address();
+		void join_multicast(uint8_t address, bool join);
+		void send_packet(request_type request, uint8_t target_device, uint32_t payload);
+		bool send_packet_async(request_type request, uint8_t target_device, uint32_t payload);
 		bool check_for_packet();
 		bool check_for_any_packet();
+		bool receive_packet(packet_fields * packet, bool any_target = false);
+		bool queue_request(request_type request, uint8_t target_device, uint32_t payload, uint16_t tag = 0);
+		void on_request_done(request_done_handler handler);
+		uint8_t flush_requests(uint8_t target_device);
+		bool wait_for_ack(uint8_t target_device);
+		void abandon_requests(uint8_t target_device);
+		uint8_t window_space(uint8_t target_device);
+		uint8_t requests_outstanding(uint8_t target_device);
+		bool handle_ack(const packet_fields * ack);
+		bool accept_request(const packet_fields * request);
+		void send_ack(const packet_fields * request);
+		bool send_ack_async(const packet_fields * request);
+		bool relay_packet();
+		bool forward_held(packet_fields * packet);
+		TickType_t forward_wait();
+		const relay_stats * relay_counts();
+		const neighbour * neighbours(uint8_t * count);
+		void enable_mesh(bool enable);
+		bool find_route(uint8_t target_device);
+		const mesh_route * routes(uint8_t * count);
+		uint8_t send_group(request_type request, uint8_t target_device, const uint8_t * members, uint8_t count, uint32_t payload, uint8_t attempts = APOL_GROUP_ATTEMPTS);
+		uint32_t retransmit_timeout(uint8_t target_device);
+		const peer_link * link(uint8_t target_device);
+		void set_ack_state(const pol_state * state);
+		void enable_auto_ack(bool enable);
+		void enable_rate_adaptation(uint8_t peers, int8_t max_power);
+		bool adapt_rate();
+		uint8_t listen_rate();
+		const rate_link * rate(uint8_t address);
+		void enable_slotted_mac(bool enable);
+		bool send_beacon();
+		bool slot_synced();
+		void wait_for_slot(uint8_t frames, bool emergency);
+		void enable_low_power_listen(bool enable, int8_t power);
+		void set_listen_interval(subsystem device, uint16_t interval);
+		uint16_t listen_interval(subsystem device);
+		bool sniff();
+		uint32_t radio_charge();
+		static uint32_t lpl_listen_current(uint16_t interval, uint32_t frame_interval);
+		static const rate_profile rate_profiles[APOL_NUM_RATES];
+		static uint32_t encode_state(const pol_state * state);
+		static bool decode_state(uint32_t payload, pol_state * state);
 		packet_fields packet_contents;
-		static const constexpr char* const request_strings[] = {"PING", "GREEN", "GREEN_PULSE", "RED", "OVERRIDE_START", "OVERRIDE_STOP", "DETECTION", "ACK", "NONE"};
-		static const constexpr char* const subsystem_strings[] = {"HHD", "POL", "VDD"};
+		static const constexpr char* const request_strings[] = {"PING", "GREEN", "GREEN_PULSE", "RED", "OVERRIDE_START", "OVERRIDE_STOP", "DETECTION", "ACK", "NONE", "RATE", "BEACON", "ROUTE"};
+		static const constexpr char* const subsystem_strings[] = {"HHD", "POL", "VDD", "RPT"};
 		RH_RF95 * rf95;
-		enum subsystem _device_type;	
+		enum subsystem _device_type; //Role, from the address
+	private:
+		bool decode_frame(const uint8_t * headers, const uint8_t * body, uint8_t len, packet_fields * packet);
+		bool read_frame(const uint8_t * frame, uint8_t len, packet_fields * packet);
+		bool heard_packet(packet_fields * packet, uint8_t len, bool any_target);
+		bool forward_frame(const packet_fields * packet, const uint8_t * frame, uint8_t len);
+		bool relay_send(const packet_fields * packet, const uint8_t * frame, uint8_t len);
+		bool send_frame(request_type request, uint8_t sender_device, uint8_t target_device, uint32_t payload, uint8_t sequence, uint8_t window = APOL_WINDOW_NONE, const RH_RF95::TxSettings * settings = NULL, const uint8_t * prefix = NULL, uint8_t prefix_len = 0, uint8_t hops = 0);
+		const RH_RF95::TxSettings * tx_settings(uint8_t target_device, RH_RF95::TxSettings * settings);
+		uint8_t find_peer(uint8_t address);
+		bool for_this_device(uint8_t target_device);
+		bool rate_frame(uint8_t peer, const packet_fields * packet);
+		void rate_heard(uint8_t peer, int8_t snr);
+		void rate_loss(uint8_t peer);
+		void rate_fallback(uint8_t peer);
+		bool send_rate(uint8_t peer);
+		bool next_rate_request();
+		void set_listen_rate(uint8_t rate);
+		int8_t rate_power(uint8_t peer, uint8_t rate);
+		void beacon_heard();
+		uint32_t slot_wait(uint32_t needed, bool emergency);
+		static bool is_emergency(request_type request);
+		const RH_RF95::TxSettings * lpl_settings(uint8_t target_device, const RH_RF95::TxSettings * settings, RH_RF95::TxSettings * wake);
+		static uint8_t frame_flags(request_type request, uint8_t window);
+		static uint32_t relay_key(uint8_t sender_device, uint8_t target_device, uint8_t sequence, uint8_t request);
+		relay_entry * relay_lookup(uint32_t key);
+		uint8_t find_neighbour(uint8_t address, bool add);
+		void relay_learn(uint8_t sender_device, uint8_t target_device, bool direct);
+		bool relay_known(uint8_t sender_device, uint8_t target_device, bool direct);
+		uint8_t relay_drop_held(uint8_t sender_device, uint8_t target_device, uint8_t sequence, bool * direct);
+		uint8_t find_route_slot(uint8_t device, uint8_t other_device, bool add);
+		bool send_route_request(uint8_t slot, uint8_t target_device, uint8_t window);
+		void route_frame(const packet_fields * packet);
+		bool relay_route(const packet_fields * packet, const uint8_t * frame, uint8_t len);
+		bool route_turn(const packet_fields * packet, bool * turn);
+		void route_loss(uint8_t target_device, bool lost);
+		void refresh_routes();
+		static int8_t link_quality(int8_t snr);
+		static int8_t path_quality(const packet_fields * packet);
+		static uint8_t encode_route(const uint8_t * relays, const int8_t * snr, uint8_t count, uint8_t * body);
+		static void route_orient(mesh_route * route, uint8_t source);
+		static bool route_newer(const mesh_route * route, uint8_t source, uint8_t sequence, int8_t quality, uint8_t count);
+		static uint8_t encode_payload(uint32_t payload, uint8_t * body);
+		bool ack_fields(const packet_fields * request, uint32_t * payload, uint8_t * sequence, uint8_t * window);
+		bool wait_for_reply_slot(const packet_fields * request);
+		bool handle_group_ack(const packet_fields * ack);
+		static uint8_t auto_ack_hook(void * context, const uint8_t * frame, uint8_t len);
+		uint8_t auto_ack(const uint8_t * frame, uint8_t len);
+		uint32_t min_rto(uint8_t peer);
+		void requests_done(peer_link * peer, uint8_t end, bool delivered);
+		request_done_handler _request_done;
+		const pol_state * _ack_state; //Snapshot source for ACKs (NULL on devices that do not own the state)
+		uint8_t _address; //This device's own unicast address
+		//Peer table: the per-peer arrays below are indexed by the slot find_peer() gives a peer's address
+		uint8_t _peer_index[APOL_NUM_ADDRESSES]; //Slot + 1 for each unicast address, 0 if it has none
+		uint8_t _peer_address[APOL_MAX_PEERS]; //Address in each slot
+		unsigned long _peer_used[APOL_MAX_PEERS]; //millis() when each peer was last heard from or given a slot
+		uint8_t _num_peers; //Slots in use
+		uint8_t _datagram_sequence; //Next sequence number for datagrams to multicast addresses (and peers with no slot)
+		uint8_t _tx_sequence[APOL_MAX_PEERS]; //Next datagram sequence number for each peer
+		peer_link _links[APOL_MAX_PEERS];
+		uint8_t _rx_expected[APOL_MAX_PEERS]; //Next windowed sequence number expected from each peer
+		request_type _rx_last_request[APOL_MAX_PEERS]; //Last windowed request accepted from each peer, echoed in the ACK payload
+		bool _rx_synced[APOL_MAX_PEERS]; //false until a windowed request has been accepted from the peer
+		uint8_t _rx_group_sequence[APOL_MAX_PEERS]; //Sequence number of the last group command accepted from each peer
+		unsigned long _rx_group_time[APOL_MAX_PEERS]; //millis() when it was accepted
+		bool _rx_group_heard[APOL_MAX_PEERS]; //false until a group command has been accepted from the peer
+		//Group command in flight from send_group()
+		uint8_t _group_members[APOL_GROUP_MAX_MEMBERS]; //Unicast addresses, as given to send_group()
+		uint8_t _group_count; //Members, 0 while no group command is in flight
+		uint8_t _group_acked; //Bit per member that has acknowledged
+		uint8_t _group_sequence; //ID header of the command
+		TaskHandle_t _group_task; //Task to wake once every member has acknowledged
+		relay_entry _relay_cache[APOL_RELAY_CACHE_SIZE]; //Frames forwarded lately, see APOL_MAX_HOPS
+		relay_stats _relay_stats;
+		relay_hold _relay_held[APOL_RELAY_HOLD_SLOTS];
+		neighbour _neighbours[APOL_MAX_NEIGHBOURS];
+		uint8_t _num_neighbours; //Slots in use
+		mesh_route _routes[APOL_MAX_ROUTES];
+		uint8_t _num_routes; //Slots in use
+		bool _mesh_enabled; //Set by enable_mesh()
+		uint8_t _route_sequence; //ID header of the next ROUTE request
+		TaskHandle_t _route_task; //Task in find_route() to wake when a ROUTE reply comes
+		rate_link _rates[APOL_MAX_PEERS];
+		uint8_t _rate_peers; //APOL_PEER() mask of the roles that send to this device, whose links the listen rate must suit
+		int8_t _rate_max_power; //Full TX power (dBm), until a peer asks for less
+		uint8_t _rx_rate; //Listen rate
+		int8_t _rate_power[APOL_MAX_PEERS]; //Power each peer is being asked to use by the change in progress
+		uint8_t _rate_acked; //Mask (bit per slot) of the peers that have acknowledged the change in progress (or need no change)
+		uint8_t _rate_asking; //Peer the RATE request in flight went to, APOL_NO_PEER if no change is in progress
+		uint8_t _rate_sequence; //ID header of the RATE request in flight
+		uint8_t _rate_attempts; //Times it has been sent
+		unsigned long _rate_sent_time; //millis() when it was last sent
+		unsigned long _rate_holdoff; //millis() before which the listen rate is not raised
+		bool _rate_enabled; //Set by enable_rate_adaptation()
+		bool _slotted; //Set by enable_slotted_mac()
+		bool _beacon_heard; //true once the superframe start below is known
+		unsigned long _superframe_start; //micros() when the last beacon heard (or sent, on the POL) started
+		uint8_t _beacon_sequence; //Superframe count, the ID header of the POL's next beacon
+		bool _lpl_enabled; //Set by enable_low_power_listen()
+		int8_t _lpl_power; //TX power (dBm) for wake-up frames, without rate adaptation
+		uint16_t _lpl_interval[NUM_SUBSYSTEMS]; //Listen interval (ms) of each role, 0 if it always listens
+		unsigned long _lpl_heard[APOL_MAX_PEERS]; //millis() when a frame from each peer was last heard
+		unsigned long _lpl_active; //millis() when this device last sent or received a frame
 };
 
 #endif
\ No newline at end of file
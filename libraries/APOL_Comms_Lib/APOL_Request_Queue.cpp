@@ -0,0 +1,290 @@
+#include <APOL_Request_Queue.h>
+
+APOL_Request_Queue::APOL_Request_Queue(uint8_t capacity, bool coalesce)
+{
+	_capacity = min(capacity, (uint8_t)APOL_REQUEST_QUEUE_LEN);
+	memset(_records, 0, sizeof(_records));
+	memset(_head, 0, sizeof(_head));
+	memset(_used, 0, sizeof(_used));
+	memset(_drops, 0, sizeof(_drops));
+	_count = 0;
+	_high_water = 0;
+	_superseded = 0;
+	_coalesced = 0;
+	_coalesce = coalesce;
+	_next_tag = 0;
+	memset(_completions, 0, sizeof(_completions));
+}
+
+//Name: priority_of
+//Purpose: Gives the priority class a request is queued in.
+//Inputs: request
+//Outputs: PRIORITY_OVERRIDE for override start and stop, PRIORITY_SAFETY for RED, otherwise PRIORITY_NORMAL
+request_priority APOL_Request_Queue::priority_of(request_type request)
+{
+	switch (request){
+		case OVERRIDE_START:
+		case OVERRIDE_STOP:
+			return PRIORITY_OVERRIDE;
+		case RED:
+			return PRIORITY_SAFETY;
+		default:
+			return PRIORITY_NORMAL;
+	}
+}
+
+//Name: light_of
+//Purpose: Gives the light a request sets, for coalescing. GREEN and GREEN_PULSE both drive the green light.
+//Inputs: request
+//Outputs: LIGHT_GREEN, LIGHT_RED, or LIGHT_NONE for requests that are not coalesced
+request_light APOL_Request_Queue::light_of(request_type request)
+{
+	switch (request){
+		case GREEN:
+		case GREEN_PULSE:
+			return LIGHT_GREEN;
+		case RED:
+			return LIGHT_RED;
+		default:
+			return LIGHT_NONE;
+	}
+}
+
+//Name: send
+//Purpose: Copies a request into the queue. For use from tasks, not interrupts.
+//Inputs: request, target_device, payload, callback (optional, see reserve()), arg (passed to callback)
+//Outputs: false if the request's priority class was full (counted in drops())
+bool APOL_Request_Queue::send(request_type request, uint8_t target_device, uint32_t payload, request_callback callback, void * arg)
+{
+	request_record * record = reserve(request, callback, arg);
+	if (record == NULL) return 0;
+	record -> target_device = target_device;
+	record -> payload = payload;
+	commit(record);
+	return 1;
+}
+
+//Name: reserve
+//Purpose: Zero-copy enqueue. Claims the next record in the request's priority class with the request type filled in.
+//         Fill in target_device and payload in place, then commit() it. Until then the receiver does not see it (or
+//         anything queued after it in the same class). For use from tasks, not interrupts.
+//         The callback, if given, is called from complete() once the request (or the one it was coalesced into) is
+//         acknowledged or given up on.
+//Inputs: request (decides the priority class, so it must not be changed before commit()), callback (optional), arg (passed to callback)
+//Outputs: The record to fill in, or NULL if the class is full (counted in drops())
+request_record * APOL_Request_Queue::reserve(request_type request, request_callback callback, void * arg)
+{
+	request_priority priority = priority_of(request);
+	request_record * record = NULL;
+	request_completion * completion = NULL;
+
+	taskENTER_CRITICAL();
+	if (callback != NULL){
+		for (uint8_t idx = 0; idx < APOL_REQUEST_CALLBACKS && completion == NULL; idx++){
+			if (_completions[idx].count == 0) completion = &_completions[idx];
+		}
+	}
+	if (_used[priority] < _capacity && (callback == NULL || completion != NULL)){
+		record = &_records[priority][(_head[priority] + _used[priority]) % _capacity];
+		_used[priority]++;
+		record -> state = RECORD_RESERVED;
+		record -> request = request;
+		if (++_next_tag == 0) _next_tag = 1; //0 is left for requests sent without a record
+		record -> tag = _next_tag;
+		if (completion != NULL){
+			completion -> callback = callback;
+			completion -> arg = arg;
+			completion -> tag = record -> tag;
+			completion -> count = 1;
+		}
+	}
+	else _drops[priority]++;
+	taskEXIT_CRITICAL();
+
+	return record;
+}
+
+//Name: commit
+//Purpose: Makes a record from reserve() visible to the receiver. A RED discards any GREEN or GREEN_PULSE to the same
+//         target still waiting in a lower class, since it jumps ahead of them and they would undo it.
+//         If coalescing is on and an older record for the same target and light is still waiting, the new request
+//         replaces its contents instead of being queued behind it, so only the latest state is sent.
+//Inputs: record (from reserve())
+//Outputs: None
+void APOL_Request_Queue::commit(request_record * record)
+{
+	taskENTER_CRITICAL();
+	if (record -> request == RED) supersede(record);
+	if (!coalesce(record)){
+		record -> state = RECORD_READY;
+		_count++;
+		if (_count > _high_water) _high_water = _count;
+	}
+	taskEXIT_CRITICAL();
+}
+
+//Name: coalesce
+//Purpose: Folds a record being committed into the newest older record still waiting in its class for the same target
+//         and light. The waiting record takes the new request and payload (the latest absolute state) and the new
+//         record's callbacks, and the new record is discarded. Called with interrupts off.
+//Inputs: record (being committed)
+//Outputs: true if the record was folded into a waiting one
+bool APOL_Request_Queue::coalesce(request_record * record)
+{
+	request_light light = light_of(record -> request);
+	if (!_coalesce || light == LIGHT_NONE) return 0;
+
+	request_priority priority = priority_of(record -> request);
+	uint8_t position = (record - _records[priority] + _capacity - _head[priority]) % _capacity;
+	for (uint8_t idx = position; idx-- > 0;){
+		request_record * waiting = &_records[priority][(_head[priority] + idx) % _capacity];
+		if (waiting -> state == RECORD_READY && waiting -> target_device == record -> target_device && light_of(waiting -> request) == light){
+			waiting -> request = record -> request;
+			waiting -> payload = record -> payload;
+			move_callbacks(record -> tag, waiting -> tag);
+			record -> state = RECORD_SUPERSEDED;
+			_coalesced++;
+			return 1;
+		}
+	}
+	return 0;
+}
+
+//Name: supersede
+//Purpose: Marks waiting GREEN and GREEN_PULSE records to the same target as record superseded. Their callbacks move to
+//         record, since it is what ends up being sent instead. Called with interrupts off.
+//Inputs: record (the RED being committed)
+//Outputs: None
+void APOL_Request_Queue::supersede(const request_record * record)
+{
+	for (uint8_t priority = priority_of(record -> request) + 1; priority < NUM_PRIORITIES; priority++){
+		for (uint8_t idx = 0; idx < _used[priority]; idx++){
+			request_record * waiting = &_records[priority][(_head[priority] + idx) % _capacity];
+			if (waiting -> state == RECORD_READY && waiting -> target_device == record -> target_device
+				&& (waiting -> request == GREEN || waiting -> request == GREEN_PULSE)){
+				waiting -> state = RECORD_SUPERSEDED;
+				move_callbacks(waiting -> tag, record -> tag);
+				_count--;
+				_superseded++;
+			}
+		}
+	}
+}
+
+//Name: receive
+//Purpose: Takes the oldest waiting record from the highest priority class that has one, skipping superseded records.
+//Inputs: record (where to copy it)
+//Outputs: true if a record was copied out
+bool APOL_Request_Queue::receive(request_record * record)
+{
+	bool received = 0;
+
+	taskENTER_CRITICAL();
+	for (uint8_t priority = 0; priority < NUM_PRIORITIES && !received; priority++){
+		while (_used[priority] > 0){
+			request_record * oldest = &_records[priority][_head[priority]];
+			if (oldest -> state == RECORD_RESERVED) break; //Still being filled in, and the rest of the class is behind it
+			if (oldest -> state == RECORD_READY){
+				*record = *oldest;
+				_count--;
+				received = 1;
+			}
+			oldest -> state = RECORD_FREE;
+			_head[priority] = (_head[priority] + 1) % _capacity;
+			_used[priority]--;
+			if (received) break;
+		}
+	}
+	taskEXIT_CRITICAL();
+
+	return received;
+}
+
+//Name: move_callbacks
+//Purpose: Moves the callbacks waiting on one record to another. A callback with the same function and argument as one
+//         already on the other record is merged into it. Called with interrupts off.
+//Inputs: from_tag, to_tag
+//Outputs: None
+void APOL_Request_Queue::move_callbacks(uint16_t from_tag, uint16_t to_tag)
+{
+	for (uint8_t idx = 0; idx < APOL_REQUEST_CALLBACKS; idx++){
+		request_completion * moving = &_completions[idx];
+		if (moving -> count == 0 || moving -> tag != from_tag) continue;
+		moving -> tag = to_tag;
+		for (uint8_t other = 0; other < APOL_REQUEST_CALLBACKS; other++){
+			request_completion * same = &_completions[other];
+			if (other != idx && same -> count != 0 && same -> tag == to_tag && same -> callback == moving -> callback
+				&& same -> arg == moving -> arg && same -> count <= 255 - moving -> count){
+				same -> count += moving -> count;
+				moving -> count = 0;
+				break;
+			}
+		}
+	}
+}
+
+//Name: complete
+//Purpose: Reports the fate of a request taken from the queue to every callback waiting on it, once for each request
+//         folded into it. Call it from APOL_Comms_Lib's request done handler. The callbacks run in the caller's task,
+//         with interrupts on.
+//Inputs: tag (from the record), request and payload (as sent), delivered (true if acknowledged, false if given up on)
+//Outputs: None
+void APOL_Request_Queue::complete(uint16_t tag, request_type request, uint32_t payload, bool delivered)
+{
+	if (tag == 0) return;
+	for (uint8_t idx = 0; idx < APOL_REQUEST_CALLBACKS; idx++){
+		request_completion completion;
+		taskENTER_CRITICAL();
+		completion = _completions[idx];
+		if (completion.count != 0 && completion.tag == tag) _completions[idx].count = 0;
+		else completion.count = 0;
+		taskEXIT_CRITICAL();
+
+		while (completion.count-- > 0) completion.callback(request, payload, delivered, completion.arg);
+	}
+}
+
+//Name: count
+//Purpose: Gives the number of records waiting to be received.
+//Inputs: None
+//Outputs: Waiting records, all classes
+uint8_t APOL_Request_Queue::count()
+{
+	return _count;
+}
+
+//Name: high_water
+//Purpose: Gives the most records that have been waiting at once.
+//Inputs: None
+//Outputs: High-water mark since construction
+uint8_t APOL_Request_Queue::high_water()
+{
+	return _high_water;
+}
+
+//Name: drops
+//Purpose: Gives the number of requests refused because their priority class was full.
+//Inputs: priority
+//Outputs: Drop count since construction
+uint16_t APOL_Request_Queue::drops(request_priority priority)
+{
+	return priority < NUM_PRIORITIES ? _drops[priority] : 0;
+}
+
+//Name: superseded
+//Purpose: Gives the number of requests discarded because a later RED jumped ahead of them.
+//Inputs: None
+//Outputs: Superseded count since construction
+uint16_t APOL_Request_Queue::superseded()
+{
+	return _superseded;
+}
+
+//Name: coalesced
+//Purpose: Gives the number of requests folded into an older waiting request for the same light.
+//Inputs: None
+//Outputs: Coalesced count since construction
+uint16_t APOL_Request_Queue::coalesced()
+{
+	return _coalesced;
+}
@@ -0,0 +1,76 @@
+/*
+  APOL_Request_Queue.h - Outgoing request queue with priority classes for Automated Pit Out Lighting (APOL) devices.
+  Replaces the pair of FreeRTOS queues (request type and payload) that each sender used to keep in step by hand.
+*/
+
+
+#ifndef APOL_Request_Queue_h
+#define APOL_Request_Queue_h
+
+#include <APOL_Comms_Lib.h>
+
+#define APOL_REQUEST_QUEUE_LEN (10) //Most records each priority class can hold
+#define APOL_REQUEST_CALLBACKS (NUM_PRIORITIES * APOL_REQUEST_QUEUE_LEN + APOL_WINDOW_SIZE) //Completion callbacks that can be waiting at once, enough for one on every queued record and every request in the send window
+
+//Priority classes, highest first. Overrides and RED are safety critical and are sent ahead of anything queued in a lower class.
+enum request_priority {PRIORITY_OVERRIDE, PRIORITY_SAFETY, PRIORITY_NORMAL, NUM_PRIORITIES};
+
+enum record_state {RECORD_FREE, RECORD_RESERVED, RECORD_READY, RECORD_SUPERSEDED};
+
+//Light a request sets. Waiting requests to the same target for the same light are coalesced into the latest one.
+enum request_light {LIGHT_NONE, LIGHT_GREEN, LIGHT_RED};
+
+//Called once per queued request when the request it ended up in (after coalescing) is acknowledged or given up on.
+//request and payload are what was actually sent, which may be a later state than the one queued.
+typedef void (*request_callback)(request_type request, uint32_t payload, bool delivered, void * arg);
+
+typedef struct request_record{
+  request_type request;
+  uint8_t target_device; //Node address (see APOL_ADDRESS)
+  uint32_t payload;
+  uint16_t tag; //Identifies the record's callbacks. Pass it to APOL_Comms_Lib::queue_request() and back to complete()
+  volatile uint8_t state; //record_state, managed by the queue
+} request_record;
+
+typedef struct request_completion{
+  request_callback callback;
+  void * arg;
+  uint16_t tag; //Record the callback waits on
+  uint8_t count; //Requests waiting with this callback and argument (0 when the entry is free)
+} request_completion;
+
+class APOL_Request_Queue
+{
+	public:
+		APOL_Request_Queue(uint8_t capacity = APOL_REQUEST_QUEUE_LEN, bool coalesce = true);
+		bool send(request_type request, uint8_t target_device, uint32_t payload, request_callback callback = NULL, void * arg = NULL);
+		request_record * reserve(request_type request, request_callback callback = NULL, void * arg = NULL);
+		void commit(request_record * record);
+		bool receive(request_record * record);
+		void complete(uint16_t tag, request_type request, uint32_t payload, bool delivered);
+		uint8_t count();
+		uint8_t high_water();
+		uint16_t drops(request_priority priority);
+		uint16_t superseded();
+		uint16_t coalesced();
+		static request_priority priority_of(request_type request);
+		static request_light light_of(request_type request);
+	private:
+		void supersede(const request_record * record);
+		bool coalesce(request_record * record);
+		void move_callbacks(uint16_t from_tag, uint16_t to_tag);
+		request_record _records[NUM_PRIORITIES][APOL_REQUEST_QUEUE_LEN];
+		uint8_t _head[NUM_PRIORITIES]; //Oldest record in each class
+		uint8_t _used[NUM_PRIORITIES]; //Records reserved, waiting or superseded (not yet reclaimed) in each class
+		uint8_t _capacity; //Records per class, up to APOL_REQUEST_QUEUE_LEN
+		uint8_t _count; //Records waiting to be received, all classes
+		uint8_t _high_water; //Most records ever waiting at once
+		uint16_t _drops[NUM_PRIORITIES]; //Records refused because their class was full
+		uint16_t _superseded; //Records discarded because a later request in a higher class undoes them
+		uint16_t _coalesced; //Records folded into a waiting record for the same light
+		bool _coalesce; //Whether light requests are coalesced
+		uint16_t _next_tag;
+		request_completion _completions[APOL_REQUEST_CALLBACKS];
+};
+
+#endif
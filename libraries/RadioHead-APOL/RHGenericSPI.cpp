@@ -29,3 +29,21 @@ void RHGenericSPI::setFrequency(Frequency frequency)
     _frequency = frequency;
 }
 
+void RHGenericSPI::transferBuffer(const uint8_t* src, uint8_t* dest, uint16_t len)
+{
+    while (len--)
+    {
+	uint8_t val = transfer(src ? *src++ : 0);
+	if (dest)
+	    *dest++ = val;
+    }
+}
+
+bool RHGenericSPI::transferBufferAsync(const uint8_t* src, uint8_t* dest, uint16_t len,
+				       TransferCallback callback, void* arg)
+{
+    transferBuffer(src, dest, len);
+    if (callback)
+	callback(arg);
+    return true;
+}
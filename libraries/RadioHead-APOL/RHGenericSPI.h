@@ -159,6 +159,32 @@ public:
     /// Might be overridden in subclass
     virtual void endTransaction(){}
 
+    /// Type of the function called when a transferBufferAsync() completes
+    typedef void (*TransferCallback)(void* arg);
+
+    /// Transfer a number of octets to and from the SPI interface.
+    /// Used by RHSPIDriver for burst reads and writes.
+    /// Base does it one octet at a time with transfer(). Subclasses with DMA can do better.
+    /// \param[in] src Octets to send, or NULL to send 0s (eg for a burst read)
+    /// \param[in] dest Where to put the octets read while sending, or NULL to discard them (eg for a burst write)
+    /// \param[in] len Number of octets to transfer
+    virtual void transferBuffer(const uint8_t* src, uint8_t* dest, uint16_t len);
+
+    /// Start transferring a number of octets to and from the SPI interface, and call callback(arg)
+    /// when the transfer is complete. On a DMA capable subclass this returns as soon as the transfer
+    /// has started and the callback is made from the DMA interrupt.
+    /// Base does the transfer with transferBuffer() and calls the callback before returning.
+    /// The caller is responsible for the slave select and for not starting another transfer on
+    /// this interface until the callback has been made.
+    /// \param[in] src Octets to send, or NULL to send 0s
+    /// \param[in] dest Where to put the octets read, or NULL to discard them
+    /// \param[in] len Number of octets to transfer
+    /// \param[in] callback Function to call when the transfer is complete. May be NULL
+    /// \param[in] arg Argument to pass to callback
+    /// \return true if the transfer was started
+    virtual bool transferBufferAsync(const uint8_t* src, uint8_t* dest, uint16_t len,
+				     TransferCallback callback, void* arg);
+
     /// Specify the interrupt number of the interrupt that will use SPI transactions
     /// Tells the SPI support software that SPI transactions will occur with the interrupt
     /// handler assocated with interruptNumber
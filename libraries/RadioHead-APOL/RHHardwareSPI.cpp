@@ -469,6 +469,9 @@ void RHHardwareSPI::begin()
         frequency = 1000000;
 
     SPI.begin(frequency, bitOrder, dataMode);
+#elif (RH_PLATFORM == RH_PLATFORM_UNIX)
+    // Simulated bus, there is no clock or mode to set
+    SPI.begin();
 #else
  #warning RHHardwareSPI does not support this platform yet. Consider adding it and contributing a patch.
 #endif
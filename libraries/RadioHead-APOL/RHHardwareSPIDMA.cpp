@@ -0,0 +1,195 @@
+// RHHardwareSPIDMA.cpp
+//
+// SAMD21 hardware SPI with DMA transfers for RadioHead
+
+#include <RHHardwareSPIDMA.h>
+
+#ifdef RH_HAVE_SAMD21_DMA
+
+// Declare a single default instance of the DMA SPI interface class
+RHHardwareSPIDMA hardware_spi_dma;
+
+// The DMAC fetches each channel's descriptor from BASEADDR and writes progress back to WRBADDR.
+// Both tables are indexed by channel and must be 128 bit aligned
+static DmacDescriptor dmaDescriptors[RH_DMA_NUM_CHANNELS] __attribute__((aligned(16)));
+static DmacDescriptor dmaWriteback[RH_DMA_NUM_CHANNELS] __attribute__((aligned(16)));
+
+// Which interface to tell when a channel completes
+static RHHardwareSPIDMA* dmaOwner[RH_DMA_NUM_CHANNELS];
+
+// Sent when there is no source buffer, and where received octets go when there is no destination buffer
+static const uint8_t dmaZero = 0;
+static uint8_t dmaDiscard;
+
+// Enable the DMAC once, whichever interface gets there first
+static void dmacInit()
+{
+    if (DMAC->CTRL.bit.DMAENABLE)
+	return;
+    PM->AHBMASK.bit.DMAC_ = 1;
+    PM->APBBMASK.bit.DMAC_ = 1;
+    DMAC->CTRL.bit.SWRST = 1;
+    while (DMAC->CTRL.bit.SWRST)
+	;
+    DMAC->BASEADDR.reg = (uint32_t)dmaDescriptors;
+    DMAC->WRBADDR.reg = (uint32_t)dmaWriteback;
+    DMAC->CTRL.reg = DMAC_CTRL_DMAENABLE | DMAC_CTRL_LVLEN(0xf);
+    NVIC_EnableIRQ(DMAC_IRQn);
+}
+
+RHHardwareSPIDMA::RHHardwareSPIDMA(Sercom* sercom, uint8_t rxTrigger, uint8_t txTrigger,
+				   uint8_t rxChannel, uint8_t txChannel,
+				   Frequency frequency, BitOrder bitOrder, DataMode dataMode)
+    :
+    RHHardwareSPI(frequency, bitOrder, dataMode),
+    _sercom(sercom),
+    _rxTrigger(rxTrigger),
+    _txTrigger(txTrigger),
+    _rxChannel(rxChannel),
+    _txChannel(txChannel),
+    _busy(false),
+    _callback(NULL),
+    _callbackArg(NULL)
+{
+}
+
+void RHHardwareSPIDMA::begin()
+{
+    RHHardwareSPI::begin();
+    dmacInit();
+    dmaOwner[_rxChannel] = this;
+    dmaOwner[_txChannel] = this;
+    // The receive channel finishes last, so it is the one that signals completion
+    configureChannel(_rxChannel, _rxTrigger, true);
+    configureChannel(_txChannel, _txTrigger, false);
+}
+
+void RHHardwareSPIDMA::configureChannel(uint8_t channel, uint8_t trigger, bool interruptOnComplete)
+{
+    ATOMIC_BLOCK_START;
+    DMAC->CHID.reg = DMAC_CHID_ID(channel);
+    DMAC->CHCTRLA.reg &= ~DMAC_CHCTRLA_ENABLE;
+    DMAC->CHCTRLA.reg = DMAC_CHCTRLA_SWRST;
+    while (DMAC->CHCTRLA.reg & DMAC_CHCTRLA_SWRST)
+	;
+    DMAC->CHCTRLB.reg = DMAC_CHCTRLB_LVL(0) | DMAC_CHCTRLB_TRIGSRC(trigger) | DMAC_CHCTRLB_TRIGACT_BEAT;
+    if (interruptOnComplete)
+	DMAC->CHINTENSET.reg = DMAC_CHINTENSET_TCMPL;
+    ATOMIC_BLOCK_END;
+}
+
+void RHHardwareSPIDMA::startTransfer(const uint8_t* src, uint8_t* dest, uint16_t len)
+{
+    volatile void* data = &_sercom->SPI.DATA.reg;
+
+    // When an address increments, the descriptor holds the address one past the last octet
+    DmacDescriptor* rx = &dmaDescriptors[_rxChannel];
+    rx->BTCTRL.reg = DMAC_BTCTRL_VALID | DMAC_BTCTRL_BEATSIZE_BYTE | DMAC_BTCTRL_BLOCKACT_NOACT
+	| (dest ? DMAC_BTCTRL_DSTINC : 0);
+    rx->BTCNT.reg = len;
+    rx->SRCADDR.reg = (uint32_t)data;
+    rx->DSTADDR.reg = dest ? (uint32_t)(dest + len) : (uint32_t)&dmaDiscard;
+    rx->DESCADDR.reg = 0;
+
+    DmacDescriptor* tx = &dmaDescriptors[_txChannel];
+    tx->BTCTRL.reg = DMAC_BTCTRL_VALID | DMAC_BTCTRL_BEATSIZE_BYTE | DMAC_BTCTRL_BLOCKACT_NOACT
+	| (src ? DMAC_BTCTRL_SRCINC : 0);
+    tx->BTCNT.reg = len;
+    tx->SRCADDR.reg = src ? (uint32_t)(src + len) : (uint32_t)&dmaZero;
+    tx->DSTADDR.reg = (uint32_t)data;
+    tx->DESCADDR.reg = 0;
+
+    // Receive must be listening before the first octet is clocked out
+    ATOMIC_BLOCK_START;
+    DMAC->CHID.reg = DMAC_CHID_ID(_rxChannel);
+    DMAC->CHINTFLAG.reg = DMAC_CHINTFLAG_MASK;
+    DMAC->CHCTRLA.reg |= DMAC_CHCTRLA_ENABLE;
+    DMAC->CHID.reg = DMAC_CHID_ID(_txChannel);
+    DMAC->CHINTFLAG.reg = DMAC_CHINTFLAG_MASK;
+    DMAC->CHCTRLA.reg |= DMAC_CHCTRLA_ENABLE;
+    ATOMIC_BLOCK_END;
+}
+
+void RHHardwareSPIDMA::transferBuffer(const uint8_t* src, uint8_t* dest, uint16_t len)
+{
+    if (len == 0)
+	return;
+    // An async transfer may still be running, and its completion may be pending with interrupts
+    // disabled (eg inside an RHSPIDriver ATOMIC_BLOCK), so poll for it rather than wait for the DMAC interrupt
+    while (_busy)
+	pollComplete();
+    _busy = true;
+    _callback = NULL;
+    startTransfer(src, dest, len);
+
+    // With interrupts enabled DMAC_Handler() clears _busy, otherwise pollComplete() does
+    while (_busy)
+	pollComplete();
+}
+
+void RHHardwareSPIDMA::pollComplete()
+{
+    ATOMIC_BLOCK_START;
+    if (_busy && (DMAC->INTSTATUS.reg & (1 << _rxChannel)))
+    {
+	uint8_t saved = DMAC->CHID.reg;
+	DMAC->CHID.reg = DMAC_CHID_ID(_rxChannel);
+	DMAC->CHINTFLAG.reg = DMAC_CHINTFLAG_MASK;
+	DMAC->CHID.reg = saved;
+	transferComplete();
+    }
+    ATOMIC_BLOCK_END;
+}
+
+bool RHHardwareSPIDMA::transferBufferAsync(const uint8_t* src, uint8_t* dest, uint16_t len,
+					   TransferCallback callback, void* arg)
+{
+    if (_busy)
+	return false;
+    if (len == 0)
+    {
+	if (callback)
+	    callback(arg);
+	return true;
+    }
+    _busy = true;
+    _callbackArg = arg;
+    _callback = callback;
+    startTransfer(src, dest, len);
+    return true;
+}
+
+bool RHHardwareSPIDMA::busy()
+{
+    return _busy;
+}
+
+void RHHardwareSPIDMA::transferComplete()
+{
+    TransferCallback callback = _callback;
+    _callback = NULL;
+    _busy = false;
+    if (callback)
+	callback(_callbackArg);
+}
+
+// Replaces the weak default handler in the SAMD core
+extern "C" void DMAC_Handler()
+{
+    // Code outside may have been part way through using CHID
+    uint8_t saved = DMAC->CHID.reg;
+    uint32_t pending = DMAC->INTSTATUS.reg;
+    for (uint8_t channel = 0; channel < RH_DMA_NUM_CHANNELS; channel++)
+    {
+	if (!(pending & (1 << channel)))
+	    continue;
+	DMAC->CHID.reg = DMAC_CHID_ID(channel);
+	uint8_t flags = DMAC->CHINTFLAG.reg;
+	DMAC->CHINTFLAG.reg = flags;
+	if ((flags & DMAC_CHINTFLAG_TCMPL) && dmaOwner[channel])
+	    dmaOwner[channel]->transferComplete();
+    }
+    DMAC->CHID.reg = saved;
+}
+
+#endif
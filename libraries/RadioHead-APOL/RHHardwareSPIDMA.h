@@ -0,0 +1,116 @@
+// RHHardwareSPIDMA.h
+//
+// SAMD21 hardware SPI with DMA transfers for RadioHead
+// Used by the APOL project to move RFM95 FIFO data without the CPU feeding every octet
+
+#ifndef RHHardwareSPIDMA_h
+#define RHHardwareSPIDMA_h
+
+#include <RHHardwareSPI.h>
+
+// SAMD21 (eg Adafruit Feather M0) with the Arduino SAMD core: SERCOM SPI and DMAC available
+#if (RH_PLATFORM == RH_PLATFORM_ARDUINO) && defined(ARDUINO_ARCH_SAMD) && defined(__SAMD21G18A__)
+ #define RH_HAVE_SAMD21_DMA
+#endif
+
+#ifdef RH_HAVE_SAMD21_DMA
+
+// Number of DMAC channels that can be used through RHHardwareSPIDMA.
+// Each SPI interface uses 2 (receive and transmit). The SAMD21 has 12.
+#ifndef RH_DMA_NUM_CHANNELS
+ #define RH_DMA_NUM_CHANNELS 4
+#endif
+
+/////////////////////////////////////////////////////////////////////
+/// \class RHHardwareSPIDMA RHHardwareSPIDMA.h <RHHardwareSPIDMA.h>
+/// \brief Hardware SPI bus interface that moves buffers by DMA on SAMD21
+///
+/// Single octets still go through RHHardwareSPI::transfer(). Buffers passed to transferBuffer()
+/// and transferBufferAsync() (ie RHSPIDriver burst reads and writes, such as the RH_RF95 FIFO)
+/// are moved by two DMAC channels triggered by the SERCOM: one feeds the transmit data register and
+/// one drains the receive data register, so the SPI clock runs back to back with no CPU work per octet.
+///
+/// transferBufferAsync() returns as soon as the channels are running and calls the callback from
+/// the DMAC interrupt. transferBuffer() waits for completion, of its own transfer and of an async one still
+/// running: if interrupts are disabled (as they are inside RHSPIDriver's ATOMIC_BLOCK) it polls the DMAC and
+/// calls the async transfer's callback itself, otherwise the DMAC interrupt ends the wait.
+///
+/// The DMAC descriptor tables are owned by this class. Other SPI peripherals on the board can use
+/// DMA by creating their own instance on a different SERCOM and pair of channels.
+class RHHardwareSPIDMA : public RHHardwareSPI
+{
+public:
+    /// Constructor
+    /// \param[in] sercom The SERCOM the SPI bus is on. Defaults to SERCOM4, used by SPI on the Feather M0
+    /// \param[in] rxTrigger DMAC trigger for the SERCOM receive register, eg SERCOM4_DMAC_ID_RX
+    /// \param[in] txTrigger DMAC trigger for the SERCOM transmit register, eg SERCOM4_DMAC_ID_TX
+    /// \param[in] rxChannel DMAC channel to use for receiving. Must be less than RH_DMA_NUM_CHANNELS
+    /// \param[in] txChannel DMAC channel to use for transmitting. Must be less than RH_DMA_NUM_CHANNELS
+    /// \param[in] frequency One of RHGenericSPI::Frequency to select the SPI bus frequency
+    /// \param[in] bitOrder Select the SPI bus bit order
+    /// \param[in] dataMode Selects the SPI bus data mode
+    RHHardwareSPIDMA(Sercom* sercom = SERCOM4, uint8_t rxTrigger = SERCOM4_DMAC_ID_RX, uint8_t txTrigger = SERCOM4_DMAC_ID_TX,
+		     uint8_t rxChannel = 0, uint8_t txChannel = 1,
+		     Frequency frequency = Frequency1MHz, BitOrder bitOrder = BitOrderMSBFirst, DataMode dataMode = DataMode0);
+
+    /// Initialise the SPI library and set up the DMAC channels
+    void begin();
+
+    /// Transfer a buffer by DMA and wait for it to finish
+    /// \param[in] src Octets to send, or NULL to send 0s
+    /// \param[in] dest Where to put the octets read, or NULL to discard them
+    /// \param[in] len Number of octets to transfer
+    void transferBuffer(const uint8_t* src, uint8_t* dest, uint16_t len);
+
+    /// Start a DMA transfer and return. callback(arg) is called from the DMAC interrupt when it completes.
+    /// \param[in] src Octets to send, or NULL to send 0s. Must stay valid until the callback
+    /// \param[in] dest Where to put the octets read, or NULL to discard them. Must stay valid until the callback
+    /// \param[in] len Number of octets to transfer
+    /// \param[in] callback Function to call when the transfer is complete. May be NULL
+    /// \param[in] arg Argument to pass to callback
+    /// \return true if the transfer was started, false if a transfer is already in progress
+    bool transferBufferAsync(const uint8_t* src, uint8_t* dest, uint16_t len,
+			     TransferCallback callback, void* arg);
+
+    /// \return true if a DMA transfer is in progress
+    bool busy();
+
+    /// Called from the DMAC interrupt handler when a channel completes. Not for user code
+    void transferComplete();
+
+protected:
+    /// Load the descriptors for both channels and enable them, receive first
+    void startTransfer(const uint8_t* src, uint8_t* dest, uint16_t len);
+
+    /// Completes the running transfer if the receive channel has finished but the DMAC interrupt has not
+    /// run (interrupts disabled), clearing its flags and calling any callback as DMAC_Handler() would
+    void pollComplete();
+
+    /// Reset a channel and set its trigger
+    void configureChannel(uint8_t channel, uint8_t trigger, bool interruptOnComplete);
+
+    /// The SERCOM in use
+    Sercom*                     _sercom;
+
+    /// DMAC triggers for the SERCOM data register
+    uint8_t                     _rxTrigger;
+    uint8_t                     _txTrigger;
+
+    /// DMAC channels
+    uint8_t                     _rxChannel;
+    uint8_t                     _txChannel;
+
+    /// True while a transfer is running
+    volatile bool               _busy;
+
+    /// Called when the running transfer completes
+    volatile TransferCallback   _callback;
+    void*                       _callbackArg;
+};
+
+/// Default instance for the SPI bus on SERCOM4, receive on DMAC channel 0, transmit on channel 1
+extern RHHardwareSPIDMA hardware_spi_dma;
+
+#endif
+
+#endif
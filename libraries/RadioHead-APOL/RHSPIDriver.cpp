@@ -10,7 +10,10 @@
 RHSPIDriver::RHSPIDriver(uint8_t slaveSelectPin, RHGenericSPI& spi)
     : 
     _spi(spi),
-    _slaveSelectPin(slaveSelectPin)
+    _slaveSelectPin(slaveSelectPin),
+    _spiReads(0),
+    _spiWrites(0),
+    _spiBursts(0)
 {
 }
 
@@ -19,6 +22,7 @@ bool RHSPIDriver::init()
     // start the SPI library with the default speeds etc:
     // On Arduino Due this defaults to SPI1 on the central group of 6 SPI pins
     _spi.begin();
+    resetSpiCounters();
 
     // Initialise the slave select pin
     // On Maple, this must be _after_ spi.begin
@@ -51,6 +55,7 @@ uint8_t RHSPIDriver::spiRead(uint8_t reg)
     val = _spi.transfer(0); // The written value is ignored, reg value is read
     deselectSlave();
     _spi.endTransaction();
+    _spiReads++;
     ATOMIC_BLOCK_END;
     return val;
 }
@@ -65,6 +70,7 @@ uint8_t RHSPIDriver::spiWrite(uint8_t reg, uint8_t val)
     _spi.transfer(val); // New value follows
     deselectSlave();
     _spi.endTransaction();
+    _spiWrites++;
     ATOMIC_BLOCK_END;
     return status;
 }
@@ -76,10 +82,10 @@ uint8_t RHSPIDriver::spiBurstRead(uint8_t reg, uint8_t* dest, uint8_t len)
     _spi.beginTransaction();
     selectSlave();
     status = _spi.transfer(reg & ~RH_SPI_WRITE_MASK); // Send the start address with the write mask off
-    while (len--)
-	*dest++ = _spi.transfer(0);
+    _spi.transferBuffer(NULL, dest, len); // By DMA if the SPI interface supports it
     deselectSlave();
     _spi.endTransaction();
+    _spiBursts++;
     ATOMIC_BLOCK_END;
     return status;
 }
@@ -91,14 +97,43 @@ uint8_t RHSPIDriver::spiBurstWrite(uint8_t reg, const uint8_t* src, uint8_t len)
     _spi.beginTransaction();
     selectSlave();
     status = _spi.transfer(reg | RH_SPI_WRITE_MASK); // Send the start address with the write mask on
-    while (len--)
-	_spi.transfer(*src++);
+    _spi.transferBuffer(src, NULL, len); // By DMA if the SPI interface supports it
     deselectSlave();
     _spi.endTransaction();
+    _spiBursts++;
     ATOMIC_BLOCK_END;
     return status;
 }
 
+uint32_t RHSPIDriver::spiReadCount()
+{
+    return _spiReads;
+}
+
+uint32_t RHSPIDriver::spiWriteCount()
+{
+    return _spiWrites;
+}
+
+uint32_t RHSPIDriver::spiBurstCount()
+{
+    return _spiBursts;
+}
+
+uint32_t RHSPIDriver::spiTransactions()
+{
+    return _spiReads + _spiWrites + _spiBursts;
+}
+
+void RHSPIDriver::resetSpiCounters()
+{
+    ATOMIC_BLOCK_START;
+    _spiReads = 0;
+    _spiWrites = 0;
+    _spiBursts = 0;
+    ATOMIC_BLOCK_END;
+}
+
 void RHSPIDriver::setSlaveSelectPin(uint8_t slaveSelectPin)
 {
     _slaveSelectPin = slaveSelectPin;
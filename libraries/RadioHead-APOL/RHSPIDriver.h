@@ -77,6 +77,25 @@ public:
     ///  it may or may not be meaningfule depending on the the type of device being accessed.
     uint8_t           spiBurstWrite(uint8_t reg, const uint8_t* src, uint8_t len);
 
+    /// Returns the number of single register reads done with spiRead()
+    /// since init() or resetSpiCounters()
+    uint32_t          spiReadCount();
+
+    /// Returns the number of single register writes done with spiWrite()
+    /// since init() or resetSpiCounters()
+    uint32_t          spiWriteCount();
+
+    /// Returns the number of burst reads and writes done with spiBurstRead() and spiBurstWrite()
+    /// since init() or resetSpiCounters()
+    uint32_t          spiBurstCount();
+
+    /// Returns the total number of SPI transactions (each with its own beginTransaction() and slave select)
+    /// since init() or resetSpiCounters()
+    uint32_t          spiTransactions();
+
+    /// Sets all the SPI transaction counters back to 0
+    void              resetSpiCounters();
+
     /// Set or change the pin to be used for SPI slave select.
     /// This can be called at any time to change the
     /// pin that will be used for slave select in subsquent SPI operations.
@@ -104,6 +123,15 @@ public:
 
     /// The pin number of the Slave Select pin that is used to select the desired device.
     uint8_t             _slaveSelectPin;
+
+    /// Number of spiRead() transactions
+    volatile uint32_t   _spiReads;
+
+    /// Number of spiWrite() transactions
+    volatile uint32_t   _spiWrites;
+
+    /// Number of spiBurstRead() and spiBurstWrite() transactions
+    volatile uint32_t   _spiBursts;
 };
 
 #endif
@@ -13,7 +13,7 @@ RH_DECLARE_MUTEX(lock);
 // Interrupt vectors for the 3 Arduino interrupt pins
 // Each interrupt can be handled by a different instance of RH_RF95, allowing you to have
 // 2 or more LORAs per Arduino
-RH_RF95* RH_RF95::_deviceForInterrupt[RH_RF95_NUM_INTERRUPTS] = {0, 0, 0};
+RH_RF95* RH_RF95::_deviceForInterrupt[RH_RF95_NUM_INTERRUPTS] = {0, 0, 0, 0};
 uint8_t RH_RF95::_interruptCount = 0; // Index into _deviceForInterrupt for next device
 
 // These are indexed by the values of ModemConfigChoice
@@ -29,12 +29,42 @@ PROGMEM static const RH_RF95::ModemConfig MODEM_CONFIG_TABLE[] =
     
 };
 
+// Bandwidth in Hz for each value of the Bw field of RegModemConfig1
+static const uint32_t bandwidths[] = {7800, 10400, 15600, 20800, 31250, 41700, 62500, 125000, 250000, 500000};
+
 RH_RF95::RH_RF95(uint8_t slaveSelectPin, uint8_t interruptPin, TaskHandle_t * rx_task_handle_ptr, RHGenericSPI& spi)
     :
     RHSPIDriver(slaveSelectPin, spi),
-    _rxBufValid(0)
+    _rxHead(0),
+    _rxTail(0),
+    _rxCount(0),
+    _rxOverflows(0),
+    _rxDropped(0),
+    _rxAccept(),
+    _rxHook(NULL),
+    _rxHookContext(NULL),
+    _rxHookResult(0),
+    _interruptTime(0),
+    _lastRxTime(0),
+    _rxAfterTx(false),
+    _cadBusy(0),
+    _modeMicros(),
+    _modeStart(0),
+    _rxSettingsUseRFO(false),
+    _rxSettingsPending(false),
+    _txDoneSemaphore(NULL),
+    _radioMutex(NULL),
+    _serviceTaskHandle(NULL),
+    _isrMaxMicros(0),
+    _serviceMaxMicros(0),
+    _shadowValid(0),
+    _spiWritesSkipped(0),
+    _txAirtime(0),
+    _rxAirtime(0),
+    _lastTxAirtime(0),
+    _lastServiceSpi(0)
 {
-	/*ZTM Added*/_rx_task_handle_ptr = rx_task_handle_ptr; //I added this in order to unsuspend the RX task in an interrput.
+	/*ZTM Added*/_rx_task_handle_ptr = rx_task_handle_ptr; //I added this in order to wake the RX task when a packet is received.
     _interruptPin = interruptPin;
     _myInterruptIndex = 0xff; // Not allocated yet
     _enableCRC = true;
@@ -46,6 +76,19 @@ bool RH_RF95::init()
     if (!RHSPIDriver::init())
 	return false;
 
+    // Lets waitPacketSent() sleep until the TX_DONE interrupt instead of spinning
+    if (_txDoneSemaphore == NULL)
+	_txDoneSemaphore = xSemaphoreCreateBinary();
+
+    // Serialises radio access between the service task and the tasks calling send(), recv() etc
+    if (_radioMutex == NULL)
+	_radioMutex = xSemaphoreCreateRecursiveMutex();
+
+    // The interrupt handler only wakes this task, which does the SPI work outside interrupt context
+    if (_serviceTaskHandle == NULL)
+	xTaskCreate(serviceTask, "RF95 SERVICE", RH_RF95_SERVICE_TASK_STACK, this,
+		    RH_RF95_SERVICE_TASK_PRIORITY, &_serviceTaskHandle);
+
 #ifdef RH_USE_MUTEX
     if (RH_MUTEX_INIT(lock) != 0)
     { 
@@ -70,9 +113,12 @@ bool RH_RF95::init()
     }
 
     // No way to check the device type :-(
+
+    // Whatever we last wrote, the radio may have been reset since
+    invalidateShadow();
     
     // Set sleep mode, so we can also set LORA mode:
-    spiWrite(RH_RF95_REG_01_OP_MODE, RH_RF95_MODE_SLEEP | RH_RF95_LONG_RANGE_MODE);
+    spiWriteShadowed(RH_RF95_REG_01_OP_MODE, RH_RF95_MODE_SLEEP | RH_RF95_LONG_RANGE_MODE);
     delay(10); // Wait for sleep mode to take over from say, CAD
     // Check we are in sleep mode, with LORA set
     if (spiRead(RH_RF95_REG_01_OP_MODE) != (RH_RF95_MODE_SLEEP | RH_RF95_LONG_RANGE_MODE))
@@ -114,6 +160,9 @@ bool RH_RF95::init()
 	else if (_myInterruptIndex == 2){
 	    attachInterrupt(interruptNumber, isr2, RISING);
 	}
+	else if (_myInterruptIndex == 3){
+	    attachInterrupt(interruptNumber, isr3, RISING);
+	}
 	else
 	    return false; // Too many devices, not enough interrupt vectors
     }
@@ -151,22 +200,66 @@ bool RH_RF95::init()
 // On MiniWirelessLoRa, only one of the several interrupt lines (DI0) from the RFM95 is usefuly 
 // connnected to the processor.
 // We use this to get RxDone and TxDone interrupts
+// This is only the top half: once the scheduler is running it just wakes the service task,
+// which reads the radio with serviceInterrupt(). No SPI or Serial traffic happens in interrupt context.
 void RH_RF95::handleInterrupt()
 {	
-	#ifdef DEBUG
-        Serial.println("\n");
-    #endif
+    unsigned long start = micros();
+    _interruptTime = start;
+
+    if (_serviceTaskHandle && xTaskGetSchedulerState() == taskSCHEDULER_RUNNING)
+    {
+	BaseType_t higherPriorityTaskWoken = pdFALSE;
+	vTaskNotifyGiveFromISR(_serviceTaskHandle, &higherPriorityTaskWoken);
+	unsigned long elapsed = micros() - start;
+	if (elapsed > _isrMaxMicros)
+	    _isrMaxMicros = elapsed;
+	portYIELD_FROM_ISR(higherPriorityTaskWoken);
+    }
+    else
+    {
+	// No scheduler yet (eg a send() from setup()), so do all the work here as before
+	serviceInterrupt();
+    }
+}
+
+// Bottom half of the interrupt handler. Runs in the service task, or in the interrupt itself
+// before the scheduler starts
+void RH_RF95::serviceTask(void* param)
+{
+    RH_RF95* driver = (RH_RF95*)param;
+    while (1)
+    {
+	ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+	driver->serviceInterrupt();
+    }
+}
 
+void RH_RF95::serviceInterrupt()
+{
+    unsigned long start = micros();
+    bool schedulerRunning = (xTaskGetSchedulerState() == taskSCHEDULER_RUNNING);
+
+    lockRadio();
     RH_MUTEX_LOCK(lock); // Multithreading support
     
     // we need the RF95 IRQ to be level triggered, or we ……have slim chance of missing events
     // https://github.com/geeksville/Meshtastic-esp32/commit/78470ed3f59f5c84fbd1325bcff1fd95b2b20183
 
-    // Read the interrupt register
-    uint8_t irq_flags = spiRead(RH_RF95_REG_12_IRQ_FLAGS);
+    uint32_t spiStart = spiTransactions();
+
+    // Read the interrupt register along with its neighbours, in one burst:
+    // RegFifoRxCurrentAddr (0x10), RegIrqFlagsMask, RegIrqFlags, RegRxNbBytes (0x13)
+    uint8_t rxRegs[4];
+    spiBurstRead(RH_RF95_REG_10_FIFO_RX_CURRENT_ADDR, rxRegs, sizeof(rxRegs));
+    uint8_t irq_flags = rxRegs[RH_RF95_REG_12_IRQ_FLAGS - RH_RF95_REG_10_FIFO_RX_CURRENT_ADDR];
     // Read the RegHopChannel register to check if CRC presence is signalled
     // in the header. If not it might be a stray (noise) packet.*
-    uint8_t hop_channel = spiRead(RH_RF95_REG_1C_HOP_CHANNEL);
+    // It is read in one burst with the packet SNR and RSSI that follow an RxDone:
+    // RegPktSnrValue (0x19), RegPktRssiValue, RegRssiValue, RegHopChannel (0x1c)
+    uint8_t pktRegs[4];
+    spiBurstRead(RH_RF95_REG_19_PKT_SNR_VALUE, pktRegs, sizeof(pktRegs));
+    uint8_t hop_channel = pktRegs[RH_RF95_REG_1C_HOP_CHANNEL - RH_RF95_REG_19_PKT_SNR_VALUE];
 
     // ack all interrupts, 
     // Sigh: on some processors, for some unknown reason, doing this only once does not actually
@@ -190,7 +283,7 @@ void RH_RF95::handleInterrupt()
     {
 //	Serial.println("E");
 	_rxBad++;
-        clearRxBuf();
+        // Nothing was put in the receive ring, so there is nothing to clear
     }
     // It is possible to get RX_DONE and CRC_ERROR and VALID_HEADER all at once
     // so this must be an else
@@ -199,51 +292,101 @@ void RH_RF95::handleInterrupt()
 	// Packet received, no CRC error
 	// Serial.println("R");
 	// Have received a packet
-	uint8_t len = spiRead(RH_RF95_REG_13_RX_NB_BYTES);
-
-	// Reset the fifo read ptr to the beginning of the packet
-	spiWrite(RH_RF95_REG_0D_FIFO_ADDR_PTR, spiRead(RH_RF95_REG_10_FIFO_RX_CURRENT_ADDR));
-	spiBurstRead(RH_RF95_REG_00_FIFO, _buf, len);
-	_bufLen = len;
-
-	// Remember the last signal to noise ratio, LORA mode
-	// Per page 111, SX1276/77/78/79 datasheet
-	_lastSNR = (int8_t)spiRead(RH_RF95_REG_19_PKT_SNR_VALUE) / 4;
-
-	// Remember the RSSI of this packet, LORA mode
-	// this is according to the doc, but is it really correct?
-	// weakest receiveable signals are reported RSSI at about -66
-	_lastRssi = spiRead(RH_RF95_REG_1A_PKT_RSSI_VALUE);
-	// Adjust the RSSI, datasheet page 87
-	if (_lastSNR < 0)
-	    _lastRssi = _lastRssi + _lastSNR;
-	else
-	    _lastRssi = (int)_lastRssi * 16 / 15;
-	if (_usingHFport)
-	    _lastRssi -= 157;
+	uint8_t len = rxRegs[RH_RF95_REG_13_RX_NB_BYTES - RH_RF95_REG_10_FIFO_RX_CURRENT_ADDR];
+	// The channel was busy with it, whoever it was for
+	if (len >= RH_RF95_HEADER_LEN)
+	    _rxAirtime += timeOnAir(len - RH_RF95_HEADER_LEN);
+
+	if (_rxCount >= RH_RF95_RX_RING_SLOTS)
+	{
+	    // Every slot is still waiting to be collected, so this frame has nowhere to go
+	    _rxOverflows++;
+	}
 	else
-	    _lastRssi -= 164;
-	    
-	// We have received a message.
-	validateRxBuf(); 
-	if (_rxBufValid)
-		#ifdef DEBUG
-            Serial.println("RX EVENT\n");
-        #endif
-		/*ZTM Added*/ if (xTaskGetSchedulerState() == taskSCHEDULER_RUNNING) vTaskResume( * _rx_task_handle_ptr);
-	    setModeIdle(); // Got one 
+	{
+	    RxSlot* slot = &_rxRing[_rxHead];
+
+	    // Reset the fifo read ptr to the beginning of the packet
+	    spiWrite(RH_RF95_REG_0D_FIFO_ADDR_PTR, rxRegs[0]);
+	    // Read the TO header on its own first, so a message for another node costs one byte rather than all of it
+	    if (len)
+		spiBurstRead(RH_RF95_REG_00_FIFO, slot->buf, 1);
+	    slot->len = len;
+
+	    if (validateRxBuf(slot->buf, len))
+	    {
+		spiBurstRead(RH_RF95_REG_00_FIFO, slot->buf + 1, len - 1);
+
+		// Remember the signal to noise ratio, LORA mode
+		// Per page 111, SX1276/77/78/79 datasheet
+		slot->snr = (int8_t)pktRegs[RH_RF95_REG_19_PKT_SNR_VALUE - RH_RF95_REG_19_PKT_SNR_VALUE] / 4;
+
+		// Remember the RSSI of this packet, LORA mode
+		// this is according to the doc, but is it really correct?
+		// weakest receiveable signals are reported RSSI at about -66
+		slot->rssi = pktRegs[RH_RF95_REG_1A_PKT_RSSI_VALUE - RH_RF95_REG_19_PKT_SNR_VALUE];
+		// Adjust the RSSI, datasheet page 87
+		if (slot->snr < 0)
+		    slot->rssi = slot->rssi + slot->snr;
+		else
+		    slot->rssi = (int)slot->rssi * 16 / 15;
+		if (_usingHFport)
+		    slot->rssi -= 157;
+		else
+		    slot->rssi -= 164;
+
+		// Let the receive hook answer it (eg acknowledge it) before the task side sees it
+		slot->hookResult = _rxHook ? _rxHook(_rxHookContext, slot->buf, len) : 0;
+		slot->time = _interruptTime;
+
+		// We have received a message: hand the slot over to the task side
+		_rxHead = (_rxHead + 1) % RH_RF95_RX_RING_SLOTS;
+		_rxCount++;
+		_rxGood++;
+		/*ZTM Added*/ if (schedulerRunning && _rx_task_handle_ptr) xTaskNotifyGive( * _rx_task_handle_ptr);
+	    }
+	    else
+	    {
+		// Too short, or addressed to another node
+		_rxDropped++;
+	    }
+	}
+	// Stay in RXCONTINUOUS so a frame arriving right behind this one is not lost
     }
     else if (_mode == RHModeTx && irq_flags & RH_RF95_TX_DONE)
     {
 		// Serial.println("T");
 		_txGood++;
+		// The radio drops back to standby by itself after TxDone, so setModeIdle() need not write OP_MODE
+		shadowRegister(RH_RF95_REG_01_OP_MODE, RH_RF95_MODE_STDBY);
 		setModeIdle();
+		restoreRxSettings();
+		// Someone asked for the receiver while this was going out (or it was sent by the receive hook)
+		if (_rxAfterTx)
+		{
+		    _rxAfterTx = false;
+		    setModeRx();
+		}
+		// Wake the task blocked in waitPacketSent()
+		if (schedulerRunning && _txDoneSemaphore)
+		    xSemaphoreGive(_txDoneSemaphore);
     }
     else if (_mode == RHModeCad && irq_flags & RH_RF95_CAD_DONE)
     {
 		// Serial.println("C");
         _cad = irq_flags & RH_RF95_CAD_DETECTED;
+        // The radio drops back to standby by itself after CadDone
+        shadowRegister(RH_RF95_REG_01_OP_MODE, RH_RF95_MODE_STDBY);
         setModeIdle();
+	// Someone asked for the receiver during the CAD
+	if (_rxAfterTx)
+	{
+	    _rxAfterTx = false;
+	    setModeRx();
+	}
+	// Wake the task blocked in isChannelActive()
+	if (schedulerRunning && _txDoneSemaphore)
+	    xSemaphoreGive(_txDoneSemaphore);
     }
     else
     {
@@ -254,17 +397,108 @@ void RH_RF95::handleInterrupt()
     // clear the radio's interrupt flag. So we do it twice. Why?
     /*uncommented*/ spiWrite(RH_RF95_REG_12_IRQ_FLAGS, 0xff); // Clear all IRQ flags
     /*uncommented*/ spiWrite(RH_RF95_REG_12_IRQ_FLAGS, 0xff); // Clear all IRQ flags
+    _lastServiceSpi = spiTransactions() - spiStart;
     RH_MUTEX_UNLOCK(lock); 
+    unlockRadio();
+
+    unsigned long elapsed = micros() - start;
+    if (elapsed > _serviceMaxMicros)
+	_serviceMaxMicros = elapsed;
+}
+
+// Index of each register kept in the shadow cache, by position in this table
+static const uint8_t SHADOW_REGISTERS[RH_RF95_NUM_SHADOW_REGISTERS] =
+{
+    RH_RF95_REG_01_OP_MODE,
+    RH_RF95_REG_06_FRF_MSB,
+    RH_RF95_REG_07_FRF_MID,
+    RH_RF95_REG_08_FRF_LSB,
+    RH_RF95_REG_09_PA_CONFIG,
+    RH_RF95_REG_1D_MODEM_CONFIG1,
+    RH_RF95_REG_1E_MODEM_CONFIG2,
+    RH_RF95_REG_20_PREAMBLE_MSB,
+    RH_RF95_REG_21_PREAMBLE_LSB,
+    RH_RF95_REG_22_PAYLOAD_LENGTH,
+    RH_RF95_REG_26_MODEM_CONFIG3,
+    RH_RF95_REG_40_DIO_MAPPING1,
+    RH_RF95_REG_4D_PA_DAC,
+};
 
-	#ifdef DEBUG
-        Serial.println("Interrupt Exited\n");
-    #endif
+int8_t RH_RF95::shadowIndex(uint8_t reg)
+{
+    for (uint8_t i = 0; i < RH_RF95_NUM_SHADOW_REGISTERS; i++)
+	if (SHADOW_REGISTERS[i] == reg)
+	    return i;
+    return -1;
+}
+
+// Write a register unless the shadow says it already holds this value
+uint8_t RH_RF95::spiWriteShadowed(uint8_t reg, uint8_t val)
+{
+    int8_t index = shadowIndex(reg);
+    if (index >= 0 && (_shadowValid & (1 << index)) && _shadow[index] == val)
+    {
+	_spiWritesSkipped++;
+	return 0;
+    }
+    uint8_t status = spiWrite(reg, val);
+    if (index >= 0)
+	shadowRegister(reg, val);
+    return status;
+}
+
+// Read a register from the shadow if we know what it holds, else from the radio
+uint8_t RH_RF95::spiReadShadowed(uint8_t reg)
+{
+    int8_t index = shadowIndex(reg);
+    if (index >= 0 && (_shadowValid & (1 << index)))
+	return _shadow[index];
+    uint8_t val = spiRead(reg);
+    if (index >= 0)
+	shadowRegister(reg, val);
+    return val;
+}
 
+// Record what a shadowed register holds, eg when the radio changes it by itself
+void RH_RF95::shadowRegister(uint8_t reg, uint8_t val)
+{
+    int8_t index = shadowIndex(reg);
+    if (index < 0)
+	return;
+    _shadow[index] = val;
+    _shadowValid |= (1 << index);
+}
+
+void RH_RF95::invalidateShadow()
+{
+    _shadowValid = 0;
+}
+
+uint32_t RH_RF95::spiWritesSkipped()
+{
+    return _spiWritesSkipped;
+}
+
+uint16_t RH_RF95::lastServiceSpiTransactions()
+{
+    return _lastServiceSpi;
+}
+
+void RH_RF95::lockRadio()
+{
+    if (_radioMutex && xTaskGetSchedulerState() == taskSCHEDULER_RUNNING)
+	xSemaphoreTakeRecursive(_radioMutex, portMAX_DELAY);
+}
+
+void RH_RF95::unlockRadio()
+{
+    if (_radioMutex && xTaskGetSchedulerState() == taskSCHEDULER_RUNNING)
+	xSemaphoreGiveRecursive(_radioMutex);
 }
 
 // These are low level functions that call the interrupt handler for the correct
 // instance of RH_RF95.
-// 3 interrupts allows us to have 3 different devices
+// 4 interrupts allows us to have 4 different devices
 void RH_INTERRUPT_ATTR RH_RF95::isr0()
 {
     if (_deviceForInterrupt[0])
@@ -280,46 +514,84 @@ void RH_INTERRUPT_ATTR RH_RF95::isr2()
     if (_deviceForInterrupt[2])
 	_deviceForInterrupt[2]->handleInterrupt();
 }
+void RH_INTERRUPT_ATTR RH_RF95::isr3()
+{
+    if (_deviceForInterrupt[3])
+	_deviceForInterrupt[3]->handleInterrupt();
+}
 
-// Check whether the latest received message is complete and uncorrupted
-void RH_RF95::validateRxBuf()
+// Check whether a received message is complete and addressed to this node
+// Only the TO header, buf[0], need have been read yet
+bool RH_RF95::validateRxBuf(const uint8_t* buf, uint8_t len)
 {
-    if (_bufLen < 4)
-	return; // Too short to be a real message
-    // Extract the 4 headers
-    _rxHeaderTo    = _buf[0];
-    _rxHeaderFrom  = _buf[1];
-    _rxHeaderId    = _buf[2];
-    _rxHeaderFlags = _buf[3];
-    if (_promiscuous ||
-	_rxHeaderTo == _thisAddress ||
-	_rxHeaderTo == RH_BROADCAST_ADDRESS)
-    {
-	_rxGood++;
-	_rxBufValid = true;
-    }
+    if (len < RH_RF95_HEADER_LEN)
+	return false; // Too short to be a real message
+    return _promiscuous || isAddressAccepted(buf[0]);
+}
+
+bool RH_RF95::isAddressAccepted(uint8_t address)
+{
+    return address == _thisAddress ||
+	address == RH_BROADCAST_ADDRESS ||
+	(_rxAccept[address >> 5] & (1UL << (address & 31)));
+}
+
+void RH_RF95::setAddressFilter(uint8_t address, bool accept)
+{
+    ATOMIC_BLOCK_START;
+    if (accept)
+	_rxAccept[address >> 5] |= 1UL << (address & 31);
+    else
+	_rxAccept[address >> 5] &= ~(1UL << (address & 31));
+    ATOMIC_BLOCK_END;
+}
+
+void RH_RF95::clearAddressFilter()
+{
+    ATOMIC_BLOCK_START;
+    memset(_rxAccept, 0, sizeof(_rxAccept));
+    ATOMIC_BLOCK_END;
+}
+
+// Make the oldest message in the ring the current one, so headerTo(), lastRssi() etc describe it
+void RH_RF95::loadRxSlot(const RxSlot* slot)
+{
+    _rxHeaderTo    = slot->buf[0];
+    _rxHeaderFrom  = slot->buf[1];
+    _rxHeaderId    = slot->buf[2];
+    _rxHeaderFlags = slot->buf[3];
+    _lastSNR       = slot->snr;
+    _lastRssi      = slot->rssi;
+    _rxHookResult  = slot->hookResult;
+    _lastRxTime    = slot->time;
 }
 
 bool RH_RF95::available()
 {	
 
+    lockRadio();
     RH_MUTEX_LOCK(lock); // Multithreading support
     if (_mode == RHModeTx)
     {	
     	RH_MUTEX_UNLOCK(lock);
+    	unlockRadio();
 		return false;
     }
     setModeRx();
     RH_MUTEX_UNLOCK(lock);
-    return _rxBufValid; // Will be set by the interrupt handler when a good message is received
+    unlockRadio();
+    return _rxCount > 0; // Will be incremented by the interrupt handler when a good message is received
 
 }
 
 void RH_RF95::clearRxBuf()
 {
     ATOMIC_BLOCK_START;
-    _rxBufValid = false;
-    _bufLen = 0;
+    if (_rxCount > 0)
+    {
+	_rxTail = (_rxTail + 1) % RH_RF95_RX_RING_SLOTS;
+	_rxCount--;
+    }
     ATOMIC_BLOCK_END;
 }
 
@@ -328,30 +600,189 @@ bool RH_RF95::recv(uint8_t* buf, uint8_t* len)
     if (!available())
 	return false;
     RH_MUTEX_LOCK(lock); // Multithread support
+    // The interrupt handler only ever fills the slot at _rxHead, so the one at _rxTail is safe to read
+    const RxSlot* slot = &_rxRing[_rxTail];
+    loadRxSlot(slot);
     if (buf && len)
     {
-	ATOMIC_BLOCK_START;
-	// Skip the 4 headers that are at the beginning of the rxBuf
-	if (*len > _bufLen-RH_RF95_HEADER_LEN)
-	    *len = _bufLen-RH_RF95_HEADER_LEN;
-	memcpy(buf, _buf+RH_RF95_HEADER_LEN, *len);
-	ATOMIC_BLOCK_END;
+	// Skip the 4 headers that are at the beginning of the slot
+	if (*len > slot->len-RH_RF95_HEADER_LEN)
+	    *len = slot->len-RH_RF95_HEADER_LEN;
+	memcpy(buf, slot->buf+RH_RF95_HEADER_LEN, *len);
     }
     clearRxBuf(); // This message accepted and cleared
     RH_MUTEX_UNLOCK(lock);
     return true;
 }
 
-bool RH_RF95::send(const uint8_t* data, uint8_t len)
+bool RH_RF95::recvView(const uint8_t** data, uint8_t* len)
 {
-    if (len > RH_RF95_MAX_MESSAGE_LEN)
+    // Messages already in the ring are valid whatever mode we are in now
+    if (_rxCount == 0)
+    {
+	available(); // Make sure the receiver is on
 	return false;
+    }
+    // The slot stays owned by the caller until recvRelease(): the interrupt handler only
+    // fills the slot at _rxHead and never reuses one that has not been released
+    const RxSlot* slot = &_rxRing[_rxTail];
+    loadRxSlot(slot);
+    *data = slot->buf + RH_RF95_HEADER_LEN;
+    *len = slot->len - RH_RF95_HEADER_LEN;
+    return true;
+}
+
+bool RH_RF95::recvViewFrame(const uint8_t** buf, uint8_t* len)
+{
+    const uint8_t* data;
+    if (!recvView(&data, len))
+	return false;
+    *buf = data - RH_RF95_HEADER_LEN;
+    *len += RH_RF95_HEADER_LEN;
+    return true;
+}
+
+void RH_RF95::recvRelease()
+{
+    clearRxBuf();
+}
+
+uint16_t RH_RF95::rxOverflows()
+{
+    return _rxOverflows;
+}
+
+uint16_t RH_RF95::rxDropped()
+{
+    return _rxDropped;
+}
+
+uint8_t RH_RF95::rxPending()
+{
+    return _rxCount;
+}
+
+unsigned long RH_RF95::isrMaxMicros()
+{
+    return _isrMaxMicros;
+}
+
+unsigned long RH_RF95::serviceMaxMicros()
+{
+    return _serviceMaxMicros;
+}
+
+void RH_RF95::setRxHook(RxHook hook, void* context)
+{
+    ATOMIC_BLOCK_START;
+    _rxHook = hook;
+    _rxHookContext = context;
+    ATOMIC_BLOCK_END;
+}
+
+uint8_t RH_RF95::rxHookResult()
+{
+    return _rxHookResult;
+}
+
+unsigned long RH_RF95::lastRxTime()
+{
+    return _lastRxTime;
+}
+
+void RH_RF95::setServiceTaskPriority(UBaseType_t priority)
+{
+    if (_serviceTaskHandle)
+	vTaskPrioritySet(_serviceTaskHandle, priority);
+}
+
+bool RH_RF95::waitPacketSent()
+{
+    waitModeEnd(RHModeTx);
+    return true;
+}
+
+bool RH_RF95::waitPacketSent(uint16_t timeout)
+{
+    if (_txDoneSemaphore == NULL || xTaskGetSchedulerState() != taskSCHEDULER_RUNNING)
+	return RHGenericDriver::waitPacketSent(timeout);
+
+    unsigned long starttime = millis();
+    unsigned long elapsed;
+    bool taken = false;
+    while (_mode == RHModeTx)
+    {
+	elapsed = millis() - starttime;
+	if (elapsed >= timeout)
+	    return false;
+	taken |= xSemaphoreTake(_txDoneSemaphore, pdMS_TO_TICKS(timeout - elapsed) + 1) == pdTRUE;
+    }
+    // As in waitModeEnd()
+    if (taken)
+	xSemaphoreGive(_txDoneSemaphore);
+    return true;
+}
 
-    waitPacketSent(); // Make sure we dont interrupt an outgoing message
+void RH_RF95::waitModeEnd(RHMode mode)
+{
+    if (_txDoneSemaphore == NULL || xTaskGetSchedulerState() != taskSCHEDULER_RUNNING)
+    {
+	while (_mode == mode)
+	    YIELD;
+	return;
+    }
+
+    // A give left over from an earlier TX_DONE or CAD_DONE nobody waited for just costs one more pass round the loop.
+    // One give wakes one task, so pass it on to any other task waiting for the same one
+    bool taken = false;
+    while (_mode == mode)
+	taken |= xSemaphoreTake(_txDoneSemaphore, portMAX_DELAY) == pdTRUE;
+    if (taken)
+	xSemaphoreGive(_txDoneSemaphore);
+}
+
+bool RH_RF95::send(const uint8_t* data, uint8_t len)
+{
+    return send(data, len, NULL);
+}
+
+bool RH_RF95::prepareTx(const TxSettings* settings)
+{
+    // Make sure we dont interrupt an outgoing message, or another task's CAD. The receive hook can start
+    // a message of its own whenever the receiver is on, so check again with the radio locked before leaving Rx
+    lockRadio();
+    while (_mode == RHModeTx || _mode == RHModeCad)
+    {
+	RHMode mode = _mode;
+	unlockRadio();
+	waitModeEnd(mode);
+	lockRadio();
+    }
+    _rxAfterTx = false;
     setModeIdle();
+    applyTxSettings(settings);
+    unlockRadio();
 
-    if (!waitCAD()) 
+    if (!listenBeforeTalk(settings)) 
+    {
+	lockRadio();
+	restoreRxSettings();
+	unlockRadio();
 	return false;  // Check channel activity
+    }
+    return true;
+}
+
+bool RH_RF95::send(const uint8_t* data, uint8_t len, const TxSettings* settings)
+{
+    if (len > RH_RF95_MAX_MESSAGE_LEN)
+	return false;
+
+    if (!prepareTx(settings))
+	return false;
+
+    // Keep the service task off the FIFO while it is being loaded
+    lockRadio();
 
     // Position at the beginning of the FIFO
     spiWrite(RH_RF95_REG_0D_FIFO_ADDR_PTR, 0);
@@ -362,18 +793,118 @@ bool RH_RF95::send(const uint8_t* data, uint8_t len)
     spiWrite(RH_RF95_REG_00_FIFO, _txHeaderFlags);
     // The message data
     spiBurstWrite(RH_RF95_REG_00_FIFO, data, len);
-    spiWrite(RH_RF95_REG_22_PAYLOAD_LENGTH, len + RH_RF95_HEADER_LEN);
-    
+    spiWriteShadowed(RH_RF95_REG_22_PAYLOAD_LENGTH, len + RH_RF95_HEADER_LEN);
+    _lastTxAirtime = timeOnAir(len);
+    _txAirtime += _lastTxAirtime;
 	
     RH_MUTEX_LOCK(lock); // Multithreading support
     setModeTx(); // Start the transmitter
     RH_MUTEX_UNLOCK(lock);
+    unlockRadio();
 	
 		
     // when Tx is done, interruptHandlerinterruptHandler will fire and radio mode will return to STANDBY
 	return true;
 }
 
+bool RH_RF95::resend(const uint8_t* buf, uint8_t len, uint8_t flags, const TxSettings* settings)
+{
+    if (len < RH_RF95_HEADER_LEN || len - RH_RF95_HEADER_LEN > RH_RF95_MAX_MESSAGE_LEN)
+	return false;
+
+    if (!prepareTx(settings))
+	return false;
+
+    // The headers as they came, but for FLAGS, then the message data
+    lockRadio();
+    spiWrite(RH_RF95_REG_0D_FIFO_ADDR_PTR, 0);
+    spiBurstWrite(RH_RF95_REG_00_FIFO, buf, RH_RF95_HEADER_LEN - 1);
+    spiWrite(RH_RF95_REG_00_FIFO, flags);
+    spiBurstWrite(RH_RF95_REG_00_FIFO, buf + RH_RF95_HEADER_LEN, len - RH_RF95_HEADER_LEN);
+    spiWriteShadowed(RH_RF95_REG_22_PAYLOAD_LENGTH, len);
+    _lastTxAirtime = timeOnAir(len - RH_RF95_HEADER_LEN);
+    _txAirtime += _lastTxAirtime;
+
+    RH_MUTEX_LOCK(lock); // Multithreading support
+    setModeTx();
+    _rxAfterTx = true; // Back to listening as soon as it has gone
+    RH_MUTEX_UNLOCK(lock);
+    unlockRadio();
+    return true;
+}
+
+bool RH_RF95::sendWithHeaders(uint8_t to, uint8_t from, uint8_t id, uint8_t flags, const uint8_t* data, uint8_t len,
+			      const TxSettings* settings)
+{
+    if (len > RH_RF95_MAX_MESSAGE_LEN)
+	return false;
+
+    lockRadio();
+    if (_mode == RHModeTx)
+    {
+	unlockRadio();
+	return false;
+    }
+    setModeIdle();
+    applyTxSettings(settings);
+
+    spiWrite(RH_RF95_REG_0D_FIFO_ADDR_PTR, 0);
+    spiWrite(RH_RF95_REG_00_FIFO, to);
+    spiWrite(RH_RF95_REG_00_FIFO, from);
+    spiWrite(RH_RF95_REG_00_FIFO, id);
+    spiWrite(RH_RF95_REG_00_FIFO, flags);
+    spiBurstWrite(RH_RF95_REG_00_FIFO, data, len);
+    spiWriteShadowed(RH_RF95_REG_22_PAYLOAD_LENGTH, len + RH_RF95_HEADER_LEN);
+    _lastTxAirtime = timeOnAir(len);
+    _txAirtime += _lastTxAirtime;
+
+    RH_MUTEX_LOCK(lock); // Multithreading support
+    setModeTx();
+    _rxAfterTx = true; // Back to listening as soon as it has gone
+    RH_MUTEX_UNLOCK(lock);
+    unlockRadio();
+    return true;
+}
+
+void RH_RF95::applyTxSettings(const TxSettings* settings)
+{
+    if (!settings)
+	return;
+    // Only the first of back to back transmissions holds the receive settings
+    if (!_rxSettingsPending)
+    {
+	_rxSettings[0] = spiReadShadowed(RH_RF95_REG_1D_MODEM_CONFIG1);
+	_rxSettings[1] = spiReadShadowed(RH_RF95_REG_1E_MODEM_CONFIG2);
+	_rxSettings[2] = spiReadShadowed(RH_RF95_REG_26_MODEM_CONFIG3);
+	_rxSettings[3] = spiReadShadowed(RH_RF95_REG_09_PA_CONFIG);
+	_rxSettings[4] = spiReadShadowed(RH_RF95_REG_4D_PA_DAC);
+	_rxSettings[5] = spiReadShadowed(RH_RF95_REG_20_PREAMBLE_MSB);
+	_rxSettings[6] = spiReadShadowed(RH_RF95_REG_21_PREAMBLE_LSB);
+	_rxSettingsUseRFO = _useRFO;
+	_rxSettingsPending = true;
+    }
+    setModemRegisters(&settings->modem);
+    setTxPower(settings->power);
+    if (settings->preamble)
+	setPreambleLength(settings->preamble);
+}
+
+void RH_RF95::restoreRxSettings()
+{
+    if (!_rxSettingsPending)
+	return;
+    // Writes to registers that already hold the value are skipped by the shadows
+    spiWriteShadowed(RH_RF95_REG_1D_MODEM_CONFIG1, _rxSettings[0]);
+    spiWriteShadowed(RH_RF95_REG_1E_MODEM_CONFIG2, _rxSettings[1]);
+    spiWriteShadowed(RH_RF95_REG_26_MODEM_CONFIG3, _rxSettings[2]);
+    spiWriteShadowed(RH_RF95_REG_09_PA_CONFIG, _rxSettings[3]);
+    spiWriteShadowed(RH_RF95_REG_4D_PA_DAC, _rxSettings[4]);
+    spiWriteShadowed(RH_RF95_REG_20_PREAMBLE_MSB, _rxSettings[5]);
+    spiWriteShadowed(RH_RF95_REG_21_PREAMBLE_LSB, _rxSettings[6]);
+    _useRFO = _rxSettingsUseRFO;
+    _rxSettingsPending = false;
+}
+
 bool RH_RF95::printRegisters()
 {
 #ifdef RH_HAVE_SERIAL
@@ -399,9 +930,9 @@ bool RH_RF95::setFrequency(float centre)
 {
     // Frf = FRF / FSTEP
     uint32_t frf = (centre * 1000000.0) / RH_RF95_FSTEP;
-    spiWrite(RH_RF95_REG_06_FRF_MSB, (frf >> 16) & 0xff);
-    spiWrite(RH_RF95_REG_07_FRF_MID, (frf >> 8) & 0xff);
-    spiWrite(RH_RF95_REG_08_FRF_LSB, frf & 0xff);
+    spiWriteShadowed(RH_RF95_REG_06_FRF_MSB, (frf >> 16) & 0xff);
+    spiWriteShadowed(RH_RF95_REG_07_FRF_MID, (frf >> 8) & 0xff);
+    spiWriteShadowed(RH_RF95_REG_08_FRF_LSB, frf & 0xff);
     _usingHFport = (centre >= 779.0);
 
     return true;
@@ -409,47 +940,65 @@ bool RH_RF95::setFrequency(float centre)
 
 void RH_RF95::setModeIdle()
 {
+    lockRadio();
     if (_mode != RHModeIdle)
     {
+	countModeTime();
 	modeWillChange(RHModeIdle);
-	spiWrite(RH_RF95_REG_01_OP_MODE, RH_RF95_MODE_STDBY);
+	spiWriteShadowed(RH_RF95_REG_01_OP_MODE, RH_RF95_MODE_STDBY);
 	_mode = RHModeIdle;
     }
+    unlockRadio();
 }
 
 bool RH_RF95::sleep()
 {
+    lockRadio();
     if (_mode != RHModeSleep)
     {
+	countModeTime();
 	modeWillChange(RHModeSleep);
-	spiWrite(RH_RF95_REG_01_OP_MODE, RH_RF95_MODE_SLEEP);
+	// LongRangeMode can be changed in sleep, so keep it set or the radio wakes up in FSK/OOK mode
+	spiWriteShadowed(RH_RF95_REG_01_OP_MODE, RH_RF95_MODE_SLEEP | RH_RF95_LONG_RANGE_MODE);
 	_mode = RHModeSleep;
     }
+    unlockRadio();
     return true;
 }
 
 void RH_RF95::setModeRx()
 {
-    if (_mode != RHModeRx)
+    lockRadio();
+    if (_mode == RHModeTx || _mode == RHModeCad)
+    {
+	// Start the receiver from TX_DONE rather than cut the message off, or cut short the CAD another task waits on
+	_rxAfterTx = true;
+    }
+    else if (_mode != RHModeRx)
     {
+	countModeTime();
 	modeWillChange(RHModeRx);
 	_mode = RHModeRx;
-	spiWrite(RH_RF95_REG_01_OP_MODE, RH_RF95_MODE_RXCONTINUOUS);
-	spiWrite(RH_RF95_REG_40_DIO_MAPPING1, 0x00); // Interrupt on RxDone
+	spiWriteShadowed(RH_RF95_REG_01_OP_MODE, RH_RF95_MODE_RXCONTINUOUS);
+	spiWriteShadowed(RH_RF95_REG_40_DIO_MAPPING1, 0x00); // Interrupt on RxDone
 	/*uncommented*/ _mode = RHModeRx;
     }
+    unlockRadio();
 }
 
 void RH_RF95::setModeTx()
 {
+    lockRadio();
     if (_mode != RHModeTx)
     {
+	countModeTime();
 	modeWillChange(RHModeTx);
 	_mode = RHModeTx;
-	spiWrite(RH_RF95_REG_01_OP_MODE, RH_RF95_MODE_TX);
-	spiWrite(RH_RF95_REG_40_DIO_MAPPING1, 0x40); // Interrupt on TxDone
+	spiWriteShadowed(RH_RF95_REG_01_OP_MODE, RH_RF95_MODE_TX);
+	spiWriteShadowed(RH_RF95_REG_40_DIO_MAPPING1, 0x40); // Interrupt on TxDone
     /*uncommented*/ _mode = RHModeTx;
 	}
+    unlockRadio();
 }
 
 /*ADDED BY ZTM 05/11/2023*/
@@ -491,8 +1040,8 @@ void RH_RF95::setTxPower(int8_t power, bool useRFO)
 	    power = 0;
 	// Set the MaxPower register to 0x7 => MaxPower = 10.8 + 0.6 * 7 = 15dBm
 	// So Pout = Pmax - (15 - power) = 15 - 15 + power
-	spiWrite(RH_RF95_REG_09_PA_CONFIG, RH_RF95_MAX_POWER | power);
-	spiWrite(RH_RF95_REG_4D_PA_DAC, RH_RF95_PA_DAC_DISABLE);
+	spiWriteShadowed(RH_RF95_REG_09_PA_CONFIG, RH_RF95_MAX_POWER | power);
+	spiWriteShadowed(RH_RF95_REG_4D_PA_DAC, RH_RF95_PA_DAC_DISABLE);
     }
     else
     {
@@ -506,27 +1055,54 @@ void RH_RF95::setTxPower(int8_t power, bool useRFO)
 	// for 8, 19 and 20dBm
 	if (power > 17)
 	{
-	    spiWrite(RH_RF95_REG_4D_PA_DAC, RH_RF95_PA_DAC_ENABLE);
+	    spiWriteShadowed(RH_RF95_REG_4D_PA_DAC, RH_RF95_PA_DAC_ENABLE);
 	    power -= 3;
 	}
 	else
 	{
-	    spiWrite(RH_RF95_REG_4D_PA_DAC, RH_RF95_PA_DAC_DISABLE);
+	    spiWriteShadowed(RH_RF95_REG_4D_PA_DAC, RH_RF95_PA_DAC_DISABLE);
 	}
 
 	// RFM95/96/97/98 does not have RFO pins connected to anything. Only PA_BOOST
 	// pin is connected, so must use PA_BOOST
 	// Pout = 2 + OutputPower (+3dBm if DAC enabled)
-	spiWrite(RH_RF95_REG_09_PA_CONFIG, RH_RF95_PA_SELECT | (power-2));
+	spiWriteShadowed(RH_RF95_REG_09_PA_CONFIG, RH_RF95_PA_SELECT | (power-2));
     }
 }
 
 // Sets registers from a canned modem configuration structure
 void RH_RF95::setModemRegisters(const ModemConfig* config)
 {
-    spiWrite(RH_RF95_REG_1D_MODEM_CONFIG1,       config->reg_1d);
-    spiWrite(RH_RF95_REG_1E_MODEM_CONFIG2,       config->reg_1e);
-    spiWrite(RH_RF95_REG_26_MODEM_CONFIG3,       config->reg_26);
+    spiWriteShadowed(RH_RF95_REG_1D_MODEM_CONFIG1,       config->reg_1d);
+    spiWriteShadowed(RH_RF95_REG_1E_MODEM_CONFIG2,       config->reg_1e);
+    spiWriteShadowed(RH_RF95_REG_26_MODEM_CONFIG3,       config->reg_26);
+}
+
+void RH_RF95::setRxModemRegisters(const ModemConfig* config)
+{
+    lockRadio();
+    while (_mode == RHModeTx || _mode == RHModeCad)
+    {
+	RHMode mode = _mode;
+	unlockRadio();
+	waitModeEnd(mode);
+	lockRadio();
+    }
+    if (_rxSettingsPending)
+    {
+	// A send with its own settings is waiting for the channel. Its restore puts these in place
+	_rxSettings[0] = config->reg_1d;
+	_rxSettings[1] = config->reg_1e;
+	_rxSettings[2] = config->reg_26;
+	unlockRadio();
+	return;
+    }
+    bool rx = _mode == RHModeRx;
+    setModeIdle();
+    setModemRegisters(config);
+    if (rx)
+	setModeRx();
+    unlockRadio();
 }
 
 // Set one of the canned FSK Modem configs
@@ -545,27 +1121,162 @@ bool RH_RF95::setModemConfig(ModemConfigChoice index)
 
 void RH_RF95::setPreambleLength(uint16_t bytes)
 {
-    spiWrite(RH_RF95_REG_20_PREAMBLE_MSB, bytes >> 8);
-    spiWrite(RH_RF95_REG_21_PREAMBLE_LSB, bytes & 0xff);
+    spiWriteShadowed(RH_RF95_REG_20_PREAMBLE_MSB, bytes >> 8);
+    spiWriteShadowed(RH_RF95_REG_21_PREAMBLE_LSB, bytes & 0xff);
 }
 
 bool RH_RF95::isChannelActive()
 {
     // Set mode RHModeCad
+    lockRadio();
     if (_mode != RHModeCad)
     {
+	countModeTime();
 	modeWillChange(RHModeCad);
-        spiWrite(RH_RF95_REG_01_OP_MODE, RH_RF95_MODE_CAD);
-        spiWrite(RH_RF95_REG_40_DIO_MAPPING1, 0x80); // Interrupt on CadDone
+        spiWriteShadowed(RH_RF95_REG_01_OP_MODE, RH_RF95_MODE_CAD);
+        spiWriteShadowed(RH_RF95_REG_40_DIO_MAPPING1, 0x80); // Interrupt on CadDone
         _mode = RHModeCad;
     }
+    unlockRadio();
 
-    while (_mode == RHModeCad)
-        YIELD;
-
+    waitModeEnd(RHModeCad);
     return _cad;
 }
 
+bool RH_RF95::waitCAD()
+{
+    return listenBeforeTalk(NULL);
+}
+
+bool RH_RF95::listenBeforeTalk(const TxSettings* settings)
+{
+    if (!_cad_timeout)
+	return true;
+
+    unsigned long start = millis();
+    uint16_t window = RH_RF95_CAD_WINDOW_MIN;
+    while (isChannelActive())
+    {
+	_cadBusy++;
+	if (millis() - start > _cad_timeout)
+	    return false;
+
+	// Binary exponential backoff in slots of a few symbols, so it scales with the modem configuration
+	uint32_t backoff = (uint32_t)random(1, window + 1) * RH_RF95_CAD_SLOT_SYMBOLS * symbolMicros();
+	if (window < RH_RF95_CAD_WINDOW_MAX)
+	    window *= 2;
+
+	// Listen meanwhile: the frame on the air may well be for us
+	lockRadio();
+	restoreRxSettings();
+	setModeRx();
+	unlockRadio();
+	backoffDelay(backoff);
+
+	// Let a frame that is still arriving finish, and anything the receive hook started go out
+	lockRadio();
+	while (_mode == RHModeTx
+	       || (_mode == RHModeRx && millis() - start <= _cad_timeout
+		   && (spiRead(RH_RF95_REG_18_MODEM_STAT)
+		       & (RH_RF95_MODEM_STATUS_SIGNAL_DETECTED | RH_RF95_MODEM_STATUS_RX_ONGOING))))
+	{
+	    unlockRadio();
+	    if (_mode == RHModeTx)
+		waitPacketSent();
+	    else
+		backoffDelay(RH_RF95_CAD_SLOT_SYMBOLS * symbolMicros());
+	    lockRadio();
+	}
+	_rxAfterTx = false;
+	setModeIdle();
+	applyTxSettings(settings);
+	unlockRadio();
+    }
+    return true;
+}
+
+uint32_t RH_RF95::cadBusy()
+{
+    return _cadBusy;
+}
+
+uint32_t RH_RF95::symbolMicros(const ModemConfig* config)
+{
+    uint8_t bwindex = (config ? config->reg_1d : spiReadShadowed(RH_RF95_REG_1D_MODEM_CONFIG1)) >> 4;
+    if (bwindex >= (sizeof(bandwidths) / sizeof(bandwidths[0])))
+	bwindex = 7; // Not defined, so take 125 kHz
+    uint8_t sf = (config ? config->reg_1e : spiReadShadowed(RH_RF95_REG_1E_MODEM_CONFIG2)) >> 4;
+    return (uint32_t)(((uint64_t)1000000 << sf) / bandwidths[bwindex]);
+}
+
+bool RH_RF95::isReceiving()
+{
+    lockRadio();
+    bool receiving = _mode == RHModeRx
+	&& (spiRead(RH_RF95_REG_18_MODEM_STAT) & (RH_RF95_MODEM_STATUS_SIGNAL_DETECTED | RH_RF95_MODEM_STATUS_RX_ONGOING));
+    unlockRadio();
+    return receiving;
+}
+
+bool RH_RF95::sniff()
+{
+    // Leave a transmission, or a message on its way in, alone
+    lockRadio();
+    bool busy = _mode == RHModeTx || _mode == RHModeCad
+	|| (_mode == RHModeRx
+	    && (spiRead(RH_RF95_REG_18_MODEM_STAT) & (RH_RF95_MODEM_STATUS_SIGNAL_DETECTED | RH_RF95_MODEM_STATUS_RX_ONGOING)));
+    unlockRadio();
+    if (busy)
+	return true;
+
+    if (isChannelActive())
+    {
+	// Someone is sending a preamble long enough to catch us: stay in RX for the message behind it
+	setModeRx();
+	return true;
+    }
+
+    // Unless a send started while the CAD ran
+    lockRadio();
+    bool asleep = _mode == RHModeIdle;
+    if (asleep)
+	sleep();
+    unlockRadio();
+    return !asleep;
+}
+
+void RH_RF95::countModeTime()
+{
+    unsigned long now = micros();
+    if (_mode <= RHModeCad)
+	_modeMicros[_mode] += now - _modeStart;
+    _modeStart = now;
+}
+
+uint32_t RH_RF95::modeTime(RHMode mode)
+{
+    if (mode > RHModeCad)
+	return 0;
+    // Fold in the current stretch, so it is never long enough for micros() to wrap while this is called now and then
+    uint64_t time;
+    lockRadio();
+    ATOMIC_BLOCK_START;
+    countModeTime();
+    time = _modeMicros[mode];
+    ATOMIC_BLOCK_END;
+    unlockRadio();
+    return (uint32_t)(time / 1000);
+}
+
+void RH_RF95::backoffDelay(uint32_t duration)
+{
+    uint32_t ms = (duration + 999) / 1000;
+    if (xTaskGetSchedulerState() == taskSCHEDULER_RUNNING)
+	vTaskDelay(pdMS_TO_TICKS(ms) + 1);
+    else
+	delay(ms);
+}
+
 void RH_RF95::enableTCXO(bool on)
 {
     if (on)
@@ -607,7 +1318,7 @@ int RH_RF95::frequencyError()
 
     int error = 0; // In hertz
     float bw_tab[] = {7.8, 10.4, 15.6, 20.8, 31.25, 41.7, 62.5, 125, 250, 500};
-    uint8_t bwindex = spiRead(RH_RF95_REG_1D_MODEM_CONFIG1) >> 4;
+    uint8_t bwindex = spiReadShadowed(RH_RF95_REG_1D_MODEM_CONFIG1) >> 4;
     if (bwindex < (sizeof(bw_tab) / sizeof(float)))
 	error = (float)freqerror * bw_tab[bwindex] * ((float)(1L << 24) / (float)RH_RF95_FXOSC / 500.0);
     // else not defined
@@ -648,7 +1359,7 @@ int RH_RF95::lastSNR()
      sf =  RH_RF95_SPREADING_FACTOR_4096CPS;
  
    // set the new spreading factor
-   spiWrite(RH_RF95_REG_1E_MODEM_CONFIG2, (spiRead(RH_RF95_REG_1E_MODEM_CONFIG2) & ~RH_RF95_SPREADING_FACTOR) | sf);
+   spiWriteShadowed(RH_RF95_REG_1E_MODEM_CONFIG2, (spiReadShadowed(RH_RF95_REG_1E_MODEM_CONFIG2) & ~RH_RF95_SPREADING_FACTOR) | sf);
    // check if Low data Rate bit should be set or cleared
    setLowDatarate();
  }
@@ -679,7 +1390,7 @@ void RH_RF95::setSignalBandwidth(long sbw)
 	bw =  RH_RF95_BW_500KHZ;
      
     // top 4 bits of reg 1D control bandwidth
-    spiWrite(RH_RF95_REG_1D_MODEM_CONFIG1, (spiRead(RH_RF95_REG_1D_MODEM_CONFIG1) & ~RH_RF95_BW) | bw);
+    spiWriteShadowed(RH_RF95_REG_1D_MODEM_CONFIG1, (spiReadShadowed(RH_RF95_REG_1D_MODEM_CONFIG1) & ~RH_RF95_BW) | bw);
     // check if low data rate bit should be set or cleared
     setLowDatarate();
 }
@@ -698,7 +1409,7 @@ void RH_RF95::setCodingRate4(uint8_t denominator)
 	cr = RH_RF95_CODING_RATE_4_8;
  
     // CR is bits 3..1 of RH_RF95_REG_1D_MODEM_CONFIG1
-    spiWrite(RH_RF95_REG_1D_MODEM_CONFIG1, (spiRead(RH_RF95_REG_1D_MODEM_CONFIG1) & ~RH_RF95_CODING_RATE) | cr);
+    spiWriteShadowed(RH_RF95_REG_1D_MODEM_CONFIG1, (spiReadShadowed(RH_RF95_REG_1D_MODEM_CONFIG1) & ~RH_RF95_CODING_RATE) | cr);
 }
  
 void RH_RF95::setLowDatarate()
@@ -710,8 +1421,8 @@ void RH_RF95::setLowDatarate()
     // this  adds  a  small  overhead  to increase robustness to reference frequency variations over the timescale of the LoRa packet."
  
     // read current value for BW and SF
-    uint8_t BW = spiRead(RH_RF95_REG_1D_MODEM_CONFIG1) >> 4;	// bw is in bits 7..4
-    uint8_t SF = spiRead(RH_RF95_REG_1E_MODEM_CONFIG2) >> 4;	// sf is in bits 7..4
+    uint8_t BW = spiReadShadowed(RH_RF95_REG_1D_MODEM_CONFIG1) >> 4;	// bw is in bits 7..4
+    uint8_t SF = spiReadShadowed(RH_RF95_REG_1E_MODEM_CONFIG2) >> 4;	// sf is in bits 7..4
    
     // calculate symbol time (see Semtech AN1200.22 section 4)
     float bw_tab[] = {7800, 10400, 15600, 20800, 31250, 41700, 62500, 125000, 250000, 500000};
@@ -727,23 +1438,23 @@ void RH_RF95::setLowDatarate()
     // So the threshold used here is 16.0ms
  
     // the LDR is bit 3 of RH_RF95_REG_26_MODEM_CONFIG3
-    uint8_t current = spiRead(RH_RF95_REG_26_MODEM_CONFIG3) & ~RH_RF95_LOW_DATA_RATE_OPTIMIZE; // mask off the LDR bit
+    uint8_t current = spiReadShadowed(RH_RF95_REG_26_MODEM_CONFIG3) & ~RH_RF95_LOW_DATA_RATE_OPTIMIZE; // mask off the LDR bit
     if (symbolTime > 16.0)
-	spiWrite(RH_RF95_REG_26_MODEM_CONFIG3, current | RH_RF95_LOW_DATA_RATE_OPTIMIZE);
+	spiWriteShadowed(RH_RF95_REG_26_MODEM_CONFIG3, current | RH_RF95_LOW_DATA_RATE_OPTIMIZE);
     else
-	spiWrite(RH_RF95_REG_26_MODEM_CONFIG3, current);
+	spiWriteShadowed(RH_RF95_REG_26_MODEM_CONFIG3, current);
    
 }
  
 void RH_RF95::setPayloadCRC(bool on)
 {
     // Payload CRC is bit 2 of register 1E
-    uint8_t current = spiRead(RH_RF95_REG_1E_MODEM_CONFIG2) & ~RH_RF95_PAYLOAD_CRC_ON; // mask off the CRC
+    uint8_t current = spiReadShadowed(RH_RF95_REG_1E_MODEM_CONFIG2) & ~RH_RF95_PAYLOAD_CRC_ON; // mask off the CRC
    
     if (on)
-	spiWrite(RH_RF95_REG_1E_MODEM_CONFIG2, current | RH_RF95_PAYLOAD_CRC_ON);
+	spiWriteShadowed(RH_RF95_REG_1E_MODEM_CONFIG2, current | RH_RF95_PAYLOAD_CRC_ON);
     else
-	spiWrite(RH_RF95_REG_1E_MODEM_CONFIG2, current);
+	spiWriteShadowed(RH_RF95_REG_1E_MODEM_CONFIG2, current);
     _enableCRC = on;
 }
  
@@ -753,3 +1464,46 @@ uint8_t RH_RF95::getDeviceVersion()
 	return _deviceVersion;
 }
 
+uint32_t RH_RF95::timeOnAir(uint8_t len)
+{
+    return timeOnAir(len, NULL);
+}
+
+uint32_t RH_RF95::timeOnAir(uint8_t len, const ModemConfig* config)
+{
+    uint8_t config1 = config ? config->reg_1d : spiReadShadowed(RH_RF95_REG_1D_MODEM_CONFIG1);
+    uint8_t config2 = config ? config->reg_1e : spiReadShadowed(RH_RF95_REG_1E_MODEM_CONFIG2);
+    uint8_t config3 = config ? config->reg_26 : spiReadShadowed(RH_RF95_REG_26_MODEM_CONFIG3);
+    uint8_t bwindex = config1 >> 4;
+    if (bwindex >= (sizeof(bandwidths) / sizeof(bandwidths[0])))
+	return 0; // Not defined
+    uint16_t preamble = ((uint16_t)spiReadShadowed(RH_RF95_REG_20_PREAMBLE_MSB) << 8) | spiReadShadowed(RH_RF95_REG_21_PREAMBLE_LSB);
+
+    return loraTimeOnAir(config2 >> 4, bandwidths[bwindex], (config1 & RH_RF95_CODING_RATE) >> 1, preamble,
+			 config1 & RH_RF95_IMPLICIT_HEADER_MODE_ON, config2 & RH_RF95_PAYLOAD_CRC_ON,
+			 config3 & RH_RF95_LOW_DATA_RATE_OPTIMIZE, len + RH_RF95_HEADER_LEN);
+}
+
+uint32_t RH_RF95::txAirtime()
+{
+    uint64_t airtime;
+    ATOMIC_BLOCK_START;
+    airtime = _txAirtime;
+    ATOMIC_BLOCK_END;
+    return (uint32_t)(airtime / 1000);
+}
+
+uint32_t RH_RF95::rxAirtime()
+{
+    uint64_t airtime;
+    ATOMIC_BLOCK_START;
+    airtime = _rxAirtime;
+    ATOMIC_BLOCK_END;
+    return (uint32_t)(airtime / 1000);
+}
+
+uint32_t RH_RF95::lastTxAirtime()
+{
+    return _lastTxAirtime;
+}
+
@@ -17,8 +17,9 @@
 #include <Seeed_Arduino_FreeRTOS.h>
 
 // This is the maximum number of interrupts the driver can support
-// Most Arduinos can handle 2, Megas can handle more
-#define RH_RF95_NUM_INTERRUPTS 3
+// Most Arduinos can handle 2, Megas can handle more. The 4th is for the simulator (tools/rf95SimBuild), eg a repeater
+// pair between two devices
+#define RH_RF95_NUM_INTERRUPTS 4
 
 // Max number of octets the LORA Rx/Tx FIFO can hold
 #define RH_RF95_FIFO_SIZE 255
@@ -38,6 +39,40 @@
  #define RH_RF95_MAX_MESSAGE_LEN (RH_RF95_MAX_PAYLOAD_LEN - RH_RF95_HEADER_LEN)
 #endif
 
+// Number of received messages the interrupt handler can hold before they are collected with recv().
+// Each slot costs RH_RF95_MAX_PAYLOAD_LEN + 4 octets of SRAM.
+// Can be pre-defined to a different size prior to including this header
+#ifndef RH_RF95_RX_RING_SLOTS
+ #define RH_RF95_RX_RING_SLOTS 4
+#endif
+
+// FreeRTOS priority and stack depth (words) of the task that services radio interrupts.
+// The priority should be above any task that uses the radio. Can be pre-defined prior to including this header,
+// or the priority changed at run time with setServiceTaskPriority()
+#ifndef RH_RF95_SERVICE_TASK_PRIORITY
+ #define RH_RF95_SERVICE_TASK_PRIORITY (configMAX_PRIORITIES - 1)
+#endif
+#ifndef RH_RF95_SERVICE_TASK_STACK
+ #define RH_RF95_SERVICE_TASK_STACK 256
+#endif
+
+// Listen before talk: when CAD finds the channel busy, send() backs off a random number of slots of
+// RH_RF95_CAD_SLOT_SYMBOLS symbols, from 1 to a window that starts at RH_RF95_CAD_WINDOW_MIN slots and doubles
+// on each busy CAD up to RH_RF95_CAD_WINDOW_MAX. Can be pre-defined prior to including this header
+#ifndef RH_RF95_CAD_SLOT_SYMBOLS
+ #define RH_RF95_CAD_SLOT_SYMBOLS 4
+#endif
+#ifndef RH_RF95_CAD_WINDOW_MIN
+ #define RH_RF95_CAD_WINDOW_MIN 8
+#endif
+#ifndef RH_RF95_CAD_WINDOW_MAX
+ #define RH_RF95_CAD_WINDOW_MAX 64
+#endif
+
+// Number of write-mostly registers (mode, frequency, power, modem config etc) whose last written value
+// is kept so that writing the same value again can be skipped
+#define RH_RF95_NUM_SHADOW_REGISTERS 13
+
 // The crystal oscillator frequency of the module
 #define RH_RF95_FXOSC 32000000.0
 
@@ -585,6 +620,17 @@ public:
 	uint8_t    reg_1e;   ///< Value for register RH_RF95_REG_1E_MODEM_CONFIG2
 	uint8_t    reg_26;   ///< Value for register RH_RF95_REG_26_MODEM_CONFIG3
     } ModemConfig;
+
+    /// \brief Modem configuration and output power for one transmission
+    ///
+    /// Passed to send() or sendWithHeaders() to transmit one message with settings other than the ones
+    /// the radio receives with. The receive settings are put back as soon as the message has gone.
+    typedef struct
+    {
+	ModemConfig modem;   ///< Modem configuration to transmit with
+	int8_t      power;   ///< Output power in dBm on PA_BOOST, as for setTxPower()
+	uint16_t    preamble; ///< Preamble length in symbols as for setPreambleLength(), or 0 to keep the current one. A long one reaches a receiver that only wakes for a CAD now and then (see sniff())
+    } TxSettings;
 	
 	/*ZTM Added*/ void testFunction();
 	/*ZTM Added*/ TaskHandle_t * _rx_task_handle_ptr;
@@ -652,6 +698,11 @@ public:
     /// \param[in] config A ModemConfig structure containing values for the modem configuration registers.
     void           setModemRegisters(const ModemConfig* config);
 
+    /// Changes the modem configuration the radio receives with, without cutting short a transmission in progress
+    /// (including one started by the receive hook) or one with its own TxSettings. The receiver is restarted if it was on.
+    /// \param[in] config A ModemConfig structure containing values for the modem configuration registers.
+    void           setRxModemRegisters(const ModemConfig* config);
+
     /// Select one of the predefined modem configurations. If you need a modem configuration not provided 
     /// here, use setModemRegisters() with your own ModemConfig.
     /// Caution: the slowest protocols may require a radio module with TCXO temperature controlled oscillator
@@ -678,9 +729,132 @@ public:
     /// \return true if a valid message was copied to buf
     virtual bool    recv(uint8_t* buf, uint8_t* len);
 
+    /// Zero-copy alternative to recv().
+    /// If there is a valid message available, sets *data to point at the oldest message inside the driver's own
+    /// receive ring (after the 4 headers) and *len to its length, and returns true. The message stays
+    /// borrowed until recvRelease() is called. The receiver keeps running meanwhile, newer messages go
+    /// into the other slots of the ring. The headers, lastRssi() and lastSNR() describe the borrowed message.
+    /// If there is no message available, turns the receiver on and returns false.
+    /// \param[out] data Set to point at the borrowed message
+    /// \param[out] len Set to the number of octets in the borrowed message
+    /// \return true if a message was borrowed
+    bool            recvView(const uint8_t** data, uint8_t* len);
+
+    /// As recvView(), but the message starts with its 4 headers (TO, FROM, ID and FLAGS), as they came
+    /// off the air, eg to pass on to resend() as it is.
+    /// \param[out] buf Set to the message, starting with the headers
+    /// \param[out] len Set to the number of octets in buf, including the headers
+    /// \return true if a message was available
+    bool            recvViewFrame(const uint8_t** buf, uint8_t* len);
+
+    /// Releases a message borrowed with recvView() so its slot can be reused for the next message.
+    void            recvRelease();
+
+    /// Returns the number of received messages that were lost because every slot of the receive ring
+    /// was still waiting to be collected.
+    /// \return Count of ring overflows since init
+    uint16_t        rxOverflows();
+
+    /// Sets whether messages whose TO header is the given address are received, as well as those to
+    /// this node's own address (see setThisAddress()) and the broadcast address, which always are.
+    /// Used to take in group (multicast) addresses. The check is a single bit test made as soon as
+    /// the TO header is read, so messages to other addresses are dropped (and counted by rxDropped())
+    /// without the rest being read from the FIFO or the receiving task being woken.
+    /// Has no effect while promiscuous (see setPromiscuous()).
+    /// \param[in] address The TO address
+    /// \param[in] accept true to receive messages to address, false to drop them
+    void            setAddressFilter(uint8_t address, bool accept);
+
+    /// Stops receiving messages to every address set with setAddressFilter().
+    void            clearAddressFilter();
+
+    /// Tells whether a message to the given address would be received (ignoring setPromiscuous()).
+    /// \param[in] address The TO address
+    /// \return true for this node's own address, the broadcast address and any set with setAddressFilter()
+    bool            isAddressAccepted(uint8_t address);
+
+    /// Returns the number of received messages discarded by the interrupt handler because they were
+    /// too short or addressed to another node.
+    /// \return Count of dropped messages since init
+    uint16_t        rxDropped();
+
+    /// Returns the number of received messages waiting in the receive ring.
+    /// \return Number of messages that can be collected with recv() or recvView()
+    uint8_t         rxPending();
+
+    /// Returns the longest time spent in the interrupt handler itself (the top half, which only
+    /// wakes the service task) since init.
+    /// \return Worst case interrupt handler time in microseconds
+    unsigned long   isrMaxMicros();
+
+    /// Returns the longest time spent servicing a radio interrupt (reading flags and the FIFO,
+    /// updating the ring) since init. This is the work that used to be done inside the interrupt.
+    /// \return Worst case service time in microseconds
+    unsigned long   serviceMaxMicros();
+
+    /// Returns the number of register writes skipped because the shadow cache showed the
+    /// register already held the value (eg setting a mode the radio is already in).
+    /// Use with spiTransactions() to see what the cache saves.
+    /// \return Count of skipped SPI writes since construction
+    uint32_t        spiWritesSkipped();
+
+    /// Returns the number of SPI transactions used by the last call to serviceInterrupt(),
+    /// ie to acknowledge the last radio interrupt and collect any received message.
+    /// \return SPI transactions for the last interrupt
+    uint16_t        lastServiceSpiTransactions();
+
+    /// Function called for each good message as soon as it is in the receive ring. See setRxHook().
+    /// \param[in] context The context given to setRxHook()
+    /// \param[in] buf The message, starting with the 4 headers
+    /// \param[in] len Number of octets in buf, including the headers
+    /// \return A value kept with the message, read back with rxHookResult() when it is collected
+    typedef uint8_t (*RxHook)(void* context, const uint8_t* buf, uint8_t len);
+
+    /// Sets a function to be called by the service task (or by the interrupt handler before the scheduler
+    /// is running) for each good message, before the receiving task is woken. It can be used to answer a
+    /// message straight away, eg with an acknowledgement, using sendWithHeaders(). The hook must not block.
+    /// \param[in] hook The function to call, or NULL for none
+    /// \param[in] context Passed to hook
+    void            setRxHook(RxHook hook, void* context);
+
+    /// Returns what the receive hook returned for the message last collected with recv() or recvView().
+    /// \return The hook's result, or 0 if no hook was set when the message arrived
+    uint8_t         rxHookResult();
+
+    /// Sends a message received earlier on as it is, eg from a repeater: the headers are taken from buf (as
+    /// recvViewFrame() gives them) with only FLAGS replaced, and the data goes out unchanged, with no copy.
+    /// Like send() it waits for a message already going out and listens before talk, but it does not wait
+    /// for this one: the receiver is turned back on from the TX_DONE interrupt as soon as it has gone.
+    /// \param[in] buf The message, starting with the 4 headers
+    /// \param[in] len Number of octets in buf, including the headers
+    /// \param[in] flags FLAGS header to send it with
+    /// \param[in] settings Modem configuration and power for this message as for send(), or NULL for the current ones
+    /// \return true if the message was queued for transmit
+    bool            resend(const uint8_t* buf, uint8_t len, uint8_t flags, const TxSettings* settings = NULL);
+
+    /// Loads a message into the transmitter and starts it, with the 4 headers given rather than taken from
+    /// setHeaderTo() etc, so a task part way through setting up its own message is not disturbed.
+    /// Unlike send() it never waits: no CAD, and it fails if a message is already being transmitted.
+    /// The receiver is turned back on when the message has gone. Meant for the receive hook.
+    /// \param[in] to TO header
+    /// \param[in] from FROM header
+    /// \param[in] id ID header
+    /// \param[in] flags FLAGS header
+    /// \param[in] data Array of data to be sent
+    /// \param[in] len Number of bytes of data to send
+    /// \param[in] settings Modem configuration and power for this message as for send(), or NULL for the current ones
+    /// \return true if the message was queued for transmit
+    bool            sendWithHeaders(uint8_t to, uint8_t from, uint8_t id, uint8_t flags, const uint8_t* data, uint8_t len,
+				    const TxSettings* settings = NULL);
+
+    /// Changes the priority of the task that services radio interrupts.
+    /// It should normally be above the priority of any task that uses the radio.
+    /// \param[in] priority New FreeRTOS priority for the service task
+    void            setServiceTaskPriority(UBaseType_t priority);
+
     /// Waits until any previous transmit packet is finished being transmitted with waitPacketSent().
     /// Then optionally waits for Channel Activity Detection (CAD) 
-    /// to show the channnel is clear (if the radio supports CAD) by calling waitCAD().
+    /// to show the channnel is clear, as waitCAD() does.
     /// Then loads a message into the transmitter and starts the transmitter. Note that a message length
     /// of 0 is permitted. 
     /// \param[in] data Array of data to be sent
@@ -690,6 +864,27 @@ public:
     /// if CAD was requested and the CAD timeout timed out before clear channel was detected.
     virtual bool    send(const uint8_t* data, uint8_t len);
 
+    /// As send(), but transmits with the given modem configuration and power (including the CAD) rather than
+    /// the current ones, which are put back when TX_DONE arrives (or straight away if CAD times out).
+    /// \param[in] data Array of data to be sent
+    /// \param[in] len Number of bytes of data to send
+    /// \param[in] settings Settings for this message, or NULL to use the current ones
+    /// \return As send()
+    bool            send(const uint8_t* data, uint8_t len, const TxSettings* settings);
+
+    /// Blocks until any previous transmit packet is finished being transmitted.
+    /// Once the FreeRTOS scheduler is running the calling task sleeps on a semaphore given by the
+    /// TX_DONE interrupt, instead of spinning on the mode, so lower priority tasks keep running
+    /// for the whole time on air. Before the scheduler starts it falls back to polling.
+    /// \return true
+    virtual bool    waitPacketSent();
+
+    /// Blocks until any previous transmit packet is finished being transmitted, or until the timeout expires.
+    /// Sleeps on the TX_DONE semaphore in the same way as waitPacketSent().
+    /// \param[in] timeout Maximum time to wait in milliseconds.
+    /// \return true if the transmitter is no longer transmitting, false on timeout
+    virtual bool    waitPacketSent(uint16_t timeout);
+
     /// Sets the length of the preamble
     /// in bytes. 
     /// Caution: this should be set to the same 
@@ -716,6 +911,7 @@ public:
 
     /// If current mode is Tx or Idle, changes it to Rx. 
     /// Starts the receiver in the RF95/96/97/98.
+    /// If a message is being transmitted, the receiver is started when it finishes rather than cutting it off.
     void           setModeRx();
 
     /// If current mode is Rx or Idle, changes it to Rx. F
@@ -758,12 +954,50 @@ public:
     // Bent G Christensen (bentor@gmail.com), 08/15/2016
     /// Use the radio's Channel Activity Detect (CAD) function to detect channel activity.
     /// Sets the RF95 radio into CAD mode and waits until CAD detection is complete.
+    /// Once the FreeRTOS scheduler is running the calling task sleeps until the CAD_DONE interrupt,
+    /// which comes after about 2 symbols. Before the scheduler starts it falls back to polling.
     /// To be used in a listen-before-talk mechanism (Collision Avoidance)
     /// with a reasonable time backoff algorithm.
     /// This is called automatically by waitCAD().
     /// \return true if channel is in use.  
     virtual bool    isChannelActive();
 
+    /// Listen before talk. While isChannelActive() shows the channel in use, backs off for a random number of
+    /// slots of RH_RF95_CAD_SLOT_SYMBOLS symbols, from 1 up to a window that doubles after each busy CAD
+    /// (see RH_RF95_CAD_WINDOW_MIN), rather than the 100 to 900 ms of RHGenericDriver::waitCAD().
+    /// The receiver is on during the backoff, so the frame that made the channel busy is not missed,
+    /// and the calling task sleeps (vTaskDelay) once the scheduler is running.
+    /// Leaves the radio idle.
+    /// \return true if the channel was found clear within the CAD timeout (or the timeout is 0), else false
+    virtual bool    waitCAD();
+
+    /// Returns the number of times CAD found the channel busy before a transmission.
+    /// \return Count of busy CADs since init
+    uint32_t        cadBusy();
+
+    /// One wake-up of low power listening, where the radio sleeps between CADs and senders stretch their
+    /// preamble (TxSettings::preamble) to span the time between them. Unless the radio is transmitting or
+    /// hearing a message already, runs a CAD: if it finds a preamble the receiver is left on to take the message,
+    /// otherwise the radio goes to sleep. Blocks for the CAD as isChannelActive() does.
+    /// \return true if the radio was left transmitting or receiving, false if it was put to sleep
+    bool            sniff();
+
+    /// Tells whether a message is on its way in: the radio is receiving and the modem has found a preamble or
+    /// is taking a message in. Unlike isChannelActive() the receiver is left as it is, so the message is not missed.
+    /// \return true if the radio is in RX mode and a message is arriving
+    bool            isReceiving();
+
+    /// Returns the duration of one symbol, eg to size a preamble in symbols from a time.
+    /// \param[in] config Modem configuration, or NULL for the current one
+    /// \return Symbol time in microseconds
+    uint32_t        symbolMicros(const ModemConfig* config = NULL);
+
+    /// Returns the time the radio has spent in a mode since init, eg for working out the energy it has used.
+    /// Times are kept with micros(), so call this at least every 70 minutes if the mode may not change for that long.
+    /// \param[in] mode RHModeSleep, RHModeIdle, RHModeTx, RHModeRx or RHModeCad
+    /// \return Time in milliseconds, including the current stretch if the radio is in that mode now
+    uint32_t        modeTime(RHMode mode);
+
     /// Enable TCXO mode
     /// Call this immediately after init(), to force your radio to use an external
     /// frequency source, such as a Temperature Compensated Crystal Oscillator (TCXO), if available.
@@ -856,17 +1090,108 @@ public:
     /// \param none
     /// \return uint8_t deviceID
     uint8_t getDeviceVersion();
+
+    /// Returns how long a message would take to transmit with the current modem configuration
+    /// (spreading factor, bandwidth, coding rate, preamble length, CRC and low data rate optimisation),
+    /// per the SX1276 datasheet section 4.1.1.7. Read from the register shadows, so normally no SPI traffic.
+    /// \param[in] len Length of the message as passed to send(), not counting the 4 RadioHead headers
+    /// \return Time on air in microseconds
+    uint32_t timeOnAir(uint8_t len);
+
+    /// As timeOnAir(uint8_t), for a message sent with another modem configuration (and the current preamble length).
+    /// \param[in] len Length of the message as passed to send(), not counting the 4 RadioHead headers
+    /// \param[in] config Modem configuration, or NULL for the current one
+    /// \return Time on air in microseconds
+    uint32_t timeOnAir(uint8_t len, const ModemConfig* config);
+
+    /// Returns how long a LoRa packet takes to transmit on an SX1276, per the datasheet section 4.1.1.7.
+    /// Needs no radio, so can be used in constant expressions, eg to work out timeouts at compile time.
+    /// \param[in] sf Spreading factor, 6 to 12
+    /// \param[in] bandwidth Bandwidth in Hz, eg 125000
+    /// \param[in] codingRate 1 for 4/5 to 4 for 4/8
+    /// \param[in] preamble Preamble length in symbols as given to setPreambleLength() (8 after init())
+    /// \param[in] implicitHeader true for implicit header mode
+    /// \param[in] crc true if the payload CRC is on
+    /// \param[in] lowDataRateOptimize true if the low data rate optimisation is on
+    /// \param[in] payloadLen Length of the LoRa payload in octets, including the 4 RadioHead headers
+    /// \return Time on air in microseconds
+    static constexpr uint32_t loraTimeOnAir(uint8_t sf, uint32_t bandwidth, uint8_t codingRate, uint16_t preamble,
+					    bool implicitHeader, bool crc, bool lowDataRateOptimize, uint8_t payloadLen)
+    {
+	// Counted in quarter symbols so the 4.25 symbols of sync word after the preamble stay exact
+	return (uint32_t)(((uint64_t)(preamble * 4 + 17
+				      + (8 + loraPayloadBlocks(8 * payloadLen - 4 * sf + 28 + (crc ? 16 : 0) - (implicitHeader ? 20 : 0),
+							       4 * (sf - (lowDataRateOptimize ? 2 : 0))) * (codingRate + 4)) * 4) << sf)
+			  * 1000000 / (4 * (uint64_t)bandwidth));
+    }
+
+    /// Returns the time this radio has spent transmitting since init, worked out from the length and
+    /// modem configuration of each message sent.
+    /// \return Transmit airtime in milliseconds
+    uint32_t        txAirtime();
+
+    /// Returns the time on air of the messages this radio has received since init, whoever they were addressed to
+    /// (but not those with a bad CRC, whose length is not known). With txAirtime(), shows how busy the channel is.
+    /// \return Receive airtime in milliseconds
+    uint32_t        rxAirtime();
+
+    /// Returns the time on air of the last message sent, eg to count the airtime spent on retransmissions.
+    /// \return Time on air in microseconds
+    uint32_t        lastTxAirtime();
+
+    /// Returns when the radio interrupted for the end of the message last collected with recv() or recvView(),
+    /// taken in the interrupt handler so it does not depend on how long the message waited to be collected.
+    /// Less timeOnAir() of its length, gives when the sender started it, eg to line up with a time reference.
+    /// \return micros() at the RxDone interrupt
+    unsigned long   lastRxTime();
     
 protected:
+    /// Payload symbol blocks for loraTimeOnAir(): the numerator of the datasheet formula over its denominator, rounded up
+    static constexpr int32_t loraPayloadBlocks(int32_t numerator, int32_t denominator)
+    {
+	return numerator > 0 ? (numerator + denominator - 1) / denominator : 0;
+    }
+
     /// This is a low level function to handle the interrupts for one instance of RH_RF95.
     /// Called automatically by isr*()
     /// Should not need to be called by user code.
     void           handleInterrupt();
 
-    /// Examine the revceive buffer to determine whether the message is for this node
-    void validateRxBuf();
+    /// Reads and acknowledges the radio interrupt flags and collects any received message.
+    /// Called by the service task after handleInterrupt() wakes it, or directly by
+    /// handleInterrupt() before the scheduler is running.
+    void           serviceInterrupt();
 
-    /// Clear our local receive buffer
+    /// Writes a register, skipping the SPI transaction if the shadow cache shows the register
+    /// already holds val. Only the registers in the shadow table are cached; others are always written.
+    /// \param[in] reg Register number
+    /// \param[in] val The value to write
+    /// \return The status byte from spiWrite(), or 0 if the write was skipped
+    uint8_t        spiWriteShadowed(uint8_t reg, uint8_t val);
+
+    /// Reads a register from the shadow cache if its value is known, else from the radio.
+    /// Only use this for registers the radio does not change by itself.
+    /// \param[in] reg Register number
+    /// \return The value of the register
+    uint8_t        spiReadShadowed(uint8_t reg);
+
+    /// Records that a shadowed register now holds val, without writing it.
+    /// Used when the radio changes a register itself, such as OP_MODE returning to standby after TxDone
+    void           shadowRegister(uint8_t reg, uint8_t val);
+
+    /// Forgets every shadowed value, so the next write of each register goes to the radio
+    void           invalidateShadow();
+
+    /// Takes the (recursive) radio mutex once the scheduler is running
+    void           lockRadio();
+
+    /// Gives the radio mutex back
+    void           unlockRadio();
+
+    /// Examine a received message to determine whether it is complete and for this node
+    bool validateRxBuf(const uint8_t* buf, uint8_t len);
+
+    /// Release the oldest message in the receive ring
     void clearRxBuf();
 
     /// Called by RH_RF95 when the radio mode is about to change to a new setting.
@@ -886,9 +1211,18 @@ private:
     /// Low level interrupt service routine for device connected to interrupt 1
     static void         isr1();
 
-    /// Low level interrupt service routine for device connected to interrupt 1
+    /// Low level interrupt service routine for device connected to interrupt 2
     static void         isr2();
 
+    /// Low level interrupt service routine for device connected to interrupt 3
+    static void         isr3();
+
+    /// FreeRTOS task that runs serviceInterrupt() each time handleInterrupt() notifies it
+    static void         serviceTask(void* param);
+
+    /// Index of reg in the shadow table, or -1 if it is not shadowed
+    static int8_t       shadowIndex(uint8_t reg);
+
     /// Array of instances connected to interrupts 0 and 1
     static RH_RF95*     _deviceForInterrupt[];
 
@@ -902,14 +1236,127 @@ private:
     /// else 0xff
     uint8_t             _myInterruptIndex;
 
-    /// Number of octets in the buffer
-    volatile uint8_t    _bufLen;
-    
-    /// The receiver/transmitter buffer
-    uint8_t             _buf[RH_RF95_MAX_PAYLOAD_LEN];
+    /// One received message, as captured by the interrupt handler
+    typedef struct
+    {
+	uint8_t    len;                           ///< Number of octets in buf, including the 4 headers
+	int8_t     snr;                           ///< SNR of this message, dB
+	int16_t    rssi;                          ///< RSSI of this message, dBm
+	uint8_t    hookResult;                    ///< What the receive hook returned for this message
+	unsigned long time;                       ///< micros() at its RxDone interrupt
+	uint8_t    buf[RH_RF95_MAX_PAYLOAD_LEN];  ///< Headers and message data
+    } RxSlot;
+
+    /// Make a slot the current message for headerTo(), lastRssi() etc
+    void                loadRxSlot(const RxSlot* slot);
+
+    /// Ring of received messages. Filled by the interrupt handler at _rxHead, drained at _rxTail
+    RxSlot              _rxRing[RH_RF95_RX_RING_SLOTS];
+
+    /// Index of the next slot the interrupt handler will fill
+    volatile uint8_t    _rxHead;
+
+    /// Index of the oldest uncollected message
+    volatile uint8_t    _rxTail;
+
+    /// Number of uncollected messages in the ring
+    volatile uint8_t    _rxCount;
+
+    /// Messages lost because the ring was full
+    volatile uint16_t   _rxOverflows;
+
+    /// Messages discarded by the interrupt handler (too short or not addressed to us)
+    volatile uint16_t   _rxDropped;
+
+    /// One bit for each TO address taken in besides our own and broadcast, see setAddressFilter()
+    uint32_t            _rxAccept[8];
+
+    /// Receive hook and its context, see setRxHook()
+    RxHook              _rxHook;
+    void*               _rxHookContext;
+
+    /// Receive hook result for the message last collected
+    uint8_t             _rxHookResult;
+
+    /// micros() at the last radio interrupt, and at the RxDone of the message last collected
+    volatile unsigned long _interruptTime;
+    unsigned long       _lastRxTime;
+
+    /// Set when setModeRx() is called during a transmit or CAD, so TX_DONE or CAD_DONE starts the receiver instead of going idle
+    volatile bool       _rxAfterTx;
+
+    /// Switches to the settings for one transmission, keeping the receive settings in _rxSettings.
+    /// Called with the radio locked and idle
+    void                applyTxSettings(const TxSettings* settings);
+
+    /// Puts the receive settings back after a transmission with applyTxSettings(), if there was one
+    void                restoreRxSettings();
+
+    /// waitCAD() for a transmission with the given settings, which are taken off while the receiver
+    /// is on during a backoff and put back before returning. Called with the radio idle and not locked
+    bool                listenBeforeTalk(const TxSettings* settings);
+
+    /// Gets the radio ready to load a message, as send() and resend() do: waits for a message already going
+    /// out, leaves RX with the settings for this one applied, and listens before talk.
+    /// \return false if the channel stayed busy (see listenBeforeTalk()), with the receive settings back
+    bool                prepareTx(const TxSettings* settings);
+
+    /// Sleeps for at least the given time in microseconds, rounded up to whole milliseconds: vTaskDelay() once the scheduler is running
+    void                backoffDelay(uint32_t duration);
+
+    /// Blocks until the radio leaves mode (RHModeTx or RHModeCad), sleeping on _txDoneSemaphore once the scheduler
+    /// is running, or polling before. Any number of tasks can wait at once
+    void                waitModeEnd(RHMode mode);
+
+    /// Busy CADs since init
+    volatile uint32_t   _cadBusy;
+
+    /// Adds the time since the last mode change to the mode the radio is leaving. Called with the radio locked
+    void                countModeTime();
+
+    /// Time spent in each mode before the current one, microseconds, and micros() when the current one started
+    volatile uint64_t   _modeMicros[RHModeCad + 1];
+    volatile unsigned long _modeStart;
+
+    /// Modem configuration registers, RegPaConfig, RegPaDac and the preamble length to go back to after a
+    /// transmission with other settings, and whether they need to
+    uint8_t             _rxSettings[7];
+    bool                _rxSettingsUseRFO;
+    volatile bool       _rxSettingsPending;
+
+    /// Given by the interrupt handler on TX_DONE and CAD_DONE, taken by waitModeEnd()
+    SemaphoreHandle_t   _txDoneSemaphore;
+
+    /// Held while the radio registers or FIFO are in use
+    SemaphoreHandle_t   _radioMutex;
+
+    /// Task that services radio interrupts
+    TaskHandle_t        _serviceTaskHandle;
+
+    /// Longest time in handleInterrupt(), microseconds
+    volatile unsigned long _isrMaxMicros;
+
+    /// Longest time in serviceInterrupt(), microseconds
+    volatile unsigned long _serviceMaxMicros;
+
+    /// Last value written to (or known to be in) each shadowed register
+    uint8_t             _shadow[RH_RF95_NUM_SHADOW_REGISTERS];
+
+    /// Bit n set if _shadow[n] is known to match the radio
+    uint16_t            _shadowValid;
+
+    /// Writes skipped because of the shadow cache
+    volatile uint32_t   _spiWritesSkipped;
+
+    /// Time on air of everything sent and received since init, microseconds
+    volatile uint64_t   _txAirtime;
+    volatile uint64_t   _rxAirtime;
+
+    /// Time on air of the last message sent, microseconds
+    volatile uint32_t   _lastTxAirtime;
 
-    /// True when there is a valid message in the buffer
-    volatile bool       _rxBufValid;
+    /// SPI transactions used by the last serviceInterrupt()
+    volatile uint16_t   _lastServiceSpi;
 
     /// True if we are using the HF port (779.0 MHz and above)
     bool                _usingHFport;
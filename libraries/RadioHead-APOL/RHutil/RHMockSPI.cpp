@@ -0,0 +1,129 @@
+// RHMockSPI.cpp
+// Host side stand-in for an SPI interface
+
+#include <RHutil/RHMockSPI.h>
+
+#if (RH_PLATFORM == RH_PLATFORM_UNIX)
+
+RHMockSPI::RHMockSPI()
+    :
+    RHGenericSPI()
+{
+    clear();
+}
+
+uint8_t RHMockSPI::exchange(uint8_t data)
+{
+    if (_sentLen < RH_MOCK_SPI_BUF_LEN)
+	_sent[_sentLen++] = data;
+    if (_responsesNext < _responsesLen)
+	return _responses[_responsesNext++];
+    return 0;
+}
+
+uint8_t RHMockSPI::transfer(uint8_t data)
+{
+    _octetTransfers++;
+    return exchange(data);
+}
+
+void RHMockSPI::transferBuffer(const uint8_t* src, uint8_t* dest, uint16_t len)
+{
+    _bufferTransfers++;
+    while (len--)
+    {
+	uint8_t val = exchange(src ? *src++ : 0);
+	if (dest)
+	    *dest++ = val;
+    }
+}
+
+bool RHMockSPI::transferBufferAsync(const uint8_t* src, uint8_t* dest, uint16_t len,
+				    TransferCallback callback, void* arg)
+{
+    if (_pending)
+	return false;
+    transferBuffer(src, dest, len);
+    _pendingCallback = callback;
+    _pendingArg = arg;
+    _pending = true;
+    return true;
+}
+
+bool RHMockSPI::completePending()
+{
+    if (!_pending)
+	return false;
+    _pending = false;
+    if (_pendingCallback)
+	_pendingCallback(_pendingArg);
+    return true;
+}
+
+bool RHMockSPI::pending()
+{
+    return _pending;
+}
+
+void RHMockSPI::beginTransaction()
+{
+    _transactions++;
+    _inTransaction = true;
+}
+
+void RHMockSPI::endTransaction()
+{
+    _inTransaction = false;
+}
+
+void RHMockSPI::queueResponse(const uint8_t* data, uint16_t len)
+{
+    while (len-- && _responsesLen < RH_MOCK_SPI_BUF_LEN)
+	_responses[_responsesLen++] = *data++;
+}
+
+const uint8_t* RHMockSPI::sent()
+{
+    return _sent;
+}
+
+uint16_t RHMockSPI::sentLen()
+{
+    return _sentLen;
+}
+
+void RHMockSPI::clear()
+{
+    _sentLen = 0;
+    _responsesLen = 0;
+    _responsesNext = 0;
+    _transactions = 0;
+    _octetTransfers = 0;
+    _bufferTransfers = 0;
+    _inTransaction = false;
+    _pendingCallback = NULL;
+    _pendingArg = NULL;
+    _pending = false;
+}
+
+uint32_t RHMockSPI::transactions()
+{
+    return _transactions;
+}
+
+uint32_t RHMockSPI::octetTransfers()
+{
+    return _octetTransfers;
+}
+
+uint32_t RHMockSPI::bufferTransfers()
+{
+    return _bufferTransfers;
+}
+
+bool RHMockSPI::inTransaction()
+{
+    return _inTransaction;
+}
+
+#endif
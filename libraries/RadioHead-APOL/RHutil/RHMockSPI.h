@@ -0,0 +1,93 @@
+// RHMockSPI.h
+// Host side stand-in for an SPI interface, for exercising RHSPIDriver and RHGenericSPI
+// transfer logic on Linux without hardware
+
+#ifndef RHMockSPI_h
+#define RHMockSPI_h
+
+#include <RHGenericSPI.h>
+
+#if (RH_PLATFORM == RH_PLATFORM_UNIX)
+
+// Most octets the mock will log or queue as responses
+#ifndef RH_MOCK_SPI_BUF_LEN
+ #define RH_MOCK_SPI_BUF_LEN 512
+#endif
+
+/////////////////////////////////////////////////////////////////////
+/// \class RHMockSPI RHMockSPI.h <RHutil/RHMockSPI.h>
+/// \brief Mock SPI interface for host builds
+///
+/// Every octet sent is appended to a log that can be inspected with sent(). Octets returned by
+/// transfer() come from a queue loaded with queueResponse(), or 0 once it is empty.
+/// Transactions, single octet transfers and buffer transfers are counted separately.
+///
+/// transferBufferAsync() behaves like a DMA backend: the octets move straight away but the
+/// callback is held back until completePending() is called, standing in for the DMA interrupt.
+/// This lets code that waits for completion be driven one step at a time.
+class RHMockSPI : public RHGenericSPI
+{
+public:
+    RHMockSPI();
+
+    /// Logs data and returns the next queued response octet (0 if none)
+    uint8_t transfer(uint8_t data);
+
+    /// Logs and answers the whole buffer, counted as one buffer transfer
+    void transferBuffer(const uint8_t* src, uint8_t* dest, uint16_t len);
+
+    /// Moves the octets now, keeps the callback until completePending()
+    /// \return false if a previous async transfer has not been completed
+    bool transferBufferAsync(const uint8_t* src, uint8_t* dest, uint16_t len,
+			     TransferCallback callback, void* arg);
+
+    void begin() {}
+    void end() {}
+    void beginTransaction();
+    void endTransaction();
+
+    /// Adds octets to the end of the response queue
+    void queueResponse(const uint8_t* data, uint16_t len);
+
+    /// Makes the callback for an outstanding transferBufferAsync(), as a DMA interrupt would
+    /// \return true if there was one
+    bool completePending();
+
+    /// \return true if a transferBufferAsync() is waiting for completePending()
+    bool pending();
+
+    /// Octets sent since the last clear()
+    const uint8_t* sent();
+    uint16_t       sentLen();
+
+    /// Empties the log and the response queue and zeroes the counters
+    void clear();
+
+    uint32_t transactions();
+    uint32_t octetTransfers();
+    uint32_t bufferTransfers();
+
+    /// True between beginTransaction() and endTransaction()
+    bool inTransaction();
+
+protected:
+    uint8_t  _sent[RH_MOCK_SPI_BUF_LEN];
+    uint16_t _sentLen;
+    uint8_t  _responses[RH_MOCK_SPI_BUF_LEN];
+    uint16_t _responsesLen;
+    uint16_t _responsesNext;
+    uint32_t _transactions;
+    uint32_t _octetTransfers;
+    uint32_t _bufferTransfers;
+    bool     _inTransaction;
+    TransferCallback _pendingCallback;
+    void*    _pendingArg;
+    bool     _pending;
+
+    /// Log one octet and return the next response
+    uint8_t  exchange(uint8_t data);
+};
+
+#endif
+
+#endif
@@ -0,0 +1,594 @@
+// SX1276Emulator.cpp
+// Register level emulation of an SX1276 LoRa radio for the Linux simulator
+
+#include <RHutil/SX1276Emulator.h>
+
+#if (RH_PLATFORM == RH_PLATFORM_UNIX)
+
+SX1276Emulator* SX1276Emulator::_radios[SX1276_EMULATOR_MAX_RADIOS];
+bool            SX1276Emulator::_airRunning = false;
+
+// Bandwidth in Hz for each RegModemConfig1 Bw setting
+static const uint32_t bandwidths[] = {7800, 10400, 15600, 20800, 31250, 41700, 62500, 125000, 250000, 500000};
+
+SX1276Emulator::SX1276Emulator(uint8_t csPin, uint8_t dio0Pin)
+    :
+    RHGenericSPI(),
+    _csPin(csPin),
+    _dio0Pin(dio0Pin),
+    _rssi(-60),
+    _snr(9),
+    _lossPercent(0),
+    _lossSeed(1)
+{
+    memset(_linkSet, 0, sizeof(_linkSet));
+    memset(_linkLoss, 0, sizeof(_linkLoss));
+    reset();
+    resetCounters();
+    simulator_interrupts_lock();
+    for (uint8_t i = 0; i < SX1276_EMULATOR_MAX_RADIOS; i++)
+    {
+	if (!_radios[i])
+	{
+	    _radios[i] = this;
+	    break;
+	}
+    }
+    simulator_interrupts_unlock();
+    simulator_attach_spi_device(_csPin, this);
+}
+
+SX1276Emulator::~SX1276Emulator()
+{
+    simulator_interrupts_lock();
+    for (uint8_t i = 0; i < SX1276_EMULATOR_MAX_RADIOS; i++)
+	if (_radios[i] == this)
+	    _radios[i] = NULL;
+    simulator_interrupts_unlock();
+    simulator_attach_spi_device(_csPin, NULL);
+}
+
+void SX1276Emulator::reset()
+{
+    memset(_registers, 0, sizeof(_registers));
+    memset(_fifo, 0, sizeof(_fifo));
+    // Power on values that the driver relies on, datasheet table 41
+    _registers[RH_RF95_REG_01_OP_MODE]           = 0x09; // FSK/OOK, low frequency mode, standby
+    _registers[RH_RF95_REG_06_FRF_MSB]           = 0x6c;
+    _registers[RH_RF95_REG_07_FRF_MID]           = 0x80;
+    _registers[RH_RF95_REG_0E_FIFO_TX_BASE_ADDR] = 0x80;
+    _registers[RH_RF95_REG_1D_MODEM_CONFIG1]     = 0x72;
+    _registers[RH_RF95_REG_1E_MODEM_CONFIG2]     = 0x70;
+    _registers[RH_RF95_REG_21_PREAMBLE_LSB]      = 0x08;
+    _registers[RH_RF95_REG_22_PAYLOAD_LENGTH]    = 0x01;
+    _registers[RH_RF95_REG_23_MAX_PAYLOAD_LENGTH]= 0xff;
+    _registers[RH_RF95_REG_42_VERSION]           = 0x12;
+    _selected = false;
+    _haveAddress = false;
+    _writing = false;
+    _address = 0;
+    _dio0 = false;
+    _interruptPending = false;
+    _modeEnd = 0;
+    _syncEnd = 0;
+    _rxStart = 0;
+    _txLen = 0;
+    _incomingEnd = 0;
+    _incomingCollided = false;
+    _signalEnd = 0;
+    _inIsr = false;
+    _isrCurrentTransactions = 0;
+}
+
+void SX1276Emulator::begin()
+{
+    simulator_interrupts_lock();
+    bool start = !_airRunning;
+    _airRunning = true;
+    simulator_interrupts_unlock();
+    if (start)
+	simulator_thread_create(airThread, NULL, SIMULATOR_INTERRUPT_PRIORITY);
+}
+
+void SX1276Emulator::select(bool selected)
+{
+    if (selected && !_selected)
+    {
+	_haveAddress = false;
+	_transactions++;
+	if (_inIsr)
+	{
+	    _isrTransactions++;
+	    _isrCurrentTransactions++;
+	}
+    }
+    _selected = selected;
+}
+
+uint8_t SX1276Emulator::transfer(uint8_t data)
+{
+    simulator_spend_micros(SIMULATOR_SPI_OCTET_MICROS);
+    // Without a chip select (eg if the bus is driven directly) treat every transfer as part of one transaction
+    if (!_haveAddress)
+    {
+	_address = data & 0x7f;
+	_writing = data & 0x80;
+	_haveAddress = true;
+	return 0; // Status octet, not used by the SX1276
+    }
+    uint8_t val = 0;
+    if (_writing)
+	writeRegister(_address, data);
+    else
+	val = readRegister(_address);
+    if (_address != RH_RF95_REG_00_FIFO)
+	_address = (_address + 1) & 0x7f;
+    return val;
+}
+
+uint8_t SX1276Emulator::registerValue(uint8_t reg)
+{
+    return _registers[reg & 0x7f];
+}
+
+uint8_t SX1276Emulator::readRegister(uint8_t reg)
+{
+    if (reg == RH_RF95_REG_00_FIFO)
+	return _fifo[_registers[RH_RF95_REG_0D_FIFO_ADDR_PTR]++];
+    if (reg == RH_RF95_REG_18_MODEM_STAT)
+    {
+	// Signal detected and RX ongoing while the receiver is picking up a frame, else modem clear
+	if (receiving() && _signalEnd > micros())
+	    return RH_RF95_MODEM_STATUS_SIGNAL_DETECTED | RH_RF95_MODEM_STATUS_RX_ONGOING;
+	return RH_RF95_MODEM_STATUS_CLEAR;
+    }
+    return _registers[reg];
+}
+
+void SX1276Emulator::writeRegister(uint8_t reg, uint8_t val)
+{
+    switch (reg)
+    {
+    case RH_RF95_REG_00_FIFO:
+	_fifo[_registers[RH_RF95_REG_0D_FIFO_ADDR_PTR]++] = val;
+	break;
+
+    case RH_RF95_REG_01_OP_MODE:
+    {
+	uint8_t old = _registers[reg];
+	// LongRangeMode can only be changed by a write that selects sleep. Other writes keep it
+	if ((val & RH_RF95_MODE) != RH_RF95_MODE_SLEEP)
+	    val = (val & ~RH_RF95_LONG_RANGE_MODE) | (old & RH_RF95_LONG_RANGE_MODE);
+	_registers[reg] = val;
+	if ((val & RH_RF95_LONG_RANGE_MODE) && (val & RH_RF95_MODE) != (old & RH_RF95_MODE))
+	    startMode(val & RH_RF95_MODE, micros());
+	break;
+    }
+
+    case RH_RF95_REG_12_IRQ_FLAGS:
+	// Write 1 to clear
+	_registers[reg] &= ~val;
+	updateDio0();
+	break;
+
+    case RH_RF95_REG_40_DIO_MAPPING1:
+	_registers[reg] = val;
+	updateDio0();
+	break;
+
+    case RH_RF95_REG_10_FIFO_RX_CURRENT_ADDR:
+    case RH_RF95_REG_13_RX_NB_BYTES:
+    case RH_RF95_REG_19_PKT_SNR_VALUE:
+    case RH_RF95_REG_1A_PKT_RSSI_VALUE:
+    case RH_RF95_REG_1B_RSSI_VALUE:
+    case RH_RF95_REG_1C_HOP_CHANNEL:
+    case RH_RF95_REG_42_VERSION:
+	break; // Read only
+
+    default:
+	_registers[reg] = val;
+	break;
+    }
+}
+
+void SX1276Emulator::startMode(uint8_t mode, unsigned long now)
+{
+    if (mode == RH_RF95_MODE_TX)
+    {
+	// The frame is taken from the FIFO at the TX base address when the transmitter starts
+	_txLen = _registers[RH_RF95_REG_22_PAYLOAD_LENGTH];
+	uint32_t toa = timeOnAir(_txLen);
+	_modeEnd = now + toa;
+	uint16_t preamble = (_registers[RH_RF95_REG_20_PREAMBLE_MSB] << 8) | _registers[RH_RF95_REG_21_PREAMBLE_LSB];
+	_syncEnd = now + (uint32_t)(((uint64_t)preamble * 4 + 17) * symbolMicros() / 4);
+	_airtimeMicros += toa;
+	// dBm to mW: 10^(dBm / 10), by way of the 1 dB steps of 10^0.1
+	double mw = 1.0;
+	for (int8_t db = txPower(); db > 0; db--)
+	    mw *= 1.2589254;
+	_txEnergyNanojoules += (uint64_t)(toa * mw);
+	for (uint8_t i = 0; i < SX1276_EMULATOR_MAX_RADIOS; i++)
+	    if (_radios[i] && _radios[i] != this && _radios[i]->receiving() && sameChannel(_radios[i]))
+		_radios[i]->frameStarted(_modeEnd, _radios[i]->linkSnrQuarters(this) >= _radios[i]->snrFloorQuarters());
+    }
+    else if (mode == RH_RF95_MODE_CAD)
+	_modeEnd = now + 2 * symbolMicros();
+    else if (receiving())
+    {
+	// Frames whose preamble is still on the air can be picked up
+	_rxStart = now;
+	for (uint8_t i = 0; i < SX1276_EMULATOR_MAX_RADIOS; i++)
+	{
+	    SX1276Emulator* other = _radios[i];
+	    if (other && other != this && sameChannel(other) && now < other->_syncEnd && other->_modeEnd != _incomingEnd
+		&& (other->_registers[RH_RF95_REG_01_OP_MODE] & RH_RF95_MODE) == RH_RF95_MODE_TX)
+		frameStarted(other->_modeEnd, linkSnrQuarters(other) >= snrFloorQuarters());
+	}
+    }
+}
+
+void SX1276Emulator::frameStarted(unsigned long end, bool detected)
+{
+    // A frame still arriving when another starts spoils both
+    _incomingCollided = _incomingEnd > micros();
+    if (end > _incomingEnd)
+	_incomingEnd = end;
+    if (detected && end > _signalEnd)
+	_signalEnd = end;
+}
+
+void SX1276Emulator::poll(unsigned long now)
+{
+    uint8_t mode = _registers[RH_RF95_REG_01_OP_MODE] & RH_RF95_MODE;
+    if (!(_registers[RH_RF95_REG_01_OP_MODE] & RH_RF95_LONG_RANGE_MODE) || now < _modeEnd)
+	return;
+
+    if (mode == RH_RF95_MODE_TX)
+    {
+	// TxDone, and the radio drops back to standby by itself
+	_registers[RH_RF95_REG_01_OP_MODE] = (_registers[RH_RF95_REG_01_OP_MODE] & ~RH_RF95_MODE) | RH_RF95_MODE_STDBY;
+	_txPackets++;
+	uint8_t frame[256];
+	uint8_t base = _registers[RH_RF95_REG_0E_FIFO_TX_BASE_ADDR];
+	for (uint16_t i = 0; i < _txLen; i++)
+	    frame[i] = _fifo[(uint8_t)(base + i)];
+	deliver(frame, _txLen, _registers[RH_RF95_REG_1E_MODEM_CONFIG2] & RH_RF95_PAYLOAD_CRC_ON);
+	setIrqFlags(RH_RF95_TX_DONE);
+    }
+    else if (mode == RH_RF95_MODE_CAD)
+    {
+	// CadDone, with CadDetected if anyone else is transmitting on this channel and heard above the floor
+	bool busy = false;
+	for (uint8_t i = 0; i < SX1276_EMULATOR_MAX_RADIOS; i++)
+	{
+	    SX1276Emulator* other = _radios[i];
+	    if (other && other != this && sameChannel(other)
+		&& (other->_registers[RH_RF95_REG_01_OP_MODE] & RH_RF95_MODE) == RH_RF95_MODE_TX
+		&& linkSnrQuarters(other) >= snrFloorQuarters())
+		busy = true;
+	}
+	_registers[RH_RF95_REG_01_OP_MODE] = (_registers[RH_RF95_REG_01_OP_MODE] & ~RH_RF95_MODE) | RH_RF95_MODE_STDBY;
+	setIrqFlags(RH_RF95_CAD_DONE | (busy ? RH_RF95_CAD_DETECTED : 0));
+    }
+}
+
+void SX1276Emulator::deliver(const uint8_t* data, uint8_t len, bool crc)
+{
+    uint8_t self;
+    for (self = 0; self < SX1276_EMULATOR_MAX_RADIOS && _radios[self] != this; self++)
+	;
+    for (uint8_t i = 0; i < SX1276_EMULATOR_MAX_RADIOS; i++)
+    {
+	SX1276Emulator* other = _radios[i];
+	if (!other || other == this || !other->receiving() || !sameChannel(other))
+	    continue;
+	if (other->_rxStart > _syncEnd)
+	{
+	    // Turned on too late to lock on to the preamble
+	    other->_lost++;
+	    continue;
+	}
+	int16_t snr = other->linkSnrQuarters(this);
+	uint8_t linkLoss = self < SX1276_EMULATOR_MAX_RADIOS ? other->_linkLoss[self] : 0;
+	if (snr < other->snrFloorQuarters()
+	    || (other->_lossPercent && (unsigned)(rand_r(&other->_lossSeed) % 100) < other->_lossPercent)
+	    || (linkLoss && (unsigned)(rand_r(&other->_lossSeed) % 100) < linkLoss))
+	    other->_lost++;
+	else
+	    other->frameReceived(data, len, crc, snr / 4);
+    }
+}
+
+int16_t SX1276Emulator::linkSnrQuarters(SX1276Emulator* from)
+{
+    uint8_t i;
+    for (i = 0; i < SX1276_EMULATOR_MAX_RADIOS && _radios[i] != from; i++)
+	;
+    if (i == SX1276_EMULATOR_MAX_RADIOS || !_linkSet[i])
+	return _snr * 4;
+    // 3 dB less for each doubling of the bandwidth above 125 kHz, as 12 quarter dB steps
+    int16_t snr = (_linkSnr[i] - (20 - from->txPower())) * 4;
+    uint8_t bw = from->_registers[RH_RF95_REG_1D_MODEM_CONFIG1] >> 4;
+    for (uint32_t hz = bandwidths[bw > 9 ? 9 : bw]; hz > 125000; hz /= 2)
+	snr -= 12;
+    for (uint32_t hz = bandwidths[bw > 9 ? 9 : bw]; hz < 125000; hz *= 2)
+	snr += 12;
+    return snr;
+}
+
+int16_t SX1276Emulator::snrFloorQuarters()
+{
+    // -7.5 dB at SF7, 2.5 dB lower for each spreading factor above
+    uint8_t sf = _registers[RH_RF95_REG_1E_MODEM_CONFIG2] >> 4;
+    return -30 - 10 * ((int16_t)sf - 7);
+}
+
+int8_t SX1276Emulator::txPower()
+{
+    uint8_t pa = _registers[RH_RF95_REG_09_PA_CONFIG];
+    if (!(pa & RH_RF95_PA_SELECT))
+	return pa & 0x0f; // RFO with MaxPower 7 (15 dBm) as RH_RF95 sets it, so Pout = OutputPower
+    return 2 + (pa & 0x0f) + ((_registers[RH_RF95_REG_4D_PA_DAC] & 0x07) == RH_RF95_PA_DAC_ENABLE ? 3 : 0);
+}
+
+void SX1276Emulator::frameReceived(const uint8_t* data, uint8_t len, bool crc, int8_t snr)
+{
+    uint8_t base = _registers[RH_RF95_REG_0F_FIFO_RX_BASE_ADDR];
+    for (uint16_t i = 0; i < len; i++)
+	_fifo[(uint8_t)(base + i)] = data[i];
+    _registers[RH_RF95_REG_10_FIFO_RX_CURRENT_ADDR] = base;
+    _registers[RH_RF95_REG_13_RX_NB_BYTES] = len;
+    _registers[RH_RF95_REG_1C_HOP_CHANNEL] = crc ? RH_RF95_RX_PAYLOAD_CRC_IS_ON : 0;
+
+    // Inverse of the RSSI calculation in the datasheet section 5.5.5
+    bool hf = _registers[RH_RF95_REG_06_FRF_MSB] >= 0xc2; // 779MHz and above
+    int16_t raw = _rssi + (hf ? 157 : 164);
+    if (snr < 0)
+	raw -= snr;
+    else
+	raw = raw * 15 / 16;
+    _registers[RH_RF95_REG_19_PKT_SNR_VALUE] = (uint8_t)(snr * 4);
+    _registers[RH_RF95_REG_1A_PKT_RSSI_VALUE] = (uint8_t)(raw < 0 ? 0 : (raw > 255 ? 255 : raw));
+
+    uint8_t flags = RH_RF95_RX_DONE | RH_RF95_VALID_HEADER;
+    if (_incomingCollided)
+    {
+	flags |= RH_RF95_PAYLOAD_CRC_ERROR;
+	_collisions++;
+    }
+    else
+	_rxPackets++;
+    if ((_registers[RH_RF95_REG_01_OP_MODE] & RH_RF95_MODE) == RH_RF95_MODE_RXSINGLE)
+	_registers[RH_RF95_REG_01_OP_MODE] = (_registers[RH_RF95_REG_01_OP_MODE] & ~RH_RF95_MODE) | RH_RF95_MODE_STDBY;
+    setIrqFlags(flags);
+}
+
+void SX1276Emulator::setIrqFlags(uint8_t flags)
+{
+    _registers[RH_RF95_REG_12_IRQ_FLAGS] |= flags & ~_registers[RH_RF95_REG_11_IRQ_FLAGS_MASK];
+    updateDio0();
+}
+
+void SX1276Emulator::updateDio0()
+{
+    // RegDioMapping1 bits 7-6 select what DIO0 shows: RxDone, TxDone or CadDone
+    static const uint8_t dio0Sources[] = {RH_RF95_RX_DONE, RH_RF95_TX_DONE, RH_RF95_CAD_DONE, 0};
+    uint8_t source = dio0Sources[_registers[RH_RF95_REG_40_DIO_MAPPING1] >> 6];
+    bool level = _registers[RH_RF95_REG_12_IRQ_FLAGS] & source;
+    if (level && !_dio0)
+	_interruptPending = true;
+    _dio0 = level;
+}
+
+bool SX1276Emulator::sameChannel(SX1276Emulator* other)
+{
+    return memcmp(&_registers[RH_RF95_REG_06_FRF_MSB], &other->_registers[RH_RF95_REG_06_FRF_MSB], 3) == 0
+	&& (_registers[RH_RF95_REG_1D_MODEM_CONFIG1] & 0xf0) == (other->_registers[RH_RF95_REG_1D_MODEM_CONFIG1] & 0xf0)
+	&& (_registers[RH_RF95_REG_1E_MODEM_CONFIG2] & RH_RF95_SPREADING_FACTOR) == (other->_registers[RH_RF95_REG_1E_MODEM_CONFIG2] & RH_RF95_SPREADING_FACTOR);
+}
+
+bool SX1276Emulator::receiving()
+{
+    uint8_t opMode = _registers[RH_RF95_REG_01_OP_MODE];
+    return (opMode & RH_RF95_LONG_RANGE_MODE)
+	&& ((opMode & RH_RF95_MODE) == RH_RF95_MODE_RXCONTINUOUS || (opMode & RH_RF95_MODE) == RH_RF95_MODE_RXSINGLE);
+}
+
+uint32_t SX1276Emulator::symbolMicros()
+{
+    uint8_t sf = _registers[RH_RF95_REG_1E_MODEM_CONFIG2] >> 4;
+    uint8_t bw = _registers[RH_RF95_REG_1D_MODEM_CONFIG1] >> 4;
+    return (uint32_t)(((uint64_t)1000000 << sf) / bandwidths[bw > 9 ? 9 : bw]);
+}
+
+uint32_t SX1276Emulator::timeOnAir(uint8_t payloadLen)
+{
+    uint8_t bw = _registers[RH_RF95_REG_1D_MODEM_CONFIG1] >> 4;
+    return timeOnAir(payloadLen,
+		     _registers[RH_RF95_REG_1E_MODEM_CONFIG2] >> 4,
+		     bandwidths[bw > 9 ? 9 : bw],
+		     (_registers[RH_RF95_REG_1D_MODEM_CONFIG1] & RH_RF95_CODING_RATE) >> 1,
+		     (_registers[RH_RF95_REG_20_PREAMBLE_MSB] << 8) | _registers[RH_RF95_REG_21_PREAMBLE_LSB],
+		     !(_registers[RH_RF95_REG_1D_MODEM_CONFIG1] & RH_RF95_IMPLICIT_HEADER_MODE_ON),
+		     _registers[RH_RF95_REG_1E_MODEM_CONFIG2] & RH_RF95_PAYLOAD_CRC_ON,
+		     _registers[RH_RF95_REG_26_MODEM_CONFIG3] & RH_RF95_LOW_DATA_RATE_OPTIMIZE);
+}
+
+uint32_t SX1276Emulator::timeOnAir(uint8_t payloadLen, uint8_t sf, uint32_t bwHz, uint8_t cr,
+				   uint16_t preamble, bool explicitHeader, bool crc, bool lowDataRateOptimize)
+{
+    if (sf < 6)
+	sf = 6;
+    if (sf > 12)
+	sf = 12;
+    if (cr < 1)
+	cr = 1;
+    // Symbol time in microseconds. The preamble is followed by 4.25 symbols of sync word
+    double tsym = (double)(1UL << sf) * 1000000.0 / bwHz;
+    double tpreamble = (preamble + 4.25) * tsym;
+    int32_t numerator = 8 * payloadLen - 4 * sf + 28 + (crc ? 16 : 0) - (explicitHeader ? 0 : 20);
+    int32_t denominator = 4 * (sf - (lowDataRateOptimize ? 2 : 0));
+    int32_t blocks = (numerator + denominator - 1) / denominator;
+    if (numerator <= 0)
+	blocks = 0;
+    uint32_t payloadSymbols = 8 + blocks * (cr + 4);
+    return (uint32_t)(tpreamble + payloadSymbols * tsym + 0.5);
+}
+
+void SX1276Emulator::airThread(void* arg)
+{
+    (void)arg;
+    while (1)
+    {
+	simulator_sleep_micros(SX1276_EMULATOR_POLL_MICROS);
+	simulator_interrupts_lock();
+	unsigned long now = micros();
+	for (uint8_t i = 0; i < SX1276_EMULATOR_MAX_RADIOS; i++)
+	    if (_radios[i])
+		_radios[i]->poll(now);
+
+	// Run the handler for every radio whose DIO0 went high, as the interrupt controller would
+	for (uint8_t i = 0; i < SX1276_EMULATOR_MAX_RADIOS; i++)
+	{
+	    SX1276Emulator* radio = _radios[i];
+	    if (!radio || !radio->_interruptPending)
+		continue;
+	    radio->_interruptPending = false;
+	    radio->_interrupts++;
+	    radio->_inIsr = true;
+	    radio->_isrCurrentTransactions = 0;
+	    unsigned long start = micros();
+	    simulator_raise_interrupt(radio->_dio0Pin, RISING);
+	    uint32_t elapsed = micros() - start;
+	    radio->_inIsr = false;
+	    radio->_isrTransactionsLast = radio->_isrCurrentTransactions;
+	    if (radio->_isrCurrentTransactions > radio->_isrTransactionsMax)
+		radio->_isrTransactionsMax = radio->_isrCurrentTransactions;
+	    radio->_isrMicrosTotal += elapsed;
+	    if (elapsed > radio->_isrMicrosMax)
+		radio->_isrMicrosMax = elapsed;
+	}
+	simulator_interrupts_unlock();
+    }
+}
+
+void SX1276Emulator::setSignal(int16_t rssi, int8_t snr)
+{
+    _rssi = rssi;
+    _snr = snr;
+}
+
+void SX1276Emulator::setLinkSignal(const SX1276Emulator* from, int8_t snr)
+{
+    simulator_interrupts_lock();
+    for (uint8_t i = 0; i < SX1276_EMULATOR_MAX_RADIOS; i++)
+    {
+	if (_radios[i] == from)
+	{
+	    _linkSnr[i] = snr;
+	    _linkSet[i] = true;
+	}
+    }
+    simulator_interrupts_unlock();
+}
+
+void SX1276Emulator::setLoss(uint8_t percent, unsigned int seed)
+{
+    _lossPercent = percent;
+    _lossSeed = seed;
+}
+
+void SX1276Emulator::setLinkLoss(const SX1276Emulator* from, uint8_t percent)
+{
+    simulator_interrupts_lock();
+    for (uint8_t i = 0; i < SX1276_EMULATOR_MAX_RADIOS; i++)
+    {
+	if (_radios[i] == from)
+	    _linkLoss[i] = percent;
+    }
+    simulator_interrupts_unlock();
+}
+
+void SX1276Emulator::resetCounters()
+{
+    _transactions = 0;
+    _isrTransactions = 0;
+    _isrTransactionsMax = 0;
+    _isrTransactionsLast = 0;
+    _interrupts = 0;
+    _isrMicrosMax = 0;
+    _isrMicrosTotal = 0;
+    _txPackets = 0;
+    _rxPackets = 0;
+    _collisions = 0;
+    _lost = 0;
+    _airtimeMicros = 0;
+    _txEnergyNanojoules = 0;
+}
+
+uint32_t SX1276Emulator::transactions()
+{
+    return _transactions;
+}
+
+uint32_t SX1276Emulator::isrTransactions()
+{
+    return _isrTransactions;
+}
+
+uint32_t SX1276Emulator::isrTransactionsMax()
+{
+    return _isrTransactionsMax;
+}
+
+uint32_t SX1276Emulator::isrTransactionsLast()
+{
+    return _isrTransactionsLast;
+}
+
+uint32_t SX1276Emulator::interruptCount()
+{
+    return _interrupts;
+}
+
+uint32_t SX1276Emulator::isrMicrosMax()
+{
+    return _isrMicrosMax;
+}
+
+uint32_t SX1276Emulator::isrMicrosTotal()
+{
+    return _isrMicrosTotal;
+}
+
+uint32_t SX1276Emulator::txPackets()
+{
+    return _txPackets;
+}
+
+uint32_t SX1276Emulator::rxPackets()
+{
+    return _rxPackets;
+}
+
+uint32_t SX1276Emulator::collisions()
+{
+    return _collisions;
+}
+
+uint32_t SX1276Emulator::lost()
+{
+    return _lost;
+}
+
+uint32_t SX1276Emulator::airtimeMicros()
+{
+    return _airtimeMicros;
+}
+
+uint32_t SX1276Emulator::txEnergyMicrojoules()
+{
+    return (uint32_t)(_txEnergyNanojoules / 1000);
+}
+
+#endif
@@ -0,0 +1,266 @@
+// SX1276Emulator.h
+// Register level emulation of an SX1276 LoRa radio (eg RFM95) for running RH_RF95 on Linux
+// without hardware
+
+#ifndef SX1276Emulator_h
+#define SX1276Emulator_h
+
+#include <RHGenericSPI.h>
+
+#if (RH_PLATFORM == RH_PLATFORM_UNIX)
+
+#ifndef SIMULATOR_VIRTUAL_TIME
+ #error SX1276Emulator needs SIMULATOR_VIRTUAL_TIME: build with tools/rf95SimBuild
+#endif
+
+#include <RH_RF95.h>
+
+// Most emulated radios that can share the simulated air
+#ifndef SX1276_EMULATOR_MAX_RADIOS
+ #define SX1276_EMULATOR_MAX_RADIOS 8
+#endif
+
+// How often the air thread advances transmissions, CAD and interrupts, in simulated microseconds
+#ifndef SX1276_EMULATOR_POLL_MICROS
+ #define SX1276_EMULATOR_POLL_MICROS 50
+#endif
+
+/////////////////////////////////////////////////////////////////////
+/// \class SX1276Emulator SX1276Emulator.h <RHutil/SX1276Emulator.h>
+/// \brief Emulated SX1276 on the simulated SPI bus
+///
+/// Answers SPI transactions the way the LoRa side of an SX1276 does, so that an unmodified RH_RF95
+/// (and anything built on it, such as APOL_Comms_Lib) can be run and measured in the simulator.
+/// The first octet of each transaction is the register address, with bit 7 set for a write.
+/// Following octets auto-increment the address, except for the FIFO (register 0) which is
+/// accessed through RegFifoAddrPtr.
+///
+/// Modelled:
+/// \li RegOpMode, including LongRangeMode only changing on writes that select sleep, and the return to standby after TxDone and CadDone
+/// \li the 256 octet FIFO and its TX and RX base addresses
+/// \li RegIrqFlags (write 1 to clear) and RegIrqFlagsMask
+/// \li time on air from the modem configuration, per the SX1276 datasheet section 4.1.1.7
+/// \li delivery to every other emulator in RX on the same frequency, spreading factor and bandwidth,
+///     with RegRxNbBytes, RegFifoRxCurrentAddr, RegPktSnrValue, RegPktRssiValue and RegHopChannel set
+/// \li overlapping receptions, which are delivered with PayloadCrcError
+/// \li optional random loss of frames arriving at a radio (see setLoss()), or from one transmitter (see setLinkLoss())
+/// \li optional signal per link (see setLinkSignal()) that follows the transmitter's power and bandwidth,
+///     with frames below the demodulation floor of the spreading factor lost
+/// \li CAD, which completes after 2 symbols and reports CadDetected if another radio is transmitting on the channel
+///     above the demodulation floor
+/// \li RegModemStat, showing signal detected and RX ongoing while a frame above the floor is arriving
+/// \li the preamble length, so a receiver turned on part way through a long preamble (eg after a CAD) still takes
+///     the frame, and one turned on after the sync word misses it
+/// \li DIO0 according to RegDioMapping1, raised on the interrupt pin with simulator_raise_interrupt()
+///
+/// Each emulator attaches itself to the simulated SPI bus on its chip select pin, so RH_RF95 reaches it
+/// through the default hardware_spi. It can also be passed to the RH_RF95 constructor as the
+/// RHGenericSPI. A background thread (the "air") runs transmissions and delivers interrupts while holding
+/// the simulated interrupt lock, so interrupts only arrive outside ATOMIC_BLOCK_START/END as on hardware.
+///
+/// Counters report how many SPI transactions and how much time each interrupt handler used,
+/// which is the path length of the driver's interrupt handling.
+class SX1276Emulator : public RHGenericSPI, public SimulatorSPIDevice
+{
+public:
+    /// \param[in] csPin Chip select pin the driver will use
+    /// \param[in] dio0Pin Pin the driver's interrupt handler is attached to
+    SX1276Emulator(uint8_t csPin, uint8_t dio0Pin);
+    ~SX1276Emulator();
+
+    /// One octet of the current transaction
+    uint8_t transfer(uint8_t data);
+
+    /// Starts the air thread if it is not already running
+    void begin();
+    void end() {}
+
+    /// Chip select from the simulated bus
+    void select(bool selected);
+
+    /// Back to the power on register values, with an empty FIFO and no pending interrupt
+    void reset();
+
+    /// Signal reported by this radio for every frame it receives
+    /// \param[in] rssi Packet RSSI in dBm
+    /// \param[in] snr Packet SNR in dB
+    void setSignal(int16_t rssi, int8_t snr);
+
+    /// Signal of frames from one transmitter, instead of setSignal(). The SNR is given for 125 kHz bandwidth with the
+    /// transmitter at +20 dBm, and is lowered by 1 dB for each dB less power and by 10log10(bandwidth / 125 kHz).
+    /// Frames whose SNR ends up below the demodulation floor of the spreading factor (-7.5 dB at SF7, 2.5 dB
+    /// lower for each step up) are lost.
+    /// \param[in] from The transmitting emulator
+    /// \param[in] snr SNR in dB at 125 kHz and +20 dBm
+    void setLinkSignal(const SX1276Emulator* from, int8_t snr);
+
+    /// Frames arriving at this radio are lost (never heard, no interrupt) with this probability
+    /// \param[in] percent Chance of losing each frame, 0 to 100
+    /// \param[in] seed Seed for the loss pattern, so runs can be repeated
+    void setLoss(uint8_t percent, unsigned int seed = 1);
+
+    /// Frames from one transmitter arriving at this radio are lost with this probability, on top of setLoss(), eg for
+    /// a link near the edge of its range. Drawn from the setLoss() seed
+    /// \param[in] from The transmitting emulator
+    /// \param[in] percent Chance of losing each frame from it, 0 to 100
+    void setLinkLoss(const SX1276Emulator* from, uint8_t percent);
+
+    /// \return Current value of a register, without counting a transaction
+    uint8_t registerValue(uint8_t reg);
+
+    /// \return Time on air in microseconds of a payload with the current modem configuration
+    uint32_t timeOnAir(uint8_t payloadLen);
+
+    /// Time on air of a LoRa frame, per the SX1276 datasheet
+    /// \param[in] payloadLen Payload octets (including the RadioHead header)
+    /// \param[in] sf Spreading factor, 6 to 12
+    /// \param[in] bwHz Bandwidth in Hz
+    /// \param[in] cr Coding rate denominator minus 4, 1 (4/5) to 4 (4/8)
+    /// \param[in] preamble Programmed preamble length in symbols
+    /// \param[in] explicitHeader true for explicit header mode
+    /// \param[in] crc true if the payload CRC is on
+    /// \param[in] lowDataRateOptimize true if LowDataRateOptimize is on
+    /// \return Microseconds
+    static uint32_t timeOnAir(uint8_t payloadLen, uint8_t sf, uint32_t bwHz, uint8_t cr,
+			      uint16_t preamble, bool explicitHeader, bool crc, bool lowDataRateOptimize);
+
+    /// Zero all the counters below
+    void resetCounters();
+
+    /// SPI transactions (chip select low to high) of any kind
+    uint32_t transactions();
+    /// SPI transactions made from within an interrupt handler
+    uint32_t isrTransactions();
+    /// Most SPI transactions made by one interrupt handler
+    uint32_t isrTransactionsMax();
+    /// SPI transactions made by the last interrupt handler
+    uint32_t isrTransactionsLast();
+    /// Interrupts raised on DIO0
+    uint32_t interruptCount();
+    /// Longest and total time spent in the interrupt handler, in microseconds
+    uint32_t isrMicrosMax();
+    uint32_t isrMicrosTotal();
+    /// Frames transmitted and frames delivered to this radio without error
+    uint32_t txPackets();
+    uint32_t rxPackets();
+    /// Frames this radio received overlapped by another, delivered with a CRC error
+    uint32_t collisions();
+    /// Frames lost on the way to this radio by setLoss() and setLinkLoss()
+    uint32_t lost();
+    /// Microseconds this radio has spent transmitting
+    uint32_t airtimeMicros();
+    /// Energy radiated by this radio (time on air times output power), in microjoules
+    uint32_t txEnergyMicrojoules();
+
+protected:
+    /// Register access from the SPI side
+    uint8_t readRegister(uint8_t reg);
+    void    writeRegister(uint8_t reg, uint8_t val);
+
+    /// Mode changes from RegOpMode writes
+    void    startMode(uint8_t mode, unsigned long now);
+
+    /// Set or clear IRQ flags and track the DIO0 level, noting a rising edge
+    void    setIrqFlags(uint8_t flags);
+    void    updateDio0();
+
+    /// Advance this radio's transmit or CAD to now. Called by the air thread
+    void    poll(unsigned long now);
+
+    /// Hand a finished transmission to every other radio listening on the same channel
+    void    deliver(const uint8_t* data, uint8_t len, bool crc);
+
+    /// A frame from a transmitter has started or finished arriving here
+    void    frameStarted(unsigned long end, bool detected);
+    void    frameReceived(const uint8_t* data, uint8_t len, bool crc, int8_t snr);
+
+    /// SNR here of a frame from another radio with its current settings, and the floor below which it is lost
+    int16_t linkSnrQuarters(SX1276Emulator* from);
+    int16_t snrFloorQuarters();
+
+    /// Output power programmed in RegPaConfig and RegPaDac, in dBm
+    int8_t  txPower();
+
+    /// true if other is on the same frequency, spreading factor and bandwidth
+    bool    sameChannel(SX1276Emulator* other);
+
+    /// true if this radio is in one of the LoRa receive modes
+    bool    receiving();
+
+    /// Duration of one symbol with the current modem configuration, in microseconds
+    uint32_t symbolMicros();
+
+    /// Air thread body, a simulated thread above every task, as the radio interrupts are
+    static void  airThread(void* arg);
+
+    uint8_t       _csPin;
+    uint8_t       _dio0Pin;
+    uint8_t       _registers[128];
+    uint8_t       _fifo[256];
+
+    /// Transaction state: true while selected, and whether the address octet has been seen
+    bool          _selected;
+    bool          _haveAddress;
+    bool          _writing;
+    uint8_t       _address;
+
+    /// Level of DIO0 and whether a rising edge is waiting to be delivered
+    bool          _dio0;
+    bool          _interruptPending;
+
+    /// When the current transmission or CAD ends, in micros()
+    unsigned long _modeEnd;
+    uint8_t       _txLen;
+
+    /// When the preamble and sync word of the current transmission end: a receiver turned on after that misses the frame
+    unsigned long _syncEnd;
+
+    /// When the receiver was last turned on
+    unsigned long _rxStart;
+
+    /// When the frame arriving here ends, and whether another overlapped it
+    unsigned long _incomingEnd;
+    bool          _incomingCollided;
+
+    /// When the last frame arriving here above the demodulation floor ends
+    unsigned long _signalEnd;
+
+    int16_t       _rssi;
+    int8_t        _snr;
+
+    /// SNR at 125 kHz and +20 dBm of frames from each radio in _radios, if _linkSet
+    int8_t        _linkSnr[SX1276_EMULATOR_MAX_RADIOS];
+    bool          _linkSet[SX1276_EMULATOR_MAX_RADIOS];
+
+    /// Loss of frames from each radio in _radios, see setLinkLoss()
+    uint8_t       _linkLoss[SX1276_EMULATOR_MAX_RADIOS];
+
+    uint8_t       _lossPercent;
+    unsigned int  _lossSeed;
+
+    /// True while the air thread is running this radio's interrupt handler
+    bool          _inIsr;
+    uint32_t      _isrCurrentTransactions;
+
+    uint32_t      _transactions;
+    uint32_t      _isrTransactions;
+    uint32_t      _isrTransactionsMax;
+    uint32_t      _isrTransactionsLast;
+    uint32_t      _interrupts;
+    uint32_t      _isrMicrosMax;
+    uint32_t      _isrMicrosTotal;
+    uint32_t      _txPackets;
+    uint32_t      _rxPackets;
+    uint32_t      _collisions;
+    uint32_t      _lost;
+    uint32_t      _airtimeMicros;
+    uint64_t      _txEnergyNanojoules;
+
+    /// Every emulator that exists, so transmissions can reach the others
+    static SX1276Emulator* _radios[SX1276_EMULATOR_MAX_RADIOS];
+    static bool            _airRunning;
+};
+
+#endif
+
+#endif
@@ -10,6 +10,8 @@
 #include <string.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <stdbool.h>
+#include <math.h>
 
 // Equivalent types for common Arduino types like uint8_t are in stdint.h
 
@@ -23,6 +25,97 @@ extern void delay(unsigned long ms);
 extern unsigned long millis();
 extern long random(long to);
 extern long random(long from, long to);
+extern unsigned long micros();
+extern void yield();
+
+#ifdef __cplusplus
+ #include <algorithm>
+ using std::min;
+ using std::max;
+#endif
+
+// Simulated digital pins. A pin written LOW that has an SPI device attached selects that device,
+// and interrupt handlers attached to a pin are run by simulator_raise_interrupt()
+#define INPUT 0
+#define OUTPUT 1
+#define LOW 0
+#define HIGH 1
+#define CHANGE 1
+#define FALLING 2
+#define RISING 3
+#define SIMULATOR_NUM_PINS 64
+
+extern void pinMode(uint8_t pin, uint8_t mode);
+extern void digitalWrite(uint8_t pin, uint8_t val);
+extern uint8_t digitalRead(uint8_t pin);
+extern void attachInterrupt(uint8_t interrupt, void (*handler)(void), int mode);
+extern void detachInterrupt(uint8_t interrupt);
+
+// Something on the simulated SPI bus, such as a radio emulator
+class SimulatorSPIDevice
+{
+public:
+    virtual ~SimulatorSPIDevice() {}
+    // Called when the device's chip select goes low (true) or high (false)
+    virtual void select(bool selected) = 0;
+    // Exchange one octet while selected
+    virtual uint8_t transfer(uint8_t data) = 0;
+};
+
+// Puts a device on the simulated SPI bus, selected by writing csPin LOW
+extern void simulator_attach_spi_device(uint8_t csPin, SimulatorSPIDevice* device);
+
+// Runs the handler attached to pin by attachInterrupt(), if any, as if it had been interrupted
+// by the given edge. Returns true if a handler was run.
+extern bool simulator_raise_interrupt(uint8_t pin, int edge = RISING);
+
+// Simulated interrupt masking. While the lock is held by one thread, simulator_raise_interrupt()
+// from another thread waits. Recursive, so handlers can use ATOMIC_BLOCK_START too
+extern void simulator_interrupts_lock();
+extern void simulator_interrupts_unlock();
+
+#ifdef SIMULATOR_VIRTUAL_TIME
+// Virtual time (tools/simKernel.cpp, built in by rf95SimBuild). Simulated threads run one at a time, highest priority
+// first, and the clock only moves when they wait or spend time, so a run repeats exactly for the same --seed
+#define SIMULATOR_FOREVER            0xffffffffffffffffULL
+#define SIMULATOR_INTERRUPT_PRIORITY 1000 // Above any task, as interrupts are
+#define SIMULATOR_SPI_OCTET_MICROS   1    // Time to exchange one octet on the SPI bus
+#define SIMULATOR_CLOCK_MICROS       1    // Time to read the clock, so loops that poll it move it on
+#define SIMULATOR_YIELD_MICROS       50   // How long yield() gives other threads
+
+typedef struct SimulatorThread SimulatorThread;
+// Starts function(arg) in a new simulated thread, which runs when it is the highest priority ready thread
+extern SimulatorThread* simulator_thread_create(void (*function)(void*), void* arg, int priority);
+extern SimulatorThread* simulator_thread_current();
+extern int              simulator_thread_priority(SimulatorThread* thread);
+extern void             simulator_thread_set_priority(SimulatorThread* thread, int priority);
+// Waits until simulator_wake(object) or the clock reaches deadline (SIMULATOR_FOREVER for never).
+// Returns false if it timed out
+extern bool             simulator_wait(const void* object, uint64_t deadline);
+// Makes ready the highest priority thread waiting on object, without switching to it. Returns false if none was
+extern bool             simulator_wake(const void* object);
+// Switches to a higher priority ready thread, if there is one and interrupts are not masked
+extern void             simulator_preempt();
+extern void             simulator_sleep_micros(uint64_t micros);
+// Moves the clock on by the time the current thread takes to do something, such as an SPI transfer
+extern void             simulator_spend_micros(uint32_t micros);
+extern uint64_t         simulator_now_micros();
+#endif
+
+// Equivalent to SPIClass in Arduino. Octets go to whichever attached device is selected,
+// and 0 is read back when none is
+class SPISimulator
+{
+public:
+    void begin() {}
+    void end() {}
+    void attachInterrupt() {}
+    void detachInterrupt() {}
+    uint8_t transfer(uint8_t data);
+};
+
+// Global instance of the SPI bus
+extern SPISimulator SPI;
 
 // Equavalent to HardwareSerial in Arduino
 // but outputs to stdout
@@ -1557,6 +1557,9 @@ these examples and explanations and extend them to suit your needs.
  // Simulate the sketch on Linux and OSX
  #include <RHutil/simulator.h>
  #define RH_HAVE_SERIAL
+ #define RH_HAVE_HARDWARE_SPI // The simulated SPI bus, see RHutil/SX1276Emulator.h
+ #define PROGMEM
+ #define memcpy_P memcpy
 #include <netinet/in.h> // For htons and friends
 
 #else
@@ -1592,6 +1595,10 @@ these examples and explanations and extend them to suit your needs.
 // See hardware/esp8266/2.0.0/cores/esp8266/Arduino.h
  #define ATOMIC_BLOCK_START { uint32_t __savedPS = xt_rsil(15);
  #define ATOMIC_BLOCK_END xt_wsr_ps(__savedPS);}
+#elif (RH_PLATFORM == RH_PLATFORM_UNIX)
+ // Keeps simulated interrupts (eg from a radio emulator thread) out
+ #define ATOMIC_BLOCK_START simulator_interrupts_lock(); {
+ #define ATOMIC_BLOCK_END } simulator_interrupts_unlock();
 #else 
  // TO BE DONE:
  #define ATOMIC_BLOCK_START
@@ -1609,6 +1616,9 @@ these examples and explanations and extend them to suit your needs.
  #define YIELD yield();
 #elif (RH_PLATFORM == RH_PLATFORM_STM32L0)
  #define YIELD yield();
+#elif (RH_PLATFORM == RH_PLATFORM_UNIX)
+ // Let emulator threads run while the simulated sketch spins
+ #define YIELD yield();
 #elif (RH_PLATFORM == RH_PLATFORM_MONGOOSE_OS)
  //ESP32 and ESP8266 use freertos so we include calls
  //that we would normall exit a function and return to
@@ -0,0 +1,215 @@
+// addressBench.cpp
+// Measures what node addressing (APOL_ADDRESS, and the TO header filter in RH_RF95::setAddressFilter()) does for two
+// pit boxes sharing the channel, on emulated SX1276 radios.
+//
+// Build with tools/rf95SimBuild tools/addressBench.cpp, run with ./addressBench [seconds]
+// The HHD of pit box 0 sends a request to its POL at random, a mean of LOAD_INTERVAL ms apart, through the send window
+// as request_handler_task does, and times it from queueing to the ACK. Every MULTICAST_EVERY requests it also sends a
+// datagram to every POL on the channel. Both POLs run in their own threads, handling frames as their rx tasks do. Each
+// configuration runs in its own process, started from the same state, for [seconds] (default 30). With one address per
+// role, as before node addresses, the second box's POL has the same address as the first and takes (and ACKs) its
+// requests too; with node addresses its driver drops them once it has read the TO header.
+
+#include <RH_RF95.h>
+#include <APOL_Comms_Lib.h>
+#include <RHutil/SX1276Emulator.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <algorithm>
+
+#define POL_CS    10
+#define POL_INT   5
+#define POL2_CS   11
+#define POL2_INT  6
+#define MAX_TRANSMIT_ATTEMPTS 5 // As on the HHD
+#define LOAD_INTERVAL 200       // Mean ms between requests from the HHD
+#define MULTICAST_EVERY 10      // Requests between datagrams to every POL
+#define MAX_SAMPLES 1000
+
+// Radios first, so they are on the simulated bus before the drivers are constructed
+SX1276Emulator hhdRadio(RFM95_CS, RFM95_INT);
+SX1276Emulator polRadio(POL_CS, POL_INT);
+SX1276Emulator pol2Radio(POL2_CS, POL2_INT);
+
+// Constructed by each configuration, with its addresses
+static APOL_Comms_Lib* hhd;
+static APOL_Comms_Lib* pols[2];
+
+static unsigned long duration = 30000;
+static volatile bool running;
+static volatile bool sending; // The HHD task is still finishing its last request, so the rx tasks keep going
+
+// Requests from the HHD: time from queueing to ACK (ms), and how many were given up on
+static unsigned long latency[MAX_SAMPLES];
+static unsigned int  delivered;
+static unsigned int  abandoned;
+static unsigned int  multicasts;
+
+// What each POL's rx task was given
+struct PolCounts
+{
+    unsigned int frames;     // Frames handed to the task
+    unsigned int requests;   // Requests acted on
+    unsigned int multicasts; // Datagrams to every POL
+};
+static PolCounts counts[2];
+
+// Random gap with the given mean, in ms
+static unsigned long gap(unsigned long mean)
+{
+    return random(0, 2 * mean + 1);
+}
+
+// Sends one request at a time to the POL of pit box 0, a random time apart, the way request_handler_task does
+static void hhdTask(void* arg)
+{
+    uint8_t target = *(uint8_t*)arg;
+    unsigned int sent = 0;
+    while (running)
+    {
+	delay(gap(LOAD_INTERVAL));
+	if (++sent % MULTICAST_EVERY == 0)
+	{
+	    hhd->send_packet(GREEN, APOL_MULTICAST(POL, APOL_ANY_GROUP), 0);
+	    multicasts++;
+	}
+	unsigned long start = millis();
+	int attempts = 0;
+	hhd->queue_request(GREEN, target, 0);
+	while (hhd->requests_outstanding(target) > 0)
+	{
+	    hhd->flush_requests(target);
+	    hhd->rf95->setModeRx();
+	    if (hhd->wait_for_ack(target))
+	    {
+		if (delivered < MAX_SAMPLES)
+		    latency[delivered] = millis() - start;
+		delivered++;
+	    }
+	    else if (++attempts >= MAX_TRANSMIT_ATTEMPTS)
+	    {
+		hhd->abandon_requests(target);
+		abandoned++;
+	    }
+	}
+    }
+    sending = false;
+}
+
+// A POL's rx task. Polls the RX ring
+static void polTask(void* arg)
+{
+    int idx = *(int*)arg;
+    APOL_Comms_Lib* pol = pols[idx];
+    while (running || sending)
+    {
+	while (pol->rf95->rxPending() > 0)
+	{
+	    if (!pol->check_for_packet())
+		continue;
+	    counts[idx].frames++;
+	    if (pol->packet_contents.request == ACK)
+		continue;
+	    if (APOL_IS_MULTICAST(pol->packet_contents.target_device))
+		counts[idx].multicasts++;
+	    else if (pol->accept_request(&pol->packet_contents))
+		counts[idx].requests++;
+	    pol->send_ack(&pol->packet_contents);
+	}
+	delay(2);
+    }
+}
+
+// The HHD's rx task. Hands ACKs to the send window
+static void hhdRxTask(void* arg)
+{
+    (void)arg;
+    while (running || sending)
+    {
+	while (hhd->rf95->rxPending() > 0)
+	    if (hhd->check_for_packet())
+		hhd->handle_ack(&hhd->packet_contents);
+	delay(2);
+    }
+}
+
+static void configuration(const char* name, uint8_t pol2Address)
+{
+    uint8_t target = APOL_ADDRESS(POL, 0, 0);
+    hhd = new APOL_Comms_Lib(APOL_ADDRESS(HHD, 0, 0), NULL);
+    pols[0] = new APOL_Comms_Lib(target, NULL, POL_CS, POL_INT);
+    pols[1] = new APOL_Comms_Lib(pol2Address, NULL, POL2_CS, POL2_INT);
+
+    hhdRadio.begin();
+    polRadio.begin();
+    pol2Radio.begin();
+    hhdRadio.setLinkSignal(&polRadio, 10);
+    hhdRadio.setLinkSignal(&pol2Radio, 10);
+    polRadio.setLinkSignal(&hhdRadio, 10);
+    polRadio.setLinkSignal(&pol2Radio, 10);
+    pol2Radio.setLinkSignal(&hhdRadio, 10);
+    pol2Radio.setLinkSignal(&polRadio, 10);
+
+    hhd->begin();
+    pols[0]->begin();
+    pols[1]->begin();
+    hhd->rf95->setModeRx();
+    pols[0]->rf95->setModeRx();
+    pols[1]->rf95->setModeRx();
+    hhdRadio.resetCounters();
+    polRadio.resetCounters();
+    pol2Radio.resetCounters();
+
+    running = true;
+    sending = true;
+    static int idx[2] = {0, 1};
+    xTaskCreate(polTask, "polTask", 256, &idx[0], 2, NULL);
+    xTaskCreate(polTask, "polTask", 256, &idx[1], 2, NULL);
+    xTaskCreate(hhdRxTask, "hhdRxTask", 256, NULL, 2, NULL);
+    xTaskCreate(hhdTask, "hhdTask", 256, &target, 1, NULL);
+    delay(duration);
+    running = false;
+    while (sending)
+	delay(10);
+    delay(10); // Let the rx tasks finish what they are doing
+
+    printf("%s\n", name);
+    unsigned int n = std::min(delivered, (unsigned int)MAX_SAMPLES);
+    std::sort(latency, latency + n);
+    if (n)
+	printf("  %u delivered, %u abandoned, latency median %lu ms p95 %lu ms max %lu ms, %u collisions at the HHD\n",
+	       delivered, abandoned, latency[n / 2], latency[n * 95 / 100], latency[n - 1], (unsigned)hhdRadio.collisions());
+    else
+	printf("  nothing delivered, %u abandoned\n", abandoned);
+    for (int i = 0; i < 2; i++)
+	printf("  POL of pit box %d (0x%02X): %u frames to the rx task, %u requests acted on, %u of %u multicasts, %u dropped by the driver\n",
+	       i, pols[i]->address(), counts[i].frames, counts[i].requests, counts[i].multicasts, multicasts, pols[i]->rf95->rxDropped());
+}
+
+void setup()
+{
+    if (_simulator_argc > 1)
+	duration = atol(_simulator_argv[1]) * 1000;
+    printf("%lu s each, a request from the HHD of pit box 0 to its POL every %d ms on average\n", duration / 1000, LOAD_INTERVAL);
+    fflush(stdout);
+
+    for (int i = 0; i < 2; i++)
+    {
+	pid_t child = fork();
+	if (child == 0)
+	{
+	    if (i == 0)
+		configuration("one address per role", APOL_ADDRESS(POL, 0, 0));
+	    else
+		configuration("node addresses", APOL_ADDRESS(POL, 1, 0));
+	    fflush(stdout);
+	    _exit(0);
+	}
+	waitpid(child, NULL, 0);
+    }
+    exit(0);
+}
+
+void loop()
+{
+}
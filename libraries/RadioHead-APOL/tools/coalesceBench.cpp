@@ -0,0 +1,289 @@
+// coalesceBench.cpp
+// Replays bursty button press traces on the HHD through APOL_Request_Queue and APOL_Comms_Lib to the POL on emulated
+// SX1276 radios, with request coalescing off and on, and measures the airtime and latency it takes to get the POL's
+// lights to the state the last press asked for.
+//
+// Build with tools/rf95SimBuild tools/coalesceBench.cpp, run with ./coalesceBench [runs] [loss percent]
+// A button thread presses at the times in the trace and queues each press the way button_task does, toggling the
+// HHD's light state and sending the absolute state, with a completion callback. The main thread makes the same calls
+// as request_handler_task, with an rx task handing it the ACKs. The POL side runs in its own thread and does what the POL rx_task does with each frame:
+// accept_request(), then send_ack(), applying the light state.
+// Settle time is from the last press until the POL applied the final state. Callback latency is from each press
+// until its completion callback ran (the press, or the later one it was coalesced into, was acknowledged).
+
+#include <RH_RF95.h>
+#include <APOL_Comms_Lib.h>
+#include <APOL_Request_Queue.h>
+#include <RHutil/SX1276Emulator.h>
+
+#define POL_CS  10
+#define POL_INT 5
+#define MAX_TRANSMIT_ATTEMPTS 5 // As on the HHD
+#define MAX_QUEUED_REQUESTS 10  // As on the HHD
+#define MAX_PRESSES 16
+
+// Radios first, so they are on the simulated bus before the drivers are constructed
+SX1276Emulator hhdRadio(RFM95_CS, RFM95_INT);
+SX1276Emulator polRadio(POL_CS, POL_INT);
+
+// The HHD's rx task, which its driver wakes
+static TaskHandle_t hhdRx;
+
+APOL_Comms_Lib hhd(HHD, &hhdRx);
+APOL_Comms_Lib pol(POL, NULL, POL_CS, POL_INT);
+
+typedef struct
+{
+    unsigned int  at;      // ms after the start of the trace
+    request_type  request; // Button pressed: GREEN, GREEN_PULSE or RED
+} press;
+
+typedef struct
+{
+    const char*   name;
+    const press*  presses;
+    unsigned int  count;
+} trace;
+
+static const press greenMash[] = {{0, GREEN}, {60, GREEN}, {120, GREEN}, {180, GREEN}, {240, GREEN}, {300, GREEN}};
+static const press greenFrenzy[] = {{0, GREEN}, {25, GREEN}, {50, GREEN}, {75, GREEN}, {100, GREEN}, {125, GREEN},
+				    {150, GREEN}, {175, GREEN}, {200, GREEN}, {225, GREEN}};
+static const press redGreenMash[] = {{0, GREEN}, {50, GREEN}, {100, RED}, {150, RED}, {200, RED}, {250, GREEN},
+				     {300, GREEN}, {350, GREEN}};
+static const press pulseThenGreen[] = {{0, GREEN_PULSE}, {80, GREEN}, {160, GREEN}, {240, GREEN}, {320, GREEN}};
+static const press spacedGreen[] = {{0, GREEN}, {400, GREEN}, {800, GREEN}, {1200, GREEN}};
+
+#define TRACE(name, presses) {name, presses, sizeof(presses) / sizeof(presses[0])}
+static const trace traces[] = {
+    TRACE("green x6, 60 ms apart", greenMash),
+    TRACE("green x10, 25 ms apart", greenFrenzy),
+    TRACE("green/red mash x8", redGreenMash),
+    TRACE("pulse then green x4", pulseThenGreen),
+    TRACE("green x4, 400 ms apart", spacedGreen),
+};
+
+static unsigned int runs = 5;
+static uint8_t loss = 0;
+
+static APOL_Request_Queue* queue;
+static const trace* current;
+static volatile bool pressesDone;
+
+// HHD light state, toggled by presses as in button_task, the state each light was last asked for, and the POL's
+// light state as applied
+static bool hhdGreen, hhdRed;
+static bool wantGreen, wantRed;
+static volatile bool polGreen, polRed;
+static volatile unsigned long polApplied; // micros() when the POL last applied a light request
+
+static unsigned long pressTime[MAX_PRESSES];
+static unsigned long doneTime[MAX_PRESSES];
+static volatile unsigned int callbacks, undelivered;
+
+static void pressDone(request_type request, uint32_t payload, bool delivered, void* arg)
+{
+    (void)request;
+    (void)payload;
+    doneTime[(uintptr_t)arg] = micros();
+    callbacks++;
+    if (!delivered)
+	undelivered++;
+}
+
+static void requestDone(uint16_t tag, request_type request, uint32_t payload, bool delivered)
+{
+    queue->complete(tag, request, payload, delivered);
+}
+
+static void polTask(void* arg)
+{
+    (void)arg;
+    while (1)
+    {
+	if (!pol.rf95->waitAvailableTimeout(10))
+	    continue;
+	while (pol.rf95->rxPending() > 0)
+	{
+	    if (!pol.check_for_packet())
+		continue;
+	    if (pol.accept_request(&pol.packet_contents))
+	    {
+		switch (pol.packet_contents.request)
+		{
+		case GREEN:
+		    polGreen = pol.packet_contents.payload;
+		    break;
+		case GREEN_PULSE:
+		    polGreen = false; // The pulse ends with the light off
+		    break;
+		case RED:
+		    polRed = pol.packet_contents.payload;
+		    break;
+		default:
+		    break;
+		}
+		polApplied = micros();
+	    }
+	    pol.send_ack(&pol.packet_contents);
+	}
+	pol.rf95->setModeRx();
+    }
+}
+
+// The HHD's rx task, woken by the driver for each frame. Hands ACKs to the send window
+static void ackTask(void* arg)
+{
+    APOL_Comms_Lib* comms = (APOL_Comms_Lib*)arg;
+    while (1)
+    {
+	ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+	while (comms->rf95->rxPending() > 0)
+	    if (comms->check_for_packet() && comms->packet_contents.request == ACK)
+		comms->handle_ack(&comms->packet_contents);
+    }
+}
+
+// Presses the buttons in the current trace at their times, as button_task would queue them
+static void buttonTask(void* arg)
+{
+    unsigned long start = *(unsigned long*)arg;
+    for (unsigned int i = 0; i < current->count; i++)
+    {
+	const press* p = &current->presses[i];
+	while (micros() - start < p->at * 1000UL)
+	    delay(1);
+	uint32_t payload = 0;
+	if (p->request == GREEN)
+	{
+	    hhdRed = false;
+	    hhdGreen = !hhdGreen;
+	    payload = wantGreen = hhdGreen;
+	}
+	else if (p->request == RED)
+	{
+	    hhdGreen = false;
+	    hhdRed = !hhdRed;
+	    payload = wantRed = hhdRed;
+	}
+	else
+	    hhdGreen = hhdRed = wantGreen = false;
+	pressTime[i] = micros();
+	queue->send(p->request, POL, payload, pressDone, (void*)(uintptr_t)i);
+    }
+    pressesDone = true;
+}
+
+// Replays the current trace once, draining the queue the way request_handler_task does
+static void replay(unsigned int* abandoned)
+{
+    int attempts = 0;
+    pressesDone = false;
+    callbacks = undelivered = 0;
+    unsigned long start = micros();
+    xTaskCreate(buttonTask, "buttonTask", 256, &start, 1, NULL);
+
+    while (!pressesDone || queue->count() > 0 || hhd.requests_outstanding(POL) > 0)
+    {
+	request_record record;
+	while (hhd.window_space(POL) > 0 && queue->receive(&record))
+	    hhd.queue_request(record.request, POL, record.payload, record.tag);
+	if (hhd.requests_outstanding(POL) == 0)
+	{
+	    delay(1);
+	    continue;
+	}
+	hhd.flush_requests(POL);
+	hhd.rf95->setModeRx();
+	if (hhd.wait_for_ack(POL))
+	    attempts = 0;
+	else if (++attempts >= MAX_TRANSMIT_ATTEMPTS)
+	{
+	    hhd.abandon_requests(POL);
+	    (*abandoned)++;
+	    attempts = 0;
+	}
+    }
+
+    // Let the POL finish with the last frame before looking at what it did
+    delay(5);
+}
+
+static void scenario(const trace* t)
+{
+    current = t;
+    for (int mode = 0; mode < 2; mode++)
+    {
+	bool coalesce = mode == 1;
+	double settle = 0, worstSettle = 0, latency = 0, worstLatency = 0;
+	unsigned int abandoned = 0, wrong = 0, missing = 0, failed = 0, folded = 0;
+	hhdRadio.resetCounters();
+	for (unsigned int run = 0; run < runs; run++)
+	{
+	    APOL_Request_Queue runQueue(MAX_QUEUED_REQUESTS, coalesce);
+	    queue = &runQueue;
+	    replay(&abandoned);
+
+	    if (polGreen != wantGreen || polRed != wantRed)
+		wrong++;
+	    if (callbacks != t->count)
+		missing++;
+	    failed += undelivered;
+	    folded += runQueue.coalesced();
+	    double s = ((long)(polApplied - pressTime[t->count - 1])) / 1000.0;
+	    settle += s;
+	    if (s > worstSettle)
+		worstSettle = s;
+	    for (unsigned int i = 0; i < t->count; i++)
+	    {
+		double l = (doneTime[i] - pressTime[i]) / 1000.0;
+		latency += l;
+		if (l > worstLatency)
+		    worstLatency = l;
+	    }
+	}
+	printf("%-23s %-9s frames %5.1f, airtime %6.1f ms, settle mean %6.1f ms max %6.1f ms, callback mean %6.1f ms max %6.1f ms, coalesced %4.1f, abandoned %u, wrong state %u, missing callbacks %u, undelivered %u\n",
+	       t->name, coalesce ? "coalesce" : "fifo", (double)hhdRadio.txPackets() / runs,
+	       hhdRadio.airtimeMicros() / 1000.0 / runs, settle / runs, worstSettle, latency / runs / t->count,
+	       worstLatency, (double)folded / runs, abandoned, wrong, missing, failed);
+    }
+}
+
+void setup()
+{
+    if (_simulator_argc > 1)
+	runs = atoi(_simulator_argv[1]);
+    if (_simulator_argc > 2)
+	loss = atoi(_simulator_argv[2]);
+    hhdRadio.begin();
+    polRadio.begin();
+
+    hhd.begin();
+    pol.begin();
+    hhd.on_request_done(requestDone);
+    hhd.rf95->setModeRx();
+    pol.rf95->setModeRx();
+
+    xTaskCreate(polTask, "polTask", 256, NULL, 2, NULL);
+    xTaskCreate(ackTask, "hhdRx", 256, &hhd, 2, &hhdRx);
+
+    // One request to synchronise the window and measure the round trip before timing anything
+    hhd.queue_request(PING, POL, 0);
+    while (hhd.requests_outstanding(POL) > 0)
+    {
+	hhd.flush_requests(POL);
+	hhd.rf95->setModeRx();
+	hhd.wait_for_ack(POL);
+    }
+
+    hhdRadio.setLoss(loss, 1);
+    polRadio.setLoss(loss, 2);
+    printf("window %u, %u runs, %u%% loss, time on air %lu us per request, rto %lu ms\n", APOL_WINDOW_SIZE, runs, loss,
+	   (unsigned long)hhd.rf95->timeOnAir(1), (unsigned long)hhd.retransmit_timeout(POL));
+}
+
+void loop()
+{
+    for (unsigned int i = 0; i < sizeof(traces) / sizeof(traces[0]); i++)
+	scenario(&traces[i]);
+    exit(0);
+}
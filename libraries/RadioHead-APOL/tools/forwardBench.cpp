@@ -0,0 +1,231 @@
+// forwardBench.cpp
+// Measures what one hop through a repeater costs (APOL_Comms_Lib::relay_packet() and forward_held()), on emulated
+// SX1276 radios.
+//
+// Build with tools/rf95SimBuild tools/forwardBench.cpp, run with ./forwardBench [seconds]
+// The HHD and POL are out of range of each other, so every request and every ACK goes through the one repeater between
+// them. The HHD sends a request to the POL at random, a mean of LOAD_INTERVAL ms apart, through the send window as
+// request_handler_task does, and times it from queueing to the ACK. The repeater's task does what its rx_task does:
+// takes every frame the driver has queued, forwards what is due and, with logging on, writes a line to the terminal
+// for each frame forwarded (LOG_MS at 115200 baud) before it turns the receiver back on. Each configuration runs in
+// its own process, started from the same state, for [seconds] (default 30).
+// Per frame forwarded it gives the repeater's SPI transactions, the time its task spent sending it (in forward_held())
+// and the time its receiver was off (in standby), and per frame received, the time its task spent taking it in.
+
+#include <RH_RF95.h>
+#include <APOL_Comms_Lib.h>
+#include <RHutil/SX1276Emulator.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <algorithm>
+
+#define POL_CS    10
+#define POL_INT   5
+#define RPT_CS    11
+#define RPT_INT   6
+#define MAX_TRANSMIT_ATTEMPTS 5 // As on the HHD
+#define LOAD_INTERVAL 500       // Mean ms between requests from the HHD
+#define OUT_OF_RANGE (-30)      // SNR (dB) of a link nothing gets over
+#define LOG_MS 10               // A "Forwarded Packet" line at 115200 baud
+#define MAX_SAMPLES 1000
+
+// Radios first, so they are on the simulated bus before the drivers are constructed
+SX1276Emulator hhdRadio(RFM95_CS, RFM95_INT);
+SX1276Emulator polRadio(POL_CS, POL_INT);
+SX1276Emulator rptRadio(RPT_CS, RPT_INT);
+
+APOL_Comms_Lib hhd(APOL_ADDRESS(HHD, 0, 0), NULL);
+APOL_Comms_Lib pol(APOL_ADDRESS(POL, 0, 0), NULL, POL_CS, POL_INT);
+APOL_Comms_Lib rpt(APOL_ADDRESS(REPEATER, 0, 0), NULL, RPT_CS, RPT_INT);
+
+static unsigned long duration = 30000;
+static volatile bool running;
+static volatile bool sending; // The HHD task is still finishing its last request, so the rx tasks keep going
+
+// Requests from the HHD: time from queueing to ACK (ms), and how many were given up on
+static unsigned long latency[MAX_SAMPLES];
+static unsigned int  delivered;
+static unsigned int  abandoned;
+
+// The repeater's task
+static unsigned int  received;   // Frames taken from the driver
+static unsigned long takeTime;   // Time (us) spent taking them in
+static unsigned int  forwarded;  // Frames forwarded
+static unsigned long sendTime;   // Time (us) spent in forward_held() for them
+
+// Random gap with the given mean, in ms
+static unsigned long gap(unsigned long mean)
+{
+    return random(0, 2 * mean + 1);
+}
+
+// Sends one request at a time to the POL, a random time apart, the way request_handler_task does
+static void hhdTask(void* arg)
+{
+    (void)arg;
+    uint8_t target = pol.address();
+    while (running)
+    {
+	delay(gap(LOAD_INTERVAL));
+	unsigned long start = millis();
+	int attempts = 0;
+	hhd.queue_request(GREEN, target, 1);
+	while (hhd.requests_outstanding(target) > 0)
+	{
+	    hhd.flush_requests(target);
+	    hhd.rf95->setModeRx();
+	    if (hhd.wait_for_ack(target))
+	    {
+		if (delivered < MAX_SAMPLES)
+		    latency[delivered] = millis() - start;
+		delivered++;
+	    }
+	    else if (++attempts >= MAX_TRANSMIT_ATTEMPTS)
+	    {
+		hhd.abandon_requests(target);
+		abandoned++;
+	    }
+	}
+    }
+    sending = false;
+}
+
+// The POL's rx task. Polls the RX ring
+static void polTask(void* arg)
+{
+    (void)arg;
+    while (running || sending)
+    {
+	while (pol.rf95->rxPending() > 0)
+	{
+	    if (!pol.check_for_packet() || pol.packet_contents.request == ACK)
+		continue;
+	    pol.accept_request(&pol.packet_contents);
+	    pol.send_ack(&pol.packet_contents);
+	}
+	delay(2);
+    }
+}
+
+// The HHD's rx task. Hands ACKs to the send window
+static void hhdRxTask(void* arg)
+{
+    (void)arg;
+    while (running || sending)
+    {
+	while (hhd.rf95->rxPending() > 0)
+	    if (hhd.check_for_packet())
+		hhd.handle_ack(&hhd.packet_contents);
+	delay(2);
+    }
+}
+
+// The repeater's rx task. Polls the RX ring, and forwards held frames as they fall due
+static void repeaterTask(void* arg)
+{
+    bool logging = *(bool*)arg;
+    packet_fields packet;
+    while (running || sending)
+    {
+	while (rpt.rf95->rxPending() > 0)
+	{
+	    unsigned long start = micros();
+	    rpt.relay_packet();
+	    takeTime += micros() - start;
+	    received++;
+	}
+	while (true)
+	{
+	    unsigned long start = micros();
+	    if (!rpt.forward_held(&packet))
+		break;
+	    sendTime += micros() - start;
+	    forwarded++;
+	    if (logging)
+		delay(LOG_MS);
+	}
+	rpt.rf95->setModeRx();
+	delay(2);
+    }
+}
+
+static void configuration(const char* name, bool logging)
+{
+    SX1276Emulator* radios[] = {&hhdRadio, &polRadio, &rptRadio};
+    for (SX1276Emulator* radio : radios)
+    {
+	radio->begin();
+	for (SX1276Emulator* from : radios)
+	    if (from != radio)
+		radio->setLinkSignal(from, 10);
+    }
+    hhdRadio.setLinkSignal(&polRadio, OUT_OF_RANGE);
+    polRadio.setLinkSignal(&hhdRadio, OUT_OF_RANGE);
+
+    hhd.begin();
+    pol.begin();
+    rpt.begin();
+    rpt.rf95->setPromiscuous(true);
+    for (SX1276Emulator* radio : radios)
+	radio->resetCounters();
+    hhd.rf95->setModeRx();
+    pol.rf95->setModeRx();
+    rpt.rf95->setModeRx();
+    uint32_t spi = rpt.rf95->spiTransactions();
+    uint32_t standby = rpt.rf95->modeTime(RHGenericDriver::RHModeIdle);
+
+    running = true;
+    sending = true;
+    xTaskCreate(polTask, "polTask", 256, NULL, 2, NULL);
+    xTaskCreate(hhdRxTask, "hhdRxTask", 256, NULL, 2, NULL);
+    xTaskCreate(repeaterTask, "repeaterTask", 256, &logging, 2, NULL);
+    xTaskCreate(hhdTask, "hhdTask", 256, NULL, 1, NULL);
+    delay(duration);
+    running = false;
+    while (sending)
+	delay(10);
+    delay(200); // Let the repeater finish what it is doing
+    spi = rpt.rf95->spiTransactions() - spi;
+    standby = rpt.rf95->modeTime(RHGenericDriver::RHModeIdle) - standby;
+
+    printf("%s\n", name);
+    unsigned int n = std::min(delivered, (unsigned int)MAX_SAMPLES);
+    std::sort(latency, latency + n);
+    if (n)
+	printf("  %u delivered, %u abandoned, latency median %lu ms p95 %lu ms max %lu ms\n",
+	       delivered, abandoned, latency[n / 2], latency[n * 95 / 100], latency[n - 1]);
+    else
+	printf("  nothing delivered, %u abandoned\n", abandoned);
+    if (forwarded && received)
+	printf("  repeater: %u received (%lu us each to take in), %u forwarded: %lu SPI transactions, %.1f ms sending, receiver off %.1f ms, per frame forwarded\n",
+	       received, takeTime / received, forwarded, (unsigned long)(spi / forwarded), (double)sendTime / forwarded / 1000,
+	       (double)standby / forwarded);
+}
+
+void setup()
+{
+    if (_simulator_argc > 1)
+	duration = atol(_simulator_argv[1]) * 1000;
+    printf("%lu s each, a request from the HHD to the POL every %d ms on average, through one repeater\n", duration / 1000, LOAD_INTERVAL);
+    fflush(stdout);
+
+    for (int i = 0; i < 2; i++)
+    {
+	pid_t child = fork();
+	if (child == 0)
+	{
+	    if (i == 0)
+		configuration("terminal quiet", false);
+	    else
+		configuration("a terminal line for each frame forwarded", true);
+	    fflush(stdout);
+	    _exit(0);
+	}
+	waitpid(child, NULL, 0);
+    }
+    exit(0);
+}
+
+void loop()
+{
+}
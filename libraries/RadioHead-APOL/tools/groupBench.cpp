@@ -0,0 +1,238 @@
+// groupBench.cpp
+// Measures what group commands (APOL_Comms_Lib::send_group()) save over one request per light when the HHD sets several
+// POLs at once, on emulated SX1276 radios.
+//
+// Build with tools/rf95SimBuild tools/groupBench.cpp, run with ./groupBench [rounds]
+// Each round the HHD of pit box 0 sends GREEN to the POL of every pit box, NUM_POLS of them, and times it from the first
+// send until every POL has acknowledged (or been given up on). One request per light goes to each POL in turn through
+// its send window, as request_handler_task does, resending up to MAX_TRANSMIT_ATTEMPTS times. A group command goes to
+// every POL at once and is resent to those that did not answer, up to APOL_GROUP_ATTEMPTS times. The POLs run in their
+// own threads, handling frames as their rx tasks do. Each configuration runs in its own process, started from the same
+// state, for [rounds] rounds (default 100), LOSS percent of frames lost at every radio or none. RH_RF95 only runs 4 radios
+// at once, so the time for a round to more POLs, up to APOL_GROUP_MAX_MEMBERS, is worked out from the airtime as well.
+
+#include <RH_RF95.h>
+#include <APOL_Comms_Lib.h>
+#include <RHutil/SX1276Emulator.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <algorithm>
+
+#define NUM_POLS 3               // Pit boxes, one POL each (RH_RF95 has interrupt vectors for 4 radios)
+#define MAX_TRANSMIT_ATTEMPTS 5  // As on the HHD
+#define ROUND_GAP 200            // ms between rounds
+#define LOSS 10                  // Percent of frames lost at every radio, with loss on
+#define MAX_SAMPLES 1000
+
+// Radios first, so they are on the simulated bus before the drivers are constructed
+SX1276Emulator hhdRadio(RFM95_CS, RFM95_INT);
+SX1276Emulator pol0Radio(10, 5);
+SX1276Emulator pol1Radio(11, 6);
+SX1276Emulator pol2Radio(12, 7);
+static SX1276Emulator* polRadios[NUM_POLS] = {&pol0Radio, &pol1Radio, &pol2Radio};
+
+static APOL_Comms_Lib* hhd;
+static APOL_Comms_Lib* pols[NUM_POLS];
+static uint8_t polAddresses[NUM_POLS];
+
+static unsigned int rounds = 100;
+static volatile bool running;
+
+// Rounds: time until every POL acknowledged (ms), and how many POLs were given up on
+static unsigned long latency[MAX_SAMPLES];
+static unsigned int  complete;
+static unsigned int  missed;
+
+// Requests each POL acted on, and the light state its ACKs carry as on the POL
+static unsigned int acted[NUM_POLS];
+static pol_state states[NUM_POLS];
+
+// Airtime (us) of a compact frame with a body of len bytes, with the RH_RF95::init() settings
+static uint32_t airtime(uint8_t len)
+{
+    return RH_RF95::loraTimeOnAir(7, 125000, 1, 8, false, true, false, RH_RF95_HEADER_LEN + len);
+}
+
+// One round of one request per light, to each POL in turn
+static void unicastRound()
+{
+    for (int i = 0; i < NUM_POLS; i++)
+    {
+	int attempts = 0;
+	hhd->queue_request(GREEN, polAddresses[i], 1);
+	while (hhd->requests_outstanding(polAddresses[i]) > 0)
+	{
+	    hhd->flush_requests(polAddresses[i]);
+	    hhd->rf95->setModeRx();
+	    if (!hhd->wait_for_ack(polAddresses[i]) && ++attempts >= MAX_TRANSMIT_ATTEMPTS)
+	    {
+		hhd->abandon_requests(polAddresses[i]);
+		missed++;
+	    }
+	}
+    }
+}
+
+// One round of a group command to every POL
+static void groupRound()
+{
+    uint8_t acked = hhd->send_group(GREEN, APOL_MULTICAST(POL, APOL_ANY_GROUP), polAddresses, NUM_POLS, 1);
+    for (int i = 0; i < NUM_POLS; i++)
+	if (!(acked & (1 << i)))
+	    missed++;
+}
+
+// A POL's rx task. Polls the RX ring
+static void polTask(void* arg)
+{
+    int idx = *(int*)arg;
+    APOL_Comms_Lib* pol = pols[idx];
+    while (running)
+    {
+	while (pol->rf95->rxPending() > 0)
+	{
+	    if (!pol->check_for_packet() || pol->packet_contents.request == ACK)
+		continue;
+	    if (pol->accept_request(&pol->packet_contents))
+		acted[idx]++;
+	    pol->send_ack(&pol->packet_contents);
+	}
+	delay(2);
+    }
+}
+
+// The HHD's rx task. Hands ACKs to the send window and to send_group()
+static void hhdRxTask(void* arg)
+{
+    (void)arg;
+    while (running)
+    {
+	while (hhd->rf95->rxPending() > 0)
+	    if (hhd->check_for_packet())
+		hhd->handle_ack(&hhd->packet_contents);
+	delay(2);
+    }
+}
+
+static void configuration(const char* name, bool group, uint8_t loss)
+{
+    hhd = new APOL_Comms_Lib(APOL_ADDRESS(HHD, 0, 0), NULL);
+    hhdRadio.begin();
+    for (int i = 0; i < NUM_POLS; i++)
+    {
+	polAddresses[i] = APOL_ADDRESS(POL, i, 0);
+	pols[i] = new APOL_Comms_Lib(polAddresses[i], NULL, 10 + i, 5 + i);
+	polRadios[i]->begin();
+    }
+    for (int i = 0; i < NUM_POLS; i++)
+    {
+	hhdRadio.setLinkSignal(polRadios[i], 10);
+	polRadios[i]->setLinkSignal(&hhdRadio, 10);
+	for (int j = 0; j < NUM_POLS; j++)
+	    if (j != i)
+		polRadios[i]->setLinkSignal(polRadios[j], 10);
+	if (loss)
+	    polRadios[i]->setLoss(loss, 1 + i);
+    }
+    if (loss)
+	hhdRadio.setLoss(loss, 100);
+
+    hhd->begin();
+    for (int i = 0; i < NUM_POLS; i++)
+    {
+	pols[i]->begin();
+	states[i].version = 1;
+	states[i].green = true;
+	pols[i]->set_ack_state(&states[i]);
+    }
+    hhd->rf95->setModeRx();
+    for (int i = 0; i < NUM_POLS; i++)
+	pols[i]->rf95->setModeRx();
+    hhdRadio.resetCounters();
+    for (int i = 0; i < NUM_POLS; i++)
+	polRadios[i]->resetCounters();
+
+    running = true;
+    static int idx[NUM_POLS];
+    for (int i = 0; i < NUM_POLS; i++)
+    {
+	idx[i] = i;
+	xTaskCreate(polTask, "polTask", 256, &idx[i], 2, NULL);
+    }
+    xTaskCreate(hhdRxTask, "hhdRxTask", 256, NULL, 2, NULL);
+    for (unsigned int r = 0; r < rounds; r++)
+    {
+	delay(ROUND_GAP);
+	unsigned long start = millis();
+	if (group)
+	    groupRound();
+	else
+	    unicastRound();
+	if (complete < MAX_SAMPLES)
+	    latency[complete] = millis() - start;
+	complete++;
+    }
+    delay(500); // Let the last ACKs go out
+    running = false;
+    delay(10);
+
+    uint32_t polAirtime = 0;
+    unsigned int actedTotal = 0;
+    for (int i = 0; i < NUM_POLS; i++)
+    {
+	polAirtime += polRadios[i]->airtimeMicros();
+	actedTotal += acted[i];
+    }
+    unsigned int n = std::min(complete, (unsigned int)MAX_SAMPLES);
+    std::sort(latency, latency + n);
+    printf("%s\n", name);
+    printf("  round to %d POLs: median %lu ms p95 %lu ms max %lu ms, %u of %u requests given up on\n",
+	   NUM_POLS, latency[n / 2], latency[n * 95 / 100], latency[n - 1], missed, complete * NUM_POLS);
+    printf("  %u requests acted on, HHD air %lu ms (%lu ms per round), POL air %lu ms, %u collisions at the HHD\n",
+	   actedTotal, (unsigned long)(hhdRadio.airtimeMicros() / 1000), (unsigned long)(hhdRadio.airtimeMicros() / 1000 / complete),
+	   (unsigned long)(polAirtime / 1000), (unsigned)hhdRadio.collisions());
+}
+
+void setup()
+{
+    if (_simulator_argc > 1)
+	rounds = atoi(_simulator_argv[1]);
+    if (rounds == 0)
+	rounds = 1;
+    printf("%u rounds each, GREEN from the HHD of pit box 0 to the POLs of %d pit boxes\n", rounds, NUM_POLS);
+    // GREEN has a 1 byte payload and the POL's ACK a full light state snapshot. Turnarounds are left out
+    uint32_t unicast = airtime(1) + airtime(APOL_MAX_PAYLOAD_LEN);
+    for (int lights = 2; lights <= APOL_GROUP_MAX_MEMBERS; lights *= 2)
+	printf("round to %d POLs without loss, from the airtime: one request per light %lu ms, group command %lu ms\n", lights,
+	       (unsigned long)(lights * unicast / 1000),
+	       (unsigned long)((airtime(1 + lights + 1) + (APOL_ACK_TURNAROUND + lights * APOL_GROUP_REPLY_SLOT) * 1000) / 1000));
+    fflush(stdout);
+
+    static const struct
+    {
+	const char* name;
+	bool group;
+	uint8_t loss;
+    } configurations[] = {
+	{"one request per light", false, 0},
+	{"group command", true, 0},
+	{"one request per light, 10% loss", false, LOSS},
+	{"group command, 10% loss", true, LOSS},
+    };
+    for (unsigned int i = 0; i < sizeof(configurations) / sizeof(configurations[0]); i++)
+    {
+	pid_t child = fork();
+	if (child == 0)
+	{
+	    configuration(configurations[i].name, configurations[i].group, configurations[i].loss);
+	    fflush(stdout);
+	    _exit(0);
+	}
+	waitpid(child, NULL, 0);
+    }
+    exit(0);
+}
+
+void loop()
+{
+}
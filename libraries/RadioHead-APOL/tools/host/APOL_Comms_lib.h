@@ -0,0 +1,3 @@
+// APOL_Comms_lib.h
+// APOL_Comms_Lib.cpp includes its header by this name, which only resolves on case insensitive file systems
+#include <APOL_Comms_Lib.h>
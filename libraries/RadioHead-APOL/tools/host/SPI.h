@@ -0,0 +1,2 @@
+// SPI.h
+// Host stand-in for the Arduino SPI library header. The simulated SPI bus is declared in RHutil/simulator.h
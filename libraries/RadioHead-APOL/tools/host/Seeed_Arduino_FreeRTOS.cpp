@@ -0,0 +1,155 @@
+// Seeed_Arduino_FreeRTOS.cpp
+// Host stand-in for the FreeRTOS API used by RH_RF95 and APOL_Comms_Lib, on the simulator's threads
+// and virtual time (tools/simKernel.cpp). Built in by rf95SimBuild.
+
+#include <Seeed_Arduino_FreeRTOS.h>
+#include <RHutil/simulator.h>
+#include <map>
+
+// Binary semaphores (count 0 or 1) and recursive mutexes (owner and depth in count)
+struct Semaphore
+{
+    uint32_t         count;
+    SimulatorThread* owner;
+};
+
+// Each task's notification value. Waiting on its address is waiting for a notification
+static std::map<SimulatorThread*, uint32_t> notifications;
+
+// The deadline ticks from now, in simulated microseconds
+static uint64_t deadline(TickType_t ticks)
+{
+    if (ticks == portMAX_DELAY)
+	return SIMULATOR_FOREVER;
+    return simulator_now_micros() + (uint64_t)ticks * portTICK_PERIOD_MS * 1000;
+}
+
+BaseType_t xTaskGetSchedulerState()
+{
+    return taskSCHEDULER_RUNNING;
+}
+
+BaseType_t xTaskCreate(TaskFunction_t function, const char* name, uint16_t stackDepth, void* parameters,
+		       UBaseType_t priority, TaskHandle_t* handle)
+{
+    (void)name;
+    (void)stackDepth;
+    SimulatorThread* thread = simulator_thread_create(function, parameters, priority);
+    if (handle)
+	*handle = thread;
+    simulator_preempt();
+    return pdPASS;
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle()
+{
+    return simulator_thread_current();
+}
+
+void vTaskPrioritySet(TaskHandle_t task, UBaseType_t priority)
+{
+    simulator_thread_set_priority(task ? (SimulatorThread*)task : simulator_thread_current(), priority);
+    simulator_preempt();
+}
+
+void vTaskDelay(TickType_t ticks)
+{
+    simulator_sleep_micros((uint64_t)ticks * portTICK_PERIOD_MS * 1000);
+}
+
+void vTaskNotifyGiveFromISR(TaskHandle_t task, BaseType_t* higherPriorityTaskWoken)
+{
+    SimulatorThread* thread = (SimulatorThread*)task;
+    uint32_t* value = &notifications[thread];
+    (*value)++;
+    if (simulator_wake(value) && higherPriorityTaskWoken
+	&& simulator_thread_priority(thread) > simulator_thread_priority(simulator_thread_current()))
+	*higherPriorityTaskWoken = pdTRUE;
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task)
+{
+    uint32_t* value = &notifications[(SimulatorThread*)task];
+    (*value)++;
+    simulator_wake(value);
+    simulator_preempt();
+    return pdPASS;
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clearOnExit, TickType_t ticks)
+{
+    uint32_t* value = &notifications[simulator_thread_current()];
+    if (!*value && ticks)
+	simulator_wait(value, deadline(ticks));
+    uint32_t taken = *value;
+    if (taken)
+	*value = clearOnExit ? 0 : taken - 1;
+    return taken;
+}
+
+static Semaphore* newSemaphore()
+{
+    Semaphore* semaphore = new Semaphore;
+    semaphore->count = 0;
+    semaphore->owner = NULL;
+    return semaphore;
+}
+
+SemaphoreHandle_t xSemaphoreCreateBinary()
+{
+    return newSemaphore();
+}
+
+SemaphoreHandle_t xSemaphoreCreateRecursiveMutex()
+{
+    return newSemaphore();
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t handle, TickType_t ticks)
+{
+    Semaphore* semaphore = (Semaphore*)handle;
+    uint64_t until = deadline(ticks);
+    while (!semaphore->count)
+	if (!ticks || !simulator_wait(semaphore, until))
+	    return pdFALSE;
+    semaphore->count = 0;
+    return pdTRUE;
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t handle)
+{
+    Semaphore* semaphore = (Semaphore*)handle;
+    if (semaphore->count)
+	return pdFALSE;
+    semaphore->count = 1;
+    simulator_wake(semaphore);
+    simulator_preempt();
+    return pdTRUE;
+}
+
+BaseType_t xSemaphoreTakeRecursive(SemaphoreHandle_t handle, TickType_t ticks)
+{
+    Semaphore* mutex = (Semaphore*)handle;
+    SimulatorThread* self = simulator_thread_current();
+    uint64_t until = deadline(ticks);
+    while (mutex->owner && mutex->owner != self)
+	if (!ticks || !simulator_wait(mutex, until))
+	    return pdFALSE;
+    mutex->owner = self;
+    mutex->count++;
+    return pdTRUE;
+}
+
+BaseType_t xSemaphoreGiveRecursive(SemaphoreHandle_t handle)
+{
+    Semaphore* mutex = (Semaphore*)handle;
+    if (mutex->owner != simulator_thread_current())
+	return pdFALSE;
+    if (--mutex->count == 0)
+    {
+	mutex->owner = NULL;
+	simulator_wake(mutex);
+	simulator_preempt();
+    }
+    return pdTRUE;
+}
@@ -0,0 +1,58 @@
+// Seeed_Arduino_FreeRTOS.h
+// Host stand-in for the FreeRTOS API used by RH_RF95 and APOL_Comms_Lib, so they can be built
+// into simulator programs (see rf95SimBuild).
+// Tasks are simulated threads on the simulator's virtual time (tools/simKernel.cpp) and the scheduler is
+// always running, so the driver's service task, semaphores and task notifications work as on the board.
+// The main thread is a task too, of priority 1.
+
+#ifndef Seeed_Arduino_FreeRTOS_h
+#define Seeed_Arduino_FreeRTOS_h
+
+#include <stdint.h>
+#include <stddef.h>
+
+typedef void*         TaskHandle_t;
+typedef void*         SemaphoreHandle_t;
+typedef void*         QueueHandle_t;
+typedef uint32_t      TickType_t;
+typedef long          BaseType_t;
+typedef unsigned long UBaseType_t;
+typedef void        (*TaskFunction_t)(void*);
+
+#define pdFALSE                   0
+#define pdTRUE                    1
+#define pdFAIL                    0
+#define pdPASS                    1
+#define portMAX_DELAY             0xffffffffUL
+#define portTICK_PERIOD_MS        1
+#define pdMS_TO_TICKS(ms)         ((TickType_t)(ms))
+#define configMAX_PRIORITIES      9
+#define taskSCHEDULER_SUSPENDED   0
+#define taskSCHEDULER_NOT_STARTED 1
+#define taskSCHEDULER_RUNNING     2
+#define portYIELD_FROM_ISR(x)     (void)(x)
+
+// Critical sections hold off the simulated interrupts, as they hold off interrupts on the board
+void simulator_interrupts_lock();
+void simulator_interrupts_unlock();
+#define taskENTER_CRITICAL()      simulator_interrupts_lock()
+#define taskEXIT_CRITICAL()       simulator_interrupts_unlock()
+
+BaseType_t        xTaskGetSchedulerState();
+BaseType_t        xTaskCreate(TaskFunction_t function, const char* name, uint16_t stackDepth, void* parameters,
+			      UBaseType_t priority, TaskHandle_t* handle);
+TaskHandle_t      xTaskGetCurrentTaskHandle();
+void              vTaskPrioritySet(TaskHandle_t task, UBaseType_t priority);
+void              vTaskDelay(TickType_t ticks);
+void              vTaskNotifyGiveFromISR(TaskHandle_t task, BaseType_t* higherPriorityTaskWoken);
+BaseType_t        xTaskNotifyGive(TaskHandle_t task);
+uint32_t          ulTaskNotifyTake(BaseType_t clearOnExit, TickType_t ticks);
+
+SemaphoreHandle_t xSemaphoreCreateBinary();
+SemaphoreHandle_t xSemaphoreCreateRecursiveMutex();
+BaseType_t        xSemaphoreTake(SemaphoreHandle_t semaphore, TickType_t ticks);
+BaseType_t        xSemaphoreGive(SemaphoreHandle_t semaphore);
+BaseType_t        xSemaphoreTakeRecursive(SemaphoreHandle_t mutex, TickType_t ticks);
+BaseType_t        xSemaphoreGiveRecursive(SemaphoreHandle_t mutex);
+
+#endif
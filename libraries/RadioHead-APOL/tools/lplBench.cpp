@@ -0,0 +1,213 @@
+// lplBench.cpp
+// Measures what low power listening (APOL_Comms_Lib::enable_low_power_listen()) trades between the HHD's radio current
+// and the latency of requests to it, on emulated SX1276 radios.
+//
+// Build with tools/rf95SimBuild tools/lplBench.cpp, run with ./lplBench [seconds]
+// The POL sends a request to the HHD at random, a mean of LOAD_INTERVAL ms apart, through the send window, and times it
+// from queueing to the ACK. The HHD handles frames as its rx task does and, with a listen interval, calls sniff() every
+// interval as its listen task does. Each configuration runs in its own process, started from the same state, for
+// [seconds] (default 120). The HHD's radio current is worked out from the time its radio spent in each mode (the
+// APOL_CURRENT_* figures), and set beside lpl_listen_current() for the same interval and traffic.
+
+#include <RH_RF95.h>
+#include <APOL_Comms_Lib.h>
+#include <RHutil/SX1276Emulator.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <algorithm>
+
+#define POL_CS    10
+#define POL_INT   5
+#define MAX_TRANSMIT_ATTEMPTS 5 // As on the HHD
+#define LOAD_INTERVAL 10000     // Mean ms between requests from the POL
+#define MAX_SAMPLES 1000
+
+// Radios first, so they are on the simulated bus before the drivers are constructed
+SX1276Emulator hhdRadio(RFM95_CS, RFM95_INT);
+SX1276Emulator polRadio(POL_CS, POL_INT);
+
+// The POL's rx task, which its driver wakes
+static TaskHandle_t polRx;
+
+APOL_Comms_Lib hhd(HHD, NULL);
+APOL_Comms_Lib pol(POL, &polRx, POL_CS, POL_INT);
+
+static unsigned long duration = 120000;
+static volatile bool running;
+
+// Requests from the POL: time from queueing to ACK (ms), and how many were given up on
+static unsigned long latency[MAX_SAMPLES];
+static unsigned int  delivered;
+static unsigned int  abandoned;
+
+static const RHGenericDriver::RHMode modes[] = {
+    RHGenericDriver::RHModeInitialising, RHGenericDriver::RHModeSleep, RHGenericDriver::RHModeIdle,
+    RHGenericDriver::RHModeTx, RHGenericDriver::RHModeRx, RHGenericDriver::RHModeCad
+};
+static const uint32_t currents[] = {
+    APOL_CURRENT_IDLE, APOL_CURRENT_SLEEP, APOL_CURRENT_IDLE, APOL_CURRENT_TX, APOL_CURRENT_RX, APOL_CURRENT_CAD
+};
+#define NUM_MODES (sizeof(modes) / sizeof(modes[0]))
+
+// Random gap with the given mean, in ms
+static unsigned long gap(unsigned long mean)
+{
+    return random(0, 2 * mean + 1);
+}
+
+// The POL's rx task, woken by the driver for each frame. Hands ACKs to the send window
+static void ackTask(void* arg)
+{
+    APOL_Comms_Lib* comms = (APOL_Comms_Lib*)arg;
+    while (1)
+    {
+	ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+	while (comms->rf95->rxPending() > 0)
+	    if (comms->check_for_packet() && comms->packet_contents.request == ACK)
+		comms->handle_ack(&comms->packet_contents);
+    }
+}
+
+// Sends one request at a time to the HHD, a random time apart, the way request_handler_task does
+static void polTask(void* arg)
+{
+    (void)arg;
+    while (running)
+    {
+	delay(gap(LOAD_INTERVAL));
+	unsigned long start = millis();
+	int attempts = 0;
+	pol.queue_request(GREEN, HHD, 0);
+	while (pol.requests_outstanding(HHD) > 0)
+	{
+	    pol.flush_requests(HHD);
+	    pol.rf95->setModeRx();
+	    if (pol.wait_for_ack(HHD))
+	    {
+		if (delivered < MAX_SAMPLES)
+		    latency[delivered] = millis() - start;
+		delivered++;
+	    }
+	    else if (++attempts >= MAX_TRANSMIT_ATTEMPTS)
+	    {
+		pol.abandon_requests(HHD);
+		abandoned++;
+	    }
+	}
+    }
+}
+
+// Ends the run after duration ms
+static void timerTask(void* arg)
+{
+    (void)arg;
+    delay(duration);
+    running = false;
+}
+
+// The HHD's rx task and listen task. Polls the RX ring, as available() would wake the radio
+static void hhdLoop(uint16_t interval)
+{
+    unsigned long lastSniff = millis();
+    while (running)
+    {
+	while (hhd.rf95->rxPending() > 0)
+	{
+	    if (!hhd.check_for_packet() || hhd.packet_contents.request == ACK)
+		continue;
+	    hhd.accept_request(&hhd.packet_contents);
+	    hhd.send_ack(&hhd.packet_contents);
+	}
+	if (interval && millis() - lastSniff >= interval)
+	{
+	    lastSniff += interval;
+	    hhd.sniff();
+	}
+	delay(2);
+    }
+}
+
+static void configuration(uint16_t interval)
+{
+    hhdRadio.begin();
+    polRadio.begin();
+    hhdRadio.setLinkSignal(&polRadio, 10);
+    polRadio.setLinkSignal(&hhdRadio, 10);
+
+    hhd.begin();
+    pol.begin();
+    if (interval)
+    {
+	hhd.set_listen_interval(HHD, interval);
+	pol.set_listen_interval(HHD, interval);
+	hhd.enable_low_power_listen(true, 20);
+	pol.enable_low_power_listen(true, 20);
+    }
+    hhd.rf95->setModeRx();
+    pol.rf95->setModeRx();
+    hhdRadio.resetCounters();
+    polRadio.resetCounters();
+
+    uint32_t before[NUM_MODES];
+    for (unsigned int i = 0; i < NUM_MODES; i++)
+	before[i] = hhd.rf95->modeTime(modes[i]);
+    running = true;
+    unsigned long start = millis();
+    xTaskCreate(timerTask, "timerTask", 256, NULL, 1, NULL);
+    xTaskCreate(polTask, "polTask", 256, NULL, 1, NULL);
+    xTaskCreate(ackTask, "polRx", 256, &pol, 2, &polRx);
+    hhdLoop(interval);
+    unsigned long elapsed = millis() - start;
+    uint64_t charge = 0; // ms uA
+    uint32_t asleep = 0;
+    for (unsigned int i = 0; i < NUM_MODES; i++)
+    {
+	uint32_t time = hhd.rf95->modeTime(modes[i]) - before[i];
+	charge += (uint64_t)time * currents[i];
+	if (modes[i] == RHGenericDriver::RHModeSleep)
+	    asleep = time;
+    }
+
+    if (interval)
+	printf("listen interval %u ms\n", interval);
+    else
+	printf("always listening\n");
+    unsigned int n = std::min(delivered, (unsigned int)MAX_SAMPLES);
+    std::sort(latency, latency + n);
+    if (n)
+	printf("  %u delivered, %u abandoned, latency median %lu ms p95 %lu ms max %lu ms\n",
+	       delivered, abandoned, latency[n / 2], latency[n * 95 / 100], latency[n - 1]);
+    else
+	printf("  nothing delivered, %u abandoned\n", abandoned);
+    printf("  HHD radio: %lu uA average (model %lu uA, %lu uA with no traffic), asleep %lu%% of the time\n",
+	   (unsigned long)(charge / elapsed), (unsigned long)APOL_Comms_Lib::lpl_listen_current(interval, elapsed / std::max(delivered, 1U)),
+	   (unsigned long)APOL_Comms_Lib::lpl_listen_current(interval, 0), (unsigned long)((uint64_t)asleep * 100 / elapsed));
+    printf("  POL radio: %lu ms transmitting, %lu ms per request\n", (unsigned long)(polRadio.airtimeMicros() / 1000),
+	   delivered ? (unsigned long)(polRadio.airtimeMicros() / 1000 / delivered) : 0UL);
+}
+
+void setup()
+{
+    if (_simulator_argc > 1)
+	duration = atol(_simulator_argv[1]) * 1000;
+    printf("%lu s each, a request from the POL to the HHD every %d ms on average\n", duration / 1000, LOAD_INTERVAL);
+    fflush(stdout);
+
+    static const uint16_t intervals[] = {0, 250, 500, 1000, 2000};
+    for (unsigned int i = 0; i < sizeof(intervals) / sizeof(intervals[0]); i++)
+    {
+	pid_t child = fork();
+	if (child == 0)
+	{
+	    configuration(intervals[i]);
+	    fflush(stdout);
+	    _exit(0);
+	}
+	waitpid(child, NULL, 0);
+    }
+    exit(0);
+}
+
+void loop()
+{
+}
@@ -0,0 +1,306 @@
+// rateBench.cpp
+// Measures what the adaptive data rate in APOL_Comms_Lib saves in airtime and radiated energy, and how it copes when a
+// link gets worse, on emulated SX1276 radios with a signal set per link: a short, strong HHD-POL link and a POL-VDD
+// link that is either long and weak or short and strong.
+//
+// Build with tools/rf95SimBuild tools/rateBench.cpp, run with ./rateBench [runs]
+// Each configuration runs in its own process, started from the same state. The HHD side runs in the main thread and
+// sends requests through the send window as request_handler_task does. The POL and the VDD each run in their own thread,
+// the VDD sending a DETECTION every two seconds, and every device has an rx task handling frames as the devices do. With rate adaptation on, every device
+// calls adapt_rate() once a second. After a settling time the HHD drains a full queue of requests [runs] times, then the
+// HHD-POL link drops to a few dB of SNR and the HHD sends a request every 250 ms for 20 seconds.
+
+#include <RH_RF95.h>
+#include <APOL_Comms_Lib.h>
+#include <RHutil/SX1276Emulator.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define POL_CS  10
+#define POL_INT 5
+#define VDD_CS  11
+#define VDD_INT 6
+#define MAX_TRANSMIT_ATTEMPTS 5 // As on the HHD
+#define MAX_QUEUED_REQUESTS 10  // As on the HHD
+#define HHD_POWER 13            // As the HHD sets it
+#define POL_POWER 20            // As the POL and VDD set it
+#define RATE_INTERVAL 1000      // ms between calls to adapt_rate(), as on the devices
+#define DETECTION_INTERVAL 2000 // ms between DETECTIONs from the VDD (a busy pit lane)
+#define SETTLE_TIME 15000       // ms for the rates to settle before measuring
+#define DEGRADED_TIME 20000     // ms of requests after the HHD-POL link gets worse
+#define STRONG_SNR 20           // dB at 125 kHz and +20 dBm, HHD-POL (and POL-VDD when close)
+#define WEAK_SNR (-3)           // dB, POL-VDD across the pits
+#define DEGRADED_SNR 3          // dB, HHD-POL after it gets worse
+
+// Radios first, so they are on the simulated bus before the drivers are constructed
+SX1276Emulator hhdRadio(RFM95_CS, RFM95_INT);
+SX1276Emulator polRadio(POL_CS, POL_INT);
+SX1276Emulator vddRadio(VDD_CS, VDD_INT);
+
+// The HHD's and the VDD's rx tasks, which their drivers wake
+static TaskHandle_t hhdRx, vddRx;
+
+APOL_Comms_Lib hhd(HHD, &hhdRx);
+APOL_Comms_Lib pol(POL, NULL, POL_CS, POL_INT);
+APOL_Comms_Lib vdd(VDD, &vddRx, VDD_CS, VDD_INT);
+
+static unsigned int runs = 10;
+static bool adaptive;
+
+// DETECTIONs from the VDD: sent, acknowledged, given up on, and the longest from first send to ACK (ms)
+static volatile unsigned int detections, detectionsDelivered, detectionsAbandoned;
+static volatile unsigned long detectionWorst;
+
+// Runs the rate adaptation for a device when it is due
+static void adapt(APOL_Comms_Lib* comms, unsigned long* lastAdapt)
+{
+    if (adaptive && millis() - *lastAdapt >= RATE_INTERVAL)
+    {
+	*lastAdapt = millis();
+	comms->adapt_rate();
+	comms->rf95->setModeRx();
+    }
+}
+
+// Handles whatever has arrived for a device (accept, ACK) and runs the rate adaptation when it is due
+static void service(APOL_Comms_Lib* comms, unsigned long* lastAdapt)
+{
+    if (comms->rf95->waitAvailableTimeout(10))
+    {
+	while (comms->rf95->rxPending() > 0)
+	{
+	    if (!comms->check_for_packet())
+		continue;
+	    if (comms->packet_contents.request == ACK)
+		comms->handle_ack(&comms->packet_contents);
+	    else
+	    {
+		comms->accept_request(&comms->packet_contents);
+		comms->send_ack(&comms->packet_contents);
+	    }
+	}
+	comms->rf95->setModeRx();
+    }
+    adapt(comms, lastAdapt);
+}
+
+// The HHD's and the VDD's rx task, woken by the driver for each frame and at least every RATE_INTERVAL to run the rate
+// adaptation, as rx_task does on the HHD. So the adaptation carries on while requests are sent
+static void rxTask(void* arg)
+{
+    APOL_Comms_Lib* comms = (APOL_Comms_Lib*)arg;
+    unsigned long lastAdapt = millis();
+    while (1)
+    {
+	ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(RATE_INTERVAL));
+	while (comms->rf95->rxPending() > 0)
+	    if (comms->check_for_packet() && comms->packet_contents.request == ACK)
+		comms->handle_ack(&comms->packet_contents);
+	adapt(comms, &lastAdapt);
+    }
+}
+
+static void polTask(void* arg)
+{
+    (void)arg;
+    unsigned long lastAdapt = millis();
+    while (1)
+	service(&pol, &lastAdapt);
+}
+
+static void vddTask(void* arg)
+{
+    (void)arg;
+    while (1)
+    {
+	delay(DETECTION_INTERVAL);
+	unsigned long start = millis();
+	int attempts = 0;
+	detections++;
+	vdd.queue_request(DETECTION, POL, 0);
+	while (vdd.requests_outstanding(POL) > 0)
+	{
+	    vdd.flush_requests(POL);
+	    vdd.rf95->setModeRx();
+	    if (vdd.wait_for_ack(POL))
+	    {
+		detectionsDelivered++;
+		if (millis() - start > detectionWorst)
+		    detectionWorst = millis() - start;
+	    }
+	    else if (++attempts >= MAX_TRANSMIT_ATTEMPTS)
+	    {
+		vdd.abandon_requests(POL);
+		detectionsAbandoned++;
+	    }
+	}
+    }
+}
+
+// Sends count requests the way request_handler_task does and returns how long it took in microseconds.
+// abandoned counts windows given up after MAX_TRANSMIT_ATTEMPTS
+static unsigned long drain(unsigned int count, unsigned int* abandoned)
+{
+    unsigned int queued = 0;
+    int attempts = 0;
+    unsigned long start = micros();
+
+    while (queued < count || hhd.requests_outstanding(POL) > 0)
+    {
+	while (queued < count && hhd.window_space(POL) > 0)
+	{
+	    hhd.queue_request((queued & 1) ? RED : GREEN, POL, queued + 1);
+	    queued++;
+	}
+	hhd.flush_requests(POL);
+	hhd.rf95->setModeRx();
+	if (hhd.wait_for_ack(POL))
+	    attempts = 0;
+	else if (++attempts >= MAX_TRANSMIT_ATTEMPTS)
+	{
+	    hhd.abandon_requests(POL);
+	    (*abandoned)++;
+	    attempts = 0;
+	}
+    }
+    return micros() - start;
+}
+
+static void setLink(SX1276Emulator* a, SX1276Emulator* b, int8_t snr)
+{
+    a->setLinkSignal(b, snr);
+    b->setLinkSignal(a, snr);
+}
+
+static void rates(char* buf, size_t size)
+{
+    snprintf(buf, size, "listen HHD %u POL %u VDD %u, HHD->POL %u/%+d dBm, POL->HHD %u/%+d dBm, VDD->POL %u/%+d dBm",
+	     hhd.listen_rate(), pol.listen_rate(), vdd.listen_rate(),
+	     hhd.rate(POL)->tx_rate, adaptive ? hhd.rate(POL)->tx_power : HHD_POWER,
+	     pol.rate(HHD)->tx_rate, adaptive ? pol.rate(HHD)->tx_power : POL_POWER,
+	     vdd.rate(POL)->tx_rate, adaptive ? vdd.rate(POL)->tx_power : POL_POWER);
+}
+
+static void configuration(const char* name, bool adapt, int8_t vddSnr)
+{
+    adaptive = adapt;
+    hhdRadio.begin();
+    polRadio.begin();
+    vddRadio.begin();
+    setLink(&hhdRadio, &polRadio, STRONG_SNR);
+    setLink(&polRadio, &vddRadio, vddSnr);
+    setLink(&hhdRadio, &vddRadio, -20); // Out of range of each other
+
+    hhd.begin();
+    pol.begin();
+    vdd.begin();
+    hhd.rf95->setTxPower(HHD_POWER);
+    pol.rf95->setTxPower(POL_POWER);
+    vdd.rf95->setTxPower(POL_POWER);
+    if (adaptive)
+    {
+	// Everything sends to the POL, the POL only to the HHD and (ACKs) to the VDD
+	hhd.enable_rate_adaptation(APOL_PEER(POL), HHD_POWER);
+	pol.enable_rate_adaptation(APOL_PEER(HHD) | APOL_PEER(VDD), POL_POWER);
+	vdd.enable_rate_adaptation(0, POL_POWER);
+    }
+    hhd.rf95->setModeRx();
+    pol.rf95->setModeRx();
+    vdd.rf95->setModeRx();
+
+    xTaskCreate(polTask, "polTask", 256, NULL, 2, NULL);
+    xTaskCreate(vddTask, "vddTask", 256, NULL, 1, NULL);
+    xTaskCreate(rxTask, "hhdRx", 256, &hhd, 2, &hhdRx);
+    xTaskCreate(rxTask, "vddRx", 256, &vdd, 2, &vddRx);
+
+    // Settle with a ping every 250 ms, as the HHD does while it is in use
+    unsigned int abandoned = 0;
+    for (unsigned long start = millis(); millis() - start < SETTLE_TIME; )
+    {
+	drain(1, &abandoned);
+	delay(250);
+    }
+
+    char buf[200];
+    rates(buf, sizeof(buf));
+    printf("%s, VDD link %+d dB\n  settled: %s\n", name, vddSnr, buf);
+
+    // Full queues, a quarter of a second apart
+    hhdRadio.resetCounters();
+    polRadio.resetCounters();
+    unsigned long total = 0, worst = 0;
+    uint16_t retransmissions = hhd.link(POL)->retransmissions;
+    abandoned = 0;
+    for (unsigned int run = 0; run < runs; run++)
+    {
+	unsigned long elapsed = drain(MAX_QUEUED_REQUESTS, &abandoned);
+	total += elapsed;
+	if (elapsed > worst)
+	    worst = elapsed;
+	delay(250);
+    }
+    printf("  full queue (10): drain mean %6.1f ms max %6.1f ms, resends %u, abandoned %u\n",
+	   total / 1000.0 / runs, worst / 1000.0, (unsigned)(hhd.link(POL)->retransmissions - retransmissions), abandoned);
+    printf("  per queue: HHD air %6.1f ms %7.1f uJ, POL air %6.1f ms %7.1f uJ\n",
+	   hhdRadio.airtimeMicros() / 1000.0 / runs, (double)hhdRadio.txEnergyMicrojoules() / runs,
+	   polRadio.airtimeMicros() / 1000.0 / runs, (double)polRadio.txEnergyMicrojoules() / runs);
+
+    // The HHD walks away: a request every 250 ms, timing how long until one gets through again
+    setLink(&hhdRadio, &polRadio, DEGRADED_SNR);
+    unsigned long degraded = millis(), recovered = 0;
+    unsigned int sent = 0, delivered = 0;
+    abandoned = 0;
+    while (millis() - degraded < DEGRADED_TIME)
+    {
+	unsigned int before = abandoned;
+	drain(1, &abandoned);
+	sent++;
+	if (abandoned == before)
+	{
+	    delivered++;
+	    if (!recovered)
+		recovered = millis();
+	}
+	delay(250);
+    }
+    rates(buf, sizeof(buf));
+    printf("  HHD link down to %+d dB: %u of %u requests delivered, first after %lu ms\n  then: %s\n",
+	   DEGRADED_SNR, delivered, sent, recovered ? recovered - degraded : 0, buf);
+    printf("  VDD detections: %u delivered, %u abandoned, slowest %lu ms\n",
+	   detectionsDelivered, detectionsAbandoned, detectionWorst);
+}
+
+void setup()
+{
+    if (_simulator_argc > 1)
+	runs = atoi(_simulator_argv[1]);
+    printf("%u runs, HHD-POL link %+d dB, HHD %d dBm, POL and VDD %d dBm\n", runs, STRONG_SNR, HHD_POWER, POL_POWER);
+    fflush(stdout);
+
+    static const struct
+    {
+	const char* name;
+	bool        adapt;
+	int8_t      vddSnr;
+    } configurations[] = {
+	{"fixed rate",    false, WEAK_SNR},
+	{"adaptive rate", true,  WEAK_SNR},
+	{"adaptive rate", true,  STRONG_SNR},
+    };
+    for (unsigned int i = 0; i < sizeof(configurations) / sizeof(configurations[0]); i++)
+    {
+	pid_t child = fork();
+	if (child == 0)
+	{
+	    configuration(configurations[i].name, configurations[i].adapt, configurations[i].vddSnr);
+	    fflush(stdout);
+	    _exit(0);
+	}
+	waitpid(child, NULL, 0);
+    }
+    exit(0);
+}
+
+void loop()
+{
+}
@@ -0,0 +1,240 @@
+// relayBench.cpp
+// Measures what two repeaters cost on the channel when each forwards what it hears (APOL_Comms_Lib::relay_packet()),
+// on emulated SX1276 radios.
+//
+// Build with tools/rf95SimBuild tools/relayBench.cpp, run with ./relayBench [seconds]
+// The HHD sends a request to the POL at random, a mean of LOAD_INTERVAL ms apart, through the send window as
+// request_handler_task does, and times it from queueing to the ACK. Two repeaters between them, in range of each other,
+// forward every frame they hear as the repeater's rx_task does. With the HHD and POL in range of each other every forward
+// is redundant, unless the POL misses the request (LOSS percent of frames lost at every radio, with loss on); out of
+// range, every exchange goes through a repeater. Each configuration runs in its own process,
+// started from the same state, for [seconds] (default 30). Frames on air counts every transmission by every radio.
+// Forwarded counts the frames each repeater sent on, and dropped those it held and dropped because the target answered
+// the sender itself.
+
+#include <RH_RF95.h>
+#include <APOL_Comms_Lib.h>
+#include <RHutil/SX1276Emulator.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <algorithm>
+
+#define POL_CS    10
+#define POL_INT   5
+#define RPT1_CS   11
+#define RPT1_INT  6
+#define RPT2_CS   12
+#define RPT2_INT  7
+#define MAX_TRANSMIT_ATTEMPTS 5 // As on the HHD
+#define LOAD_INTERVAL 1000      // Mean ms between requests from the HHD
+#define OUT_OF_RANGE (-30)      // SNR (dB) of a link nothing gets over
+#define LOSS 10                 // Percent of frames lost at every radio, with loss on
+#define MAX_SAMPLES 1000
+
+// Radios first, so they are on the simulated bus before the drivers are constructed
+SX1276Emulator hhdRadio(RFM95_CS, RFM95_INT);
+SX1276Emulator polRadio(POL_CS, POL_INT);
+SX1276Emulator rpt1Radio(RPT1_CS, RPT1_INT);
+SX1276Emulator rpt2Radio(RPT2_CS, RPT2_INT);
+
+APOL_Comms_Lib hhd(APOL_ADDRESS(HHD, 0, 0), NULL);
+APOL_Comms_Lib pol(APOL_ADDRESS(POL, 0, 0), NULL, POL_CS, POL_INT);
+APOL_Comms_Lib rpt1(APOL_ADDRESS(REPEATER, 0, 0), NULL, RPT1_CS, RPT1_INT);
+APOL_Comms_Lib rpt2(APOL_ADDRESS(REPEATER, 0, 1), NULL, RPT2_CS, RPT2_INT);
+
+static unsigned long duration = 30000;
+static volatile bool running;
+static volatile bool sending; // The HHD task is still finishing its last request, so the rx tasks keep going
+
+// Requests from the HHD: time from queueing to ACK (ms), and how many were given up on
+static unsigned long latency[MAX_SAMPLES];
+static unsigned int  delivered;
+static unsigned int  abandoned;
+static unsigned int  acted;     // Requests the POL acted on
+static unsigned int  forwarded[2];
+
+// Random gap with the given mean, in ms
+static unsigned long gap(unsigned long mean)
+{
+    return random(0, 2 * mean + 1);
+}
+
+// Sends one request at a time to the POL, a random time apart, the way request_handler_task does
+static void hhdTask(void* arg)
+{
+    (void)arg;
+    uint8_t target = pol.address();
+    while (running)
+    {
+	delay(gap(LOAD_INTERVAL));
+	unsigned long start = millis();
+	int attempts = 0;
+	hhd.queue_request(GREEN, target, 1);
+	while (hhd.requests_outstanding(target) > 0)
+	{
+	    hhd.flush_requests(target);
+	    hhd.rf95->setModeRx();
+	    if (hhd.wait_for_ack(target))
+	    {
+		if (delivered < MAX_SAMPLES)
+		    latency[delivered] = millis() - start;
+		delivered++;
+	    }
+	    else if (++attempts >= MAX_TRANSMIT_ATTEMPTS)
+	    {
+		hhd.abandon_requests(target);
+		abandoned++;
+	    }
+	}
+    }
+    sending = false;
+}
+
+// The POL's rx task. Polls the RX ring
+static void polTask(void* arg)
+{
+    (void)arg;
+    while (running || sending)
+    {
+	while (pol.rf95->rxPending() > 0)
+	{
+	    if (!pol.check_for_packet() || pol.packet_contents.request == ACK)
+		continue;
+	    if (pol.accept_request(&pol.packet_contents))
+		acted++;
+	    pol.send_ack(&pol.packet_contents);
+	}
+	delay(2);
+    }
+}
+
+// The HHD's rx task. Hands ACKs to the send window
+static void hhdRxTask(void* arg)
+{
+    (void)arg;
+    while (running || sending)
+    {
+	while (hhd.rf95->rxPending() > 0)
+	    if (hhd.check_for_packet())
+		hhd.handle_ack(&hhd.packet_contents);
+	delay(2);
+    }
+}
+
+// A repeater's rx task. Polls the RX ring, and forwards held frames as they fall due
+static void repeaterTask(void* arg)
+{
+    int idx = *(int*)arg;
+    APOL_Comms_Lib* rpt = idx ? &rpt2 : &rpt1;
+    packet_fields packet;
+    while (running || sending)
+    {
+	while (rpt->rf95->rxPending() > 0)
+	    rpt->relay_packet();
+	while (rpt->forward_held(&packet))
+	    forwarded[idx]++;
+	rpt->rf95->setModeRx();
+	delay(2);
+    }
+}
+
+static void configuration(const char* name, bool inRange, uint8_t loss)
+{
+    SX1276Emulator* radios[] = {&hhdRadio, &polRadio, &rpt1Radio, &rpt2Radio};
+    for (SX1276Emulator* radio : radios)
+    {
+	radio->begin();
+	for (SX1276Emulator* from : radios)
+	    if (from != radio)
+		radio->setLinkSignal(from, 10);
+    }
+    if (!inRange)
+    {
+	hhdRadio.setLinkSignal(&polRadio, OUT_OF_RANGE);
+	polRadio.setLinkSignal(&hhdRadio, OUT_OF_RANGE);
+    }
+    if (loss)
+	for (int i = 0; i < 4; i++)
+	    radios[i]->setLoss(loss, 1 + i);
+
+    hhd.begin();
+    pol.begin();
+    rpt1.begin();
+    rpt2.begin();
+    rpt1.rf95->setPromiscuous(true);
+    rpt2.rf95->setPromiscuous(true);
+    for (SX1276Emulator* radio : radios)
+	radio->resetCounters();
+    hhd.rf95->setModeRx();
+    pol.rf95->setModeRx();
+    rpt1.rf95->setModeRx();
+    rpt2.rf95->setModeRx();
+
+    running = true;
+    sending = true;
+    static int idx[2] = {0, 1};
+    xTaskCreate(polTask, "polTask", 256, NULL, 2, NULL);
+    xTaskCreate(hhdRxTask, "hhdRxTask", 256, NULL, 2, NULL);
+    xTaskCreate(repeaterTask, "repeaterTask", 256, &idx[0], 2, NULL);
+    xTaskCreate(repeaterTask, "repeaterTask", 256, &idx[1], 2, NULL);
+    xTaskCreate(hhdTask, "hhdTask", 256, NULL, 1, NULL);
+    delay(duration);
+    running = false;
+    while (sending)
+	delay(10);
+    delay(200); // Let the repeaters finish what they are doing
+
+    unsigned long frames = 0, airtime = 0;
+    for (SX1276Emulator* radio : radios)
+    {
+	frames += radio->txPackets();
+	airtime += radio->airtimeMicros() / 1000;
+    }
+    printf("%s\n", name);
+    unsigned int n = std::min(delivered, (unsigned int)MAX_SAMPLES);
+    std::sort(latency, latency + n);
+    if (n)
+	printf("  %u delivered, %u abandoned, latency median %lu ms p95 %lu ms max %lu ms, %u acted on by the POL\n",
+	       delivered, abandoned, latency[n / 2], latency[n * 95 / 100], latency[n - 1], acted);
+    else
+	printf("  nothing delivered, %u abandoned\n", abandoned);
+    printf("  %lu frames on air (%.1f per request), channel busy %lu ms (%lu%%), repeaters forwarded %u and %u, dropped %lu and %lu\n",
+	   frames, delivered ? (double)frames / delivered : 0.0, airtime, airtime * 100 / duration, forwarded[0], forwarded[1],
+	   (unsigned long)rpt1.relay_counts()->direct, (unsigned long)rpt2.relay_counts()->direct);
+}
+
+void setup()
+{
+    if (_simulator_argc > 1)
+	duration = atol(_simulator_argv[1]) * 1000;
+    printf("%lu s each, a request from the HHD to the POL every %d ms on average, two repeaters\n", duration / 1000, LOAD_INTERVAL);
+    fflush(stdout);
+
+    static const struct
+    {
+	const char* name;
+	bool inRange;
+	uint8_t loss;
+    } configurations[] = {
+	{"HHD and POL in range", true, 0},
+	{"HHD and POL in range, 10% loss", true, LOSS},
+	{"HHD and POL out of range", false, 0},
+	{"HHD and POL out of range, 10% loss", false, LOSS},
+    };
+    for (unsigned int i = 0; i < sizeof(configurations) / sizeof(configurations[0]); i++)
+    {
+	pid_t child = fork();
+	if (child == 0)
+	{
+	    configuration(configurations[i].name, configurations[i].inRange, configurations[i].loss);
+	    fflush(stdout);
+	    _exit(0);
+	}
+	waitpid(child, NULL, 0);
+    }
+    exit(0);
+}
+
+void loop()
+{
+}
@@ -0,0 +1,135 @@
+// rf95Bench.cpp
+// Runs the unmodified RH_RF95 driver and APOL_Comms_Lib against two emulated SX1276 radios on Linux,
+// and reports SPI transactions per packet, interrupt handler path lengths, time on air (as the radios see it and as
+// the drivers count it) and round trip times.
+//
+// Build with tools/rf95SimBuild tools/rf95Bench.cpp, run with ./rf95Bench [exchanges]
+// The handheld (HHD) sends PING through APOL_Comms_Lib on the usual RFM95 pins. The pit out light (POL)
+// end is a bare RH_RF95 on other pins that answers each PING with an ACK carrying the same payload.
+
+#include <RH_RF95.h>
+#include <APOL_Comms_Lib.h>
+#include <RHutil/SX1276Emulator.h>
+
+#define POL_CS  10
+#define POL_INT 5
+
+// Radios first, so they are on the simulated bus before the drivers are constructed
+SX1276Emulator hhdRadio(RFM95_CS, RFM95_INT);
+SX1276Emulator polRadio(POL_CS, POL_INT);
+
+APOL_Comms_Lib comms(HHD, NULL);
+RH_RF95 pol(POL_CS, POL_INT);
+
+static unsigned int exchanges = 20;
+static unsigned int done = 0;
+static unsigned int lost = 0;
+
+// Totals over all exchanges
+static uint32_t hhdSpi, polSpi;
+static unsigned long rttTotal, rttMax;
+
+void setup()
+{
+    if (_simulator_argc > 1)
+	exchanges = atoi(_simulator_argv[1]);
+    hhdRadio.begin();
+    polRadio.begin();
+
+    comms.begin();
+    if (!pol.init())
+    {
+	Serial.println("POL init failed");
+	exit(1);
+    }
+    pol.setFrequency(RF95_FREQ);
+    pol.setThisAddress(POL);
+    pol.setModeRx();
+
+    hhdRadio.resetCounters();
+    polRadio.resetCounters();
+    printf("%u PING/ACK exchanges, time on air %lu us (PING) %lu us (ACK), driver estimate %lu us\n", exchanges,
+	   (unsigned long)hhdRadio.timeOnAir(RH_RF95_HEADER_LEN + 1), (unsigned long)polRadio.timeOnAir(RH_RF95_HEADER_LEN + 1),
+	   (unsigned long)comms.rf95->timeOnAir(1));
+}
+
+void loop()
+{
+    if (done >= exchanges)
+    {
+	unsigned int ok = done - lost;
+	printf("\nexchanges %u, lost %u\n", done, lost);
+	if (ok)
+	{
+	    // Per exchange rather than per step, as the service tasks read the received frames while the other end runs
+	    printf("SPI transactions per exchange: HHD %.1f, POL %.1f\n", (double)hhdSpi / ok, (double)polSpi / ok);
+	    printf("round trip: mean %lu us, max %lu us\n", rttTotal / ok, rttMax);
+	}
+	SX1276Emulator* radios[] = {&hhdRadio, &polRadio};
+	const char* names[] = {"HHD", "POL"};
+	for (int i = 0; i < 2; i++)
+	{
+	    SX1276Emulator* r = radios[i];
+	    printf("%s radio: tx %lu rx %lu collisions %lu airtime %lu us\n", names[i],
+		   (unsigned long)r->txPackets(), (unsigned long)r->rxPackets(),
+		   (unsigned long)r->collisions(), (unsigned long)r->airtimeMicros());
+	    printf("%s interrupts %lu: SPI transactions in handlers %lu (max %lu per interrupt), handler time max %lu us mean %lu us\n",
+		   names[i], (unsigned long)r->interruptCount(), (unsigned long)r->isrTransactions(),
+		   (unsigned long)r->isrTransactionsMax(), (unsigned long)r->isrMicrosMax(),
+		   r->interruptCount() ? (unsigned long)(r->isrMicrosTotal() / r->interruptCount()) : 0UL);
+	}
+	// What the drivers count for themselves, to set against the radios' own airtime
+	printf("driver airtime: HHD tx %lu ms rx %lu ms, POL tx %lu ms rx %lu ms\n",
+	       (unsigned long)comms.rf95->txAirtime(), (unsigned long)comms.rf95->rxAirtime(),
+	       (unsigned long)pol.txAirtime(), (unsigned long)pol.rxAirtime());
+	exit(lost ? 1 : 0);
+    }
+
+    unsigned long start = micros();
+
+    // HHD -> POL
+    uint32_t hhdStart = comms.rf95->spiTransactions();
+    uint32_t polStart = pol.spiTransactions();
+    comms.send_packet(PING, POL, done + 1);
+    comms.rf95->setModeRx(); // Listening before the ACK can start, as the firmware's rx_task would be
+
+    uint8_t buf[RH_RF95_MAX_MESSAGE_LEN];
+    uint8_t len = sizeof(buf);
+    if (!pol.waitAvailableTimeout(PING_TIMEOUT) || !pol.recv(buf, &len))
+    {
+	printf("exchange %u: PING lost\n", done + 1);
+	lost++;
+	done++;
+	return;
+    }
+
+    // POL -> HHD
+    pol.setHeaderTo(pol.headerFrom());
+    pol.setHeaderFrom(POL);
+    pol.setHeaderId(pol.headerId());
+    pol.setHeaderFlags((APOL_FRAME_VERSION << APOL_FLAGS_VERSION_SHIFT) | ACK, 0xFF);
+    pol.send(buf, len);
+    pol.waitPacketSent();
+    pol.setModeRx();
+
+    bool acked = comms.rf95->waitAvailableTimeout(PING_TIMEOUT) && comms.check_for_packet()
+	&& comms.packet_contents.request == ACK && comms.packet_contents.payload == done + 1;
+    uint32_t hhdTotal = comms.rf95->spiTransactions() - hhdStart;
+    uint32_t polTotal = pol.spiTransactions() - polStart;
+    unsigned long rtt = micros() - start;
+    done++;
+    if (!acked)
+    {
+	printf("exchange %u: ACK lost\n", done);
+	lost++;
+	return;
+    }
+
+    hhdSpi += hhdTotal;
+    polSpi += polTotal;
+    rttTotal += rtt;
+    if (rtt > rttMax)
+	rttMax = rtt;
+    printf("exchange %u: rtt %lu us, SPI HHD %lu POL %lu, last ISR %lu transactions\n", done, rtt,
+	   (unsigned long)hhdTotal, (unsigned long)polTotal, (unsigned long)hhdRadio.isrTransactionsLast());
+}
@@ -0,0 +1,303 @@
+// simKernel.cpp
+// Virtual time for simulator programs built with -DSIMULATOR_VIRTUAL_TIME (see rf95SimBuild)
+//
+// Every simulated thread (the main thread, the radio emulators' air thread and the FreeRTOS tasks of
+// tools/host/Seeed_Arduino_FreeRTOS.cpp) is a pthread, but only one of them runs at a time: the highest priority
+// ready thread, first come first served among equals, as on a single core. The clock does not follow the wall clock.
+// It moves when a thread spends time (SPI octets, reading the clock) and, when every thread is waiting, jumps to the
+// earliest timeout. So a run depends only on its seed and not on the host.
+
+#include <RadioHead.h>
+#if (RH_PLATFORM == RH_PLATFORM_UNIX) && defined(SIMULATOR_VIRTUAL_TIME)
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <RHutil/simulator.h>
+
+#define SIMULATOR_MAIN_PRIORITY 1   // The main thread runs as a task of this priority
+#define SIMULATOR_SLICE_MICROS  1000 // Ready threads of equal priority take turns each tick, as FreeRTOS time slices
+
+struct SimulatorThread
+{
+    pthread_t        pthread;
+    pthread_cond_t   cond;       // Signalled when the thread is given the processor
+    void           (*function)(void*);
+    void*            arg;
+    int              priority;
+    bool             ready;      // Running or waiting for the processor
+    bool             timedOut;   // The last wait ended by its timeout
+    const void*      waitObject; // What it waits on, when not ready
+    uint64_t         deadline;   // When the wait times out, SIMULATOR_FOREVER for never
+    uint64_t         order;      // When it became ready or started waiting, for first come first served
+    SimulatorThread* next;
+};
+
+// Everything below is guarded by kernelMutex
+static pthread_mutex_t  kernelMutex = PTHREAD_MUTEX_INITIALIZER;
+static SimulatorThread* threads = NULL;
+static SimulatorThread* current = NULL;
+static uint64_t         now = 0;
+static uint64_t         order = 0;
+static uint64_t         sliceStart = 0;
+
+// Simulated interrupt masking, held by one thread at a time
+static SimulatorThread* interruptsOwner = NULL;
+static unsigned int     interruptsDepth = 0;
+
+static SimulatorThread* newThread(void (*function)(void*), void* arg, int priority)
+{
+    SimulatorThread* thread = (SimulatorThread*)calloc(1, sizeof(SimulatorThread));
+    pthread_cond_init(&thread->cond, NULL);
+    thread->function = function;
+    thread->arg = arg;
+    thread->priority = priority;
+    thread->ready = true;
+    thread->deadline = SIMULATOR_FOREVER;
+    thread->order = order++;
+    thread->next = threads;
+    threads = thread;
+    return thread;
+}
+
+// The first call, from the main thread (perhaps from a constructor before main()), makes it a simulated thread
+static void kernelInit()
+{
+    if (!current)
+	current = newThread(NULL, NULL, SIMULATOR_MAIN_PRIORITY);
+}
+
+// Makes ready the threads whose timeouts have passed
+static void timeouts()
+{
+    for (SimulatorThread* t = threads; t; t = t->next)
+	if (!t->ready && t->deadline <= now)
+	{
+	    t->ready = true;
+	    t->timedOut = true;
+	    t->waitObject = NULL;
+	    t->deadline = SIMULATOR_FOREVER;
+	    t->order = order++;
+	}
+}
+
+// The ready thread that should run, or NULL if there is none
+static SimulatorThread* best()
+{
+    SimulatorThread* found = NULL;
+    for (SimulatorThread* t = threads; t; t = t->next)
+	if (t->ready && (!found || t->priority > found->priority
+			 || (t->priority == found->priority && t->order < found->order)))
+	    found = t;
+    return found;
+}
+
+// Gives the processor to thread and returns when the calling thread next gets it back
+static void switchTo(SimulatorThread* thread)
+{
+    SimulatorThread* self = current;
+    if (thread == self)
+	return;
+    current = thread;
+    sliceStart = now;
+    pthread_cond_signal(&thread->cond);
+    while (current != self)
+	pthread_cond_wait(&self->cond, &kernelMutex);
+}
+
+// The thread to run after the current one stops being ready, moving the clock on until one is
+static SimulatorThread* pickNext()
+{
+    while (1)
+    {
+	timeouts();
+	SimulatorThread* next = best();
+	if (next)
+	    return next;
+	uint64_t earliest = SIMULATOR_FOREVER;
+	for (SimulatorThread* t = threads; t; t = t->next)
+	    if (t->deadline < earliest)
+		earliest = t->deadline;
+	if (earliest == SIMULATOR_FOREVER)
+	{
+	    fprintf(stderr, "simulator: every thread waits forever\n");
+	    abort();
+	}
+	now = earliest;
+    }
+}
+
+static bool waitLocked(const void* object, uint64_t deadline)
+{
+    SimulatorThread* self = current;
+    self->ready = false;
+    self->timedOut = false;
+    self->waitObject = object;
+    self->deadline = deadline;
+    self->order = order++;
+    switchTo(pickNext());
+    return !self->timedOut;
+}
+
+static bool wakeLocked(const void* object)
+{
+    SimulatorThread* found = NULL;
+    for (SimulatorThread* t = threads; t; t = t->next)
+	if (!t->ready && t->waitObject == object
+	    && (!found || t->priority > found->priority || (t->priority == found->priority && t->order < found->order)))
+	    found = t;
+    if (!found)
+	return false;
+    found->ready = true;
+    found->waitObject = NULL;
+    found->deadline = SIMULATOR_FOREVER;
+    found->order = order++;
+    return true;
+}
+
+// Switches away from the current thread if a higher priority one is ready, or an equal one is and the current
+// one has had its time slice. Not while interrupts are masked
+static void preemptLocked()
+{
+    if (interruptsDepth)
+	return;
+    timeouts();
+    SimulatorThread* next = best();
+    if (next == current)
+	return;
+    if (next->priority > current->priority
+	|| (next->priority == current->priority && now - sliceStart >= SIMULATOR_SLICE_MICROS))
+    {
+	current->order = order++;
+	switchTo(next);
+    }
+}
+
+static void* threadMain(void* arg)
+{
+    SimulatorThread* self = (SimulatorThread*)arg;
+    pthread_mutex_lock(&kernelMutex);
+    while (current != self)
+	pthread_cond_wait(&self->cond, &kernelMutex);
+    pthread_mutex_unlock(&kernelMutex);
+
+    self->function(self->arg);
+
+    pthread_mutex_lock(&kernelMutex);
+    SimulatorThread** link = &threads;
+    while (*link != self)
+	link = &(*link)->next;
+    *link = self->next;
+    current = pickNext();
+    sliceStart = now;
+    pthread_cond_signal(&current->cond);
+    pthread_mutex_unlock(&kernelMutex);
+    pthread_cond_destroy(&self->cond);
+    free(self);
+    return NULL;
+}
+
+SimulatorThread* simulator_thread_create(void (*function)(void*), void* arg, int priority)
+{
+    pthread_mutex_lock(&kernelMutex);
+    kernelInit();
+    SimulatorThread* thread = newThread(function, arg, priority);
+    pthread_create(&thread->pthread, NULL, threadMain, thread);
+    pthread_detach(thread->pthread);
+    pthread_mutex_unlock(&kernelMutex);
+    return thread;
+}
+
+SimulatorThread* simulator_thread_current()
+{
+    pthread_mutex_lock(&kernelMutex);
+    kernelInit();
+    SimulatorThread* thread = current;
+    pthread_mutex_unlock(&kernelMutex);
+    return thread;
+}
+
+int simulator_thread_priority(SimulatorThread* thread)
+{
+    return thread->priority;
+}
+
+void simulator_thread_set_priority(SimulatorThread* thread, int priority)
+{
+    pthread_mutex_lock(&kernelMutex);
+    thread->priority = priority;
+    pthread_mutex_unlock(&kernelMutex);
+}
+
+bool simulator_wait(const void* object, uint64_t deadline)
+{
+    pthread_mutex_lock(&kernelMutex);
+    kernelInit();
+    bool woken = waitLocked(object, deadline);
+    pthread_mutex_unlock(&kernelMutex);
+    return woken;
+}
+
+bool simulator_wake(const void* object)
+{
+    pthread_mutex_lock(&kernelMutex);
+    bool woken = wakeLocked(object);
+    pthread_mutex_unlock(&kernelMutex);
+    return woken;
+}
+
+void simulator_preempt()
+{
+    pthread_mutex_lock(&kernelMutex);
+    kernelInit();
+    preemptLocked();
+    pthread_mutex_unlock(&kernelMutex);
+}
+
+void simulator_sleep_micros(uint64_t micros)
+{
+    pthread_mutex_lock(&kernelMutex);
+    kernelInit();
+    waitLocked(current, now + micros); // Nothing wakes a thread waiting on itself
+    pthread_mutex_unlock(&kernelMutex);
+}
+
+void simulator_spend_micros(uint32_t micros)
+{
+    pthread_mutex_lock(&kernelMutex);
+    now += micros;
+    pthread_mutex_unlock(&kernelMutex);
+}
+
+uint64_t simulator_now_micros()
+{
+    pthread_mutex_lock(&kernelMutex);
+    uint64_t time = now;
+    pthread_mutex_unlock(&kernelMutex);
+    return time;
+}
+
+void simulator_interrupts_lock()
+{
+    pthread_mutex_lock(&kernelMutex);
+    kernelInit();
+    while (interruptsDepth && interruptsOwner != current)
+	waitLocked(&interruptsOwner, SIMULATOR_FOREVER);
+    interruptsOwner = current;
+    interruptsDepth++;
+    pthread_mutex_unlock(&kernelMutex);
+}
+
+void simulator_interrupts_unlock()
+{
+    pthread_mutex_lock(&kernelMutex);
+    if (interruptsDepth && --interruptsDepth == 0)
+    {
+	interruptsOwner = NULL;
+	wakeLocked(&interruptsOwner);
+	preemptLocked();
+    }
+    pthread_mutex_unlock(&kernelMutex);
+}
+
+#endif
@@ -11,8 +11,24 @@
 #include <sys/time.h>
 #include <unistd.h>
 #include <time.h>
+#include <sched.h>
+#include <pthread.h>
 
 SerialSimulator Serial;
+SPISimulator SPI;
+
+// Simulated pin state, SPI devices and interrupt handlers, indexed by pin number
+static uint8_t             pinValues[SIMULATOR_NUM_PINS];
+static SimulatorSPIDevice* spiDevices[SIMULATOR_NUM_PINS];
+static SimulatorSPIDevice* spiSelected = NULL;
+static void              (*interruptHandlers[SIMULATOR_NUM_PINS])(void);
+static int                 interruptModes[SIMULATOR_NUM_PINS];
+
+#ifndef SIMULATOR_VIRTUAL_TIME
+// Held while "interrupts are disabled" and while a handler runs
+static pthread_mutex_t     interruptsMutex;
+static pthread_once_t      interruptsOnce = PTHREAD_ONCE_INIT;
+#endif
 
 // Functions we expect to find in the sketch
 extern void setup();
@@ -36,17 +52,70 @@ unsigned long time_in_millis()
 // Run the Arduino standard functions in the main loop
 int main(int argc, char** argv)
 {
+    start_millis = time_in_millis();
+    // Seed the random number generator, from --seed N if given. Otherwise runs differ, unless in virtual time
+#ifdef SIMULATOR_VIRTUAL_TIME
+    unsigned int seed = 1;
+#else
+    unsigned int seed = getpid() ^ (unsigned) time(NULL)/2;
+#endif
+    for (int i = 1; i + 1 < argc; i++)
+	if (strcmp(argv[i], "--seed") == 0)
+	{
+	    seed = strtoul(argv[i + 1], NULL, 0);
+	    for (int j = i; j + 2 <= argc; j++)
+		argv[j] = argv[j + 2];
+	    argc -= 2;
+	    break;
+	}
+    srandom(seed);
     // Let simulated program have access to argc and argv
     _simulator_argc = argc;
     _simulator_argv = argv;
-    start_millis = time_in_millis();
-    // Seed the random number generator
-    srand(getpid() ^ (unsigned) time(NULL)/2);
     setup();
     while (1)
 	loop();
 }
 
+long random(long from, long to)
+{
+    return from + (random() % (to - from));
+}
+
+long random(long to)
+{
+    return random(0, to);
+}
+
+#ifdef SIMULATOR_VIRTUAL_TIME
+
+void delay(unsigned long ms)
+{
+    simulator_sleep_micros(ms * 1000ULL);
+}
+
+// Arduino equivalent, milliseconds since process start
+unsigned long millis()
+{
+    return micros() / 1000;
+}
+
+// Arduino equivalent, microseconds since process start
+unsigned long micros()
+{
+    simulator_spend_micros(SIMULATOR_CLOCK_MICROS);
+    simulator_preempt();
+    return simulator_now_micros();
+}
+
+// Lets other threads run while the sketch spins
+void yield()
+{
+    simulator_sleep_micros(SIMULATOR_YIELD_MICROS);
+}
+
+#else
+
 void delay(unsigned long ms)
 {
     usleep(ms * 1000);
@@ -58,14 +127,116 @@ unsigned long millis()
     return time_in_millis() - start_millis;
 }
 
-long random(long from, long to)
+// Arduino equivalent, microseconds since process start
+unsigned long micros()
 {
-    return from + (random() % (to - from));
+    struct timeval te;
+    gettimeofday(&te, NULL);
+    return (te.tv_sec * 1000000LL + te.tv_usec) - (start_millis * 1000LL);
 }
 
-long random(long to)
+// Lets other threads (eg radio emulators) run while the sketch spins
+void yield()
 {
-    return random(0, to);
+    sched_yield();
+}
+
+#endif
+
+void pinMode(uint8_t pin, uint8_t mode)
+{
+    (void)pin;
+    (void)mode;
+}
+
+void digitalWrite(uint8_t pin, uint8_t val)
+{
+    if (pin >= SIMULATOR_NUM_PINS)
+	return;
+    pinValues[pin] = val;
+    SimulatorSPIDevice* device = spiDevices[pin];
+    if (!device)
+	return;
+    if (val == LOW)
+    {
+	spiSelected = device;
+	device->select(true);
+    }
+    else if (spiSelected == device)
+    {
+	spiSelected = NULL;
+	device->select(false);
+    }
+}
+
+uint8_t digitalRead(uint8_t pin)
+{
+    return pin < SIMULATOR_NUM_PINS ? pinValues[pin] : LOW;
+}
+
+void attachInterrupt(uint8_t interrupt, void (*handler)(void), int mode)
+{
+    if (interrupt >= SIMULATOR_NUM_PINS)
+	return;
+    interruptModes[interrupt] = mode;
+    interruptHandlers[interrupt] = handler;
+}
+
+void detachInterrupt(uint8_t interrupt)
+{
+    if (interrupt < SIMULATOR_NUM_PINS)
+	interruptHandlers[interrupt] = NULL;
+}
+
+void simulator_attach_spi_device(uint8_t csPin, SimulatorSPIDevice* device)
+{
+    if (csPin < SIMULATOR_NUM_PINS)
+    {
+	spiDevices[csPin] = device;
+	pinValues[csPin] = HIGH;
+    }
+}
+
+#ifndef SIMULATOR_VIRTUAL_TIME
+// In virtual time these are in simKernel.cpp
+static void interruptsInit()
+{
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_init(&interruptsMutex, &attr);
+    pthread_mutexattr_destroy(&attr);
+}
+
+void simulator_interrupts_lock()
+{
+    pthread_once(&interruptsOnce, interruptsInit);
+    pthread_mutex_lock(&interruptsMutex);
+}
+
+void simulator_interrupts_unlock()
+{
+    pthread_mutex_unlock(&interruptsMutex);
+}
+#endif
+
+bool simulator_raise_interrupt(uint8_t pin, int edge)
+{
+    if (pin >= SIMULATOR_NUM_PINS)
+	return false;
+    simulator_interrupts_lock();
+    void (*handler)(void) = interruptHandlers[pin];
+    int mode = interruptModes[pin];
+    bool run = handler && (mode == edge || mode == CHANGE);
+    if (run)
+	handler();
+    simulator_interrupts_unlock();
+    return run;
+}
+
+uint8_t SPISimulator::transfer(uint8_t data)
+{
+    return spiSelected ? spiSelected->transfer(data) : 0;
 }
 
 #endif
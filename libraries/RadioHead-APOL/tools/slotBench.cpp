@@ -0,0 +1,239 @@
+// slotBench.cpp
+// Compares the slotted MAC (APOL_Comms_Lib::enable_slotted_mac(), each device sending in its own slot of a superframe
+// started by the POL's beacon) with listen before talk alone, for collisions and latency when several nodes share the
+// channel, on emulated SX1276 radios.
+//
+// Build with tools/rf95SimBuild tools/slotBench.cpp, run with ./slotBench [seconds]
+// The HHD sends GREEN and the VDD OVERRIDE_START (an emergency, which may use the contention slot) to the POL at
+// random, a mean of LOAD_INTERVAL ms apart, through the send window as request_handler_task does, and times each from
+// queueing to the ACK. The POL runs in its own thread, handling frames as its rx task does and sending the beacon every
+// APOL_SUPERFRAME ms as its beacon task does, and the HHD and the VDD each have an rx task. Each configuration runs in
+// its own process, started from the same state, for [seconds] (default 30). The HHD and the VDD either hear each other
+// or are on opposite sides of the POL (hidden from each other, where CAD cannot help).
+
+#include <RH_RF95.h>
+#include <APOL_Comms_Lib.h>
+#include <RHutil/SX1276Emulator.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <algorithm>
+
+#define POL_CS    10
+#define POL_INT   5
+#define VDD_CS    11
+#define VDD_INT   6
+#define MAX_TRANSMIT_ATTEMPTS 5 // As on the HHD
+#define LOAD_INTERVAL 200       // Mean ms between requests from each of the HHD and VDD
+#define MAX_SAMPLES 1000
+
+// Radios first, so they are on the simulated bus before the drivers are constructed
+SX1276Emulator hhdRadio(RFM95_CS, RFM95_INT);
+SX1276Emulator polRadio(POL_CS, POL_INT);
+SX1276Emulator vddRadio(VDD_CS, VDD_INT);
+
+// The HHD's and the VDD's rx tasks, which their drivers wake
+static TaskHandle_t hhdRx, vddRx;
+
+APOL_Comms_Lib hhd(HHD, &hhdRx);
+APOL_Comms_Lib pol(POL, NULL, POL_CS, POL_INT);
+APOL_Comms_Lib vdd(VDD, &vddRx, VDD_CS, VDD_INT);
+
+static unsigned long duration = 30000;
+static volatile bool running;
+static bool slotted;
+
+// Requests from one sender: time from queueing to ACK (ms), and how many were given up on
+struct senderStats
+{
+    unsigned long latency[MAX_SAMPLES];
+    unsigned int  delivered;
+    unsigned int  abandoned;
+};
+static senderStats hhdStats, vddStats;
+
+// Random gap with the given mean, in ms
+static unsigned long gap(unsigned long mean)
+{
+    return random(0, 2 * mean + 1);
+}
+
+static void polTask(void* arg)
+{
+    (void)arg;
+    unsigned long lastBeacon = millis() - APOL_SUPERFRAME;
+    while (1)
+    {
+	if (slotted && millis() - lastBeacon >= APOL_SUPERFRAME)
+	{
+	    lastBeacon += APOL_SUPERFRAME;
+	    pol.send_beacon();
+	}
+	if (!pol.rf95->waitAvailableTimeout(1))
+	    continue;
+	while (pol.rf95->rxPending() > 0)
+	{
+	    if (!pol.check_for_packet() || pol.packet_contents.request == ACK)
+		continue;
+	    pol.accept_request(&pol.packet_contents);
+	    pol.send_ack(&pol.packet_contents);
+	}
+	pol.rf95->setModeRx();
+    }
+}
+
+// The HHD's or the VDD's rx task, woken by the driver for each frame. Takes in beacons and hands ACKs to the send window
+static void ackTask(void* arg)
+{
+    APOL_Comms_Lib* comms = (APOL_Comms_Lib*)arg;
+    while (1)
+    {
+	ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+	while (comms->rf95->rxPending() > 0)
+	    if (comms->check_for_packet() && comms->packet_contents.request == ACK)
+		comms->handle_ack(&comms->packet_contents);
+    }
+}
+
+// Sends one request at a time to the POL, a random time apart, the way request_handler_task does
+static void sender(APOL_Comms_Lib* comms, request_type request, senderStats* stats)
+{
+    while (running)
+    {
+	delay(gap(LOAD_INTERVAL));
+	unsigned long start = millis();
+	int attempts = 0;
+	comms->queue_request(request, POL, 0);
+	while (comms->requests_outstanding(POL) > 0)
+	{
+	    comms->flush_requests(POL);
+	    comms->rf95->setModeRx();
+	    if (comms->wait_for_ack(POL))
+	    {
+		if (stats->delivered < MAX_SAMPLES)
+		    stats->latency[stats->delivered] = millis() - start;
+		stats->delivered++;
+	    }
+	    else if (++attempts >= MAX_TRANSMIT_ATTEMPTS)
+	    {
+		comms->abandon_requests(POL);
+		stats->abandoned++;
+	    }
+	}
+    }
+}
+
+static void vddTask(void* arg)
+{
+    (void)arg;
+    sender(&vdd, OVERRIDE_START, &vddStats);
+}
+
+// Ends the run after duration ms
+static void timerTask(void* arg)
+{
+    (void)arg;
+    delay(duration);
+    running = false;
+}
+
+static void setLink(SX1276Emulator* a, SX1276Emulator* b, int8_t snr)
+{
+    a->setLinkSignal(b, snr);
+    b->setLinkSignal(a, snr);
+}
+
+static void report(const char* name, senderStats* stats)
+{
+    unsigned int n = std::min(stats->delivered, (unsigned int)MAX_SAMPLES);
+    if (!n)
+    {
+	printf("  %s: nothing delivered, %u abandoned\n", name, stats->abandoned);
+	return;
+    }
+    std::sort(stats->latency, stats->latency + n);
+    printf("  %s: %u delivered, %u abandoned, latency median %lu ms p95 %lu ms max %lu ms\n", name,
+	   stats->delivered, stats->abandoned, stats->latency[n / 2], stats->latency[n * 95 / 100], stats->latency[n - 1]);
+}
+
+static void configuration(const char* name, bool slots, bool hidden)
+{
+    hhdRadio.begin();
+    polRadio.begin();
+    vddRadio.begin();
+    setLink(&hhdRadio, &polRadio, 10);
+    setLink(&polRadio, &vddRadio, 10);
+    setLink(&hhdRadio, &vddRadio, hidden ? -20 : 10);
+
+    hhd.begin();
+    pol.begin();
+    vdd.begin();
+    slotted = slots;
+    hhd.enable_slotted_mac(slots);
+    pol.enable_slotted_mac(slots);
+    vdd.enable_slotted_mac(slots);
+    hhd.rf95->setModeRx();
+    pol.rf95->setModeRx();
+    vdd.rf95->setModeRx();
+    hhdRadio.resetCounters();
+    polRadio.resetCounters();
+    vddRadio.resetCounters();
+
+    running = true;
+    xTaskCreate(polTask, "polTask", 256, NULL, 2, NULL);
+    xTaskCreate(ackTask, "hhdRx", 256, &hhd, 2, &hhdRx);
+    xTaskCreate(ackTask, "vddRx", 256, &vdd, 2, &vddRx);
+    xTaskCreate(vddTask, "vddTask", 256, NULL, 1, NULL);
+    unsigned long start = millis();
+    xTaskCreate(timerTask, "timerTask", 256, NULL, 1, NULL);
+    sender(&hhd, GREEN, &hhdStats);
+    while (vdd.requests_outstanding(POL) > 0)
+	delay(10);
+    unsigned long elapsed = millis() - start;
+
+    printf("%s\n", name);
+    report("HHD (GREEN)", &hhdStats);
+    report("VDD (OVERRIDE_START)", &vddStats);
+    unsigned long airtime = hhdRadio.airtimeMicros() + polRadio.airtimeMicros() + vddRadio.airtimeMicros();
+    printf("  POL radio: %lu frames received, %lu collisions; resends HHD %u VDD %u; busy CADs HHD %lu VDD %lu\n",
+	   (unsigned long)polRadio.rxPackets(), (unsigned long)polRadio.collisions(),
+	   hhd.link(POL)->retransmissions, vdd.link(POL)->retransmissions,
+	   (unsigned long)hhd.rf95->cadBusy(), (unsigned long)vdd.rf95->cadBusy());
+    printf("  channel use: %.0f%%\n", airtime / 10.0 / elapsed);
+}
+
+void setup()
+{
+    if (_simulator_argc > 1)
+	duration = atol(_simulator_argv[1]) * 1000;
+    printf("%lu s each, HHD and VDD a request every %d ms on average, %d ms superframe of %d slots\n", duration / 1000,
+	   LOAD_INTERVAL, APOL_SUPERFRAME, APOL_NUM_SLOTS);
+    fflush(stdout);
+
+    static const struct
+    {
+	const char* name;
+	bool        slotted;
+	bool        hidden;
+    } configurations[] = {
+	{"CAD, all in range",              false, false},
+	{"slotted, all in range",          true,  false},
+	{"CAD, HHD and VDD hidden",        false, true},
+	{"slotted, HHD and VDD hidden",    true,  true},
+    };
+    for (unsigned int i = 0; i < sizeof(configurations) / sizeof(configurations[0]); i++)
+    {
+	pid_t child = fork();
+	if (child == 0)
+	{
+	    configuration(configurations[i].name, configurations[i].slotted, configurations[i].hidden);
+	    fflush(stdout);
+	    _exit(0);
+	}
+	waitpid(child, NULL, 0);
+    }
+    exit(0);
+}
+
+void loop()
+{
+}
@@ -0,0 +1,145 @@
+// spiTest.cpp
+// Checks the bytes RHSPIDriver puts on the bus for register reads, writes and burst transfers, and the
+// transferBufferAsync() completion handshake, against RHutil/RHMockSPI on Linux.
+//
+// Build with tools/rf95SimBuild tools/spiTest.cpp, run with ./spiTest
+// Prints each check that fails and exits with status 1 if any did.
+
+#include <RHSPIDriver.h>
+#include <RHutil/RHMockSPI.h>
+
+#define TEST_CS 9 // No emulated radio on this pin, so the mock is the only thing on the bus
+
+// The smallest driver that can be built: only the SPI access of RHSPIDriver is used
+class TestDriver : public RHSPIDriver
+{
+public:
+    TestDriver(RHGenericSPI& spi) : RHSPIDriver(TEST_CS, spi) {}
+    bool    available() { return false; }
+    bool    recv(uint8_t* buf, uint8_t* len) { (void)buf; (void)len; return false; }
+    bool    send(const uint8_t* data, uint8_t len) { (void)data; (void)len; return false; }
+    uint8_t maxMessageLength() { return 0; }
+};
+
+static RHMockSPI  spi;
+static TestDriver driver(spi);
+
+static unsigned int checks = 0;
+static unsigned int failures = 0;
+
+static void check(bool ok, const char* what)
+{
+    checks++;
+    if (ok)
+	return;
+    failures++;
+    printf("FAILED: %s\n", what);
+}
+
+// The mock's log since the last clear() is exactly expected
+static bool sentIs(const uint8_t* expected, uint16_t len)
+{
+    return spi.sentLen() == len && memcmp(spi.sent(), expected, len) == 0;
+}
+
+static unsigned int callbacks = 0;
+static void* callbackArg = NULL;
+
+static void transferDone(void* arg)
+{
+    callbacks++;
+    callbackArg = arg;
+}
+
+static void testRegisterAccess()
+{
+    spi.clear();
+    driver.resetSpiCounters();
+    uint8_t response[] = { 0x00, 0x42 }; // Nothing while the address goes out, then the register value
+    spi.queueResponse(response, sizeof(response));
+    check(driver.spiRead(0x81) == 0x42, "spiRead() returns the octet clocked in after the address");
+    const uint8_t read[] = { 0x01, 0x00 };
+    check(sentIs(read, sizeof(read)), "spiRead() sends the address with the write mask off, then 0");
+
+    spi.clear();
+    const uint8_t status[] = { 0x5a };
+    spi.queueResponse(status, sizeof(status));
+    check(driver.spiWrite(0x01, 0x8f) == 0x5a, "spiWrite() returns the status clocked in with the address");
+    const uint8_t write[] = { 0x81, 0x8f };
+    check(sentIs(write, sizeof(write)), "spiWrite() sends the address with the write mask on, then the value");
+    check(spi.octetTransfers() == 2 && spi.bufferTransfers() == 0, "register access moves single octets");
+    check(spi.transactions() == 1 && !spi.inTransaction(), "spiWrite() is one transaction, ended");
+    check(driver.spiReadCount() == 1 && driver.spiWriteCount() == 1, "register accesses are counted");
+}
+
+static void testBurstRead()
+{
+    spi.clear();
+    driver.resetSpiCounters();
+    const uint8_t response[] = { 0x33, 0x10, 0x20, 0x30, 0x40 }; // Status, then the FIFO
+    spi.queueResponse(response, sizeof(response));
+    uint8_t dest[4] = { 0 };
+    check(driver.spiBurstRead(0x00, dest, sizeof(dest)) == 0x33, "spiBurstRead() returns the status");
+    check(memcmp(dest, response + 1, sizeof(dest)) == 0, "spiBurstRead() fills dest with the octets after the status");
+    const uint8_t sent[] = { 0x00, 0x00, 0x00, 0x00, 0x00 };
+    check(sentIs(sent, sizeof(sent)), "spiBurstRead() sends the address, then 0s");
+    check(spi.octetTransfers() == 1 && spi.bufferTransfers() == 1, "spiBurstRead() moves the data as one buffer transfer");
+    check(spi.transactions() == 1 && !spi.inTransaction(), "spiBurstRead() is one transaction, ended");
+    check(driver.spiBurstCount() == 1 && driver.spiTransactions() == 1, "spiBurstRead() is counted as a burst");
+}
+
+static void testBurstWrite()
+{
+    spi.clear();
+    driver.resetSpiCounters();
+    const uint8_t src[] = { 0xde, 0xad, 0xbe, 0xef, 0x01 };
+    driver.spiBurstWrite(0x00, src, sizeof(src));
+    const uint8_t sent[] = { 0x80, 0xde, 0xad, 0xbe, 0xef, 0x01 };
+    check(sentIs(sent, sizeof(sent)), "spiBurstWrite() sends the address with the write mask on, then src");
+    check(spi.octetTransfers() == 1 && spi.bufferTransfers() == 1, "spiBurstWrite() moves the data as one buffer transfer");
+    check(spi.transactions() == 1 && !spi.inTransaction(), "spiBurstWrite() is one transaction, ended");
+    check(driver.spiBurstCount() == 1, "spiBurstWrite() is counted as a burst");
+
+    spi.clear();
+    driver.spiBurstWrite(0x00, src, 0);
+    check(spi.sentLen() == 1 && spi.sent()[0] == 0x80, "an empty spiBurstWrite() sends only the address");
+}
+
+static void testAsync()
+{
+    spi.clear();
+    callbacks = 0;
+    callbackArg = NULL;
+    const uint8_t response[] = { 0x01, 0x02, 0x03 };
+    spi.queueResponse(response, sizeof(response));
+    const uint8_t src[] = { 0xa1, 0xa2, 0xa3 };
+    uint8_t dest[3] = { 0 };
+    int arg;
+    check(spi.transferBufferAsync(src, dest, sizeof(src), transferDone, &arg), "transferBufferAsync() starts");
+    check(sentIs(src, sizeof(src)) && memcmp(dest, response, sizeof(dest)) == 0, "transferBufferAsync() moves the octets both ways");
+    check(spi.pending() && callbacks == 0, "the callback waits for completePending()");
+    check(!spi.transferBufferAsync(src, NULL, sizeof(src), transferDone, &arg), "a second transfer is refused while one is pending");
+    check(spi.sentLen() == sizeof(src), "a refused transfer sends nothing");
+
+    check(spi.completePending(), "completePending() completes the transfer");
+    check(callbacks == 1 && callbackArg == &arg && !spi.pending(), "the callback is made once, with its argument");
+    check(!spi.completePending() && callbacks == 1, "there is nothing left to complete");
+
+    check(spi.transferBufferAsync(NULL, NULL, 2, NULL, NULL) && spi.completePending(), "a transfer with no callback completes");
+    const uint8_t sent[] = { 0xa1, 0xa2, 0xa3, 0x00, 0x00 };
+    check(sentIs(sent, sizeof(sent)), "a transfer with no source sends 0s");
+}
+
+void setup()
+{
+    testRegisterAccess();
+    testBurstRead();
+    testBurstWrite();
+    testAsync();
+    printf("%u checks, %u failed\n", checks, failures);
+    exit(failures ? 1 : 0);
+}
+
+void loop()
+{
+}
@@ -0,0 +1,269 @@
+// windowBench.cpp
+// Measures how long APOL_Comms_Lib takes to drain a queue of requests from the HHD to the POL on emulated SX1276
+// radios, sent stop-and-wait (one request outstanding, as request_handler_task used to) and through the send window.
+//
+// Build with tools/rf95SimBuild tools/windowBench.cpp, run with ./windowBench [runs] [loss percent]
+// The HHD side runs in the main thread and makes the same calls as request_handler_task, with an rx task handing it the
+// ACKs. The POL side runs in its own thread and does what the POL rx_task does with each frame: accept_request(), then send_ack().
+// Each request carries its position in the queue as the payload, so the order the POL acted on them can be checked.
+// The last part measures how long an override waits behind queued GREEN presses, in arrival order and through
+// APOL_Request_Queue. Then the POL is made slow to act on each request, and the queue is drained with the ACK sent by
+// the POL side after it has acted (as rx_task does) and by the auto-ACK from the radio service context.
+
+#include <RH_RF95.h>
+#include <APOL_Comms_Lib.h>
+#include <APOL_Request_Queue.h>
+#include <RHutil/SX1276Emulator.h>
+
+#define POL_CS  10
+#define POL_INT 5
+#define MAX_TRANSMIT_ATTEMPTS 5 // As on the HHD
+#define MAX_QUEUED_REQUESTS 10  // As on the HHD
+
+// Radios first, so they are on the simulated bus before the drivers are constructed
+SX1276Emulator hhdRadio(RFM95_CS, RFM95_INT);
+SX1276Emulator polRadio(POL_CS, POL_INT);
+
+// The HHD's rx task, which its driver wakes
+static TaskHandle_t hhdRx;
+
+APOL_Comms_Lib hhd(HHD, &hhdRx);
+APOL_Comms_Lib pol(POL, NULL, POL_CS, POL_INT);
+
+static unsigned int runs = 10;
+static uint8_t loss = 0;
+
+// Payloads of the requests the POL acted on, in order
+static uint32_t applied[64];
+static volatile unsigned int appliedCount;
+
+// micros() when the current drain started and when the POL acted on an override
+static unsigned long drainStart;
+static volatile unsigned long overrideApplied;
+
+// How long the POL takes to act on each request it accepts, before it gets to send_ack()
+static volatile unsigned int polDispatchMs;
+
+static void polTask(void* arg)
+{
+    (void)arg;
+    while (1)
+    {
+	if (!pol.rf95->waitAvailableTimeout(10))
+	    continue;
+	while (pol.rf95->rxPending() > 0)
+	{
+	    if (!pol.check_for_packet())
+		continue;
+	    if (pol.accept_request(&pol.packet_contents) && appliedCount < sizeof(applied) / sizeof(applied[0]))
+	    {
+		applied[appliedCount++] = pol.packet_contents.payload;
+		if (pol.packet_contents.request == OVERRIDE_STOP)
+		    overrideApplied = micros();
+		if (polDispatchMs)
+		    delay(polDispatchMs);
+	    }
+	    pol.send_ack(&pol.packet_contents);
+	}
+	pol.rf95->setModeRx();
+    }
+}
+
+// The HHD's rx task, woken by the driver for each frame. Hands ACKs to the send window
+static void ackTask(void* arg)
+{
+    APOL_Comms_Lib* comms = (APOL_Comms_Lib*)arg;
+    while (1)
+    {
+	ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+	while (comms->rf95->rxPending() > 0)
+	    if (comms->check_for_packet() && comms->packet_contents.request == ACK)
+		comms->handle_ack(&comms->packet_contents);
+    }
+}
+
+// Sends count requests the way request_handler_task does and returns how long it took in microseconds.
+// stopAndWait keeps one request outstanding at a time. abandoned counts windows given up after MAX_TRANSMIT_ATTEMPTS
+static unsigned long drain(const request_type* requests, unsigned int count, bool stopAndWait, unsigned int* abandoned)
+{
+    unsigned int queued = 0;
+    int attempts = 0;
+    appliedCount = 0;
+    unsigned long start = drainStart = micros();
+
+    while (queued < count || hhd.requests_outstanding(POL) > 0)
+    {
+	while (queued < count && hhd.window_space(POL) > 0 && !(stopAndWait && hhd.requests_outstanding(POL) > 0))
+	{
+	    hhd.queue_request(requests[queued], POL, queued + 1);
+	    queued++;
+	}
+	hhd.flush_requests(POL);
+	hhd.rf95->setModeRx();
+	if (hhd.wait_for_ack(POL))
+	    attempts = 0;
+	else if (++attempts >= MAX_TRANSMIT_ATTEMPTS)
+	{
+	    hhd.abandon_requests(POL);
+	    (*abandoned)++;
+	    attempts = 0;
+	}
+    }
+    unsigned long elapsed = micros() - start;
+
+    // Let the POL finish with the last frame before looking at what it did
+    delay(5);
+    return elapsed;
+}
+
+// true if the POL acted on every request once, in order. A resent SYNC can be acted on twice in a row
+static bool inOrder(unsigned int count)
+{
+    unsigned int expected = 1;
+    for (unsigned int i = 0; i < appliedCount; i++)
+    {
+	if (i > 0 && applied[i] == applied[i - 1])
+	    continue;
+	if (applied[i] != expected++)
+	    return false;
+    }
+    return expected == count + 1;
+}
+
+static void scenario(const char* name, const request_type* requests, unsigned int count)
+{
+    for (int mode = 0; mode < 2; mode++)
+    {
+	bool stopAndWait = mode == 0;
+	unsigned long total = 0, worst = 0;
+	unsigned int abandoned = 0, disordered = 0;
+	uint16_t retransmissions = hhd.link(POL)->retransmissions;
+	hhdRadio.resetCounters();
+	for (unsigned int run = 0; run < runs; run++)
+	{
+	    unsigned long elapsed = drain(requests, count, stopAndWait, &abandoned);
+	    total += elapsed;
+	    if (elapsed > worst)
+		worst = elapsed;
+	    if (!inOrder(count))
+		disordered++;
+	}
+	printf("%-22s %-14s drain mean %6.1f ms max %6.1f ms, frames %5.1f, resends %4u, abandoned %u, out of order %u\n",
+	       name, stopAndWait ? "stop-and-wait" : "window",
+	       total / 1000.0 / runs, worst / 1000.0, (double)hhdRadio.txPackets() / runs,
+	       (unsigned)(hhd.link(POL)->retransmissions - retransmissions), abandoned, disordered);
+    }
+}
+
+// Queues GREEN presses then an override, and reports how long after the queue started draining the POL
+// acted on the override: sent in the order they were queued, and in the order APOL_Request_Queue gives them out
+static void overrideLatency(unsigned int presses)
+{
+    request_type requests[MAX_QUEUED_REQUESTS + 1];
+    unsigned int abandoned = 0;
+    printf("override behind %2u presses:", presses);
+    for (int mode = 0; mode < 2; mode++)
+    {
+	for (unsigned int i = 0; i < presses; i++)
+	    requests[i] = GREEN;
+	requests[presses] = OVERRIDE_STOP;
+	unsigned int count = presses + 1;
+	if (mode == 1)
+	{
+	    // Without coalescing, so both orders carry the same requests
+	    APOL_Request_Queue queue(APOL_REQUEST_QUEUE_LEN, false);
+	    for (unsigned int i = 0; i <= presses; i++)
+		queue.send(requests[i], POL, 0);
+	    request_record record;
+	    for (count = 0; queue.receive(&record); count++)
+		requests[count] = record.request;
+	}
+	overrideApplied = 0;
+	unsigned long elapsed = drain(requests, count, false, &abandoned);
+	printf(" %s %6.1f ms (drain %6.1f ms)", mode ? "priority" : "fifo", (overrideApplied - drainStart) / 1000.0, elapsed / 1000.0);
+    }
+    printf("\n");
+}
+
+// Drains a queue with the POL taking dispatchMs to act on each request, acknowledged by the POL side once it has
+// acted and by the auto-ACK straight from the radio service context
+static void slowDispatch(const char* name, unsigned int dispatchMs, const request_type* requests, unsigned int count)
+{
+    polDispatchMs = dispatchMs;
+    for (int mode = 0; mode < 2; mode++)
+    {
+	bool autoAck = mode == 1;
+	pol.enable_auto_ack(autoAck);
+	unsigned long total = 0, worst = 0;
+	unsigned int abandoned = 0, disordered = 0;
+	uint16_t retransmissions = hhd.link(POL)->retransmissions;
+	hhdRadio.resetCounters();
+	for (unsigned int run = 0; run < runs; run++)
+	{
+	    unsigned long elapsed = drain(requests, count, false, &abandoned);
+	    // Let the POL catch up before the next run, so each starts with it idle
+	    delay(count * dispatchMs);
+	    total += elapsed;
+	    if (elapsed > worst)
+		worst = elapsed;
+	    if (!inOrder(count))
+		disordered++;
+	}
+	printf("%-22s %-14s drain mean %6.1f ms max %6.1f ms, frames %5.1f, resends %4u, abandoned %u, out of order %u, rto %lu ms\n",
+	       name, autoAck ? "auto-ack" : "ack after", total / 1000.0 / runs, worst / 1000.0,
+	       (double)hhdRadio.txPackets() / runs, (unsigned)(hhd.link(POL)->retransmissions - retransmissions),
+	       abandoned, disordered, (unsigned long)hhd.retransmit_timeout(POL));
+    }
+    pol.enable_auto_ack(false);
+    polDispatchMs = 0;
+}
+
+void setup()
+{
+    if (_simulator_argc > 1)
+	runs = atoi(_simulator_argv[1]);
+    if (_simulator_argc > 2)
+	loss = atoi(_simulator_argv[2]);
+    hhdRadio.begin();
+    polRadio.begin();
+
+    hhd.begin();
+    pol.begin();
+    hhd.rf95->setModeRx();
+    pol.rf95->setModeRx();
+
+    xTaskCreate(polTask, "polTask", 256, NULL, 2, NULL);
+    xTaskCreate(ackTask, "hhdRx", 256, &hhd, 2, &hhdRx);
+
+    // One request to synchronise the window and measure the round trip before timing anything
+    unsigned int abandoned = 0;
+    request_type sync = PING;
+    drain(&sync, 1, true, &abandoned);
+
+    hhdRadio.setLoss(loss, 1);
+    polRadio.setLoss(loss, 2);
+    printf("window %u, %u runs, %u%% loss, time on air %lu us per request, rto %lu ms\n", APOL_WINDOW_SIZE, runs, loss,
+	   (unsigned long)hhd.rf95->timeOnAir(1), (unsigned long)hhd.retransmit_timeout(POL));
+}
+
+void loop()
+{
+    static const request_type buttons[] = {GREEN, RED, OVERRIDE_STOP};
+    scenario("green, red, override", buttons, sizeof(buttons) / sizeof(buttons[0]));
+
+    request_type full[MAX_QUEUED_REQUESTS];
+    for (unsigned int i = 0; i < MAX_QUEUED_REQUESTS; i++)
+	full[i] = (i & 1) ? RED : GREEN;
+    scenario("full queue (10)", full, MAX_QUEUED_REQUESTS);
+
+    if (!loss)
+	for (unsigned int presses = 0; presses < MAX_QUEUED_REQUESTS; presses += 3)
+	    overrideLatency(presses);
+
+    slowDispatch("full queue, 20 ms act", 20, full, MAX_QUEUED_REQUESTS);
+    slowDispatch("full queue, 60 ms act", 60, full, MAX_QUEUED_REQUESTS);
+
+    printf("srtt %lu ms, rttvar %lu ms, rto %lu ms\n", (unsigned long)(hhd.link(POL)->srtt >> 3),
+	   (unsigned long)(hhd.link(POL)->rttvar >> 2), (unsigned long)hhd.retransmit_timeout(POL));
+    exit(0);
+}